@@ -1,12 +1,24 @@
 #include "camera.hpp"
+#include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 
+
+const float Camera::MIN_ZOOM = 0.05f;
+const float Camera::MAX_ZOOM = 500.0f;
+
+
 // ================================================================================================
 Camera::Camera(float left, float top, float right, float bottom) :
 	m_view{ glm::lookAt(glm::vec3{ 0, 0, 1 }, glm::vec3{ 0, 0, 0 }, glm::vec3{ 0, 1, 0 }) },
-	m_proj{ glm::ortho(left, right, bottom, top, 0.01f, 100.0f) }
+	m_proj{},
+	m_left{left},
+	m_top{top},
+	m_right{right},
+	m_bottom{bottom},
+	m_center{0, 0},
+	m_zoom{1}
 {
-	
+	updateProjection();
 }
 
 // ================================================================================================
@@ -18,5 +30,60 @@ Camera::~Camera()
 // ================================================================================================
 void Camera::onResize(float left, float top, float right, float bottom)
 {
-	m_proj = glm::ortho(left, right, bottom, top, 0.01f, 100.0f);
+	m_left = left;
+	m_top = top;
+	m_right = right;
+	m_bottom = bottom;
+	updateProjection();
+}
+
+// ================================================================================================
+void Camera::pan(const glm::vec2& offset)
+{
+	m_center += offset;
+	updateProjection();
+}
+
+// ================================================================================================
+void Camera::zoom(float factor, const glm::vec2& anchor)
+{
+	const float newzoom = std::min(std::max(m_zoom * factor, MIN_ZOOM), MAX_ZOOM);
+
+	// The anchor keeps its offset from the center in screen space, so its world offset scales with 1 / zoom
+	m_center = anchor + ((m_center - anchor) * (m_zoom / newzoom));
+	m_zoom = newzoom;
+	updateProjection();
+}
+
+// ================================================================================================
+void Camera::reset()
+{
+	m_center = { 0, 0 };
+	m_zoom = 1;
+	updateProjection();
+}
+
+// ================================================================================================
+glm::vec2 Camera::windowToWorld(double x, double y, int width, int height) const
+{
+	const glm::vec4 bounds = getVisibleBounds();
+	const float u = (width > 0) ? (float)(x / width) : 0.5f;
+	const float v = (height > 0) ? (float)(y / height) : 0.5f;
+	return { bounds.x + ((bounds.z - bounds.x) * u), bounds.w - ((bounds.w - bounds.y) * v) };
+}
+
+// ================================================================================================
+glm::vec4 Camera::getVisibleBounds() const
+{
+	return {
+		m_center.x + (std::min(m_left, m_right) / m_zoom), m_center.y + (std::min(m_top, m_bottom) / m_zoom),
+		m_center.x + (std::max(m_left, m_right) / m_zoom), m_center.y + (std::max(m_top, m_bottom) / m_zoom)
+	};
+}
+
+// ================================================================================================
+void Camera::updateProjection()
+{
+	m_proj = glm::ortho(m_center.x + (m_left / m_zoom), m_center.x + (m_right / m_zoom),
+		m_center.y + (m_bottom / m_zoom), m_center.y + (m_top / m_zoom), 0.01f, 100.0f);
 }
\ No newline at end of file
@@ -2,15 +2,27 @@
 
 #include <GL\glew.h>
 #include <glfw\glfw3.h>
+#include <glm\vec2.hpp>
 #include <glm\vec4.hpp>
 #include <glm\matrix.hpp>
 
 
+// Orthographic camera over a base box (set by the window size), which can be panned and zoomed interactively
 class Camera
 {
+public:
+	static const float MIN_ZOOM;
+	static const float MAX_ZOOM;
+
 private:
 	glm::mat4 m_view;
 	glm::mat4 m_proj;
+	float m_left;
+	float m_top;
+	float m_right;
+	float m_bottom;
+	glm::vec2 m_center;
+	float m_zoom;
 
 public:
 	Camera(float left, float top, float right, float bottom);
@@ -18,6 +30,22 @@ public:
 
 	void onResize(float left, float top, float right, float bottom);
 
+	// Moves the view by an offset in world units
+	void pan(const glm::vec2& offset);
+	// Scales the view by a factor (> 1 zooms in), keeping the world position under the anchor fixed on screen
+	void zoom(float factor, const glm::vec2& anchor);
+	void reset();
+
+	// Converts a window position in pixels (from the top left) to world coordinates
+	glm::vec2 windowToWorld(double x, double y, int width, int height) const;
+	// The visible world rectangle as (min x, min y, max x, max y)
+	glm::vec4 getVisibleBounds() const;
+
+	inline float getZoom() const { return m_zoom; }
+	inline const glm::vec2& getCenter() const { return m_center; }
 	inline const glm::mat4& view() const { return m_view; }
 	inline const glm::mat4& projection() const { return m_proj; }
+
+private:
+	void updateProjection();
 };
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "checkpoint.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+
+// ================================================================================================
+Checkpointer::Checkpointer(const char *path, size_t pcount, float threshold) :
+	m_pCount{pcount},
+	m_threshold{threshold},
+	m_slots{},
+	m_nextSlot{0},
+	m_writeJob{}
+{
+	for (size_t i = 0; i < 2; ++i) {
+		m_slots[i].path = std::string(path) + "." + std::to_string(i);
+		m_slots[i].written.reset(new Particle[m_pCount]);
+		m_slots[i].valid = false;
+	}
+}
+
+// ================================================================================================
+Checkpointer::~Checkpointer()
+{
+	if (m_writeJob)
+		g_jobs->wait(m_writeJob);
+}
+
+// ================================================================================================
+void Checkpointer::write(const Particle *state, double time)
+{
+	if (isBusy())
+		throw std::runtime_error("Cannot start a checkpoint while the previous one is being written.");
+
+	slot_t *slot = &m_slots[m_nextSlot];
+	m_nextSlot ^= 1;
+	m_writeJob = g_jobs->submit([this, slot, state, time]() {
+		try {
+			writeSlot(*slot, state, time);
+		}
+		catch (const std::exception& ex) {
+			// Rewritten in full next time, since the file may only be partially updated
+			slot->valid = false;
+			std::cerr << "Checkpoint Error: \"" << ex.what() << "\"." << std::endl;
+		}
+	});
+}
+
+// ================================================================================================
+void Checkpointer::writeSlot(slot_t& slot, const Particle *state, double time)
+{
+	const char *path = slot.path.c_str();
+	if (!slot.valid) {
+		writeSnapshot(path, state, m_pCount, time);
+		memcpy(slot.written.get(), state, sizeof(Particle) * m_pCount);
+		slot.valid = true;
+		std::cout << "Checkpoint written to '" << slot.path << "' (time " << time << ", full)" << std::endl;
+		return;
+	}
+
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error(std::string("Could not open checkpoint '") + path + "' for writing");
+
+	// The magic is cleared while the columns are updated, so a file that was torn by a crash is never loaded
+	SnapshotHeader header = makeSnapshotHeader(m_pCount, time);
+	const char cleared[sizeof(header.magic)] = {};
+	file.seekp(0);
+	file.write(cleared, sizeof(cleared));
+	file.flush();
+	slot.valid = false;
+
+	uint64_t columnOffsets[SNAPSHOT_ATTRIBUTE_COUNT];
+	for (uint32_t i = 0; i < SNAPSHOT_ATTRIBUTE_COUNT; ++i)
+		columnOffsets[i] = getSnapshotColumnOffset(m_pCount, (SnapshotAttribute)i);
+
+	size_t changed = 0;
+	size_t chunks = 0;
+	float values[CHECKPOINT_CHUNK_PARTICLES];
+	for (size_t first = 0; first < m_pCount; first += CHECKPOINT_CHUNK_PARTICLES, ++chunks) {
+		const size_t count = std::min(CHECKPOINT_CHUNK_PARTICLES, m_pCount - first);
+		Particle *written = slot.written.get() + first;
+		if (!isChunkChanged(written, state + first, count))
+			continue;
+
+		for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute) {
+			for (size_t i = 0; i < count; ++i)
+				values[i] = getSnapshotValue(state[first + i], (SnapshotAttribute)attribute);
+			file.seekp((std::streamoff)(columnOffsets[attribute] + (first * sizeof(float))));
+			file.write(reinterpret_cast<const char*>(values), count * sizeof(float));
+		}
+		memcpy(written, state + first, sizeof(Particle) * count);
+		++changed;
+	}
+
+	file.flush();
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.flush();
+	if (!file.good())
+		throw std::runtime_error(std::string("Could not write checkpoint '") + path + "'");
+	slot.valid = true;
+
+	std::cout << "Checkpoint written to '" << slot.path << "' (time " << time << ", " << changed << " of " << chunks
+		<< " chunks)" << std::endl;
+}
+
+// ================================================================================================
+bool Checkpointer::isChunkChanged(const Particle *written, const Particle *state, size_t count) const
+{
+	for (size_t i = 0; i < count; ++i) {
+		for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute) {
+			const float before = getSnapshotValue(written[i], (SnapshotAttribute)attribute);
+			const float after = getSnapshotValue(state[i], (SnapshotAttribute)attribute);
+			// Compared bitwise without a threshold, so even a change in the sign of zero is written. Ids are words,
+			// which are always compared exactly.
+			const bool changed = (m_threshold > 0.0f) && (attribute != SNAPSHOT_ID)
+				? !(std::fabs(after - before) <= m_threshold)
+				: (memcmp(&before, &after, sizeof(float)) != 0);
+			if (changed)
+				return true;
+		}
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "jobs.hpp"
+#include "particle.hpp"
+
+
+// Particles compared and rewritten together by incremental checkpoints
+#define CHECKPOINT_CHUNK_PARTICLES ((size_t)4096)
+
+
+// Writes checkpoints of the particle state as snapshot files on the job system, so a frame only pays for starting
+// the copy. Checkpoints alternate between two files, '<path>.0' and '<path>.1', so a crash while one is written
+// always leaves the other intact. After the first full write, a file is only updated in place for the chunks that
+// changed beyond the threshold since it was last written. With a threshold of zero any changed bit counts, which
+// keeps restarting from the file bit exact.
+class Checkpointer
+{
+private:
+	struct slot_t
+	{
+		std::string path;
+		std::unique_ptr<Particle[]> written;	// State in the file, which the next write is compared against
+		bool valid;								// If the file holds a complete checkpoint of written
+	};
+
+	const size_t m_pCount;
+	const float m_threshold;
+	slot_t m_slots[2];
+	size_t m_nextSlot;
+	JobHandle m_writeJob;
+
+public:
+	Checkpointer(const char *path, size_t pcount, float threshold);
+	// Waits for the checkpoint that is being written
+	~Checkpointer();
+
+	// While busy, the state passed to the last write is still being read
+	inline bool isBusy() const { return m_writeJob && !m_writeJob->isDone(); }
+
+	// Writes the state as the next checkpoint, failures are reported without stopping the simulation
+	void write(const Particle *state, double time);
+
+	Checkpointer(const Checkpointer&) = delete;
+	Checkpointer& operator = (const Checkpointer&) = delete;
+
+private:
+	void writeSlot(slot_t& slot, const Particle *state, double time);
+	bool isChunkChanged(const Particle *written, const Particle *state, size_t count) const;
+};
\ No newline at end of file
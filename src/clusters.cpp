@@ -0,0 +1,414 @@
+#include "clusters.hpp"
+#include "cpusolver.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+
+static const char ClusterMagic[8] = { 'P', '5', '0', 'K', 'C', 'L', 'S', 'T' };
+
+
+// ================================================================================================
+// Root of the tree of a particle on the host, see fofFind in the kernel source
+static uint32_t findClusterRoot(const std::atomic<uint32_t> *parent, uint32_t x)
+{
+	uint32_t p = parent[x].load(std::memory_order_relaxed);
+	while (p != x) {
+		x = p;
+		p = parent[x].load(std::memory_order_relaxed);
+	}
+	return x;
+}
+
+// ================================================================================================
+ClusterFinder::ClusterFinder(const char *path, bool device, vec2f origin, vec2f extent, size_t pcount,
+		uint32_t interval, float linkingLength, uint32_t minMembers) :
+	m_device{device},
+	m_pCount{pcount},
+	m_interval{interval},
+	m_linkingLength{linkingLength},
+	m_minMembers{std::max(minMembers, 1u)},
+	m_grid{nullptr},
+	m_initKernel{nullptr},
+	m_linkKernel{nullptr},
+	m_jumpKernel{nullptr},
+	m_countKernel{nullptr},
+	m_markKernel{nullptr},
+	m_scatterKernel{nullptr},
+	m_summarizeKernel{nullptr},
+	m_labelKernel{nullptr},
+	m_parentMem{nullptr},
+	m_changedMem{nullptr},
+	m_ranksMem{nullptr},
+	m_memberStartMem{nullptr},
+	m_membersMem{nullptr},
+	m_clusterIndexMem{nullptr},
+	m_summariesMem{nullptr},
+	m_labelsMem{nullptr},
+	m_parent{},
+	m_file{},
+	m_writeJob{},
+	m_failed{false},
+	m_lastCount{0}
+{
+	if (!m_interval)
+		throw std::runtime_error("The cluster interval must be greater than zero");
+	if (!(m_linkingLength > 0.0f))
+		throw std::runtime_error("The linking length must be greater than zero");
+	if (!m_pCount || m_pCount >= CLUSTER_NONE)
+		throw std::runtime_error("Clusters can not be found for this particle count");
+
+	m_file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+		throw std::runtime_error(std::string("Could not create cluster file '") + path + "'");
+	ClusterHeader header = {};
+	memcpy(header.magic, ClusterMagic, sizeof(ClusterMagic));
+	header.version = CLUSTER_VERSION;
+	header.particleCount = (uint32_t)m_pCount;
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!m_file)
+		throw std::runtime_error(std::string("Could not write cluster file '") + path + "'");
+
+	if (!m_device) {
+		m_grid = new SpatialGrid(nullptr, origin, extent, m_pCount);
+		m_parent.reset(new std::atomic<uint32_t>[m_pCount]);
+		return;
+	}
+
+	// The grid and the clustering share one program, which only has to be built once
+	std::string source = ParticleGridKernelSource;
+	source += ParticleClusterKernelSource;
+	cl_program program = buildProgram(source.c_str());
+	try {
+		m_grid = new SpatialGrid(program, origin, extent, m_pCount);
+		m_initKernel = new Kernel(program, "FofInit");
+		m_linkKernel = new Kernel(program, "FofLink");
+		m_jumpKernel = new Kernel(program, "FofJump");
+		m_countKernel = new Kernel(program, "FofCount");
+		m_markKernel = new Kernel(program, "FofMark");
+		m_scatterKernel = new Kernel(program, "FofScatter");
+		m_summarizeKernel = new Kernel(program, "FofSummarize");
+		m_labelKernel = new Kernel(program, "FofLabel");
+	}
+	catch (...) {
+		clReleaseProgram(program);
+		throw;
+	}
+	clReleaseProgram(program);
+
+	// Buffers indexed by root have a word for the total of their prefix sum
+	const size_t words = m_pCount + 1;
+	const size_t maxClusters = (m_pCount / m_minMembers) + 1;
+	cl_int clerr;
+	CL_CHECK_RETURN_FATAL(
+		m_parentMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * m_pCount, nullptr, &clerr),
+		clerr, m_parentMem, "Could not create the cluster parent buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_changedMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &clerr),
+		clerr, m_changedMem, "Could not create the cluster change flag");
+	CL_CHECK_RETURN_FATAL(
+		m_ranksMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * m_pCount, nullptr, &clerr),
+		clerr, m_ranksMem, "Could not create the cluster rank buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_memberStartMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * words, nullptr, &clerr),
+		clerr, m_memberStartMem, "Could not create the cluster member start buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_membersMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * m_pCount, nullptr, &clerr),
+		clerr, m_membersMem, "Could not create the cluster member buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_clusterIndexMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * words, nullptr, &clerr),
+		clerr, m_clusterIndexMem, "Could not create the cluster index buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_summariesMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(ClusterSummary) * maxClusters, nullptr,
+			&clerr),
+		clerr, m_summariesMem, "Could not create the cluster summary buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_labelsMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * m_pCount, nullptr, &clerr),
+		clerr, m_labelsMem, "Could not create the cluster label buffer");
+}
+
+// ================================================================================================
+ClusterFinder::~ClusterFinder()
+{
+	if (m_writeJob)
+		g_jobs->wait(m_writeJob);
+
+	for (Kernel *kernel : { m_initKernel, m_linkKernel, m_jumpKernel, m_countKernel, m_markKernel, m_scatterKernel,
+		m_summarizeKernel, m_labelKernel }) {
+		if (kernel)
+			delete kernel;
+	}
+	for (cl_mem mem : { m_parentMem, m_changedMem, m_ranksMem, m_memberStartMem, m_membersMem, m_clusterIndexMem,
+		m_summariesMem, m_labelsMem }) {
+		if (mem)
+			clReleaseMemObject(mem);
+	}
+	if (m_grid)
+		delete m_grid;
+}
+
+// ================================================================================================
+void ClusterFinder::find(cl_mem state, uint64_t step, double time)
+{
+	if (!m_device)
+		throw std::runtime_error("Cannot find clusters of OpenCL memory with a host cluster finder.");
+
+	m_grid->build(state, m_pCount, m_linkingLength);
+	const GridParams& grid = m_grid->getParams();
+	const cl_mem cellStart = m_grid->getCellStartMem();
+	const cl_mem sortedIndex = m_grid->getSortedIndexMem();
+	const cl_mem sorted = m_grid->getSortedMem();
+	const cl_uint count = (cl_uint)m_pCount;
+	const size_t global[1] = { m_pCount };
+
+	m_initKernel->setKernelArgument(0, sizeof(m_parentMem), &m_parentMem);
+	m_initKernel->setKernelArgument(1, sizeof(count), &count);
+	m_initKernel->enqueueNDRange(1, global);
+
+	// Links until a pass finds every pair of friends in the same tree already, the flag is the only thing waited for
+	const float linkingLength2 = m_linkingLength * m_linkingLength;
+	m_linkKernel->setKernelArgument(0, sizeof(sorted), &sorted);
+	m_linkKernel->setKernelArgument(1, sizeof(sortedIndex), &sortedIndex);
+	m_linkKernel->setKernelArgument(2, sizeof(cellStart), &cellStart);
+	m_linkKernel->setKernelArgument(3, sizeof(grid), &grid);
+	m_linkKernel->setKernelArgument(4, sizeof(linkingLength2), &linkingLength2);
+	m_linkKernel->setKernelArgument(5, sizeof(m_parentMem), &m_parentMem);
+	m_linkKernel->setKernelArgument(6, sizeof(m_changedMem), &m_changedMem);
+	m_jumpKernel->setKernelArgument(0, sizeof(m_parentMem), &m_parentMem);
+	m_jumpKernel->setKernelArgument(1, sizeof(count), &count);
+	uint32_t iterations = 0;
+	cl_uint changed = 1;
+	while (changed) {
+		const cl_uint zero = 0;
+		CL_CHECK_FATAL(clEnqueueFillBuffer(g_clCommandQueue, m_changedMem, &zero, sizeof(zero), 0, sizeof(zero), 0,
+			nullptr, nullptr), "Could not clear the cluster change flag");
+		m_linkKernel->enqueueNDRange(1, global);
+		m_jumpKernel->enqueueNDRange(1, global);
+		CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_changedMem, CL_TRUE, 0, sizeof(changed), &changed, 0,
+			nullptr, nullptr), "Could not read the cluster change flag");
+		++iterations;
+	}
+
+	// The members are grouped by root, and the roots with enough of them numbered into clusters
+	const cl_uint zero = 0;
+	CL_CHECK_FATAL(clEnqueueFillBuffer(g_clCommandQueue, m_memberStartMem, &zero, sizeof(zero), 0,
+		sizeof(cl_uint) * m_pCount, 0, nullptr, nullptr), "Could not clear the cluster member counts");
+	m_countKernel->setKernelArgument(0, sizeof(m_parentMem), &m_parentMem);
+	m_countKernel->setKernelArgument(1, sizeof(count), &count);
+	m_countKernel->setKernelArgument(2, sizeof(m_memberStartMem), &m_memberStartMem);
+	m_countKernel->setKernelArgument(3, sizeof(m_ranksMem), &m_ranksMem);
+	m_countKernel->enqueueNDRange(1, global);
+
+	m_markKernel->setKernelArgument(0, sizeof(m_memberStartMem), &m_memberStartMem);
+	m_markKernel->setKernelArgument(1, sizeof(count), &count);
+	m_markKernel->setKernelArgument(2, sizeof(m_minMembers), &m_minMembers);
+	m_markKernel->setKernelArgument(3, sizeof(m_clusterIndexMem), &m_clusterIndexMem);
+	m_markKernel->enqueueNDRange(1, global);
+	m_grid->scan(m_clusterIndexMem, m_pCount);
+	m_grid->scan(m_memberStartMem, m_pCount);
+
+	m_scatterKernel->setKernelArgument(0, sizeof(m_parentMem), &m_parentMem);
+	m_scatterKernel->setKernelArgument(1, sizeof(count), &count);
+	m_scatterKernel->setKernelArgument(2, sizeof(m_memberStartMem), &m_memberStartMem);
+	m_scatterKernel->setKernelArgument(3, sizeof(m_ranksMem), &m_ranksMem);
+	m_scatterKernel->setKernelArgument(4, sizeof(m_membersMem), &m_membersMem);
+	m_scatterKernel->enqueueNDRange(1, global);
+
+	m_summarizeKernel->setKernelArgument(0, sizeof(state), &state);
+	m_summarizeKernel->setKernelArgument(1, sizeof(count), &count);
+	m_summarizeKernel->setKernelArgument(2, sizeof(m_minMembers), &m_minMembers);
+	m_summarizeKernel->setKernelArgument(3, sizeof(m_memberStartMem), &m_memberStartMem);
+	m_summarizeKernel->setKernelArgument(4, sizeof(m_membersMem), &m_membersMem);
+	m_summarizeKernel->setKernelArgument(5, sizeof(m_clusterIndexMem), &m_clusterIndexMem);
+	m_summarizeKernel->setKernelArgument(6, sizeof(m_summariesMem), &m_summariesMem);
+	m_summarizeKernel->enqueueNDRange(1, global);
+
+	m_labelKernel->setKernelArgument(0, sizeof(m_parentMem), &m_parentMem);
+	m_labelKernel->setKernelArgument(1, sizeof(count), &count);
+	m_labelKernel->setKernelArgument(2, sizeof(m_minMembers), &m_minMembers);
+	m_labelKernel->setKernelArgument(3, sizeof(m_memberStartMem), &m_memberStartMem);
+	m_labelKernel->setKernelArgument(4, sizeof(m_clusterIndexMem), &m_clusterIndexMem);
+	m_labelKernel->setKernelArgument(5, sizeof(m_labelsMem), &m_labelsMem);
+	m_labelKernel->enqueueNDRange(1, global);
+
+	// Only the labels and the summaries of the clusters that were found come back
+	cl_uint clusters = 0;
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_clusterIndexMem, CL_TRUE, sizeof(cl_uint) * m_pCount,
+		sizeof(clusters), &clusters, 0, nullptr, nullptr), "Could not read the cluster count");
+
+	const ClusterRecord record = { step, time, clusters, iterations };
+	const size_t labelsSize = sizeof(uint32_t) * m_pCount;
+	auto block = std::make_shared<std::vector<unsigned char>>(sizeof(record) + labelsSize
+		+ (sizeof(ClusterSummary) * clusters));
+	memcpy(block->data(), &record, sizeof(record));
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_labelsMem, CL_FALSE, 0, labelsSize,
+		block->data() + sizeof(record), 0, nullptr, nullptr), "Could not read the cluster labels");
+	if (clusters) {
+		CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_summariesMem, CL_FALSE, 0,
+			sizeof(ClusterSummary) * clusters, block->data() + sizeof(record) + labelsSize, 0, nullptr, nullptr),
+			"Could not read the cluster summaries");
+	}
+	CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not wait for the clusters");
+
+	m_lastCount = clusters;
+	write(block);
+}
+
+// ================================================================================================
+void ClusterFinder::find(const CpuSolver& solver, uint64_t step, double time)
+{
+	if (m_device)
+		throw std::runtime_error("Cannot find clusters of the host state with a device cluster finder.");
+
+	const particle_soa_t& soa = solver.getArrays();
+	m_grid->build(soa, m_pCount, m_linkingLength);
+	const GridParams& grid = m_grid->getParams();
+	const uint32_t *cellStart = m_grid->getCellStart();
+	const uint32_t *sortedIndex = m_grid->getSortedIndex();
+	const float *sorted = m_grid->getSorted();
+	std::atomic<uint32_t> *parent = m_parent.get();
+	for (size_t i = 0; i < m_pCount; ++i)
+		parent[i].store((uint32_t)i, std::memory_order_relaxed);
+
+	// The same link and jump passes as the device, with a compare and swap loop for the atomic minimum
+	const float linkingLength2 = m_linkingLength * m_linkingLength;
+	const size_t pcount = m_pCount;
+	uint32_t iterations = 0;
+	std::atomic<bool> changed{true};
+	while (changed) {
+		changed = false;
+		g_jobs->parallel_for(0, pcount, 4096,
+			[&grid, cellStart, sortedIndex, sorted, parent, linkingLength2, &changed](size_t begin, size_t end) {
+				bool linked = false;
+				for (size_t slot = begin; slot < end; ++slot) {
+					const float *pos = &sorted[slot * 4];
+					const uint32_t a = sortedIndex[slot];
+					const uint32_t cell = getGridCell(grid, pos[0], pos[1]);
+					const int cx = (int)(cell % grid.side[0]);
+					const int cy = (int)(cell / grid.side[0]);
+					uint32_t ra = findClusterRoot(parent, a);
+					for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, (int)grid.side[1] - 1); ++y) {
+						for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, (int)grid.side[0] - 1); ++x) {
+							const uint32_t neighbour = ((uint32_t)y * grid.side[0]) + (uint32_t)x;
+							for (uint32_t k = cellStart[neighbour]; k < cellStart[neighbour + 1]; ++k) {
+								const uint32_t b = sortedIndex[k];
+								const float dx = sorted[k * 4] - pos[0];
+								const float dy = sorted[(k * 4) + 1] - pos[1];
+								if (b <= a || ((dx * dx) + (dy * dy)) > linkingLength2)
+									continue;
+
+								ra = findClusterRoot(parent, ra);
+								const uint32_t rb = findClusterRoot(parent, b);
+								if (ra == rb)
+									continue;
+								const uint32_t low = std::min(ra, rb);
+								std::atomic<uint32_t>& high = parent[std::max(ra, rb)];
+								uint32_t current = high.load(std::memory_order_relaxed);
+								while (low < current && !high.compare_exchange_weak(current, low)) {}
+								ra = low;
+								linked = true;
+							}
+						}
+					}
+				}
+				if (linked)
+					changed = true;
+			});
+		g_jobs->parallel_for(0, pcount, 16384, [parent](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				parent[i].store(findClusterRoot(parent, (uint32_t)i), std::memory_order_relaxed);
+		});
+		++iterations;
+	}
+
+	// Counted and summed in state order, which numbers the clusters by their roots like the device does
+	std::vector<uint32_t> members(m_pCount, 0);
+	for (size_t i = 0; i < m_pCount; ++i)
+		++members[parent[i].load(std::memory_order_relaxed)];
+	std::vector<uint32_t> clusterIndex(m_pCount, CLUSTER_NONE);
+	uint32_t clusters = 0;
+	for (size_t root = 0; root < m_pCount; ++root) {
+		if (members[root] >= m_minMembers)
+			clusterIndex[root] = clusters++;
+	}
+
+	const ClusterRecord record = { step, time, clusters, iterations };
+	const size_t labelsSize = sizeof(uint32_t) * m_pCount;
+	auto block = std::make_shared<std::vector<unsigned char>>(sizeof(record) + labelsSize
+		+ (sizeof(ClusterSummary) * clusters));
+	memcpy(block->data(), &record, sizeof(record));
+	uint32_t *labels = reinterpret_cast<uint32_t*>(block->data() + sizeof(record));
+	ClusterSummary *summaries = reinterpret_cast<ClusterSummary*>(block->data() + sizeof(record) + labelsSize);
+
+	std::vector<double> sums((size_t)clusters * 5, 0.0);
+	for (size_t i = 0; i < m_pCount; ++i) {
+		const uint32_t root = parent[i].load(std::memory_order_relaxed);
+		const uint32_t cluster = clusterIndex[root];
+		labels[i] = cluster;
+		if (cluster == CLUSTER_NONE)
+			continue;
+		double *sum = &sums[(size_t)cluster * 5];
+		const double m = soa.mass[i];
+		sum[0] += m;
+		sum[1] += m * soa.x[i];
+		sum[2] += m * soa.y[i];
+		sum[3] += m * soa.vx[i];
+		sum[4] += m * soa.vy[i];
+		if (members[root] != 0) {
+			summaries[cluster] = {};
+			summaries[cluster].count = members[root];
+			summaries[cluster].root = root;
+			members[root] = 0;
+		}
+	}
+
+	std::vector<double> spread(clusters, 0.0);
+	for (uint32_t cluster = 0; cluster < clusters; ++cluster) {
+		const double *sum = &sums[(size_t)cluster * 5];
+		const double invMass = (sum[0] > 0.0) ? (1.0 / sum[0]) : 0.0;
+		ClusterSummary& summary = summaries[cluster];
+		summary.mass = (float)sum[0];
+		summary.center[0] = (float)(sum[1] * invMass);
+		summary.center[1] = (float)(sum[2] * invMass);
+		summary.velocity[0] = (float)(sum[3] * invMass);
+		summary.velocity[1] = (float)(sum[4] * invMass);
+	}
+	for (size_t i = 0; i < m_pCount; ++i) {
+		const uint32_t cluster = labels[i];
+		if (cluster == CLUSTER_NONE)
+			continue;
+		const double dx = soa.x[i] - summaries[cluster].center[0];
+		const double dy = soa.y[i] - summaries[cluster].center[1];
+		spread[cluster] += soa.mass[i] * ((dx * dx) + (dy * dy));
+	}
+	for (uint32_t cluster = 0; cluster < clusters; ++cluster) {
+		const double mass = sums[(size_t)cluster * 5];
+		summaries[cluster].radius = (mass > 0.0) ? (float)std::sqrt(spread[cluster] / mass) : 0.0f;
+	}
+
+	m_lastCount = clusters;
+	write(block);
+}
+
+// ================================================================================================
+void ClusterFinder::write(std::shared_ptr<std::vector<unsigned char>> block)
+{
+	if (m_failed)
+		return;
+
+	// Records are written in order, each job waits for the one before it
+	m_writeJob = g_jobs->submit([this, block]() {
+		if (m_failed)
+			return;
+		m_file.write(reinterpret_cast<const char*>(block->data()), (std::streamsize)block->size());
+		m_file.flush();
+		if (!m_file) {
+			m_failed = true;
+			std::cerr << "Cluster Error: \"Could not write a record\"." << std::endl;
+		}
+	}, { m_writeJob });
+}
\ No newline at end of file
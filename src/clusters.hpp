@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "gpu.hpp"
+#include "jobs.hpp"
+#include "kernel.hpp"
+#include "spatialgrid.hpp"
+
+
+class CpuSolver;
+
+
+#define CLUSTER_VERSION 1u
+// Label of particles that are not in a cluster
+#define CLUSTER_NONE 0xFFFFFFFFu
+
+
+// Cluster files start with a header, and then hold a record for every pass. Each record is followed by the cluster
+// of every particle in the order of the state, and then by the summary of every cluster. Clusters are numbered by
+// the lowest state index among their members. All values are little endian.
+struct ClusterHeader
+{
+	char magic[8];				// "P50KCLST"
+	uint32_t version;
+	uint32_t particleCount;
+};
+static_assert(sizeof(ClusterHeader) == 16, "ClusterHeader is part of the file format");
+
+struct ClusterRecord
+{
+	uint64_t step;
+	double time;
+	uint32_t clusterCount;
+	uint32_t iterations;		// Link passes that were needed
+};
+static_assert(sizeof(ClusterRecord) == 24, "ClusterRecord is part of the file format");
+
+// Mass weighted centre, velocity and radius of gyration of a cluster (mirror of the kernel type)
+struct ClusterSummary
+{
+	uint32_t count;
+	float mass;
+	float center[2];
+	float velocity[2];
+	float radius;
+	uint32_t root;				// Lowest state index among the members
+};
+static_assert(sizeof(ClusterSummary) == 32, "ClusterSummary is part of the file format");
+
+
+// Finds the clumps and halos of the state with friends-of-friends every interval steps. Particles closer than the
+// linking length are friends, and a cluster is every particle reachable through friends, kept if it has enough
+// members. The particles are sorted into a grid of cells of the linking length, so friends are only searched in the
+// cells around each particle, and a parallel union-find hooks the trees of friends onto the smaller root with
+// atomics. Pointer jumping between the link passes flattens the trees, so a pass costs about one force step, and
+// one or two more passes confirm that nothing changed. The passes are not capped, since every pass that links
+// lowers a parent they always end, and a long chain only costs more of them. The pass runs on the OpenCL device, or on the host for the CPU
+// solver, and the records are written on the job system.
+class ClusterFinder
+{
+private:
+	const bool m_device;
+	const size_t m_pCount;
+	const uint32_t m_interval;
+	const float m_linkingLength;
+	const uint32_t m_minMembers;
+	SpatialGrid *m_grid;
+
+	// Device pass, with the kernels of a program built from ParticleGridKernelSource and ParticleClusterKernelSource
+	Kernel *m_initKernel;
+	Kernel *m_linkKernel;
+	Kernel *m_jumpKernel;
+	Kernel *m_countKernel;
+	Kernel *m_markKernel;
+	Kernel *m_scatterKernel;
+	Kernel *m_summarizeKernel;
+	Kernel *m_labelKernel;
+	cl_mem m_parentMem;
+	cl_mem m_changedMem;
+	cl_mem m_ranksMem;
+	cl_mem m_memberStartMem;	// Members of each root, scanned into the first slot of each root in m_membersMem
+	cl_mem m_membersMem;
+	cl_mem m_clusterIndexMem;	// Marks of the roots, scanned into the cluster numbers
+	cl_mem m_summariesMem;
+	cl_mem m_labelsMem;
+
+	// Host pass
+	std::unique_ptr<std::atomic<uint32_t>[]> m_parent;
+
+	std::ofstream m_file;
+	JobHandle m_writeJob;
+	std::atomic<bool> m_failed;
+	uint32_t m_lastCount;		// Clusters found by the last pass
+
+public:
+	// Creates the file, and the grid over the rectangle at origin with the given extent. Device passes build their
+	// program here. Throws on failure.
+	ClusterFinder(const char *path, bool device, vec2f origin, vec2f extent, size_t pcount, uint32_t interval,
+		float linkingLength, uint32_t minMembers);
+	// Waits for the last record to be written
+	~ClusterFinder();
+
+	inline bool isDevice() const { return m_device; }
+	inline float getLinkingLength() const { return m_linkingLength; }
+	inline uint32_t getLastClusterCount() const { return m_lastCount; }
+	// If a pass is due after the step
+	inline bool isDue(uint64_t step) const { return (step % m_interval) == 0; }
+
+	// Finds the clusters of the state after a step, and queues their record. The OpenCL state has to be acquired, and
+	// is waited for before this returns.
+	void find(cl_mem state, uint64_t step, double time);
+	void find(const CpuSolver& solver, uint64_t step, double time);
+
+	ClusterFinder(const ClusterFinder&) = delete;
+	ClusterFinder& operator = (const ClusterFinder&) = delete;
+
+private:
+	void write(std::shared_ptr<std::vector<unsigned char>> block);
+};
\ No newline at end of file
@@ -0,0 +1,429 @@
+#include "codec.hpp"
+#include "cpusolver.hpp"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+
+// rANS with byte wise renormalization, and four interleaved states so consecutive symbols do not depend on each other
+static const uint32_t RANS_PROB_BITS = 12;
+static const uint32_t RANS_PROB_SCALE = 1u << RANS_PROB_BITS;
+static const uint32_t RANS_LOWER = 1u << 23;
+static const size_t RANS_STATES = 4;
+
+// Each byte plane is stored as is, or rANS coded with its frequency table
+enum CodecPlaneMode :
+	uint32_t
+{
+	CODEC_PLANE_STORED = 0,
+	CODEC_PLANE_RANS = 1
+};
+
+struct CodecPlaneHeader
+{
+	uint32_t mode;				// CodecPlaneMode
+	uint32_t size;				// Bytes of data after the header and frequency table
+};
+static_assert(sizeof(CodecPlaneHeader) == 8, "CodecPlaneHeader is part of the file format");
+
+// Scratch space of the thread that is encoding or decoding, which stays allocated between columns
+static thread_local std::vector<uint32_t> t_words;
+static thread_local std::vector<unsigned char> t_planes;
+static thread_local std::vector<unsigned char> t_rans;
+
+
+// ================================================================================================
+static bool useAvx2()
+{
+	static const bool avx2 = (CpuSolver::DetectIsa() >= CpuSolver::ISA_AVX2);
+	return avx2;
+}
+
+// ================================================================================================
+template <typename T>
+static void append(std::vector<unsigned char>& out, const T *data, size_t count)
+{
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+	out.insert(out.end(), bytes, bytes + (count * sizeof(T)));
+}
+
+// ================================================================================================
+static void normalizeFrequencies(const size_t counts[256], size_t total, uint16_t freqs[256])
+{
+	// Every symbol that occurs keeps at least one slot, and the rounding error is taken from or given to the most
+	// frequent symbols
+	uint32_t sum = 0;
+	for (size_t s = 0; s < 256; ++s) {
+		uint32_t freq = (uint32_t)(((uint64_t)counts[s] * RANS_PROB_SCALE) / total);
+		if (counts[s] && !freq)
+			freq = 1;
+		freqs[s] = (uint16_t)freq;
+		sum += freq;
+	}
+	while (sum != RANS_PROB_SCALE) {
+		size_t largest = 0;
+		for (size_t s = 1; s < 256; ++s) {
+			if (freqs[s] > freqs[largest])
+				largest = s;
+		}
+		if (sum > RANS_PROB_SCALE) {
+			--freqs[largest];
+			--sum;
+		}
+		else {
+			++freqs[largest];
+			++sum;
+		}
+	}
+}
+
+// ================================================================================================
+static size_t ransEncode(const unsigned char *src, size_t count, const uint16_t freqs[256], unsigned char *dst,
+	size_t capacity)
+{
+	uint32_t starts[256];
+	uint32_t start = 0;
+	for (size_t s = 0; s < 256; ++s) {
+		starts[s] = start;
+		start += freqs[s];
+	}
+
+	// Encoded back to front, so the decoder reads the output front to back. Returns zero once it stops saving space.
+	unsigned char *ptr = dst + capacity;
+	uint32_t states[RANS_STATES] = { RANS_LOWER, RANS_LOWER, RANS_LOWER, RANS_LOWER };
+	for (size_t i = count; i-- > 0;) {
+		const unsigned char symbol = src[i];
+		const uint32_t freq = freqs[symbol];
+		uint32_t& x = states[i & (RANS_STATES - 1)];
+		const uint32_t limit = ((RANS_LOWER >> RANS_PROB_BITS) << 8) * freq;
+		while (x >= limit) {
+			if (ptr == dst)
+				return 0;
+			*--ptr = (unsigned char)(x & 0xFF);
+			x >>= 8;
+		}
+		x = ((x / freq) << RANS_PROB_BITS) + (x % freq) + starts[symbol];
+	}
+	for (size_t k = RANS_STATES; k-- > 0;) {
+		if ((size_t)(ptr - dst) < sizeof(uint32_t))
+			return 0;
+		ptr -= sizeof(uint32_t);
+		memcpy(ptr, &states[k], sizeof(uint32_t));
+	}
+
+	const size_t size = (size_t)((dst + capacity) - ptr);
+	memmove(dst, ptr, size);
+	return size;
+}
+
+// ================================================================================================
+static void ransDecode(const unsigned char *src, size_t size, const uint16_t freqs[256], unsigned char *dst,
+	size_t count)
+{
+	uint32_t starts[256];
+	unsigned char symbols[RANS_PROB_SCALE];
+	uint32_t start = 0;
+	for (size_t s = 0; s < 256; ++s) {
+		if (start + freqs[s] > RANS_PROB_SCALE)
+			throw std::runtime_error("The trajectory column has an invalid frequency table");
+		starts[s] = start;
+		memset(symbols + start, (int)s, freqs[s]);
+		start += freqs[s];
+	}
+	if (start != RANS_PROB_SCALE || size < RANS_STATES * sizeof(uint32_t))
+		throw std::runtime_error("The trajectory column has an invalid entropy coded plane");
+
+	const unsigned char *ptr = src;
+	const unsigned char *end = src + size;
+	uint32_t states[RANS_STATES];
+	for (size_t k = 0; k < RANS_STATES; ++k) {
+		memcpy(&states[k], ptr, sizeof(uint32_t));
+		ptr += sizeof(uint32_t);
+	}
+
+	const uint32_t mask = RANS_PROB_SCALE - 1;
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t& x = states[i & (RANS_STATES - 1)];
+		const unsigned char symbol = symbols[x & mask];
+		dst[i] = symbol;
+		x = (freqs[symbol] * (x >> RANS_PROB_BITS)) + (x & mask) - starts[symbol];
+		while (x < RANS_LOWER) {
+			if (ptr == end)
+				throw std::runtime_error("The trajectory column has a truncated entropy coded plane");
+			x = (x << 8) | *ptr++;
+		}
+	}
+}
+
+// ================================================================================================
+static void encodePlane(const unsigned char *plane, size_t count, std::vector<unsigned char>& out)
+{
+	size_t counts[256] = {};
+	for (size_t i = 0; i < count; ++i)
+		++counts[plane[i]];
+
+	// Planes that do not compress, such as the noisy low bytes of float bits, are stored
+	uint16_t freqs[256];
+	size_t size = 0;
+	if (count > 0) {
+		normalizeFrequencies(counts, count, freqs);
+		t_rans.resize(count);
+		size = ransEncode(plane, count, freqs, t_rans.data(), count);
+		if (size + sizeof(freqs) >= count)
+			size = 0;
+	}
+
+	if (size) {
+		const CodecPlaneHeader header = { CODEC_PLANE_RANS, (uint32_t)size };
+		append(out, &header, 1);
+		append(out, freqs, 256);
+		append(out, t_rans.data(), size);
+	}
+	else {
+		const CodecPlaneHeader header = { CODEC_PLANE_STORED, (uint32_t)count };
+		append(out, &header, 1);
+		append(out, plane, count);
+	}
+}
+
+// ================================================================================================
+static const unsigned char* decodePlane(const unsigned char *data, const unsigned char *end, unsigned char *plane,
+	size_t count)
+{
+	CodecPlaneHeader header;
+	if ((size_t)(end - data) < sizeof(header))
+		throw std::runtime_error("The trajectory column is truncated");
+	memcpy(&header, data, sizeof(header));
+	data += sizeof(header);
+
+	if (header.mode == CODEC_PLANE_STORED) {
+		if (header.size != count || (size_t)(end - data) < count)
+			throw std::runtime_error("The trajectory column is truncated");
+		memcpy(plane, data, count);
+		return data + count;
+	}
+	if (header.mode != CODEC_PLANE_RANS)
+		throw std::runtime_error("The trajectory column has an unknown plane encoding");
+
+	uint16_t freqs[256];
+	if ((size_t)(end - data) < sizeof(freqs) || (size_t)(end - data) - sizeof(freqs) < header.size)
+		throw std::runtime_error("The trajectory column is truncated");
+	memcpy(freqs, data, sizeof(freqs));
+	data += sizeof(freqs);
+	ransDecode(data, header.size, freqs, plane, count);
+	return data + header.size;
+}
+
+// ================================================================================================
+uint32_t encodeColumn(const float *values, size_t count, uint32_t codec, float errorBound, bool keyframe,
+	codec_history_t& history, std::vector<unsigned char>& out)
+{
+	const bool avx2 = useAvx2();
+
+	// The step leaves a margin for the rounding of the scaling and the conversion back, so the error stays within
+	// the bound. Columns with values too large for it are kept lossless instead.
+	float step = 0.0f;
+	if ((codec & TRAJECTORY_CODEC_QUANTIZE) && errorBound > 0.0f) {
+		const float candidate = errorBound * 1.6f;
+		const float maxabs = avx2 ? codec_max_abs_avx2(values, count) : codec_max_abs_scalar(values, count);
+		if (maxabs / candidate < (float)CODEC_QUANTIZE_LIMIT)
+			step = candidate;
+	}
+	if (step == 0.0f)
+		codec &= ~(uint32_t)TRAJECTORY_CODEC_QUANTIZE;
+
+	const bool delta = (codec & TRAJECTORY_CODEC_DELTA) && !keyframe && history.valid && (history.step == step)
+		&& (history.words.size() == count);
+	if (!delta)
+		codec &= ~(uint32_t)TRAJECTORY_CODEC_DELTA;
+	history.words.resize(count);
+	history.step = step;
+	history.valid = true;
+
+	t_words.resize(count);
+	const float invStep = (step > 0.0f) ? (1.0f / step) : 0.0f;
+	if (avx2)
+		codec_quantize_avx2(values, count, invStep, delta, history.words.data(), t_words.data());
+	else
+		codec_quantize_scalar(values, count, invStep, delta, history.words.data(), t_words.data());
+
+	// Without any stage left the words are the float bits, which are stored as they are. The history is still kept,
+	// so a column that starts a delta chain can be raw.
+	if (codec == TRAJECTORY_CODEC_RAW) {
+		append(out, values, count);
+		return TRAJECTORY_CODEC_RAW;
+	}
+
+	const CodecColumnHeader header = { step, 0 };
+	append(out, &header, 1);
+	if (!(codec & TRAJECTORY_CODEC_ENTROPY)) {
+		append(out, t_words.data(), count);
+		return codec;
+	}
+
+	// Bytes of the same significance are coded together, the high bytes of small deltas are mostly zero
+	t_planes.resize(count * sizeof(uint32_t));
+	if (avx2)
+		codec_split_planes_avx2(t_words.data(), count, t_planes.data());
+	else
+		codec_split_planes_scalar(t_words.data(), count, t_planes.data());
+	for (size_t k = 0; k < sizeof(uint32_t); ++k)
+		encodePlane(t_planes.data() + (k * count), count, out);
+	return codec;
+}
+
+// ================================================================================================
+void decodeColumn(const unsigned char *data, size_t size, uint32_t codec, size_t count, codec_history_t& history,
+	float *values)
+{
+	if (codec == TRAJECTORY_CODEC_RAW) {
+		if (size != count * sizeof(float))
+			throw std::runtime_error("The trajectory column has an unexpected size");
+		memcpy(values, data, size);
+		history.words.resize(count);
+		memcpy(history.words.data(), data, size);
+		history.step = 0.0f;
+		history.valid = true;
+		return;
+	}
+
+	const unsigned char *end = data + size;
+	CodecColumnHeader header;
+	if (size < sizeof(header))
+		throw std::runtime_error("The trajectory column is truncated");
+	memcpy(&header, data, sizeof(header));
+	data += sizeof(header);
+
+	const float step = header.step;
+	if (((codec & TRAJECTORY_CODEC_QUANTIZE) != 0) != (step > 0.0f))
+		throw std::runtime_error("The trajectory column has an invalid quantization step");
+	const bool delta = (codec & TRAJECTORY_CODEC_DELTA) != 0;
+	if (delta && (!history.valid || history.step != step || history.words.size() != count))
+		throw std::runtime_error("The trajectory column is a delta without its previous chunk");
+
+	const bool avx2 = useAvx2();
+	t_words.resize(count);
+	if (codec & TRAJECTORY_CODEC_ENTROPY) {
+		t_planes.resize(count * sizeof(uint32_t));
+		for (size_t k = 0; k < sizeof(uint32_t); ++k)
+			data = decodePlane(data, end, t_planes.data() + (k * count), count);
+		if (avx2)
+			codec_merge_planes_avx2(t_planes.data(), count, t_words.data());
+		else
+			codec_merge_planes_scalar(t_planes.data(), count, t_words.data());
+	}
+	else {
+		if ((size_t)(end - data) != count * sizeof(uint32_t))
+			throw std::runtime_error("The trajectory column has an unexpected size");
+		memcpy(t_words.data(), data, count * sizeof(uint32_t));
+	}
+
+	history.words.resize(count);
+	history.step = step;
+	history.valid = true;
+	if (avx2)
+		codec_dequantize_avx2(t_words.data(), count, step, delta, history.words.data(), values);
+	else
+		codec_dequantize_scalar(t_words.data(), count, step, delta, history.words.data(), values);
+}
+
+// ================================================================================================
+std::string getCodecName(uint32_t codec)
+{
+	if (codec == TRAJECTORY_CODEC_RAW)
+		return "raw";
+
+	std::string name;
+	const auto add = [&name](const char *stage) {
+		if (!name.empty())
+			name += "+";
+		name += stage;
+	};
+	if (codec & TRAJECTORY_CODEC_QUANTIZE)
+		add("quantize");
+	if (codec & TRAJECTORY_CODEC_DELTA)
+		add("delta");
+	if (codec & TRAJECTORY_CODEC_ENTROPY)
+		add("entropy");
+	return name;
+}
+
+
+
+// ================================================================================================
+float codec_max_abs_scalar(const float *values, size_t count)
+{
+	// Anything that is not finite makes the column impossible to quantize
+	float result = 0.0f;
+	for (size_t i = 0; i < count; ++i) {
+		const float magnitude = std::fabs(values[i]);
+		if (!(magnitude <= std::numeric_limits<float>::max()))
+			return std::numeric_limits<float>::infinity();
+		result = (magnitude > result) ? magnitude : result;
+	}
+	return result;
+}
+
+// ================================================================================================
+void codec_quantize_scalar(const float *values, size_t count, float invStep, bool delta, uint32_t *history,
+	uint32_t *words)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t previous = delta ? history[i] : 0;
+		if (invStep > 0.0f) {
+			// Rounds to nearest even like the SIMD conversion, so both produce the same words
+			const uint32_t q = (uint32_t)(int32_t)std::lrint(values[i] * invStep);
+			const uint32_t d = q - previous;
+			history[i] = q;
+			words[i] = (d << 1) ^ (uint32_t)((int32_t)d >> 31);
+		}
+		else {
+			uint32_t bits;
+			memcpy(&bits, &values[i], sizeof(bits));
+			history[i] = bits;
+			words[i] = bits ^ previous;
+		}
+	}
+}
+
+// ================================================================================================
+void codec_dequantize_scalar(const uint32_t *words, size_t count, float step, bool delta, uint32_t *history,
+	float *values)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t previous = delta ? history[i] : 0;
+		const uint32_t w = words[i];
+		if (step > 0.0f) {
+			const uint32_t q = previous + ((w >> 1) ^ (0u - (w & 1)));
+			history[i] = q;
+			values[i] = (float)(int32_t)q * step;
+		}
+		else {
+			const uint32_t bits = previous ^ w;
+			history[i] = bits;
+			memcpy(&values[i], &bits, sizeof(bits));
+		}
+	}
+}
+
+// ================================================================================================
+void codec_split_planes_scalar(const uint32_t *words, size_t count, unsigned char *planes)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t w = words[i];
+		planes[i] = (unsigned char)(w & 0xFF);
+		planes[count + i] = (unsigned char)((w >> 8) & 0xFF);
+		planes[(2 * count) + i] = (unsigned char)((w >> 16) & 0xFF);
+		planes[(3 * count) + i] = (unsigned char)(w >> 24);
+	}
+}
+
+// ================================================================================================
+void codec_merge_planes_scalar(const unsigned char *planes, size_t count, uint32_t *words)
+{
+	for (size_t i = 0; i < count; ++i) {
+		words[i] = (uint32_t)planes[i] | ((uint32_t)planes[count + i] << 8) | ((uint32_t)planes[(2 * count) + i] << 16)
+			| ((uint32_t)planes[(3 * count) + i] << 24);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Stages of a trajectory column encoding, combined as flags. Values are quantized to integers first, then stored as
+// the difference to the previous frame, and finally entropy coded. Without quantization the stages work on the bits
+// of the floats and are lossless.
+enum TrajectoryCodec :
+	uint32_t
+{
+	TRAJECTORY_CODEC_RAW = 0,		// Little endian floats
+	TRAJECTORY_CODEC_QUANTIZE = 1,	// Rounded to multiples of a step, which keeps the error within the bound
+	TRAJECTORY_CODEC_DELTA = 2,		// Against the same column of the previous chunk
+	TRAJECTORY_CODEC_ENTROPY = 4	// rANS over the byte planes of the words
+};
+
+// Quantized magnitudes are kept below this, where rounding on the way back stays well inside the error bound
+#define CODEC_QUANTIZE_LIMIT (1 << 20)
+
+
+// Starts every column that is not raw
+struct CodecColumnHeader
+{
+	float step;					// Quantization step, zero when the column holds float bits
+	uint32_t reserved;
+};
+static_assert(sizeof(CodecColumnHeader) == 8, "CodecColumnHeader is part of the file format");
+
+// Column words of the previous chunk, which deltas are taken against. The encoder and decoder each keep one per
+// attribute, and update it with every column they process.
+struct codec_history_t
+{
+	std::vector<uint32_t> words;	// Quantized values, or float bits
+	float step;						// Of the words, zero for float bits
+	bool valid;
+};
+
+
+// Encodes a column, and appends it to out. Stages that can not be used are dropped, quantization when a value is out
+// of range for the error bound, and deltas for keyframes or when the history has a different step. Returns the
+// stages that were used.
+uint32_t encodeColumn(const float *values, size_t count, uint32_t codec, float errorBound, bool keyframe,
+	codec_history_t& history, std::vector<unsigned char>& out);
+// Decodes a column written by encodeColumn with the given stages, throws if it is malformed
+void decodeColumn(const unsigned char *data, size_t size, uint32_t codec, size_t count, codec_history_t& history,
+	float *values);
+
+// Formats the stages as names joined by '+', such as "quantize+delta+entropy"
+std::string getCodecName(uint32_t codec);
+
+
+// Word transforms of the codecs, which have an AVX2 variant that is selected at runtime. A step or inverse step of zero
+// works on float bits, with an exclusive or for deltas instead of a zigzag coded difference.
+float codec_max_abs_scalar(const float *values, size_t count);
+void codec_quantize_scalar(const float *values, size_t count, float invStep, bool delta, uint32_t *history,
+	uint32_t *words);
+void codec_dequantize_scalar(const uint32_t *words, size_t count, float step, bool delta, uint32_t *history,
+	float *values);
+// Plane k holds byte k of every word, at planes + (k * count)
+void codec_split_planes_scalar(const uint32_t *words, size_t count, unsigned char *planes);
+void codec_merge_planes_scalar(const unsigned char *planes, size_t count, uint32_t *words);
+
+float codec_max_abs_avx2(const float *values, size_t count);
+void codec_quantize_avx2(const float *values, size_t count, float invStep, bool delta, uint32_t *history,
+	uint32_t *words);
+void codec_dequantize_avx2(const uint32_t *words, size_t count, float step, bool delta, uint32_t *history,
+	float *values);
+void codec_split_planes_avx2(const uint32_t *words, size_t count, unsigned char *planes);
+void codec_merge_planes_avx2(const unsigned char *planes, size_t count, uint32_t *words);
\ No newline at end of file
@@ -0,0 +1,162 @@
+// This file is compiled with AVX2 code generation enabled (see p50k.build), and must only be called after
+// CpuSolver::DetectIsa() has confirmed that the host supports it. The results match the scalar kernels bit for bit.
+#include "codec.hpp"
+#include <immintrin.h>
+
+
+// Groups the bytes of the four words in each 128 bit lane by significance, and then the lanes by quad word, which
+// leaves byte k of eight words in quad word k. The byte shuffle is a 4x4 transpose, and its own inverse. These are
+// built inside the functions, a static initializer would run AVX2 code on hosts without it.
+static inline __m256i plane_shuffle()
+{
+	return _mm256_setr_epi8(
+		0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+		0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+}
+
+
+// ================================================================================================
+float codec_max_abs_avx2(const float *values, size_t count)
+{
+	const size_t vectorEnd = count & ~(size_t)7;
+	const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	const __m256 largest = _mm256_set1_ps(3.402823466e+38f);
+	__m256 result = _mm256_setzero_ps();
+	__m256 invalid = _mm256_setzero_ps();
+	for (size_t i = 0; i < vectorEnd; i += 8) {
+		const __m256 magnitude = _mm256_and_ps(_mm256_loadu_ps(values + i), absmask);
+		// Not less or equal catches infinities and NaN
+		invalid = _mm256_or_ps(invalid, _mm256_cmp_ps(magnitude, largest, _CMP_NLE_UQ));
+		result = _mm256_max_ps(result, magnitude);
+	}
+	if (_mm256_movemask_ps(invalid))
+		return codec_max_abs_scalar(values, vectorEnd);
+
+	alignas(32) float lanes[8];
+	_mm256_store_ps(lanes, result);
+	float maximum = codec_max_abs_scalar(values + vectorEnd, count - vectorEnd);
+	for (size_t k = 0; k < 8; ++k)
+		maximum = (lanes[k] > maximum) ? lanes[k] : maximum;
+	return maximum;
+}
+
+// ================================================================================================
+void codec_quantize_avx2(const float *values, size_t count, float invStep, bool delta, uint32_t *history,
+	uint32_t *words)
+{
+	const size_t vectorEnd = count & ~(size_t)7;
+	const __m256i keep = delta ? _mm256_set1_epi32(-1) : _mm256_setzero_si256();
+	if (invStep > 0.0f) {
+		const __m256 scale = _mm256_set1_ps(invStep);
+		for (size_t i = 0; i < vectorEnd; i += 8) {
+			// The conversion rounds to nearest even under the default rounding mode
+			const __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(values + i), scale));
+			const __m256i previous = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(history + i)), keep);
+			const __m256i d = _mm256_sub_epi32(q, previous);
+			_mm256_storeu_si256((__m256i*)(history + i), q);
+			_mm256_storeu_si256((__m256i*)(words + i),
+				_mm256_xor_si256(_mm256_slli_epi32(d, 1), _mm256_srai_epi32(d, 31)));
+		}
+	}
+	else {
+		for (size_t i = 0; i < vectorEnd; i += 8) {
+			const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(values + i));
+			const __m256i previous = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(history + i)), keep);
+			_mm256_storeu_si256((__m256i*)(history + i), bits);
+			_mm256_storeu_si256((__m256i*)(words + i), _mm256_xor_si256(bits, previous));
+		}
+	}
+
+	codec_quantize_scalar(values + vectorEnd, count - vectorEnd, invStep, delta, history + vectorEnd,
+		words + vectorEnd);
+}
+
+// ================================================================================================
+void codec_dequantize_avx2(const uint32_t *words, size_t count, float step, bool delta, uint32_t *history,
+	float *values)
+{
+	const size_t vectorEnd = count & ~(size_t)7;
+	const __m256i keep = delta ? _mm256_set1_epi32(-1) : _mm256_setzero_si256();
+	if (step > 0.0f) {
+		const __m256 scale = _mm256_set1_ps(step);
+		const __m256i one = _mm256_set1_epi32(1);
+		for (size_t i = 0; i < vectorEnd; i += 8) {
+			const __m256i w = _mm256_loadu_si256((const __m256i*)(words + i));
+			const __m256i d = _mm256_xor_si256(_mm256_srli_epi32(w, 1),
+				_mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(w, one)));
+			const __m256i previous = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(history + i)), keep);
+			const __m256i q = _mm256_add_epi32(previous, d);
+			_mm256_storeu_si256((__m256i*)(history + i), q);
+			_mm256_storeu_ps(values + i, _mm256_mul_ps(_mm256_cvtepi32_ps(q), scale));
+		}
+	}
+	else {
+		for (size_t i = 0; i < vectorEnd; i += 8) {
+			const __m256i w = _mm256_loadu_si256((const __m256i*)(words + i));
+			const __m256i previous = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(history + i)), keep);
+			const __m256i bits = _mm256_xor_si256(previous, w);
+			_mm256_storeu_si256((__m256i*)(history + i), bits);
+			_mm256_storeu_ps(values + i, _mm256_castsi256_ps(bits));
+		}
+	}
+
+	codec_dequantize_scalar(words + vectorEnd, count - vectorEnd, step, delta, history + vectorEnd,
+		values + vectorEnd);
+}
+
+// ================================================================================================
+void codec_split_planes_avx2(const uint32_t *words, size_t count, unsigned char *planes)
+{
+	const size_t vectorEnd = count & ~(size_t)7;
+	unsigned char *plane0 = planes;
+	unsigned char *plane1 = planes + count;
+	unsigned char *plane2 = planes + (2 * count);
+	unsigned char *plane3 = planes + (3 * count);
+	const __m256i shuffle = plane_shuffle();
+	const __m256i permute = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	for (size_t i = 0; i < vectorEnd; i += 8) {
+		const __m256i w = _mm256_loadu_si256((const __m256i*)(words + i));
+		const __m256i grouped = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(w, shuffle), permute);
+		const __m128i low = _mm256_castsi256_si128(grouped);
+		const __m128i high = _mm256_extracti128_si256(grouped, 1);
+		_mm_storel_epi64((__m128i*)(plane0 + i), low);
+		_mm_storel_epi64((__m128i*)(plane1 + i), _mm_unpackhi_epi64(low, low));
+		_mm_storel_epi64((__m128i*)(plane2 + i), high);
+		_mm_storel_epi64((__m128i*)(plane3 + i), _mm_unpackhi_epi64(high, high));
+	}
+
+	// The tail keeps the plane stride of the whole column
+	for (size_t i = vectorEnd; i < count; ++i) {
+		const uint32_t w = words[i];
+		plane0[i] = (unsigned char)(w & 0xFF);
+		plane1[i] = (unsigned char)((w >> 8) & 0xFF);
+		plane2[i] = (unsigned char)((w >> 16) & 0xFF);
+		plane3[i] = (unsigned char)(w >> 24);
+	}
+}
+
+// ================================================================================================
+void codec_merge_planes_avx2(const unsigned char *planes, size_t count, uint32_t *words)
+{
+	const size_t vectorEnd = count & ~(size_t)7;
+	const unsigned char *plane0 = planes;
+	const unsigned char *plane1 = planes + count;
+	const unsigned char *plane2 = planes + (2 * count);
+	const unsigned char *plane3 = planes + (3 * count);
+	const __m256i shuffle = plane_shuffle();
+	const __m256i permute = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	for (size_t i = 0; i < vectorEnd; i += 8) {
+		const __m128i low = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(plane0 + i)),
+			_mm_loadl_epi64((const __m128i*)(plane1 + i)));
+		const __m128i high = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(plane2 + i)),
+			_mm_loadl_epi64((const __m128i*)(plane3 + i)));
+		const __m256i grouped = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		const __m256i w = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(grouped, permute), shuffle);
+		_mm256_storeu_si256((__m256i*)(words + i), w);
+	}
+
+	for (size_t i = vectorEnd; i < count; ++i) {
+		words[i] = (uint32_t)plane0[i] | ((uint32_t)plane1[i] << 8) | ((uint32_t)plane2[i] << 16)
+			| ((uint32_t)plane3[i] << 24);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "cpusolver.hpp"
+#include "fastmath.hpp"
+#include "jobs.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#else
+#	include <cpuid.h>
+#endif
+
+
+// ================================================================================================
+static float* AllocateAligned(size_t count)
+{
+#if defined(_MSC_VER)
+	void *mem = _aligned_malloc(count * sizeof(float), 64);
+#else
+	void *mem = nullptr;
+	if (posix_memalign(&mem, 64, count * sizeof(float)))
+		mem = nullptr;
+#endif
+	if (!mem)
+		throw std::runtime_error("Could not allocate host particle arrays.");
+	return static_cast<float*>(mem);
+}
+
+// ================================================================================================
+static void FreeAligned(float *mem)
+{
+#if defined(_MSC_VER)
+	_aligned_free(mem);
+#else
+	free(mem);
+#endif
+}
+
+
+// ================================================================================================
+CpuSolver::CpuSolver(size_t count) :
+	m_count{count},
+	m_paddedCount{((count + LANES - 1) / LANES) * LANES},
+	m_data{nullptr},
+	m_soa{},
+	m_isa{DetectIsa()}
+{
+	// One allocation for all eight arrays, each one a multiple of 64 bytes long
+	m_data = AllocateAligned(m_paddedCount * 8);
+	m_soa.mass = m_data;
+	m_soa.x = m_data + (m_paddedCount * 1);
+	m_soa.y = m_data + (m_paddedCount * 2);
+	m_soa.vx = m_data + (m_paddedCount * 3);
+	m_soa.vy = m_data + (m_paddedCount * 4);
+	m_soa.ax = m_data + (m_paddedCount * 5);
+	m_soa.ay = m_data + (m_paddedCount * 6);
+	m_soa.id = reinterpret_cast<uint32_t*>(m_data + (m_paddedCount * 7));
+
+	// Padding particles are given a unit mass so they never divide by zero
+	for (size_t i = 0; i < m_paddedCount; ++i) {
+		m_soa.mass[i] = 1.0f;
+		m_soa.x[i] = m_soa.y[i] = m_soa.vx[i] = m_soa.vy[i] = m_soa.ax[i] = m_soa.ay[i] = 0.0f;
+		m_soa.id[i] = (uint32_t)i;
+	}
+}
+
+// ================================================================================================
+CpuSolver::~CpuSolver()
+{
+	if (m_data)
+		FreeAligned(m_data);
+}
+
+// ================================================================================================
+void CpuSolver::setIsa(Isa isa)
+{
+	if (isa > DetectIsa())
+		throw std::runtime_error(std::string("The host does not support the ") + GetIsaName(isa) + " instruction set.");
+	m_isa = isa;
+}
+
+// ================================================================================================
+void CpuSolver::setState(const Particle *particles)
+{
+	const particle_soa_t& soa = m_soa;
+	g_jobs->parallel_for(0, m_count, GRAIN, [&soa, particles](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const Particle& part = particles[i];
+			soa.mass[i] = part.mass;
+			soa.x[i] = part.x;
+			soa.y[i] = part.y;
+			soa.vx[i] = part.vx;
+			soa.vy[i] = part.vy;
+			soa.ax[i] = part.ax;
+			soa.ay[i] = part.ay;
+			soa.id[i] = part.id;
+		}
+	});
+}
+
+// ================================================================================================
+void CpuSolver::setState(const Snapshot& snapshot)
+{
+	const particle_soa_t& soa = m_soa;
+	const float *mass = snapshot.getColumn(SNAPSHOT_MASS);
+	const float *x = snapshot.getColumn(SNAPSHOT_POS_X);
+	const float *y = snapshot.getColumn(SNAPSHOT_POS_Y);
+	const float *vx = snapshot.getColumn(SNAPSHOT_VEL_X);
+	const float *vy = snapshot.getColumn(SNAPSHOT_VEL_Y);
+	const uint32_t *ids = snapshot.getIds();
+	g_jobs->parallel_for(0, m_count, GRAIN, [&soa, mass, x, y, vx, vy, ids](size_t begin, size_t end) {
+		const size_t bytes = (end - begin) * sizeof(float);
+		const auto copy = [begin, end, bytes](float *dst, const float *src, float fallback) {
+			if (src)
+				memcpy(dst + begin, src + begin, bytes);
+			else
+				std::fill(dst + begin, dst + end, fallback);
+		};
+		copy(soa.mass, mass, 1.0f);
+		copy(soa.x, x, 0.0f);
+		copy(soa.y, y, 0.0f);
+		copy(soa.vx, vx, 0.0f);
+		copy(soa.vy, vy, 0.0f);
+		copy(soa.ax, nullptr, 0.0f);
+		copy(soa.ay, nullptr, 0.0f);
+
+		// Snapshots without ids number the particles like the generators
+		if (ids)
+			memcpy(soa.id + begin, ids + begin, (end - begin) * sizeof(uint32_t));
+		else {
+			for (size_t i = begin; i < end; ++i)
+				soa.id[i] = (uint32_t)i;
+		}
+	});
+}
+
+// ================================================================================================
+void CpuSolver::getState(Particle *particles) const
+{
+	const particle_soa_t& soa = m_soa;
+	g_jobs->parallel_for(0, m_count, GRAIN, [&soa, particles](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Particle& part = particles[i];
+			part.mass = soa.mass[i];
+			part.x = soa.x[i];
+			part.y = soa.y[i];
+			part.vx = soa.vx[i];
+			part.vy = soa.vy[i];
+			part.ax = soa.ax[i];
+			part.ay = soa.ay[i];
+			part.id = soa.id[i];
+		}
+	});
+}
+
+// ================================================================================================
+void CpuSolver::getRenderStream(void *stream) const
+{
+	const particle_soa_t& soa = m_soa;
+	const size_t count = m_count;
+	g_jobs->parallel_for(0, m_count, GRAIN, [&soa, count, stream](size_t begin, size_t end) {
+		encodeRenderStream(soa.x, soa.y, soa.vx, soa.vy, begin, end, count, stream);
+	});
+}
+
+// ================================================================================================
+void CpuSolver::step(const FrameParams& frame)
+{
+	void (*solve)(const particle_soa_t&, size_t, size_t, const FrameParams&) = cpu_solve_scalar;
+	if (m_isa == ISA_AVX512)
+		solve = cpu_solve_avx512;
+	else if (m_isa == ISA_AVX2)
+		solve = cpu_solve_avx2;
+
+	// Iterate over blocks of LANES particles, so every chunk stays aligned to the vector width
+	const particle_soa_t& soa = m_soa;
+	g_jobs->parallel_for(0, m_paddedCount / LANES, GRAIN / LANES,
+		[&soa, &frame, solve](size_t begin, size_t end) {
+			solve(soa, begin * LANES, end * LANES, frame);
+		});
+}
+
+// ================================================================================================
+CpuSolver::Isa CpuSolver::DetectIsa()
+{
+	static int detected = -1;
+	if (detected >= 0)
+		return (Isa)detected;
+
+	unsigned int leaf1[4] = { 0, 0, 0, 0 };
+	unsigned int leaf7[4] = { 0, 0, 0, 0 };
+	unsigned long long xcr0 = 0;
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	const int maxleaf = regs[0];
+	__cpuidex(regs, 1, 0);
+	for (int i = 0; i < 4; ++i) leaf1[i] = (unsigned int)regs[i];
+	if (maxleaf >= 7) {
+		__cpuidex(regs, 7, 0);
+		for (int i = 0; i < 4; ++i) leaf7[i] = (unsigned int)regs[i];
+	}
+	const bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+	if (osxsave)
+		xcr0 = _xgetbv(0);
+#else
+	const unsigned int maxleaf = __get_cpuid_max(0, nullptr);
+	__cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+	if (maxleaf >= 7)
+		__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+	const bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+	if (osxsave) {
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long)hi << 32) | lo;
+	}
+#endif
+
+	// The OS must save the YMM (and for AVX-512, the opmask and ZMM) registers on context switches
+	const bool osymm = (xcr0 & 0x06) == 0x06;
+	const bool oszmm = (xcr0 & 0xE6) == 0xE6;
+	const bool fma = (leaf1[2] & (1u << 12)) != 0;
+	const bool avx2 = (leaf7[1] & (1u << 5)) != 0;
+	const bool avx512f = (leaf7[1] & (1u << 16)) != 0;
+
+	if (osymm && oszmm && avx512f)
+		detected = ISA_AVX512;
+	else if (osymm && avx2 && fma)
+		detected = ISA_AVX2;
+	else
+		detected = ISA_SCALAR;
+	return (Isa)detected;
+}
+
+// ================================================================================================
+const char* CpuSolver::GetIsaName(Isa isa)
+{
+	switch (isa)
+	{
+	case ISA_SCALAR: return "Scalar";
+	case ISA_AVX2: return "AVX2";
+	case ISA_AVX512: return "AVX-512";
+	default: return "Unknown";
+	}
+}
+
+
+// ================================================================================================
+void cpu_solve_scalar(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame)
+{
+	const float dtime = frame.deltaTime;
+
+	for (size_t i = begin; i < end; ++i) {
+		const float srcx = soa.x[i];
+		const float srcy = soa.y[i];
+		const float diffx = srcx - frame.attractor.x;
+		const float diffy = srcy - frame.attractor.y;
+
+		// Force from central attractor
+		const float difflen = std::sqrt((diffx * diffx) + (diffy * diffy)) + 1;
+		const float scale = 1.0f / fm_cube(difflen);
+		const float forcex = scale * diffx;
+		const float forcey = scale * diffy;
+
+		// Velocity fields
+		const float angle = fm_atan2<P50K_FASTMATH_TIER>(diffy, diffx);
+		const float radialx = fm_cos<P50K_FASTMATH_TIER>(angle);
+		const float radialy = fm_sin<P50K_FASTMATH_TIER>(angle);
+		const float vfieldx = (diffy * frame.fieldStrength) + (frame.pulse.x * radialx) - (frame.pulse.y * radialy);
+		const float vfieldy = (-diffx * frame.fieldStrength) + (frame.pulse.x * radialy) + (frame.pulse.y * radialx);
+
+		// Solve final changes
+		const float daccx = (-forcex / soa.mass[i]) * frame.attractorStrength;
+		const float daccy = (-forcey / soa.mass[i]) * frame.attractorStrength;
+		const float dvelx = soa.vx[i] + (daccx * dtime);
+		const float dvely = soa.vy[i] + (daccy * dtime);
+		const float fieldscale = dtime / difflen;
+		soa.x[i] = srcx + (dvelx * dtime) + (vfieldx * fieldscale);
+		soa.y[i] = srcy + (dvely * dtime) + (vfieldy * fieldscale);
+		soa.vx[i] = dvelx;
+		soa.vy[i] = dvely;
+		soa.ax[i] = daccx;
+		soa.ay[i] = daccy;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "particle.hpp"
+
+
+// Structure-of-arrays view of the particle state used by the host step kernels. All arrays are 64-byte aligned,
+// and padded to a multiple of CpuSolver::LANES particles. The step kernels leave the ids alone.
+class Snapshot;
+
+
+struct particle_soa_t
+{
+	float *mass;
+	float *x;
+	float *y;
+	float *vx;
+	float *vy;
+	float *ax;
+	float *ay;
+	uint32_t *id;
+};
+
+
+// Instruction set specific implementations of the Solve kernel, updating the particles in [begin, end) in place.
+// The SIMD versions require begin and end to be multiples of their vector width.
+void cpu_solve_scalar(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame);
+void cpu_solve_avx2(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame);
+void cpu_solve_avx512(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame);
+
+
+// Runs the particle physics on the host, across the job system workers with the widest available SIMD extension.
+// The scalar path doubles as the reference implementation, with --fastmath=precise for the standard library functions.
+class CpuSolver
+{
+public:
+	enum Isa :
+		unsigned char
+	{
+		ISA_SCALAR = 0,
+		ISA_AVX2 = 1,
+		ISA_AVX512 = 2
+	};
+
+	// The widest SIMD width, in floats, that the particle arrays are padded to
+	static const size_t LANES = 16;
+	// The number of particles processed by a single job
+	static const size_t GRAIN = 16 * 1024;
+
+private:
+	const size_t m_count;
+	const size_t m_paddedCount;
+	float *m_data;
+	particle_soa_t m_soa;
+	Isa m_isa;
+
+public:
+	CpuSolver(size_t count);
+	~CpuSolver();
+
+	inline size_t getCount() const { return m_count; }
+	inline const particle_soa_t& getArrays() const { return m_soa; }
+	inline Isa getIsa() const { return m_isa; }
+	// Can be used to force a narrower instruction set, for validation against the scalar reference
+	void setIsa(Isa isa);
+
+	void setState(const Particle *particles);
+	// Copies the snapshot columns straight into the arrays, which have the same layout
+	void setState(const Snapshot& snapshot);
+	void getState(Particle *particles) const;
+	// Writes the compact render stream (see RENDER_STREAM_COMPACT), which takes RENDER_STREAM_BYTES_PER_PARTICLE bytes
+	// for each particle
+	void getRenderStream(void *stream) const;
+
+	void step(const FrameParams& frame);
+
+	static Isa DetectIsa();
+	static const char* GetIsaName(Isa isa);
+
+	CpuSolver(const CpuSolver&) = delete;
+	CpuSolver& operator = (const CpuSolver&) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,79 @@
+// This file is compiled with AVX2 and FMA code generation enabled (see p50k.build), and must only be called
+// after CpuSolver::DetectIsa() has confirmed that the host supports them.
+#include "cpusolver.hpp"
+#include "fastmath_avx2.hpp"
+#include <cmath>
+
+
+// ================================================================================================
+void cpu_solve_avx2(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 dt = _mm256_set1_ps(frame.deltaTime);
+	const __m256 attractorx = _mm256_set1_ps(frame.attractor.x);
+	const __m256 attractory = _mm256_set1_ps(frame.attractor.y);
+	const __m256 pulsex = _mm256_set1_ps(frame.pulse.x);
+	const __m256 pulsey = _mm256_set1_ps(frame.pulse.y);
+	const __m256 fieldstrength = _mm256_set1_ps(frame.fieldStrength);
+	const __m256 accscale = _mm256_set1_ps(-frame.attractorStrength);
+
+	for (size_t i = begin; i < end; i += 8) {
+		const __m256 srcx = _mm256_load_ps(soa.x + i);
+		const __m256 srcy = _mm256_load_ps(soa.y + i);
+		const __m256 mass = _mm256_load_ps(soa.mass + i);
+		const __m256 diffx = _mm256_sub_ps(srcx, attractorx);
+		const __m256 diffy = _mm256_sub_ps(srcy, attractory);
+
+		// Force from central attractor
+		const __m256 dist = _mm256_sqrt_ps(_mm256_fmadd_ps(diffx, diffx, _mm256_mul_ps(diffy, diffy)));
+		const __m256 difflen = _mm256_add_ps(dist, one);
+		const __m256 scale = _mm256_div_ps(one, fm_cube_avx2(difflen));
+
+		// Velocity fields
+		const __m256 angle = fm_atan2_avx2<P50K_FASTMATH_TIER>(diffy, diffx);
+		const __m256 radialx = fm_cos_avx2<P50K_FASTMATH_TIER>(angle);
+		const __m256 radialy = fm_sin_avx2<P50K_FASTMATH_TIER>(angle);
+		const __m256 vfieldx = _mm256_fnmadd_ps(pulsey, radialy, _mm256_fmadd_ps(pulsex, radialx, _mm256_mul_ps(diffy, fieldstrength)));
+		const __m256 vfieldy = _mm256_fmadd_ps(pulsey, radialx, _mm256_fmsub_ps(pulsex, radialy, _mm256_mul_ps(diffx, fieldstrength)));
+
+		// Solve final changes
+		const __m256 accfactor = _mm256_div_ps(_mm256_mul_ps(scale, accscale), mass);
+		const __m256 daccx = _mm256_mul_ps(diffx, accfactor);
+		const __m256 daccy = _mm256_mul_ps(diffy, accfactor);
+		const __m256 dvelx = _mm256_fmadd_ps(daccx, dt, _mm256_load_ps(soa.vx + i));
+		const __m256 dvely = _mm256_fmadd_ps(daccy, dt, _mm256_load_ps(soa.vy + i));
+		const __m256 fieldscale = _mm256_div_ps(dt, difflen);
+		_mm256_store_ps(soa.x + i, _mm256_fmadd_ps(vfieldx, fieldscale, _mm256_fmadd_ps(dvelx, dt, srcx)));
+		_mm256_store_ps(soa.y + i, _mm256_fmadd_ps(vfieldy, fieldscale, _mm256_fmadd_ps(dvely, dt, srcy)));
+		_mm256_store_ps(soa.vx + i, dvelx);
+		_mm256_store_ps(soa.vy + i, dvely);
+		_mm256_store_ps(soa.ax + i, daccx);
+		_mm256_store_ps(soa.ay + i, daccy);
+	}
+}
+
+// ================================================================================================
+template <int Tier>
+static void fm_evaluate_tier_avx2(FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	for (size_t i = 0; i < count; i += 8) {
+		const __m256 vx = _mm256_loadu_ps(x + i);
+		switch (func) {
+		case FASTMATH_FUNC_ATAN2: _mm256_storeu_ps(out + i, fm_atan2_avx2<Tier>(_mm256_loadu_ps(y + i), vx)); break;
+		case FASTMATH_FUNC_SIN: _mm256_storeu_ps(out + i, fm_sin_avx2<Tier>(vx)); break;
+		case FASTMATH_FUNC_COS: _mm256_storeu_ps(out + i, fm_cos_avx2<Tier>(vx)); break;
+		default: break;
+		}
+	}
+}
+
+// ================================================================================================
+void fm_evaluate_avx2(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	switch (tier) {
+	case FASTMATH_PRECISE: fm_evaluate_tier_avx2<FASTMATH_PRECISE>(func, y, x, out, count); break;
+	case FASTMATH_ACCURATE: fm_evaluate_tier_avx2<FASTMATH_ACCURATE>(func, y, x, out, count); break;
+	case FASTMATH_FAST: fm_evaluate_tier_avx2<FASTMATH_FAST>(func, y, x, out, count); break;
+	default: break;
+	}
+}
\ No newline at end of file
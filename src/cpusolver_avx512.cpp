@@ -0,0 +1,79 @@
+// This file is compiled with AVX-512 code generation enabled (see p50k.build), and must only be called after
+// CpuSolver::DetectIsa() has confirmed that the host supports AVX-512F.
+#include "cpusolver.hpp"
+#include "fastmath_avx512.hpp"
+#include <cmath>
+
+
+// ================================================================================================
+void cpu_solve_avx512(const particle_soa_t& soa, size_t begin, size_t end, const FrameParams& frame)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 dt = _mm512_set1_ps(frame.deltaTime);
+	const __m512 attractorx = _mm512_set1_ps(frame.attractor.x);
+	const __m512 attractory = _mm512_set1_ps(frame.attractor.y);
+	const __m512 pulsex = _mm512_set1_ps(frame.pulse.x);
+	const __m512 pulsey = _mm512_set1_ps(frame.pulse.y);
+	const __m512 fieldstrength = _mm512_set1_ps(frame.fieldStrength);
+	const __m512 accscale = _mm512_set1_ps(-frame.attractorStrength);
+
+	for (size_t i = begin; i < end; i += 16) {
+		const __m512 srcx = _mm512_load_ps(soa.x + i);
+		const __m512 srcy = _mm512_load_ps(soa.y + i);
+		const __m512 mass = _mm512_load_ps(soa.mass + i);
+		const __m512 diffx = _mm512_sub_ps(srcx, attractorx);
+		const __m512 diffy = _mm512_sub_ps(srcy, attractory);
+
+		// Force from central attractor
+		const __m512 dist = _mm512_sqrt_ps(_mm512_fmadd_ps(diffx, diffx, _mm512_mul_ps(diffy, diffy)));
+		const __m512 difflen = _mm512_add_ps(dist, one);
+		const __m512 scale = _mm512_div_ps(one, fm_cube_avx512(difflen));
+
+		// Velocity fields
+		const __m512 angle = fm_atan2_avx512<P50K_FASTMATH_TIER>(diffy, diffx);
+		const __m512 radialx = fm_cos_avx512<P50K_FASTMATH_TIER>(angle);
+		const __m512 radialy = fm_sin_avx512<P50K_FASTMATH_TIER>(angle);
+		const __m512 vfieldx = _mm512_fnmadd_ps(pulsey, radialy, _mm512_fmadd_ps(pulsex, radialx, _mm512_mul_ps(diffy, fieldstrength)));
+		const __m512 vfieldy = _mm512_fmadd_ps(pulsey, radialx, _mm512_fmsub_ps(pulsex, radialy, _mm512_mul_ps(diffx, fieldstrength)));
+
+		// Solve final changes
+		const __m512 accfactor = _mm512_div_ps(_mm512_mul_ps(scale, accscale), mass);
+		const __m512 daccx = _mm512_mul_ps(diffx, accfactor);
+		const __m512 daccy = _mm512_mul_ps(diffy, accfactor);
+		const __m512 dvelx = _mm512_fmadd_ps(daccx, dt, _mm512_load_ps(soa.vx + i));
+		const __m512 dvely = _mm512_fmadd_ps(daccy, dt, _mm512_load_ps(soa.vy + i));
+		const __m512 fieldscale = _mm512_div_ps(dt, difflen);
+		_mm512_store_ps(soa.x + i, _mm512_fmadd_ps(vfieldx, fieldscale, _mm512_fmadd_ps(dvelx, dt, srcx)));
+		_mm512_store_ps(soa.y + i, _mm512_fmadd_ps(vfieldy, fieldscale, _mm512_fmadd_ps(dvely, dt, srcy)));
+		_mm512_store_ps(soa.vx + i, dvelx);
+		_mm512_store_ps(soa.vy + i, dvely);
+		_mm512_store_ps(soa.ax + i, daccx);
+		_mm512_store_ps(soa.ay + i, daccy);
+	}
+}
+
+// ================================================================================================
+template <int Tier>
+static void fm_evaluate_tier_avx512(FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	for (size_t i = 0; i < count; i += 16) {
+		const __m512 vx = _mm512_loadu_ps(x + i);
+		switch (func) {
+		case FASTMATH_FUNC_ATAN2: _mm512_storeu_ps(out + i, fm_atan2_avx512<Tier>(_mm512_loadu_ps(y + i), vx)); break;
+		case FASTMATH_FUNC_SIN: _mm512_storeu_ps(out + i, fm_sin_avx512<Tier>(vx)); break;
+		case FASTMATH_FUNC_COS: _mm512_storeu_ps(out + i, fm_cos_avx512<Tier>(vx)); break;
+		default: break;
+		}
+	}
+}
+
+// ================================================================================================
+void fm_evaluate_avx512(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	switch (tier) {
+	case FASTMATH_PRECISE: fm_evaluate_tier_avx512<FASTMATH_PRECISE>(func, y, x, out, count); break;
+	case FASTMATH_ACCURATE: fm_evaluate_tier_avx512<FASTMATH_ACCURATE>(func, y, x, out, count); break;
+	case FASTMATH_FAST: fm_evaluate_tier_avx512<FASTMATH_FAST>(func, y, x, out, count); break;
+	default: break;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,393 @@
+#include "diagnostics.hpp"
+#include "cpusolver.hpp"
+#include "particle.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+
+// Rows collected on the host before they are handed to a write job
+static const size_t DiagnosticsBlockBytes = 16 * 1024;
+
+
+// ================================================================================================
+DiagnosticsSample makeDiagnosticsSample(const DiagnosticsResult& result, uint64_t step, double time)
+{
+	const float *moments = result.moments;
+	DiagnosticsSample sample = {};
+	sample.step = step;
+	sample.time = time;
+	sample.mass = moments[DIAGNOSTICS_MASS];
+	sample.kinetic = 0.5 * moments[DIAGNOSTICS_MASS_SPEED2];
+	sample.potential = moments[DIAGNOSTICS_POTENTIAL];
+	sample.momentum[0] = moments[DIAGNOSTICS_MOMENTUM_X];
+	sample.momentum[1] = moments[DIAGNOSTICS_MOMENTUM_Y];
+	sample.angularMomentum = moments[DIAGNOSTICS_ANGULAR];
+
+	// The dispersion is the mean squared speed less the square of the mean velocity, which rounding can push below
+	// zero for a cold state
+	if (sample.mass > 0.0) {
+		const double invMass = 1.0 / sample.mass;
+		sample.centerOfMass[0] = moments[DIAGNOSTICS_MASS_X] * invMass;
+		sample.centerOfMass[1] = moments[DIAGNOSTICS_MASS_Y] * invMass;
+		const double meanx = sample.momentum[0] * invMass;
+		const double meany = sample.momentum[1] * invMass;
+		const double variance = (moments[DIAGNOSTICS_MASS_SPEED2] * invMass) - ((meanx * meanx) + (meany * meany));
+		sample.velocityDispersion = std::sqrt(std::max(variance, 0.0));
+	}
+	std::copy(result.histogram, result.histogram + DIAGNOSTICS_BINS, sample.histogram);
+	return sample;
+}
+
+// ================================================================================================
+Diagnostics::Diagnostics(const char *path, ReadbackSource source, uint32_t interval, float range) :
+	m_source{source},
+	m_interval{interval},
+	m_binScale{(float)DIAGNOSTICS_BINS / range},
+	m_partialsMem{nullptr},
+	m_resultMem{nullptr},
+	m_partialsBuffer{nullptr},
+	m_reduceCompute{nullptr},
+	m_finalCompute{nullptr},
+	m_ring{},
+	m_oldest{0},
+	m_inFlight{0},
+	m_latest{},
+	m_hasLatest{false},
+	m_file{},
+	m_lines{},
+	m_writeJob{},
+	m_failed{false}
+{
+	if (!m_interval)
+		throw std::runtime_error("The diagnostics interval must be greater than zero");
+	if (!(range > 0.0f))
+		throw std::runtime_error("The diagnostics histogram range must be greater than zero");
+
+	m_file.open(path, std::ios::out | std::ios::trunc);
+	if (!m_file.is_open())
+		throw std::runtime_error(std::string("Could not create diagnostics '") + path + "'");
+
+	// Bins are named by the distance they start at
+	m_file << "step,time,mass,kinetic,potential,total,momentum_x,momentum_y,angular_momentum,center_x,center_y,"
+		"dispersion";
+	for (size_t i = 0; i < DIAGNOSTICS_BINS; ++i)
+		m_file << ",r" << ((float)i / m_binScale);
+	m_file << std::endl;
+	if (!m_file)
+		throw std::runtime_error(std::string("Could not write diagnostics '") + path + "'");
+
+	const size_t partialsSize = sizeof(float) * DIAGNOSTICS_MOMENT_COUNT * DIAGNOSTICS_LANES;
+	if (m_source == READBACK_OPENCL) {
+		cl_int clerr;
+		CL_CHECK_RETURN_FATAL(
+			m_partialsMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, partialsSize, nullptr, &clerr),
+			clerr, m_partialsMem, "Could not create the diagnostics partial sums");
+		CL_CHECK_RETURN_FATAL(
+			m_resultMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(DiagnosticsResult), nullptr, &clerr),
+			clerr, m_resultMem, "Could not create the diagnostics result");
+	}
+	else if (m_source == READBACK_OPENGL) {
+		std::string reduceSource = "#version 430 core\n";
+		reduceSource += ParticleReduceComputeShaderSource;
+		m_reduceCompute = new ComputeShader(reduceSource.c_str());
+		m_reduceCompute->bind();
+		m_reduceCompute->setUniform("BinScale", m_binScale);
+		m_reduceCompute->release();
+
+		std::string finalSource = "#version 430 core\n#define DIAGNOSTICS_FINAL\n";
+		finalSource += ParticleReduceComputeShaderSource;
+		m_finalCompute = new ComputeShader(finalSource.c_str());
+		m_finalCompute->bind();
+		m_finalCompute->setUniform("Lanes", (unsigned int)DIAGNOSTICS_LANES);
+		m_finalCompute->release();
+
+		m_partialsBuffer = new VertexBuffer(partialsSize, GL_DYNAMIC_COPY);
+	}
+
+	for (slot_t& slot : m_ring) {
+		if (m_source == READBACK_HOST) {
+			slot.result = new DiagnosticsResult();
+		}
+		else if (m_source == READBACK_OPENCL) {
+			cl_int clerr;
+			CL_CHECK_RETURN_FATAL(
+				slot.pinnedMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+					sizeof(DiagnosticsResult), nullptr, &clerr),
+				clerr, slot.pinnedMem, "Could not create a diagnostics readback buffer");
+			CL_CHECK_RETURN_FATAL(
+				slot.result = static_cast<DiagnosticsResult*>(clEnqueueMapBuffer(g_clCommandQueue, slot.pinnedMem,
+					CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(DiagnosticsResult), 0, nullptr, nullptr, &clerr)),
+				clerr, slot.result, "Could not map a diagnostics readback buffer");
+		}
+		else {
+			// Each slot is reduced into directly, like the tracer samples
+			slot.buffer = new VertexBuffer(sizeof(DiagnosticsResult), GL_STREAM_READ);
+		}
+	}
+}
+
+// ================================================================================================
+Diagnostics::~Diagnostics()
+{
+	try {
+		while (m_inFlight)
+			collect(true);
+		flush();
+	}
+	catch (const std::exception& ex) {
+		std::cerr << "Diagnostics Error: \"" << ex.what() << "\"." << std::endl;
+	}
+	if (m_writeJob)
+		g_jobs->wait(m_writeJob);
+
+	for (slot_t& slot : m_ring) {
+		if (slot.event) {
+			clWaitForEvents(1, &slot.event);
+			clReleaseEvent(slot.event);
+		}
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+
+		if (slot.buffer)
+			delete slot.buffer;
+		else if (slot.pinnedMem) {
+			clEnqueueUnmapMemObject(g_clCommandQueue, slot.pinnedMem, slot.result, 0, nullptr, nullptr);
+			clFinish(g_clCommandQueue);
+			clReleaseMemObject(slot.pinnedMem);
+		}
+		else if (slot.result)
+			delete slot.result;
+	}
+
+	if (m_reduceCompute)
+		delete m_reduceCompute;
+	if (m_finalCompute)
+		delete m_finalCompute;
+	if (m_partialsBuffer)
+		delete m_partialsBuffer;
+	if (m_partialsMem)
+		clReleaseMemObject(m_partialsMem);
+	if (m_resultMem)
+		clReleaseMemObject(m_resultMem);
+}
+
+// ================================================================================================
+void Diagnostics::reduce(const CpuSolver& solver, const FrameParams& frame, uint64_t step, double time)
+{
+	if (m_source != READBACK_HOST)
+		throw std::runtime_error("Cannot reduce the host state into device diagnostics.");
+
+	// Each chunk sums in double precision on its own, and only merges its sums once
+	slot_t& slot = beginReduce(step, time);
+	const particle_soa_t& soa = solver.getArrays();
+	const float binScale = m_binScale;
+	double totals[DIAGNOSTICS_MOMENT_COUNT] = {};
+	uint32_t bins[DIAGNOSTICS_BINS] = {};
+	std::mutex mutex;
+	g_jobs->parallel_for(0, solver.getCount(), 16384,
+		[&soa, &frame, binScale, &totals, &bins, &mutex](size_t begin, size_t end) {
+			double sums[DIAGNOSTICS_MOMENT_COUNT] = {};
+			uint32_t chunkBins[DIAGNOSTICS_BINS] = {};
+			for (size_t i = begin; i < end; ++i) {
+				const float mass = soa.mass[i];
+				const float diffx = soa.x[i] - frame.attractor.x;
+				const float diffy = soa.y[i] - frame.attractor.y;
+				const float dist = std::sqrt((diffx * diffx) + (diffy * diffy));
+
+				sums[DIAGNOSTICS_MASS] += mass;
+				sums[DIAGNOSTICS_MASS_X] += mass * soa.x[i];
+				sums[DIAGNOSTICS_MASS_Y] += mass * soa.y[i];
+				sums[DIAGNOSTICS_MOMENTUM_X] += mass * soa.vx[i];
+				sums[DIAGNOSTICS_MOMENTUM_Y] += mass * soa.vy[i];
+				sums[DIAGNOSTICS_MASS_SPEED2] += mass * ((soa.vx[i] * soa.vx[i]) + (soa.vy[i] * soa.vy[i]));
+				sums[DIAGNOSTICS_POTENTIAL] += getAttractorPotential(dist, frame.attractorStrength);
+				sums[DIAGNOSTICS_ANGULAR] += mass * ((diffx * soa.vy[i]) - (diffy * soa.vx[i]));
+				const float bin = dist * binScale;
+				++chunkBins[(bin < (float)(DIAGNOSTICS_BINS - 1)) ? (size_t)bin : (DIAGNOSTICS_BINS - 1)];
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t k = 0; k < DIAGNOSTICS_MOMENT_COUNT; ++k)
+				totals[k] += sums[k];
+			for (size_t i = 0; i < DIAGNOSTICS_BINS; ++i)
+				bins[i] += chunkBins[i];
+		});
+
+	for (size_t k = 0; k < DIAGNOSTICS_MOMENT_COUNT; ++k)
+		slot.result->moments[k] = (float)totals[k];
+	std::copy(bins, bins + DIAGNOSTICS_BINS, slot.result->histogram);
+	endReduce();
+}
+
+// ================================================================================================
+void Diagnostics::reduce(Kernel& reduceKernel, Kernel& finalKernel, cl_mem state, cl_mem frame, size_t pcount,
+	uint64_t step, double time)
+{
+	if (m_source != READBACK_OPENCL)
+		throw std::runtime_error("Cannot reduce OpenCL memory into these diagnostics.");
+
+	slot_t& slot = beginReduce(step, time);
+	const cl_uint zero = 0;
+	CL_CHECK_FATAL(clEnqueueFillBuffer(g_clCommandQueue, m_resultMem, &zero, sizeof(zero),
+		offsetof(DiagnosticsResult, histogram), sizeof(slot.result->histogram), 0, nullptr, nullptr),
+		"Could not clear the diagnostics histogram");
+
+	const cl_uint count = (cl_uint)pcount;
+	const cl_uint lanes = DIAGNOSTICS_LANES;
+	reduceKernel.setKernelArgument(0, sizeof(state), &state);
+	reduceKernel.setKernelArgument(1, sizeof(count), &count);
+	reduceKernel.setKernelArgument(2, sizeof(frame), &frame);
+	reduceKernel.setKernelArgument(3, sizeof(m_binScale), &m_binScale);
+	reduceKernel.setKernelArgument(4, sizeof(m_partialsMem), &m_partialsMem);
+	reduceKernel.setKernelArgument(5, sizeof(m_resultMem), &m_resultMem);
+	finalKernel.setKernelArgument(0, sizeof(m_partialsMem), &m_partialsMem);
+	finalKernel.setKernelArgument(1, sizeof(lanes), &lanes);
+	finalKernel.setKernelArgument(2, sizeof(m_resultMem), &m_resultMem);
+
+	// Nothing is waited for here, the in order queue runs both passes before the read of the result, and only that
+	// read is waited for when the slot is collected
+	size_t global[1] = { DIAGNOSTICS_LANES };
+	reduceKernel.enqueueNDRange(1, global);
+	global[0] = DIAGNOSTICS_MOMENT_COUNT;
+	finalKernel.enqueueNDRange(1, global);
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_resultMem, CL_FALSE, 0, sizeof(DiagnosticsResult),
+		slot.result, 0, nullptr, &slot.event), "Could not read back the diagnostics");
+	clFlush(g_clCommandQueue);
+	endReduce();
+}
+
+// ================================================================================================
+void Diagnostics::reduce(const VertexBuffer *state, size_t pcount, uint64_t step, double time)
+{
+	if (m_source != READBACK_OPENGL)
+		throw std::runtime_error("Cannot reduce an OpenGL buffer into these diagnostics.");
+
+	slot_t& slot = beginReduce(step, time);
+	const GLuint zero = 0;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer->getVboName());
+	glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI, offsetof(DiagnosticsResult, histogram),
+		sizeof(slot.result->histogram), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, state->getVboName());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_partialsBuffer->getVboName());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, slot.buffer->getVboName());
+	m_reduceCompute->bind();
+	m_reduceCompute->setUniform("Count", (unsigned int)pcount);
+	m_reduceCompute->dispatch(DIAGNOSTICS_LANES);
+	m_reduceCompute->release();
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	m_finalCompute->bind();
+	m_finalCompute->dispatch(DIAGNOSTICS_MOMENT_COUNT);
+	m_finalCompute->release();
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	endReduce();
+}
+
+// ================================================================================================
+Diagnostics::slot_t& Diagnostics::beginReduce(uint64_t step, double time)
+{
+	if (m_inFlight == DIAGNOSTICS_LATENCY)
+		collect(true);
+
+	slot_t& slot = m_ring[(m_oldest + m_inFlight) % DIAGNOSTICS_LATENCY];
+	slot.step = step;
+	slot.time = time;
+	return slot;
+}
+
+// ================================================================================================
+void Diagnostics::endReduce()
+{
+	++m_inFlight;
+	while (m_inFlight && collect(false)) {}
+	if (m_lines.size() >= DiagnosticsBlockBytes)
+		flush();
+}
+
+// ================================================================================================
+bool Diagnostics::collect(bool wait)
+{
+	slot_t& slot = m_ring[m_oldest];
+
+	if (slot.event) {
+		if (wait) {
+			CL_CHECK_FATAL(clWaitForEvents(1, &slot.event), "Could not wait for a diagnostics readback");
+		}
+		cl_int status = CL_QUEUED;
+		CL_CHECK_FATAL(clGetEventInfo(slot.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status,
+			nullptr), "Could not query a diagnostics readback");
+		if (status < 0)
+			throw std::runtime_error("Could not read back the diagnostics.");
+		if (status != CL_COMPLETE)
+			return false;
+		clReleaseEvent(slot.event);
+		slot.event = nullptr;
+	}
+	else if (slot.fence) {
+		const GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+			wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		if (status == GL_WAIT_FAILED)
+			throw std::runtime_error("Could not wait for a diagnostics readback.");
+	}
+
+	if (slot.buffer) {
+		DiagnosticsResult result;
+		const void *mapped = slot.buffer->mapBufferRange(GL_MAP_READ_BIT, 0, sizeof(result));
+		memcpy(&result, mapped, sizeof(result));
+		slot.buffer->unmapBuffer();
+		m_latest = makeDiagnosticsSample(result, slot.step, slot.time);
+	}
+	else {
+		m_latest = makeDiagnosticsSample(*slot.result, slot.step, slot.time);
+	}
+	m_hasLatest = true;
+	m_oldest = (m_oldest + 1) % DIAGNOSTICS_LATENCY;
+	--m_inFlight;
+
+	char row[512];
+	const DiagnosticsSample& s = m_latest;
+	snprintf(row, sizeof(row), "%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g",
+		(unsigned long long)s.step, s.time, s.mass, s.kinetic, s.potential, s.kinetic + s.potential, s.momentum[0],
+		s.momentum[1], s.angularMomentum, s.centerOfMass[0], s.centerOfMass[1], s.velocityDispersion);
+	m_lines += row;
+	for (size_t i = 0; i < DIAGNOSTICS_BINS; ++i)
+		m_lines += "," + std::to_string(s.histogram[i]);
+	m_lines += "\n";
+	return true;
+}
+
+// ================================================================================================
+void Diagnostics::flush()
+{
+	if (m_lines.empty() || m_failed)
+		return;
+
+	// Rows are written in order, each job waits for the one before it
+	auto block = std::make_shared<std::string>();
+	block->swap(m_lines);
+	m_writeJob = g_jobs->submit([this, block]() {
+		if (m_failed)
+			return;
+		m_file << *block;
+		m_file.flush();
+		if (!m_file) {
+			m_failed = true;
+			std::cerr << "Diagnostics Error: \"Could not write a block of rows\"." << std::endl;
+		}
+	}, { m_writeJob });
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "gpu.hpp"
+#include "jobs.hpp"
+#include "kernel.hpp"
+#include "readback.hpp"
+#include "shader.hpp"
+#include "vbo.hpp"
+
+
+class CpuSolver;
+struct FrameParams;
+
+
+// Reductions in flight at once, the oldest is only waited for when all of them are
+#define DIAGNOSTICS_LATENCY 2
+// Partial sums of the first reduction pass, each lane strides over the state so the pass does not depend on the
+// particle count
+#define DIAGNOSTICS_LANES 4096
+// Bins of the radial density histogram, the last one also counts everything beyond the range
+#define DIAGNOSTICS_BINS 64
+
+
+// Sums over all particles, in the order the reduction kernels write them. Positions and angles are relative to the
+// attractor, which is the centre every force is computed from.
+enum DiagnosticsMoment :
+	uint32_t
+{
+	DIAGNOSTICS_MASS = 0,
+	DIAGNOSTICS_MASS_X = 1,			// Mass weighted positions, for the centre of mass
+	DIAGNOSTICS_MASS_Y = 2,
+	DIAGNOSTICS_MOMENTUM_X = 3,
+	DIAGNOSTICS_MOMENTUM_Y = 4,
+	DIAGNOSTICS_MASS_SPEED2 = 5,	// Twice the kinetic energy
+	DIAGNOSTICS_POTENTIAL = 6,
+	DIAGNOSTICS_ANGULAR = 7,		// Angular momentum around the attractor
+	DIAGNOSTICS_MOMENT_COUNT
+};
+
+// What a reduction reads back, in the layout of the device result buffers
+struct DiagnosticsResult
+{
+	float moments[DIAGNOSTICS_MOMENT_COUNT];
+	uint32_t histogram[DIAGNOSTICS_BINS];	// Particles by distance to the attractor
+};
+static_assert(sizeof(DiagnosticsResult) == 4 * (DIAGNOSTICS_MOMENT_COUNT + DIAGNOSTICS_BINS),
+	"DiagnosticsResult must match the layout of the reduction kernels");
+
+// One entry of the diagnostics time series
+struct DiagnosticsSample
+{
+	uint64_t step;
+	double time;
+	double mass;
+	double kinetic;
+	double potential;
+	double momentum[2];
+	double angularMomentum;
+	double centerOfMass[2];
+	double velocityDispersion;		// Mass weighted, around the mean velocity
+	uint32_t histogram[DIAGNOSTICS_BINS];
+};
+
+
+// The potential energy of a particle at a distance from the attractor. The attractor pulls with strength * r / (r+1)^3
+// whatever the mass, so this is the same for every particle.
+inline float getAttractorPotential(float distance, float strength)
+{
+	const float difflen = distance + 1.0f;
+	return strength * ((0.5f / (difflen * difflen)) - (1.0f / difflen));
+}
+
+
+// Monitors a run without reading the state back. Every interval steps, reduction kernels sum the energies, momenta
+// and mass moments of the state where it lives, and bin the particles by their distance to the attractor, so only a
+// result of a few hundred bytes leaves the device. The results are read back without stalling like the tracer
+// samples, and the time series is written to a CSV file on the job system.
+class Diagnostics
+{
+	struct slot_t
+	{
+		DiagnosticsResult *result;	// Host result, pinned OpenCL mapping, or nullptr for OpenGL
+		cl_mem pinnedMem;			// READBACK_OPENCL
+		cl_event event;
+		VertexBuffer *buffer;		// READBACK_OPENGL, written by the reduction shaders
+		GLsync fence;
+		uint64_t step;
+		double time;
+	};
+
+private:
+	const ReadbackSource m_source;
+	const uint32_t m_interval;
+	const float m_binScale;				// Bins per unit of distance
+	cl_mem m_partialsMem;				// READBACK_OPENCL
+	cl_mem m_resultMem;
+	VertexBuffer *m_partialsBuffer;		// READBACK_OPENGL
+	ComputeShader *m_reduceCompute;
+	ComputeShader *m_finalCompute;
+	slot_t m_ring[DIAGNOSTICS_LATENCY];
+	size_t m_oldest;
+	size_t m_inFlight;
+	DiagnosticsSample m_latest;
+	bool m_hasLatest;
+	std::ofstream m_file;
+	std::string m_lines;				// Rows that have not been handed to a write job yet
+	JobHandle m_writeJob;
+	std::atomic<bool> m_failed;
+
+public:
+	// Creates the CSV file and the reduction resources for where the backend keeps its state, throws on failure. The
+	// histogram covers distances up to range.
+	Diagnostics(const char *path, ReadbackSource source, uint32_t interval, float range);
+	// Waits for the reductions in flight, and writes their rows
+	~Diagnostics();
+
+	inline ReadbackSource getSource() const { return m_source; }
+	inline uint32_t getInterval() const { return m_interval; }
+	// If a reduction is due after the step
+	inline bool isDue(uint64_t step) const { return (step % m_interval) == 0; }
+	// The newest entry of the time series, valid once hasLatest is true
+	inline bool hasLatest() const { return m_hasLatest; }
+	inline const DiagnosticsSample& getLatest() const { return m_latest; }
+
+	// Starts a reduction of the state after a step, with the frame it was solved with. The kernels are the Reduce and
+	// ReduceFinal kernels of the simulation program, and frame the device copy of the frame parameters. The OpenGL
+	// state has to be written by a dispatch before a storage barrier, with the frame uniforms still bound.
+	void reduce(const CpuSolver& solver, const FrameParams& frame, uint64_t step, double time);
+	void reduce(Kernel& reduceKernel, Kernel& finalKernel, cl_mem state, cl_mem frame, size_t pcount, uint64_t step,
+		double time);
+	void reduce(const VertexBuffer *state, size_t pcount, uint64_t step, double time);
+
+	Diagnostics(const Diagnostics&) = delete;
+	Diagnostics& operator = (const Diagnostics&) = delete;
+
+private:
+	slot_t& beginReduce(uint64_t step, double time);
+	void endReduce();
+	// Turns the oldest reduction into a row, returns false if it has not arrived and wait is not set
+	bool collect(bool wait);
+	void flush();
+};
+
+
+// Derives the time series entry from the sums of a reduction
+DiagnosticsSample makeDiagnosticsSample(const DiagnosticsResult& result, uint64_t step, double time);
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "fastmath.hpp"
+#include "cpusolver.hpp"
+#include "gpu.hpp"
+#include "kernel.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+
+// Per-element benchmark kernels, Repeat > 1 accumulates extra evaluations so timings are not bandwidth bound
+static const char * const FastMathBenchSource = R"(
+	__kernel void BenchAtan2(__global const float * y, __global const float * x, __global float * out, const int Repeat)
+	{
+		const int IDX = get_global_id(0);
+		float r = fm_atan2(y[IDX], x[IDX]);
+		for (int i = 1; i < Repeat; ++i)
+			r += fm_atan2(y[IDX], x[IDX] + (float)i * 1e-3f) * 1e-9f;
+		out[IDX] = r;
+	}
+
+	__kernel void BenchSin(__global const float * y, __global const float * x, __global float * out, const int Repeat)
+	{
+		const int IDX = get_global_id(0);
+		float r = fm_sin(x[IDX]);
+		for (int i = 1; i < Repeat; ++i)
+			r += fm_sin(x[IDX] + (float)i * 1e-3f) * 1e-9f;
+		out[IDX] = r;
+	}
+
+	__kernel void BenchCos(__global const float * y, __global const float * x, __global float * out, const int Repeat)
+	{
+		const int IDX = get_global_id(0);
+		float r = fm_cos(x[IDX]);
+		for (int i = 1; i < Repeat; ++i)
+			r += fm_cos(x[IDX] + (float)i * 1e-3f) * 1e-9f;
+		out[IDX] = r;
+	}
+)";
+
+static const char * const FastMathFuncNames[FASTMATH_FUNC_COUNT] = { "atan2", "sin", "cos" };
+static const char * const FastMathBenchKernels[FASTMATH_FUNC_COUNT] = { "BenchAtan2", "BenchSin", "BenchCos" };
+
+
+// ================================================================================================
+const char* getFastMathTierName(int tier)
+{
+	switch (tier)
+	{
+	case FASTMATH_PRECISE: return "precise";
+	case FASTMATH_ACCURATE: return "accurate";
+	case FASTMATH_FAST: return "fast";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+// Writes a float literal in full precision, which needs a decimal point or exponent before the suffix
+static void writeFloatLiteral(std::ostream& out, float value)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%.9g", value);
+	out << text << (strpbrk(text, ".e") ? "f" : ".0f");
+}
+
+// ================================================================================================
+// Writes a polynomial as nested mad() (or GLSL fma()) calls in the coefficient's full float precision
+static void writePolynomial(std::ostream& out, const float *coeffs, unsigned int terms, FastMathLanguage language)
+{
+	const char *mad = (language == FASTMATH_LANGUAGE_GLSL) ? "fma(s, " : "mad(s, ";
+	for (unsigned int i = 0; i < terms - 1; ++i)
+		out << mad;
+	writeFloatLiteral(out, coeffs[terms - 1]);
+	for (int i = (int)terms - 2; i >= 0; --i) {
+		out << ", ";
+		writeFloatLiteral(out, coeffs[i]);
+		out << ")";
+	}
+}
+
+// ================================================================================================
+std::string buildFastMathSource(int tier, FastMathLanguage language)
+{
+	const bool glsl = (language == FASTMATH_LANGUAGE_GLSL);
+	std::ostringstream out;
+	out << "#define FASTMATH_TIER " << tier << "\n";
+	out << "float fm_cube(float x) { return x * x * x; }\n";
+
+	if (tier == FASTMATH_PRECISE) {
+		out << (glsl ? "float fm_atan2(float y, float x) { return atan(y, x); }\n"
+			: "float fm_atan2(float y, float x) { return atan2(y, x); }\n");
+		out << "float fm_sin(float x) { return sin(x); }\n";
+		out << "float fm_cos(float x) { return cos(x); }\n";
+		return out.str();
+	}
+
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[tier];
+	char constants[512];
+	snprintf(constants, sizeof(constants),
+		"#define FM_HALF_PI %.9gf\n#define FM_PI %.9gf\n#define FM_INV_TWO_PI %.9gf\n"
+		"#define FM_TWO_PI_HI %.9gf\n#define FM_TWO_PI_LO %.9gf\n",
+		FASTMATH_HALF_PI, FASTMATH_PI, FASTMATH_INV_TWO_PI, FASTMATH_TWO_PI_HI, FASTMATH_TWO_PI_LO);
+	out << constants;
+
+	out << "float fm_atan_poly(float s) { return ";
+	writePolynomial(out, coeffs.atan, coeffs.atanTerms, language);
+	out << "; }\n";
+	out << "float fm_sin_poly(float s) { return ";
+	writePolynomial(out, coeffs.sin, coeffs.sinTerms, language);
+	out << "; }\n";
+
+	// GLSL has no copysign, so the sign bit of y is copied directly
+	if (glsl) {
+		out << R"(
+	float fm_atan2(float y, float x)
+	{
+		const float ax = abs(x);
+		const float ay = abs(y);
+		const float a = min(ax, ay) / max(max(ax, ay), 1e-30f);
+		float r = a * fm_atan_poly(a * a);
+		r = (ay > ax) ? (FM_HALF_PI - r) : r;
+		r = (x < 0.0f) ? (FM_PI - r) : r;
+		return uintBitsToFloat(floatBitsToUint(r) | (floatBitsToUint(y) & 0x80000000u));
+	}
+
+	float fm_sin(float x)
+	{
+		const float k = roundEven(x * FM_INV_TWO_PI);
+		x = fma(-k, FM_TWO_PI_HI, x);
+		x = fma(-k, FM_TWO_PI_LO, x);
+		x = (x > FM_HALF_PI) ? (FM_PI - x) : x;
+		x = (x < -FM_HALF_PI) ? (-FM_PI - x) : x;
+		return x * fm_sin_poly(x * x);
+	}
+
+	float fm_cos(float x)
+	{
+		return fm_sin(x + FM_HALF_PI);
+	}
+)";
+		return out.str();
+	}
+
+	out << R"(
+	float fm_atan2(float y, float x)
+	{
+		const float ax = fabs(x);
+		const float ay = fabs(y);
+		const float a = fmin(ax, ay) / fmax(fmax(ax, ay), 1e-30f);
+		float r = a * fm_atan_poly(a * a);
+		r = (ay > ax) ? (FM_HALF_PI - r) : r;
+		r = (x < 0.0f) ? (FM_PI - r) : r;
+		return copysign(r, y);
+	}
+
+	float fm_sin(float x)
+	{
+		const float k = rint(x * FM_INV_TWO_PI);
+		x = mad(-k, FM_TWO_PI_HI, x);
+		x = mad(-k, FM_TWO_PI_LO, x);
+		x = (x > FM_HALF_PI) ? (FM_PI - x) : x;
+		x = (x < -FM_HALF_PI) ? (-FM_PI - x) : x;
+		return x * fm_sin_poly(x * x);
+	}
+
+	float fm_cos(float x)
+	{
+		return fm_sin(x + FM_HALF_PI);
+	}
+)";
+
+	return out.str();
+}
+
+
+// ================================================================================================
+template <int Tier>
+static void fm_evaluate_tier_scalar(FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		switch (func) {
+		case FASTMATH_FUNC_ATAN2: out[i] = fm_atan2<Tier>(y[i], x[i]); break;
+		case FASTMATH_FUNC_SIN: out[i] = fm_sin<Tier>(x[i]); break;
+		case FASTMATH_FUNC_COS: out[i] = fm_cos<Tier>(x[i]); break;
+		default: break;
+		}
+	}
+}
+
+// ================================================================================================
+void fm_evaluate_scalar(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count)
+{
+	switch (tier) {
+	case FASTMATH_PRECISE: fm_evaluate_tier_scalar<FASTMATH_PRECISE>(func, y, x, out, count); break;
+	case FASTMATH_ACCURATE: fm_evaluate_tier_scalar<FASTMATH_ACCURATE>(func, y, x, out, count); break;
+	case FASTMATH_FAST: fm_evaluate_tier_scalar<FASTMATH_FAST>(func, y, x, out, count); break;
+	default: break;
+	}
+}
+
+
+// ================================================================================================
+// Maximum absolute error of a set of results against double precision libm
+static double measureMaxError(FastMathFunc func, const float *y, const float *x, const float *out, size_t count)
+{
+	double maxerr = 0.0;
+	for (size_t i = 0; i < count; ++i) {
+		double ref;
+		switch (func) {
+		case FASTMATH_FUNC_ATAN2: ref = std::atan2((double)y[i], (double)x[i]); break;
+		case FASTMATH_FUNC_SIN: ref = std::sin((double)x[i]); break;
+		default: ref = std::cos((double)x[i]); break;
+		}
+		maxerr = std::fmax(maxerr, std::fabs(ref - (double)out[i]));
+	}
+	return maxerr;
+}
+
+// ================================================================================================
+static void printBenchmarkResult(const char *target, FastMathFunc func, int tier, double nsPerElement, double maxerr)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "  %-8s %-6s %-9s %8.3f ns/elem   max error %.2e",
+		target, FastMathFuncNames[func], getFastMathTierName(tier), nsPerElement, maxerr);
+	std::cout << line << std::endl;
+}
+
+// ================================================================================================
+static void benchmarkDevice(const std::vector<float>& aty, const std::vector<float>& atx,
+	const std::vector<float>& angles)
+{
+	const size_t count = atx.size();
+	const size_t bytes = count * sizeof(float);
+	const int TIMED_REPEAT = 64;
+
+	cl_int clerr;
+	cl_mem inputs[3], outbuf;
+	const std::vector<float> *inputdata[3] = { &aty, &atx, &angles };
+	for (int i = 0; i < 3; ++i) {
+		CL_CHECK_RETURN_FATAL(inputs[i] = clCreateBuffer(g_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes,
+			(void*)inputdata[i]->data(), &clerr), clerr, inputs[i], "Could not create the benchmark input buffer");
+	}
+	CL_CHECK_RETURN_FATAL(outbuf = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY, bytes, nullptr, &clerr),
+		clerr, outbuf, "Could not create the benchmark output buffer");
+
+	char devname[256] = {};
+	clGetDeviceInfo(g_clDevice, CL_DEVICE_NAME, sizeof(devname) - 1, devname, nullptr);
+	std::cout << "OpenCL device: " << devname << std::endl;
+
+	std::vector<float> out(count);
+	for (int tier = 0; tier < FASTMATH_TIER_COUNT; ++tier) {
+		const std::string source = buildFastMathSource(tier) + FastMathBenchSource;
+		cl_program program = buildProgram(source.c_str());
+
+		for (int f = 0; f < FASTMATH_FUNC_COUNT; ++f) {
+			const bool isatan = (f == FASTMATH_FUNC_ATAN2);
+			const std::vector<float>& y = aty;
+			const std::vector<float>& x = isatan ? atx : angles;
+
+			Kernel kernel(program, FastMathBenchKernels[f]);
+			kernel.setKernelArgument(0, sizeof(cl_mem), &inputs[0]);
+			kernel.setKernelArgument(1, sizeof(cl_mem), isatan ? &inputs[1] : &inputs[2]);
+			kernel.setKernelArgument(2, sizeof(cl_mem), &outbuf);
+
+			// Accuracy from a single evaluation per element
+			int repeat = 1;
+			kernel.setKernelArgument(3, sizeof(int), &repeat);
+			kernel.executeNDRange(1, &count, true);
+			CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, outbuf, CL_TRUE, 0, bytes, out.data(), 0, nullptr, nullptr),
+				"Could not read the benchmark results");
+			const double maxerr = measureMaxError((FastMathFunc)f, y.data(), x.data(), out.data(), count);
+
+			// Timing from the profiling event, best of several runs
+			repeat = TIMED_REPEAT;
+			kernel.setKernelArgument(3, sizeof(int), &repeat);
+			double bestns = 1e30;
+			for (int run = 0; run < 5; ++run) {
+				cl_event evt;
+				kernel.executeNDRange(1, &count, true, &evt);
+				cl_ulong start = 0, end = 0;
+				clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+				clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+				clReleaseEvent(evt);
+				bestns = std::fmin(bestns, (double)(end - start));
+			}
+
+			printBenchmarkResult("device", (FastMathFunc)f, tier, bestns / ((double)count * TIMED_REPEAT), maxerr);
+		}
+
+		clReleaseProgram(program);
+	}
+
+	for (int i = 0; i < 3; ++i)
+		clReleaseMemObject(inputs[i]);
+	clReleaseMemObject(outbuf);
+}
+
+// ================================================================================================
+void run_fastmath_benchmark()
+{
+	typedef void (*evaluate_func_t)(int, FastMathFunc, const float*, const float*, float*, size_t);
+	const size_t COUNT = 1 << 20;
+
+	// atan2 is measured over all four quadrants, sin/cos over the [-pi, pi] range the error bounds are quoted for
+	std::mt19937 rng(5489u);
+	std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> angle(-FASTMATH_PI, FASTMATH_PI);
+	std::vector<float> aty(COUNT), atx(COUNT), angles(COUNT), unused(COUNT, 0.0f), out(COUNT);
+	for (size_t i = 0; i < COUNT; ++i) {
+		aty[i] = coord(rng);
+		atx[i] = coord(rng);
+		angles[i] = angle(rng);
+	}
+
+	std::cout << "Fast math benchmark (" << COUNT << " elements, build tier '"
+		<< getFastMathTierName(P50K_FASTMATH_TIER) << "')" << std::endl;
+
+	const CpuSolver::Isa hostIsa = CpuSolver::DetectIsa();
+	for (int isa = CpuSolver::ISA_SCALAR; isa <= hostIsa; ++isa) {
+		const evaluate_func_t evaluate = (isa == CpuSolver::ISA_AVX512) ? fm_evaluate_avx512 :
+			((isa == CpuSolver::ISA_AVX2) ? fm_evaluate_avx2 : fm_evaluate_scalar);
+
+		for (int f = 0; f < FASTMATH_FUNC_COUNT; ++f) {
+			const FastMathFunc func = (FastMathFunc)f;
+			const float *y = (func == FASTMATH_FUNC_ATAN2) ? aty.data() : unused.data();
+			const float *x = (func == FASTMATH_FUNC_ATAN2) ? atx.data() : angles.data();
+
+			for (int tier = 0; tier < FASTMATH_TIER_COUNT; ++tier) {
+				double bestns = 1e30;
+				for (int run = 0; run < 5; ++run) {
+					const auto start = std::chrono::steady_clock::now();
+					evaluate(tier, func, y, x, out.data(), COUNT);
+					const auto end = std::chrono::steady_clock::now();
+					bestns = std::fmin(bestns, std::chrono::duration<double, std::nano>(end - start).count());
+				}
+
+				printBenchmarkResult(CpuSolver::GetIsaName((CpuSolver::Isa)isa), func, tier, bestns / COUNT,
+					measureMaxError(func, y, x, out.data(), COUNT));
+			}
+		}
+	}
+
+	if (g_clContext)
+		benchmarkDevice(aty, atx, angles);
+}
\ No newline at end of file
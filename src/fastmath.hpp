@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+
+// Precision tiers of the fast math library. The kernels and the host solver use P50K_FASTMATH_TIER, which is chosen
+// at build time. Maximum absolute errors, as measured by --bench-math over all quadrants for atan2 and [-pi, pi]
+// for sin/cos, are:
+//   FASTMATH_PRECISE  - The builtin/libm functions. The SIMD paths have no vector libm, and use ACCURATE instead.
+//   FASTMATH_ACCURATE - atan2 2e-6 rad, sin/cos 2e-7
+//   FASTMATH_FAST     - atan2 6e-4 rad, sin/cos 7e-5
+// Arguments to sin/cos are reduced to [-pi, pi] first, so larger arguments add ~2e-8 * |x| of reduction error.
+#define FASTMATH_PRECISE 0
+#define FASTMATH_ACCURATE 1
+#define FASTMATH_FAST 2
+#define FASTMATH_TIER_COUNT 3
+#ifndef P50K_FASTMATH_TIER
+#	define P50K_FASTMATH_TIER FASTMATH_ACCURATE
+#endif
+
+
+// Minimax polynomial coefficients for one precision tier, shared by the host code and the OpenCL kernels.
+// atan(a) = a * P(a^2) on [0, 1], and sin(x) = x * P(x^2) on [-pi/2, pi/2], with the constant term first.
+struct fastmath_coeffs_t
+{
+	unsigned int atanTerms;
+	float atan[6];
+	unsigned int sinTerms;
+	float sin[6];
+};
+
+static const fastmath_coeffs_t FASTMATH_COEFFS[FASTMATH_TIER_COUNT] = {
+	// PRECISE (only used by the SIMD paths)
+	{ 6, { 0.999977222f, -0.332622853f, 0.19354044f, -0.116426524f, 0.0526473226f, -0.0117191065f },
+	  5, { 0.999999977f, -0.166666476f, 0.00833289979f, -0.000198008958f, 2.59048488e-06f, 0.0f } },
+	// ACCURATE
+	{ 6, { 0.999977222f, -0.332622853f, 0.19354044f, -0.116426524f, 0.0526473226f, -0.0117191065f },
+	  5, { 0.999999977f, -0.166666476f, 0.00833289979f, -0.000198008958f, 2.59048488e-06f, 0.0f } },
+	// FAST
+	{ 3, { 0.995357987f, -0.288689949f, 0.0793386592f, 0.0f, 0.0f, 0.0f },
+	  3, { 0.999696825f, -0.165673151f, 0.0075143986f, 0.0f, 0.0f, 0.0f } }
+};
+
+// Constants used by the argument reduction, with 2*pi split in two for Cody-Waite reduction
+#define FASTMATH_HALF_PI 1.57079637f
+#define FASTMATH_PI 3.14159274f
+#define FASTMATH_INV_TWO_PI 0.159154937f
+#define FASTMATH_TWO_PI_HI 6.28318548f
+#define FASTMATH_TWO_PI_LO -1.74845553e-7f
+
+
+// Device languages the library can be generated for
+enum FastMathLanguage :
+	unsigned char
+{
+	FASTMATH_LANGUAGE_OPENCL = 0,
+	FASTMATH_LANGUAGE_GLSL = 1		// GLSL 4.30, for compute shaders
+};
+
+const char* getFastMathTierName(int tier);
+
+// Generates the source that defines fm_atan2, fm_sin, fm_cos and fm_cube for the tier, which must be prepended to
+// any kernel source that uses them. GLSL sources start after the #version line.
+std::string buildFastMathSource(int tier, FastMathLanguage language = FASTMATH_LANGUAGE_OPENCL);
+
+
+// ================================================================================================
+// Host scalar implementations of the same algorithms as the OpenCL and SIMD versions
+inline float fm_poly(const float *coeffs, unsigned int terms, float s)
+{
+	float r = coeffs[terms - 1];
+	for (int i = (int)terms - 2; i >= 0; --i)
+		r = (r * s) + coeffs[i];
+	return r;
+}
+
+template <int Tier>
+inline float fm_atan2(float y, float x)
+{
+	if (Tier == FASTMATH_PRECISE)
+		return std::atan2(y, x);
+
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const float ax = std::fabs(x);
+	const float ay = std::fabs(y);
+	const float a = std::fmin(ax, ay) / std::fmax(std::fmax(ax, ay), 1e-30f);
+	float r = a * fm_poly(coeffs.atan, coeffs.atanTerms, a * a);
+	r = (ay > ax) ? (FASTMATH_HALF_PI - r) : r;
+	r = (x < 0) ? (FASTMATH_PI - r) : r;
+	return std::copysign(r, y);
+}
+
+template <int Tier>
+inline float fm_sin(float x)
+{
+	if (Tier == FASTMATH_PRECISE)
+		return std::sin(x);
+
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const float k = std::nearbyint(x * FASTMATH_INV_TWO_PI);
+	x = x - (k * FASTMATH_TWO_PI_HI);
+	x = x - (k * FASTMATH_TWO_PI_LO);
+	x = (x > FASTMATH_HALF_PI) ? (FASTMATH_PI - x) : x;
+	x = (x < -FASTMATH_HALF_PI) ? (-FASTMATH_PI - x) : x;
+	return x * fm_poly(coeffs.sin, coeffs.sinTerms, x * x);
+}
+
+template <int Tier>
+inline float fm_cos(float x)
+{
+	if (Tier == FASTMATH_PRECISE)
+		return std::cos(x);
+	return fm_sin<Tier>(x + FASTMATH_HALF_PI);
+}
+
+inline float fm_cube(float x)
+{
+	return x * x * x;
+}
+
+
+// ================================================================================================
+// Array evaluation of the library functions for each instruction set, used to benchmark the tiers. For the
+// single argument functions y is ignored. The SIMD versions require count to be a multiple of 16.
+enum FastMathFunc :
+	unsigned char
+{
+	FASTMATH_FUNC_ATAN2 = 0,
+	FASTMATH_FUNC_SIN,
+	FASTMATH_FUNC_COS,
+	FASTMATH_FUNC_COUNT
+};
+
+void fm_evaluate_scalar(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count);
+void fm_evaluate_avx2(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count);
+void fm_evaluate_avx512(int tier, FastMathFunc func, const float *y, const float *x, float *out, size_t count);
+
+// Measures the speed and accuracy of every tier on the host and on the OpenCL device (if initialized)
+void run_fastmath_benchmark();
\ No newline at end of file
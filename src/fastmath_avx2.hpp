@@ -0,0 +1,68 @@
+#pragma once
+
+// AVX2 + FMA versions of the fast math library, only include this from files compiled with AVX2 enabled
+#include <immintrin.h>
+#include "fastmath.hpp"
+
+
+// ================================================================================================
+static inline __m256 fm_poly_avx2(const float *coeffs, unsigned int terms, __m256 s)
+{
+	__m256 r = _mm256_set1_ps(coeffs[terms - 1]);
+	for (int i = (int)terms - 2; i >= 0; --i)
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(coeffs[i]));
+	return r;
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m256 fm_atan2_avx2(__m256 y, __m256 x)
+{
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const __m256 signmask = _mm256_set1_ps(-0.0f);
+	const __m256 absx = _mm256_andnot_ps(signmask, x);
+	const __m256 absy = _mm256_andnot_ps(signmask, y);
+
+	const __m256 hi = _mm256_max_ps(absx, absy);
+	const __m256 lo = _mm256_min_ps(absx, absy);
+	const __m256 a = _mm256_div_ps(lo, _mm256_max_ps(hi, _mm256_set1_ps(1e-30f)));
+	__m256 r = _mm256_mul_ps(a, fm_poly_avx2(coeffs.atan, coeffs.atanTerms, _mm256_mul_ps(a, a)));
+
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(FASTMATH_HALF_PI), r), _mm256_cmp_ps(absy, absx, _CMP_GT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(FASTMATH_PI), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+	return _mm256_or_ps(r, _mm256_and_ps(y, signmask));
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m256 fm_sin_avx2(__m256 x)
+{
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const __m256 signmask = _mm256_set1_ps(-0.0f);
+	const __m256 pi = _mm256_set1_ps(FASTMATH_PI);
+
+	// Reduce to [-pi, pi], then reflect |x| > pi/2 since sin(pi - x) = sin(x)
+	const __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(FASTMATH_INV_TWO_PI)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	x = _mm256_fnmadd_ps(k, _mm256_set1_ps(FASTMATH_TWO_PI_HI), x);
+	x = _mm256_fnmadd_ps(k, _mm256_set1_ps(FASTMATH_TWO_PI_LO), x);
+	const __m256 sign = _mm256_and_ps(x, signmask);
+	__m256 ax = _mm256_andnot_ps(signmask, x);
+	ax = _mm256_blendv_ps(ax, _mm256_sub_ps(pi, ax), _mm256_cmp_ps(ax, _mm256_set1_ps(FASTMATH_HALF_PI), _CMP_GT_OQ));
+	x = _mm256_or_ps(ax, sign);
+
+	return _mm256_mul_ps(x, fm_poly_avx2(coeffs.sin, coeffs.sinTerms, _mm256_mul_ps(x, x)));
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m256 fm_cos_avx2(__m256 x)
+{
+	return fm_sin_avx2<Tier>(_mm256_add_ps(x, _mm256_set1_ps(FASTMATH_HALF_PI)));
+}
+
+// ================================================================================================
+static inline __m256 fm_cube_avx2(__m256 x)
+{
+	return _mm256_mul_ps(_mm256_mul_ps(x, x), x);
+}
\ No newline at end of file
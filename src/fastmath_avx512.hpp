@@ -0,0 +1,66 @@
+#pragma once
+
+// AVX-512F versions of the fast math library, only include this from files compiled with AVX-512 support
+#include <immintrin.h>
+#include "fastmath.hpp"
+
+
+// ================================================================================================
+static inline __m512 fm_poly_avx512(const float *coeffs, unsigned int terms, __m512 s)
+{
+	__m512 r = _mm512_set1_ps(coeffs[terms - 1]);
+	for (int i = (int)terms - 2; i >= 0; --i)
+		r = _mm512_fmadd_ps(r, s, _mm512_set1_ps(coeffs[i]));
+	return r;
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m512 fm_atan2_avx512(__m512 y, __m512 x)
+{
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const __m512 absx = _mm512_abs_ps(x);
+	const __m512 absy = _mm512_abs_ps(y);
+
+	const __m512 hi = _mm512_max_ps(absx, absy);
+	const __m512 lo = _mm512_min_ps(absx, absy);
+	const __m512 a = _mm512_div_ps(lo, _mm512_max_ps(hi, _mm512_set1_ps(1e-30f)));
+	__m512 r = _mm512_mul_ps(a, fm_poly_avx512(coeffs.atan, coeffs.atanTerms, _mm512_mul_ps(a, a)));
+
+	r = _mm512_mask_sub_ps(r, _mm512_cmp_ps_mask(absy, absx, _CMP_GT_OQ), _mm512_set1_ps(FASTMATH_HALF_PI), r);
+	r = _mm512_mask_sub_ps(r, _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ), _mm512_set1_ps(FASTMATH_PI), r);
+	const __m512i sign = _mm512_and_epi32(_mm512_castps_si512(y), _mm512_set1_epi32((int)0x80000000));
+	return _mm512_castsi512_ps(_mm512_or_epi32(_mm512_castps_si512(r), sign));
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m512 fm_sin_avx512(__m512 x)
+{
+	const fastmath_coeffs_t& coeffs = FASTMATH_COEFFS[Tier];
+	const __m512 halfpi = _mm512_set1_ps(FASTMATH_HALF_PI);
+
+	// Reduce to [-pi, pi], then reflect |x| > pi/2 about +-pi/2 since sin(pi - x) = sin(x)
+	const __m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(FASTMATH_INV_TWO_PI)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	x = _mm512_fnmadd_ps(k, _mm512_set1_ps(FASTMATH_TWO_PI_HI), x);
+	x = _mm512_fnmadd_ps(k, _mm512_set1_ps(FASTMATH_TWO_PI_LO), x);
+	x = _mm512_mask_sub_ps(x, _mm512_cmp_ps_mask(x, halfpi, _CMP_GT_OQ), _mm512_set1_ps(FASTMATH_PI), x);
+	x = _mm512_mask_sub_ps(x, _mm512_cmp_ps_mask(x, _mm512_set1_ps(-FASTMATH_HALF_PI), _CMP_LT_OQ),
+		_mm512_set1_ps(-FASTMATH_PI), x);
+
+	return _mm512_mul_ps(x, fm_poly_avx512(coeffs.sin, coeffs.sinTerms, _mm512_mul_ps(x, x)));
+}
+
+// ================================================================================================
+template <int Tier>
+static inline __m512 fm_cos_avx512(__m512 x)
+{
+	return fm_sin_avx512<Tier>(_mm512_add_ps(x, _mm512_set1_ps(FASTMATH_HALF_PI)));
+}
+
+// ================================================================================================
+static inline __m512 fm_cube_avx512(__m512 x)
+{
+	return _mm512_mul_ps(_mm512_mul_ps(x, x), x);
+}
\ No newline at end of file
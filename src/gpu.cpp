@@ -1,5 +1,9 @@
 #include "gpu.hpp"
+#include "playback.hpp"
+#include "profiler.hpp"
 #include <GL\wglew.h>
+#include <cmath>
+#include <cstdarg>
 #include <iostream>
 
 
@@ -16,6 +20,10 @@ cl_context g_clContext = nullptr;
 cl_command_queue g_clCommandQueue = nullptr;
 size_t OPENCL_MAX_WORK_GROUP_SIZE = 0;
 
+// Camera dragging state, the world position that stays under the cursor while the left mouse button is held
+static bool g_cameraDragging = false;
+static glm::vec2 g_cameraDragAnchor{0, 0};
+
 
 void _glfw_error_callback(int err, const char *errstr)
 {
@@ -27,53 +35,126 @@ void _glfw_resize_callback(GLFWwindow *win, int width, int height)
 	const float xscale = width / 1080.0f;
 	const float yscale = height / 1080.0f;
 	g_camera->onResize(-2.5f * xscale, 2.5f * yscale, 2.5f * xscale, -2.5f * yscale);
-	glViewport(0, 0, width, height);
+	if (glfwGetWindowAttrib(win, GLFW_CLIENT_API) != GLFW_NO_API)
+		glViewport(0, 0, width, height);
 }
 
-
-const char *clGetErrorString(cl_int);
-bool _clCheckError(cl_int err, const char *file, unsigned int line, const std::string& msg, bool fatal)
+void _glfw_key_callback(GLFWwindow *win, int key, int scancode, int action, int mods)
 {
-	if (err) {
-		std::cerr << "OpenCL error | " << file << "(" << line << ") : (" << err << ")'" 
-				<< clGetErrorString(err) << "'." << std::endl;
-		if (fatal)
-			throw std::runtime_error(msg);
-		else
-			std::cerr << "  Error message: '" << msg << "'." << std::endl;
-		return true;
+	if (action != GLFW_PRESS)
+		return;
+
+	switch (key)
+	{
+	case GLFW_KEY_F2: g_profiler.setEnabled(!g_profiler.isEnabled()); break;
+	case GLFW_KEY_F3: g_profiler.requestDump(); break;
+	case GLFW_KEY_F4: g_trace.setEnabled(!g_trace.isEnabled()); break;
+	case GLFW_KEY_HOME: g_camera->reset(); break;
+	default:
+		if (g_playback)
+			g_playback->onKey(key);
+		break;
 	}
-	return false;
 }
 
-void initialize_gl()
+glm::vec2 _glfw_cursor_world_position(GLFWwindow *win)
+{
+	double x, y;
+	int width, height;
+	glfwGetCursorPos(win, &x, &y);
+	glfwGetWindowSize(win, &width, &height);
+	return g_camera->windowToWorld(x, y, width, height);
+}
+
+void _glfw_mouse_button_callback(GLFWwindow *win, int button, int action, int mods)
+{
+	if (button != GLFW_MOUSE_BUTTON_LEFT)
+		return;
+
+	g_cameraDragging = (action == GLFW_PRESS);
+	if (g_cameraDragging)
+		g_cameraDragAnchor = _glfw_cursor_world_position(win);
+}
+
+void _glfw_cursor_pos_callback(GLFWwindow *win, double x, double y)
+{
+	if (g_cameraDragging)
+		g_camera->pan(g_cameraDragAnchor - _glfw_cursor_world_position(win));
+}
+
+void _glfw_scroll_callback(GLFWwindow *win, double xoffset, double yoffset)
+{
+	g_camera->zoom(std::pow(1.15f, (float)yoffset), _glfw_cursor_world_position(win));
+}
+
+
+bool _clReportError(cl_int err, const char *file, unsigned int line, bool fatal, const char *msg, ...)
+{
+	char outstr[1024];
+	va_list args;
+	va_start(args, msg);
+	vsnprintf(outstr, 1024, msg, args);
+	va_end(args);
+
+	std::cerr << "OpenCL error | " << file << "(" << line << ") : (" << err << ")'" 
+			<< clGetErrorString(err) << "'." << std::endl;
+	if (fatal)
+		throw std::runtime_error(outstr);
+	else
+		std::cerr << "  Error message: '" << outstr << "'." << std::endl;
+	return true;
+}
+
+bool _clThrowError(cl_int err, const char *file, unsigned int line)
+{
+	std::stringstream ss;
+	ss << "OpenCL error '" << clGetErrorString(err) << "' (" << err << ") at " << file << "(" << line << ")";
+	throw std::runtime_error(ss.str());
+}
+
+// Creates the window and the camera, with the context type set up by the window hints
+static void create_window(const char *error)
+{
+	glfwWindowHint(GLFW_REFRESH_RATE, 60);
+	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+
+	g_windowPtr = glfwCreateWindow(1000, 1000, "P50K", nullptr, nullptr);
+	if (!g_windowPtr)
+		throw std::runtime_error(error);
+
+	glfwSetWindowSizeCallback(g_windowPtr, _glfw_resize_callback);
+	glfwSetKeyCallback(g_windowPtr, _glfw_key_callback);
+	glfwSetMouseButtonCallback(g_windowPtr, _glfw_mouse_button_callback);
+	glfwSetCursorPosCallback(g_windowPtr, _glfw_cursor_pos_callback);
+	glfwSetScrollCallback(g_windowPtr, _glfw_scroll_callback);
+
+	g_camera = new Camera(-2.5f, 2.5f, 2.5f, -2.5f);
+}
+
+void initialize_gl(bool computeShaders)
 {
 	glfwSetErrorCallback(_glfw_error_callback);
 
 	if (!glfwInit())
 		throw std::runtime_error("GLFW initialization failed");
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, computeShaders ? 4 : 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
-	glfwWindowHint(GLFW_REFRESH_RATE, 60);
-	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
-
-	g_windowPtr = glfwCreateWindow(1000, 1000, "P50K", nullptr, nullptr);
-	if (!g_windowPtr)
-		throw std::runtime_error("Could not create GLFW window");
+	create_window(computeShaders ? "Could not create GLFW window with an OpenGL 4.3 context"
+		: "Could not create GLFW window");
 
 	glfwMakeContextCurrent(g_windowPtr);
 	glfwSwapInterval(1);
 
-	glfwSetWindowSizeCallback(g_windowPtr, _glfw_resize_callback);
-
 	GLenum glewerror = GLEW_OK;
 	if ((glewerror = glewInit()) != GLEW_OK) {
 		throw std::runtime_error(std::string("GLEW initialization error: \"") +
 				reinterpret_cast<const char*>(glewGetErrorString(glewerror)) + "\"");
 	}
+	if (computeShaders && !GLEW_VERSION_4_3)
+		throw std::runtime_error("The graphics device does not support OpenGL 4.3 compute shaders");
 
 	glViewport(0, 0, 1000, 1000);
 	glEnable(GL_DEPTH_TEST);
@@ -81,7 +162,14 @@ void initialize_gl()
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	g_camera = new Camera(-2.5f, 2.5f, 2.5f, -2.5f);
+	// Lets the driver compile shaders on its own threads, where it supports it
+	if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	// Present a cleared frame, so the window shows up straight away instead of while the programs are built
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glfwSwapBuffers(g_windowPtr);
+	glfwPollEvents();
 
 	const GLubyte *renderer = glGetString(GL_RENDERER);
 	std::cout << "Initialized Graphics Device (" << reinterpret_cast<const char*>(renderer) << ")" << std::endl;
@@ -192,7 +280,7 @@ void initialize_cl()
 	g_clContext = clCreateContext(clprops, 1, &clfastdevid, /*clerrcallback*/ nullptr, nullptr, &clerr);
 	if (!g_clContext || clerr)
 		throw std::runtime_error(std::string("Failed to create OpenCL context on selected device (") + clGetErrorString(clerr) + ")");
-	g_clCommandQueue = clCreateCommandQueue(g_clContext, clfastdevid, NULL, &clerr);
+	g_clCommandQueue = clCreateCommandQueue(g_clContext, clfastdevid, CL_QUEUE_PROFILING_ENABLE, &clerr);
 	if (!g_clCommandQueue || clerr)
 		throw std::runtime_error(std::string("Failed to create OpenCL command queue on selected device (") + clGetErrorString(clerr) + ")");
 
@@ -200,6 +288,17 @@ void initialize_cl()
 	std::cout << "Initialized OpenCL Context" << std::endl;
 }
 
+void initialize_window()
+{
+	glfwSetErrorCallback(_glfw_error_callback);
+
+	if (!glfwInit())
+		throw std::runtime_error("GLFW initialization failed");
+
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	create_window("Could not create GLFW window");
+}
+
 size_t getMaxWorkGroupSize()
 {
 	return OPENCL_MAX_WORK_GROUP_SIZE;
@@ -16,31 +16,67 @@ extern cl_device_id g_clDevice;
 extern cl_context g_clContext;
 extern cl_command_queue g_clCommandQueue;
 
-#define CL_CHECK(stmt, msg, ...) \
-	_clCheckError((stmt), __FILE__, __LINE__, ([&]() -> std::string { \
-		char outstr[1024]; \
-		snprintf(outstr, 1024, msg, __VA_ARGS__); \
-		return std::string(outstr); \
-	})(), false)
-#define CL_CHECK_FATAL(stmt, msg, ...) \
-	_clCheckError((stmt), __FILE__, __LINE__, ([&]() -> std::string { \
-		char outstr[1024]; \
-		snprintf(outstr, 1024, msg, __VA_ARGS__); \
-		return std::string(outstr); \
-	})(), true)
-#define CL_CHECK_RETURN_FATAL(stmt, errval, stmtval, msg, ...) \
-	_clCheckError(([&]() -> cl_int { (stmt); return (errval) ? (errval) : !(stmtval); })(), \
-		__FILE__, __LINE__, ([&]() -> std::string { \
-			char outstr[1024]; \
-			snprintf(outstr, 1024, msg, __VA_ARGS__); \
-			return std::string(outstr); \
-		})(), true)
-bool _clCheckError(cl_int err, const char *file, unsigned int line, const std::string& msg, bool fatal);
-
-void initialize_gl();
+// Compile-time policy for the CL_CHECK* macros. In every policy the message is only formatted when the check fails,
+// so successful checks only cost a branch. Select with P50K_CL_CHECK_POLICY:
+//   P50K_CL_CHECK_FULL       - All failures are reported with their formatted message
+//   P50K_CL_CHECK_FATAL_ONLY - Non-fatal checks silently return the failure, fatal checks report and throw
+//   P50K_CL_CHECK_OFF        - Nothing is formatted, fatal checks throw with only the error name and location
+#define P50K_CL_CHECK_OFF 0
+#define P50K_CL_CHECK_FATAL_ONLY 1
+#define P50K_CL_CHECK_FULL 2
+#ifndef P50K_CL_CHECK_POLICY
+#	define P50K_CL_CHECK_POLICY P50K_CL_CHECK_FULL
+#endif
+
+#if P50K_CL_CHECK_POLICY >= P50K_CL_CHECK_FULL
+#	define CL_CHECK(stmt, msg, ...) \
+		([&]() -> bool { \
+			const cl_int _clerr = (stmt); \
+			return _clerr ? _clReportError(_clerr, __FILE__, __LINE__, false, msg, ##__VA_ARGS__) : false; \
+		})()
+#else
+#	define CL_CHECK(stmt, msg, ...) ((stmt) != CL_SUCCESS)
+#endif
+
+#if P50K_CL_CHECK_POLICY >= P50K_CL_CHECK_FATAL_ONLY
+#	define CL_CHECK_FATAL(stmt, msg, ...) \
+		([&]() -> bool { \
+			const cl_int _clerr = (stmt); \
+			return _clerr ? _clReportError(_clerr, __FILE__, __LINE__, true, msg, ##__VA_ARGS__) : false; \
+		})()
+#	define CL_CHECK_RETURN_FATAL(stmt, errval, stmtval, msg, ...) \
+		([&]() -> bool { \
+			(stmt); \
+			const cl_int _clerr = (errval) ? (errval) : !(stmtval); \
+			return _clerr ? _clReportError(_clerr, __FILE__, __LINE__, true, msg, ##__VA_ARGS__) : false; \
+		})()
+#else
+#	define CL_CHECK_FATAL(stmt, msg, ...) \
+		([&]() -> bool { \
+			const cl_int _clerr = (stmt); \
+			return _clerr ? _clThrowError(_clerr, __FILE__, __LINE__) : false; \
+		})()
+#	define CL_CHECK_RETURN_FATAL(stmt, errval, stmtval, msg, ...) \
+		([&]() -> bool { \
+			(stmt); \
+			const cl_int _clerr = (errval) ? (errval) : !(stmtval); \
+			return _clerr ? _clThrowError(_clerr, __FILE__, __LINE__) : false; \
+		})()
+#endif
+
+// Failure paths of the CL_CHECK* macros, these always return true or throw
+bool _clReportError(cl_int err, const char *file, unsigned int line, bool fatal, const char *msg, ...);
+bool _clThrowError(cl_int err, const char *file, unsigned int line);
+const char *clGetErrorString(cl_int error);
+
+// Creates the window with an OpenGL 3.3 core context, or 4.3 if compute shaders are needed
+void initialize_gl(bool computeShaders = false);
+// Creates the window without any graphics context, for a renderer that creates its own surface (Vulkan)
+void initialize_window();
 void initialize_cl();
 
 size_t getMaxWorkGroupSize();
 
+// Destroys the window, whichever way it was created
 void shutdown_gl();
 void shutdown_cl();
\ No newline at end of file
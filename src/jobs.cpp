@@ -0,0 +1,345 @@
+#include "jobs.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <iostream>
+
+#if defined(_WIN32)
+#	define NOMINMAX
+#	include <Windows.h>
+#elif defined(__linux__)
+#	include <pthread.h>
+#	include <sched.h>
+#endif
+
+
+JobSystem *g_jobs = nullptr;
+
+// The index of the worker running on the current thread, or -1 for non-worker threads
+static thread_local int t_workerIndex = -1;
+
+
+// ================================================================================================
+Job::Job(job_func_t func) :
+	m_func{std::move(func)},
+	m_pending{1},
+	m_done{false},
+	m_mutex{},
+	m_dependents{},
+	m_exception{nullptr}
+{
+
+}
+
+
+// ================================================================================================
+JobSystem::JobSystem(unsigned int threads, bool pin) :
+	m_workers{},
+	m_queued{0},
+	m_nextQueue{0},
+	m_stop{false},
+	m_sleepMutex{},
+	m_sleepCond{}
+{
+	if (!threads) {
+		const unsigned int hwthreads = std::thread::hardware_concurrency();
+		threads = (hwthreads > 1) ? (hwthreads - 1) : 1;
+	}
+
+	for (unsigned int i = 0; i < threads; ++i)
+		m_workers.emplace_back(new worker_t);
+	for (unsigned int i = 0; i < threads; ++i) {
+		std::thread& thread = m_workers[i]->thread;
+		thread = std::thread(&JobSystem::workerMain, this, i);
+
+		if (pin) {
+			// Leave the first hardware thread for the main thread
+			const unsigned int core = (i + 1) % std::max(std::thread::hardware_concurrency(), 1u);
+#if defined(_WIN32)
+			// Affinity masks only reach the cores of the first processor group, the rest are left unpinned
+			if (core < sizeof(DWORD_PTR) * 8)
+				SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+			if (core < CPU_SETSIZE) {
+				cpu_set_t cpus;
+				CPU_ZERO(&cpus);
+				CPU_SET(core, &cpus);
+				pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+			}
+#endif
+		}
+	}
+}
+
+// ================================================================================================
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop.store(true);
+	}
+	m_sleepCond.notify_all();
+
+	for (auto& worker : m_workers) {
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+// ================================================================================================
+JobHandle JobSystem::submit(Job::job_func_t func, std::initializer_list<JobHandle> deps)
+{
+	return submit(std::move(func), std::vector<JobHandle>(deps));
+}
+
+// ================================================================================================
+JobHandle JobSystem::submit(Job::job_func_t func, const std::vector<JobHandle>& deps)
+{
+	JobHandle job = std::make_shared<Job>(std::move(func));
+
+	for (const JobHandle& dep : deps) {
+		if (!dep)
+			continue;
+
+		std::lock_guard<std::mutex> lock(dep->m_mutex);
+		if (!dep->m_done.load(std::memory_order_acquire)) {
+			job->m_pending.fetch_add(1);
+			dep->m_dependents.push_back(job);
+		}
+	}
+
+	// Release the submission guard, the job is queued here if all dependencies were already complete
+	if (job->m_pending.fetch_sub(1) == 1)
+		enqueue(job);
+	return job;
+}
+
+// ================================================================================================
+void JobSystem::wait(const JobHandle& job)
+{
+	if (!job)
+		return;
+
+	const int self = getWorkerIndex();
+	while (!job->isDone()) {
+		if (!tryRunJob(self))
+			std::this_thread::yield();
+	}
+
+	if (job->m_exception)
+		std::rethrow_exception(job->m_exception);
+}
+
+// ================================================================================================
+void JobSystem::waitAll(const std::vector<JobHandle>& jobs)
+{
+	// Every job is waited for before the first exception is rethrown, the others may still use the caller's data
+	std::exception_ptr exception;
+	for (const JobHandle& job : jobs) {
+		try {
+			wait(job);
+		}
+		catch (...) {
+			if (!exception)
+				exception = std::current_exception();
+		}
+	}
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+// ================================================================================================
+void JobSystem::parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& func)
+{
+	if (end <= begin)
+		return;
+
+	// Small ranges are not worth the overhead of queueing
+	const size_t count = end - begin;
+	grain = std::max<size_t>(grain, 1);
+	if (count <= grain) {
+		func(begin, end);
+		return;
+	}
+
+	// Aim for a few chunks per thread so stealing can balance uneven work
+	const size_t threads = m_workers.size() + 1;
+	const size_t chunk = std::max(grain, (count + (threads * 4) - 1) / (threads * 4));
+
+	std::vector<JobHandle> jobs;
+	jobs.reserve((count + chunk - 1) / chunk);
+	for (size_t cbeg = begin + chunk; cbeg < end; cbeg += chunk) {
+		const size_t cend = std::min(cbeg + chunk, end);
+		jobs.push_back(submit([&func, cbeg, cend]() { func(cbeg, cend); }));
+	}
+
+	// The calling thread takes the first chunk itself. The queued chunks call func by reference, so they are waited
+	// for even if it throws.
+	std::exception_ptr exception;
+	try {
+		func(begin, std::min(begin + chunk, end));
+	}
+	catch (...) {
+		exception = std::current_exception();
+	}
+	if (exception) {
+		try {
+			waitAll(jobs);
+		}
+		catch (...) {
+		}
+		std::rethrow_exception(exception);
+	}
+	waitAll(jobs);
+}
+
+// ================================================================================================
+JobHandle JobSystem::parallel_for_async(size_t begin, size_t end, size_t grain, std::function<void(size_t, size_t)> func,
+	std::initializer_list<JobHandle> deps)
+{
+	const size_t count = (end > begin) ? (end - begin) : 0;
+	grain = std::max<size_t>(grain, 1);
+	const size_t threads = m_workers.size() + 1;
+	const size_t chunk = std::max(grain, (count + (threads * 4) - 1) / (threads * 4));
+
+	auto shared = std::make_shared<std::function<void(size_t, size_t)>>(std::move(func));
+	std::vector<JobHandle> chunks;
+	for (size_t cbeg = begin; cbeg < end; cbeg += chunk) {
+		const size_t cend = std::min(cbeg + chunk, end);
+		chunks.push_back(submit([shared, cbeg, cend]() { (*shared)(cbeg, cend); }, deps));
+	}
+
+	// Join job, which carries the completion of all chunks and the first exception among them
+	if (chunks.empty())
+		return submit([]() {}, deps);
+	return submit([chunks]() {
+		for (const JobHandle& chunk : chunks) {
+			if (chunk->m_exception)
+				std::rethrow_exception(chunk->m_exception);
+		}
+	}, chunks);
+}
+
+// ================================================================================================
+void JobSystem::enqueue(const JobHandle& job)
+{
+	// Workers push to their own queue, other threads distribute round-robin
+	int index = getWorkerIndex();
+	if (index < 0)
+		index = (int)(m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_workers.size());
+
+	// Counted before it is published, so a worker that takes it at once cannot take the count below zero
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_queued.fetch_add(1);
+	}
+
+	worker_t& worker = *m_workers[index];
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.jobs.push_back(job);
+	}
+	m_sleepCond.notify_one();
+}
+
+// ================================================================================================
+bool JobSystem::tryRunJob(int self)
+{
+	JobHandle job;
+
+	// Newest job from our own queue first, for cache locality
+	if (self >= 0) {
+		worker_t& worker = *m_workers[self];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.jobs.empty()) {
+			job = std::move(worker.jobs.back());
+			worker.jobs.pop_back();
+		}
+	}
+
+	// Otherwise steal the oldest job from another queue
+	if (!job) {
+		const unsigned int count = (unsigned int)m_workers.size();
+		const unsigned int start = (self >= 0) ? (unsigned int)self + 1 : m_nextQueue.load(std::memory_order_relaxed);
+		for (unsigned int i = 0; i < count && !job; ++i) {
+			worker_t& victim = *m_workers[(start + i) % count];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+			}
+		}
+	}
+
+	if (!job)
+		return false;
+
+	m_queued.fetch_sub(1);
+	execute(job);
+	return true;
+}
+
+// ================================================================================================
+void JobSystem::execute(const JobHandle& job)
+{
+	try {
+		job->m_func();
+	}
+	catch (...) {
+		job->m_exception = std::current_exception();
+	}
+	job->m_func = nullptr;
+
+	// Mark as complete, and release any jobs that were waiting on this one
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->m_mutex);
+		job->m_done.store(true, std::memory_order_release);
+		dependents.swap(job->m_dependents);
+	}
+	for (const JobHandle& dep : dependents) {
+		if (dep->m_pending.fetch_sub(1) == 1)
+			enqueue(dep);
+	}
+}
+
+// ================================================================================================
+void JobSystem::workerMain(unsigned int index)
+{
+	t_workerIndex = (int)index;
+
+	char name[32];
+	snprintf(name, 32, "Job Worker %u", index);
+	g_trace.setThreadName(name);
+
+	while (!m_stop.load()) {
+		if (tryRunJob((int)index))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleepCond.wait(lock, [this]() { return m_stop.load() || m_queued.load() > 0; });
+	}
+}
+
+// ================================================================================================
+int JobSystem::getWorkerIndex()
+{
+	return t_workerIndex;
+}
+
+
+// ================================================================================================
+void initialize_jobs(unsigned int threads, bool pin)
+{
+	g_jobs = new JobSystem(threads, pin);
+	std::cout << "Initialized Job System (" << g_jobs->getWorkerCount() << " workers"
+		<< (pin ? ", pinned" : "") << ")" << std::endl;
+}
+
+// ================================================================================================
+void shutdown_jobs()
+{
+	if (g_jobs) {
+		delete g_jobs;
+		g_jobs = nullptr;
+	}
+}
\ No newline at end of file
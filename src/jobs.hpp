@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class JobSystem;
+
+
+// A single unit of work in the job system. A job is queued once all of the jobs that it depends on are complete.
+class Job
+{
+	friend class JobSystem;
+
+public:
+	using job_func_t = std::function<void()>;
+
+private:
+	job_func_t m_func;
+	std::atomic<int> m_pending;		// Unfinished dependencies, plus one while the job is being submitted
+	std::atomic<bool> m_done;
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<Job>> m_dependents;
+	std::exception_ptr m_exception;
+
+public:
+	Job(job_func_t func);
+
+	inline bool isDone() const { return m_done.load(std::memory_order_acquire); }
+};
+
+using JobHandle = std::shared_ptr<Job>;
+
+
+// Work-stealing thread pool for host side parallelism. Each worker owns a deque of jobs that it pushes to and pops
+// from at the back, while idle workers steal the oldest jobs from the front of other workers' deques. Threads that
+// wait on a job help execute queued jobs until it completes.
+class JobSystem
+{
+private:
+	struct worker_t
+	{
+		std::mutex mutex;
+		std::deque<JobHandle> jobs;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<worker_t>> m_workers;
+	std::atomic<unsigned int> m_queued;
+	std::atomic<unsigned int> m_nextQueue;
+	std::atomic<bool> m_stop;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_sleepCond;
+
+public:
+	// A thread count of zero will create one worker for each hardware thread, minus one for the main thread
+	JobSystem(unsigned int threads = 0, bool pin = false);
+	~JobSystem();
+
+	inline unsigned int getWorkerCount() const { return (unsigned int)m_workers.size(); }
+
+	JobHandle submit(Job::job_func_t func, std::initializer_list<JobHandle> deps = {});
+	JobHandle submit(Job::job_func_t func, const std::vector<JobHandle>& deps);
+
+	// Blocks until the job is complete, executing other jobs in the meantime. Rethrows exceptions from the job.
+	void wait(const JobHandle& job);
+	void waitAll(const std::vector<JobHandle>& jobs);
+
+	// Splits [begin, end) into chunks of at least grain items, and calls func(chunkbegin, chunkend) for each chunk
+	void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& func);
+	// As above, but returns a job that completes once all chunks are done, and waits for deps before starting
+	JobHandle parallel_for_async(size_t begin, size_t end, size_t grain, std::function<void(size_t, size_t)> func,
+		std::initializer_list<JobHandle> deps = {});
+
+private:
+	void enqueue(const JobHandle& job);
+	bool tryRunJob(int self);
+	void execute(const JobHandle& job);
+	void workerMain(unsigned int index);
+
+	static int getWorkerIndex();
+};
+
+extern JobSystem *g_jobs;
+
+void initialize_jobs(unsigned int threads = 0, bool pin = false);
+void shutdown_jobs();
\ No newline at end of file
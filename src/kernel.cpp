@@ -1,32 +1,53 @@
 #include "kernel.hpp"
 #include "gpu.hpp"
+#include "trace.hpp"
 #include <iostream>
 
 
 // ================================================================================================
-Kernel::Kernel(const char *source, const char *fname) :
-	m_program{nullptr},
-	m_kernel{nullptr},
-	m_fname{fname},
-	m_state{IDLE},
-	m_mutex{},
-	m_thread{nullptr}
+cl_program buildProgram(const char *source, const char *options)
 {
 	cl_int clerr;
-	CL_CHECK_RETURN_FATAL(m_program = clCreateProgramWithSource(g_clContext, 1, &source, 0, &clerr),
-		clerr, m_program, "Could not create OpenCL program from source.");
+	cl_program program;
+	CL_CHECK_RETURN_FATAL(program = clCreateProgramWithSource(g_clContext, 1, &source, 0, &clerr),
+		clerr, program, "Could not create OpenCL program from source.");
 
 	// Build the program
-	if (clerr = clBuildProgram(m_program, 0, nullptr, nullptr, nullptr, nullptr)) {
+	if (clerr = clBuildProgram(program, 0, nullptr, options, nullptr, nullptr)) {
 		std::cerr << "Failed to build OpenCL program (" << clerr << ")." << std::endl;
 		char cllog[8192];
-		CL_CHECK_FATAL(clGetProgramBuildInfo(m_program, g_clDevice, CL_PROGRAM_BUILD_LOG, 8192, cllog, nullptr),
+		CL_CHECK_FATAL(clGetProgramBuildInfo(program, g_clDevice, CL_PROGRAM_BUILD_LOG, 8192, cllog, nullptr),
 			"Could not get the program build info log");
-		
+		clReleaseProgram(program);
+
 		throw std::runtime_error(std::string("OpenCL program build error: '") + cllog + "'");
 	}
 
+	return program;
+}
+
+
+// ================================================================================================
+Kernel::Kernel(const char *source, const char *fname) :
+	Kernel(buildProgram(source), fname)
+{
+	// The delegated constructor retained the program, drop the reference from buildProgram
+	clReleaseProgram(m_program);
+}
+
+// ================================================================================================
+Kernel::Kernel(cl_program program, const char *fname) :
+	m_program{program},
+	m_kernel{nullptr},
+	m_fname{fname},
+	m_state{IDLE},
+	m_mutex{},
+	m_waitJob{}
+{
+	CL_CHECK_FATAL(clRetainProgram(m_program), "Could not retain OpenCL program for kernel '%s'", fname);
+
 	// Create the kernel
+	cl_int clerr;
 	CL_CHECK_RETURN_FATAL(m_kernel = clCreateKernel(m_program, fname, &clerr), clerr, m_kernel,
 		"Could not create OpenCL kernel from program with entry point '%s'", fname);
 }
@@ -34,10 +55,19 @@ Kernel::Kernel(const char *source, const char *fname) :
 // ================================================================================================
 Kernel::~Kernel()
 {
-	if (m_thread) {
-		m_thread->join();
-		delete m_thread;
+	if (m_waitJob) {
+		try {
+			g_jobs->wait(m_waitJob);
+		}
+		catch (std::exception& ex) {
+			std::cerr << "Kernel '" << m_fname << "' failed while waiting: \"" << ex.what() << "\"." << std::endl;
+		}
 	}
+
+	if (m_kernel)
+		clReleaseKernel(m_kernel);
+	if (m_program)
+		clReleaseProgram(m_program);
 }
 
 // ================================================================================================
@@ -48,46 +78,56 @@ void Kernel::setKernelArgument(unsigned int pos, size_t size, const void* arg)
 }
 
 // ================================================================================================
-void Kernel::executeNDRange(unsigned int numdim, const size_t* worksize, bool wait)
+void Kernel::executeNDRange(unsigned int numdim, const size_t* worksize, bool wait, cl_event* evt)
 {
 	CL_CHECK_FATAL(
-		clEnqueueNDRangeKernel(g_clCommandQueue, m_kernel, numdim, nullptr, worksize, nullptr, 0, nullptr, nullptr),
+		clEnqueueNDRangeKernel(g_clCommandQueue, m_kernel, numdim, nullptr, worksize, nullptr, 0, nullptr, evt),
 		"Could not queue execution of kernel '%s'", m_fname.c_str());
 
 	{
-		tthread::lock_guard<tthread::mutex> lock(m_mutex);
+		std::lock_guard<std::mutex> lock(m_mutex);
 		m_state = WORKING;
 	}
 
 	if (wait) {
+		ScopedTrace trace("clFinish", "wait");
 		CL_CHECK_FATAL(clFinish(g_clCommandQueue),
 			"Could not wait for kernel '%s' to finish on main thread", m_fname.c_str());
 
 		{
-			tthread::lock_guard<tthread::mutex> lock(m_mutex);
+			std::lock_guard<std::mutex> lock(m_mutex);
 			m_state = IDLE;
 		}
 	}
 	else {
-		auto waitfunc = [](void *args) -> void {
-			Kernel *kern = static_cast<Kernel*>(args);
+		// Wait for the previous execution to finish before replacing it
+		if (m_waitJob)
+			g_jobs->wait(m_waitJob);
 
-			CL_CHECK_FATAL(clFinish(g_clCommandQueue),
-				"Could not wait for kernel '%s' to finish on wait thread", kern->m_fname.c_str());
+		// Note that this occupies a worker for the duration of the kernel
+		m_waitJob = g_jobs->submit([this]() {
+			{
+				ScopedTrace trace("clFinish", "wait");
+				CL_CHECK_FATAL(clFinish(g_clCommandQueue),
+					"Could not wait for kernel '%s' to finish on job worker", m_fname.c_str());
+			}
 
 			{
-				tthread::lock_guard<tthread::mutex> lock(kern->m_mutex);
-				kern->m_state = IDLE;
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_state = IDLE;
 			}
-		};
+		});
+	}
+}
 
-		if (m_thread) {
-			m_thread->join();
-			delete m_thread;
-		}
 
-		m_thread = new tthread::thread(waitfunc, this);
-	}
+
+// ================================================================================================
+void Kernel::enqueueNDRange(unsigned int numdim, const size_t* worksize)
+{
+	CL_CHECK_FATAL(
+		clEnqueueNDRangeKernel(g_clCommandQueue, m_kernel, numdim, nullptr, worksize, nullptr, 0, nullptr, nullptr),
+		"Could not queue execution of kernel '%s'", m_fname.c_str());
 }
 
 
@@ -104,45 +144,643 @@ const char * const ParticleKernelSource = R"(
 		float2 pos;
 		float2 vel;
 		float2 acc;
+		uint id;
 	} Particle;
 
+	// Per-frame parameters (mirror of the host FrameParams type)
+	typedef struct FrameParams
+	{
+		float2 attractor;
+		float2 pulse;
+		float deltaTime;
+		float totalTime;
+		float fieldStrength;
+		float attractorStrength;
+		float4 viewBounds;
+		float lodKeep;
+		float padding[3];
+	} FrameParams;
+
+	#ifdef RENDER_STREAM
+	void writeRenderStream(__global uchar * stream, const uint Count, const uint slot, const float2 pos,
+						   const float2 vel)
+	{
+		const float2 unorm = clamp((pos * (0.5f / RENDER_STREAM_EXTENT)) + 0.5f, 0.0f, 1.0f);
+		((__global ushort2 *)stream)[slot] = convert_ushort2_rte(unorm * 65535.0f);
+		stream[(Count * 4) + slot] = convert_uchar_sat_rte(length(vel) * (255.0f / RENDER_STREAM_SPEED_SCALE));
+	}
+	#endif
+
+	// The fast math functions (fm_atan2, fm_sin, fm_cos, fm_cube) are prepended by buildFastMathSource(). When
+	// RENDER_STREAM is defined the solution is also written to the compact render stream (see particle.hpp). With
+	// RENDER_CULL as well, only the visible particles selected by the level of detail are written, packed to the
+	// front of the stream, and counters receives the number written followed by the number visible.
 	__kernel void Solve(__global __read_only const Particle * src, __global __write_only Particle * dst,
-						const float DeltaTime, const float TotalTime) 
+						__constant FrameParams * Frame
+	#ifdef RENDER_STREAM
+						, __global uchar * stream, const uint Count
+	#endif
+	#ifdef RENDER_CULL
+						, __global uint * counters
+	#endif
+						) 
 	{
+	#ifdef RENDER_CULL
+		__local uint groupDrawn;
+		__local uint groupVisible;
+		__local uint groupBase;
+	#endif
+
 		const int IDX = get_global_id(0);
-		const float SRCX = src[IDX].pos.x;
-		const float SRCY = src[IDX].pos.y;
 		float2 force = (float2)(0, 0);
 
 		// Force from central attractor
-		float2 diff = src[IDX].pos;
+		float2 diff = src[IDX].pos - Frame->attractor;
 		float difflen = length(diff) + 1;
-		float scale = 1.0 / pow(difflen, 3);
+		float scale = 1.0f / fm_cube(difflen);
 		force += (scale * diff);
 
 		// Additional values that are nice to know and are used below (maybe)
-		const float angle = atan2(SRCY, SRCX);
-		const float distToCenter = length(src[IDX].pos);
+		const float angle = fm_atan2(diff.y, diff.x);
 
 		// Add the effects of an additional velocity field
-		float afx = SRCY;
-		float afy = -SRCX;
-		float2 vfield = ((float2)(afx, afy) * 0.1f);
+		float afx = diff.y;
+		float afy = -diff.x;
+		float2 vfield = ((float2)(afx, afy) * Frame->fieldStrength);
 
-		// And another velocity field
-		float pulseamt = sin(TotalTime * 2.0f) * 1.0f;
-		vfield.x += (pulseamt * cos(angle));
-		vfield.y += (pulseamt * sin(angle));
+		// And another velocity field, with the pulse amplitude and phase from the frame parameters
+		const float2 radial = (float2)(fm_cos(angle), fm_sin(angle));
+		vfield.x += (Frame->pulse.x * radial.x) - (Frame->pulse.y * radial.y);
+		vfield.y += (Frame->pulse.x * radial.y) + (Frame->pulse.y * radial.x);
 
 		// Solve final changes
-		float2 dAcc = (-force / src[IDX].mass) * 5.0f;
-		float2 dVel = src[IDX].vel + (dAcc * DeltaTime);
-		float2 dPos = src[IDX].pos + (dVel * DeltaTime) + (vfield * DeltaTime / (distToCenter + 1));
+		float2 dAcc = (-force / src[IDX].mass) * Frame->attractorStrength;
+		float2 dVel = src[IDX].vel + (dAcc * Frame->deltaTime);
+		float2 dPos = src[IDX].pos + (dVel * Frame->deltaTime) + (vfield * Frame->deltaTime / difflen);
 
 		// Write solution to output array
 		dst[IDX].mass = src[IDX].mass;
 		dst[IDX].pos = dPos;
 		dst[IDX].vel = dVel;
 		dst[IDX].acc = dAcc;
+		dst[IDX].id = src[IDX].id;
+
+	#if defined(RENDER_CULL)
+		// Particles are kept by a hash of their index, so the same subset is drawn every frame
+		const bool visible = all(dPos >= Frame->viewBounds.xy) && all(dPos <= Frame->viewBounds.zw);
+		const float lodrand = (float)(((uint)IDX * 2654435761u) >> 8) * (1.0f / 16777216.0f);
+		const bool drawn = visible && (lodrand < Frame->lodKeep);
+
+		// Reserve output slots within the work-group first, so there is only one global atomic per group
+		if (get_local_id(0) == 0) {
+			groupDrawn = 0;
+			groupVisible = 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		uint slot = 0;
+		if (visible)
+			atomic_inc(&groupVisible);
+		if (drawn)
+			slot = atomic_inc(&groupDrawn);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (get_local_id(0) == 0) {
+			groupBase = atomic_add(&counters[0], groupDrawn);
+			atomic_add(&counters[1], groupVisible);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (drawn)
+			writeRenderStream(stream, Count, groupBase + slot, dPos, dVel);
+	#elif defined(RENDER_STREAM)
+		writeRenderStream(stream, Count, IDX, dPos, dVel);
+	#endif
+	}
+)";
+const char * const ParticleInitKernelSource = R"(
+	// Values of the host InitialCondition type
+	#define INIT_UNIFORM 0
+	#define INIT_DISK 1
+	#define INIT_PLUMMER 2
+	#define INIT_GALAXY 3
+	#define INIT_LATTICE 4
+
+	#define TWO_PI 6.28318530718f
+
+	// Parameters of the initial condition generators (mirror of the host InitParams type)
+	typedef struct InitParams
+	{
+		uint2 key;
+		uint model;
+		uint count;
+		float2 dims;
+		float attractorStrength;
+		uint latticeSide;
+	} InitParams;
+
+	// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3")
+	uint4 philox4x32(uint4 ctr, uint2 key)
+	{
+		for (int i = 0; i < 10; ++i) {
+			const uint hi0 = mul_hi(0xD2511F53u, ctr.x);
+			const uint lo0 = 0xD2511F53u * ctr.x;
+			const uint hi1 = mul_hi(0xCD9E8D57u, ctr.z);
+			const uint lo1 = 0xCD9E8D57u * ctr.z;
+			ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+			key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+		}
+		return ctr;
+	}
+
+	// Same distributions as generateParticleRange() on the host, see particle.cpp
+	__kernel void Initialize(__global __write_only Particle * dst, const InitParams Params)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Params.count)
+			return;
+
+		const float4 u = convert_float4(philox4x32((uint4)(IDX, 0, 0, 0), Params.key) >> 8) * (1.0f / 16777216.0f);
+		const float2 halfDims = Params.dims * 0.5f;
+		const float radius = min(halfDims.x, halfDims.y);
+
+		float2 pos = (float2)(0, 0);
+		float2 vel = (float2)(0, 0);
+		if (Params.model == INIT_DISK || Params.model == INIT_GALAXY) {
+			const float scale = radius / 4.0f;
+			const float r = min(-scale * log((1.0f - u.x) * (1.0f - u.y)), radius * 2.0f);
+			float angle = TWO_PI * u.z;
+			if (Params.model == INIT_GALAXY) {
+				angle = ((u.w < 0.5f) ? 0.0f : (TWO_PI / 2.0f)) + (2.5f * log(1.0f + (r / scale)))
+					+ ((u.z - 0.5f) * 0.8f);
+				const float speed = r * sqrt(Params.attractorStrength / ((r + 1.0f) * (r + 1.0f) * (r + 1.0f)));
+				vel = (float2)(-sin(angle), cos(angle)) * speed;
+			}
+			pos = (float2)(cos(angle), sin(angle)) * r;
+		}
+		else if (Params.model == INIT_PLUMMER) {
+			const float scale = radius / 4.0f;
+			const float m = u.x * 0.99f;
+			const float r = scale * sqrt(m / (1.0f - m));
+			const float angle = TWO_PI * u.y;
+			pos = (float2)(cos(angle), sin(angle)) * r;
+		}
+		else if (Params.model == INIT_LATTICE) {
+			const uint side = Params.latticeSide;
+			const float2 cell = (float2)((float)(IDX % side) + 0.5f, (float)(IDX / side) + 0.5f);
+			pos = ((cell / (float)side) * Params.dims) - halfDims;
+		}
+		else
+			pos = (u.xy * Params.dims) - halfDims;
+
+		dst[IDX].mass = 1.0f;
+		dst[IDX].pos = pos;
+		dst[IDX].vel = vel;
+		dst[IDX].acc = (float2)(0, 0);
+		dst[IDX].id = IDX;
+	}
+)";
+const char * const ParticleGatherKernelSource = R"(
+	// Samples of the traced particles (mirror of the host TracerSample type), found by scanning the ids of the state.
+	// Lookup holds the sample slot of each id up to LookupCount, or 0xFFFFFFFF for ids that are not traced.
+	__kernel void Gather(__global __read_only const Particle * state, const uint Count,
+						 __global __read_only const uint * lookup, const uint LookupCount,
+						 __global __write_only float4 * samples)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Count)
+			return;
+
+		const uint id = state[IDX].id;
+		const uint slot = (id < LookupCount) ? lookup[id] : 0xFFFFFFFFu;
+		if (slot != 0xFFFFFFFFu)
+			samples[slot] = (float4)(state[IDX].pos, state[IDX].vel);
+	}
+)";
+const char * const ParticleReduceKernelSource = R"(
+	// Layout of the host DiagnosticsResult, the moments in the order of DiagnosticsMoment followed by the histogram
+	#define DIAGNOSTICS_MOMENTS 8
+	#define DIAGNOSTICS_BINS 64u
+
+	// First pass, where each lane strides over the state and writes its sums to partials, moment by moment. The
+	// particles are also binned by their distance to the attractor, within the group first so there is only one
+	// global atomic per bin and group.
+	__kernel void Reduce(__global __read_only const Particle * state, const uint Count,
+						 __constant FrameParams * Frame, const float BinScale,
+						 __global float * partials, __global uint * result)
+	{
+		__local uint groupBins[DIAGNOSTICS_BINS];
+		const uint lane = get_global_id(0);
+		const uint lanes = get_global_size(0);
+		for (uint i = get_local_id(0); i < DIAGNOSTICS_BINS; i += get_local_size(0))
+			groupBins[i] = 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		float sums[DIAGNOSTICS_MOMENTS] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		for (uint i = lane; i < Count; i += lanes) {
+			const float mass = state[i].mass;
+			const float2 pos = state[i].pos;
+			const float2 vel = state[i].vel;
+			const float2 diff = pos - Frame->attractor;
+			const float dist = length(diff);
+			const float difflen = dist + 1.0f;
+
+			sums[0] += mass;
+			sums[1] += mass * pos.x;
+			sums[2] += mass * pos.y;
+			sums[3] += mass * vel.x;
+			sums[4] += mass * vel.y;
+			sums[5] += mass * dot(vel, vel);
+			sums[6] += Frame->attractorStrength * ((0.5f / (difflen * difflen)) - (1.0f / difflen));
+			sums[7] += mass * ((diff.x * vel.y) - (diff.y * vel.x));
+			atomic_inc(&groupBins[(uint)fmin(dist * BinScale, (float)(DIAGNOSTICS_BINS - 1u))]);
+		}
+		for (uint k = 0; k < DIAGNOSTICS_MOMENTS; ++k)
+			partials[(k * lanes) + lane] = sums[k];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (uint i = get_local_id(0); i < DIAGNOSTICS_BINS; i += get_local_size(0)) {
+			if (groupBins[i])
+				atomic_add(&result[DIAGNOSTICS_MOMENTS + i], groupBins[i]);
+		}
+	}
+
+	// Second pass, a work item per moment sums the partials of every lane into the result
+	__kernel void ReduceFinal(__global __read_only const float * partials, const uint Lanes, __global uint * result)
+	{
+		const uint k = get_global_id(0);
+		if (k >= DIAGNOSTICS_MOMENTS)
+			return;
+
+		float sum = 0.0f;
+		for (uint lane = 0; lane < Lanes; ++lane)
+			sum += partials[(k * Lanes) + lane];
+		result[k] = as_uint(sum);
+	}
+)";
+const char * const ParticleGridKernelSource = R"(
+	// Particle struct (mirror of the host Particle type)
+	typedef struct __attribute__((packed)) Particle
+	{
+		float mass;
+		float2 pos;
+		float2 vel;
+		float2 acc;
+		uint id;
+	} Particle;
+
+	// Placement of the cells (mirror of the host GridParams type)
+	typedef struct GridParams
+	{
+		float2 origin;
+		float cellSize;
+		float invCellSize;
+		uint2 side;
+		uint cellCount;
+		uint count;
+	} GridParams;
+
+	#define GRID_SCAN_BLOCK 1024u
+
+	int2 gridCellCoords(const GridParams * grid, const float2 pos)
+	{
+		const float2 f = (pos - grid->origin) * grid->invCellSize;
+		const float2 last = convert_float2(grid->side - 1u);
+		return convert_int2(select(fmin(f, last), (float2)(0.0f, 0.0f), isless(f, (float2)(0.0f, 0.0f)) || isnan(f)));
+	}
+
+	uint gridCell(const GridParams * grid, const float2 pos)
+	{
+		const int2 c = gridCellCoords(grid, pos);
+		return ((uint)c.y * grid->side.x) + (uint)c.x;
+	}
+
+	// Counts the particles of each cell, and keeps the slot that each one takes within its cell
+	__kernel void GridCount(__global __read_only const Particle * state, const GridParams Grid,
+							__global uint * cellCounts, __global uint * cells, __global uint * ranks)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Grid.count)
+			return;
+
+		const uint cell = gridCell(&Grid, state[IDX].pos);
+		cells[IDX] = cell;
+		ranks[IDX] = atomic_inc(&cellCounts[cell]);
+	}
+
+	// Moves every particle to its slot, once cellStart holds the prefix sum of the counts
+	__kernel void GridScatter(__global __read_only const Particle * state, const GridParams Grid,
+							  __global const uint * cellStart, __global const uint * cells,
+							  __global const uint * ranks, __global uint * sortedIndex, __global float4 * sorted)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Grid.count)
+			return;
+
+		const uint slot = cellStart[cells[IDX]] + ranks[IDX];
+		sortedIndex[slot] = IDX;
+		sorted[slot] = (float4)(state[IDX].pos, state[IDX].vel);
+	}
+
+	// Exclusive prefix sum in three passes, the totals of blocks of words, a single work item scanning the totals
+	// which also writes the overall total after the data, and the blocks scanned from their offsets
+	__kernel void ScanBlocks(__global const uint * data, const uint Count, __global uint * blockSums)
+	{
+		const uint begin = get_global_id(0) * GRID_SCAN_BLOCK;
+		if (begin >= Count)
+			return;
+
+		const uint end = min(begin + GRID_SCAN_BLOCK, Count);
+		uint sum = 0;
+		for (uint i = begin; i < end; ++i)
+			sum += data[i];
+		blockSums[get_global_id(0)] = sum;
+	}
+
+	__kernel void ScanTotals(__global uint * blockSums, const uint BlockCount, __global uint * data, const uint Count)
+	{
+		if (get_global_id(0) != 0)
+			return;
+
+		uint running = 0;
+		for (uint i = 0; i < BlockCount; ++i) {
+			const uint sum = blockSums[i];
+			blockSums[i] = running;
+			running += sum;
+		}
+		data[Count] = running;
+	}
+
+	__kernel void ScanApply(__global uint * data, const uint Count, __global const uint * blockSums)
+	{
+		const uint begin = get_global_id(0) * GRID_SCAN_BLOCK;
+		if (begin >= Count)
+			return;
+
+		const uint end = min(begin + GRID_SCAN_BLOCK, Count);
+		uint running = blockSums[get_global_id(0)];
+		for (uint i = begin; i < end; ++i) {
+			const uint value = data[i];
+			data[i] = running;
+			running += value;
+		}
+	}
+)";
+const char * const ParticleClusterKernelSource = R"(
+	// Summary of a cluster (mirror of the host ClusterSummary type)
+	typedef struct ClusterSummary
+	{
+		uint count;
+		float mass;
+		float2 center;
+		float2 velocity;
+		float radius;
+		uint root;
+	} ClusterSummary;
+
+	// Root of the tree of a particle. Parents only ever decrease, so the walk ends even while other work items hook
+	// trees together.
+	uint fofFind(__global volatile uint * parent, uint x)
+	{
+		uint p = parent[x];
+		while (p != x) {
+			x = p;
+			p = parent[x];
+		}
+		return x;
+	}
+
+	__kernel void FofInit(__global uint * parent, const uint Count)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX < Count)
+			parent[IDX] = IDX;
+	}
+
+	// A work item per sorted slot hooks the root of each particle onto the smaller root of every later particle
+	// within the linking length, from the cells around it. A hook that loses the race against another one is found
+	// again by the next pass, changed tells the host if one is needed.
+	__kernel void FofLink(__global const float4 * sorted, __global const uint * sortedIndex,
+						  __global const uint * cellStart, const GridParams Grid, const float LinkingLength2,
+						  __global volatile uint * parent, __global uint * changed)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Grid.count)
+			return;
+
+		const float2 pos = sorted[IDX].xy;
+		const uint a = sortedIndex[IDX];
+		const int2 c = gridCellCoords(&Grid, pos);
+		uint ra = fofFind(parent, a);
+		for (int y = max(c.y - 1, 0); y <= min(c.y + 1, (int)Grid.side.y - 1); ++y) {
+			for (int x = max(c.x - 1, 0); x <= min(c.x + 1, (int)Grid.side.x - 1); ++x) {
+				const uint cell = ((uint)y * Grid.side.x) + (uint)x;
+				const uint end = cellStart[cell + 1];
+				for (uint k = cellStart[cell]; k < end; ++k) {
+					const uint b = sortedIndex[k];
+					const float2 d = sorted[k].xy - pos;
+					if (b <= a || dot(d, d) > LinkingLength2)
+						continue;
+
+					ra = fofFind(parent, ra);
+					const uint rb = fofFind(parent, b);
+					if (ra != rb) {
+						atomic_min(&parent[max(ra, rb)], min(ra, rb));
+						ra = min(ra, rb);
+						*changed = 1;
+					}
+				}
+			}
+		}
+	}
+
+	// Pointer jumping, every particle points straight at its root afterwards
+	__kernel void FofJump(__global volatile uint * parent, const uint Count)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX < Count)
+			parent[IDX] = fofFind(parent, IDX);
+	}
+
+	// Counts the members of each root, and keeps the slot each particle takes among them
+	__kernel void FofCount(__global const uint * parent, const uint Count, __global uint * memberCounts,
+						   __global uint * ranks)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX < Count)
+			ranks[IDX] = atomic_inc(&memberCounts[parent[IDX]]);
+	}
+
+	// Marks the roots of clusters with enough members, the prefix sum of the marks numbers the clusters
+	__kernel void FofMark(__global const uint * memberCounts, const uint Count, const uint MinMembers,
+						  __global uint * clusterIndex)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX < Count)
+			clusterIndex[IDX] = (memberCounts[IDX] >= MinMembers) ? 1 : 0;
+	}
+
+	// Groups the particles by their root, once memberStart holds the prefix sum of the counts
+	__kernel void FofScatter(__global const uint * parent, const uint Count, __global const uint * memberStart,
+							 __global const uint * ranks, __global uint * members)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX < Count)
+			members[memberStart[parent[IDX]] + ranks[IDX]] = IDX;
+	}
+
+	// A work item per root sums the members of its cluster
+	__kernel void FofSummarize(__global __read_only const Particle * state, const uint Count, const uint MinMembers,
+							   __global const uint * memberStart, __global const uint * members,
+							   __global const uint * clusterIndex, __global ClusterSummary * summaries)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Count)
+			return;
+		const uint begin = memberStart[IDX];
+		const uint end = memberStart[IDX + 1];
+		if (end - begin < MinMembers)
+			return;
+
+		float mass = 0.0f;
+		float2 moment = (float2)(0.0f, 0.0f);
+		float2 momentum = (float2)(0.0f, 0.0f);
+		for (uint k = begin; k < end; ++k) {
+			const uint i = members[k];
+			const float m = state[i].mass;
+			mass += m;
+			moment += m * state[i].pos;
+			momentum += m * state[i].vel;
+		}
+		const float invMass = (mass > 0.0f) ? (1.0f / mass) : 0.0f;
+		const float2 center = moment * invMass;
+
+		float spread = 0.0f;
+		for (uint k = begin; k < end; ++k) {
+			const uint i = members[k];
+			const float2 d = state[i].pos - center;
+			spread += state[i].mass * dot(d, d);
+		}
+
+		ClusterSummary summary;
+		summary.count = end - begin;
+		summary.mass = mass;
+		summary.center = center;
+		summary.velocity = momentum * invMass;
+		summary.radius = sqrt(spread * invMass);
+		summary.root = IDX;
+		summaries[clusterIndex[IDX]] = summary;
+	}
+
+	// The cluster of every particle, or 0xFFFFFFFF for particles in groups that are too small
+	__kernel void FofLabel(__global const uint * parent, const uint Count, const uint MinMembers,
+						   __global const uint * memberStart, __global const uint * clusterIndex,
+						   __global uint * labels)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= Count)
+			return;
+		const uint root = parent[IDX];
+		labels[IDX] = ((memberStart[root + 1] - memberStart[root]) >= MinMembers) ? clusterIndex[root] : 0xFFFFFFFFu;
+	}
+)";
+
+const char * const ParticleQueryKernelSource = R"(
+	#define QUERY_MAX_K 32u
+	#define QUERY_NONE 0xFFFFFFFFu
+
+	// A work item per probe visits the cells overlapping the square around it, and counts every particle within the
+	// radius. The first MaxResults of them are listed in the slots of the probe.
+	__kernel void QueryRange(__global const float2 * probes, const uint ProbeCount, const float Radius,
+							 const uint MaxResults, __global const float4 * sorted, __global const uint * sortedIndex,
+							 __global const uint * cellStart, const GridParams Grid, __global uint * counts,
+							 __global uint * indices, __global float * distances2)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= ProbeCount)
+			return;
+
+		const float2 probe = probes[IDX];
+		const float radius2 = Radius * Radius;
+		const int2 low = gridCellCoords(&Grid, probe - Radius);
+		const int2 high = gridCellCoords(&Grid, probe + Radius);
+		const uint base = IDX * MaxResults;
+		uint found = 0;
+		for (int y = low.y; y <= high.y; ++y) {
+			for (int x = low.x; x <= high.x; ++x) {
+				const uint cell = ((uint)y * Grid.side.x) + (uint)x;
+				const uint end = cellStart[cell + 1];
+				for (uint k = cellStart[cell]; k < end; ++k) {
+					const float2 d = sorted[k].xy - probe;
+					const float d2 = dot(d, d);
+					if (d2 > radius2)
+						continue;
+					if (found < MaxResults) {
+						indices[base + found] = sortedIndex[k];
+						distances2[base + found] = d2;
+					}
+					++found;
+				}
+			}
+		}
+		counts[IDX] = found;
+	}
+
+	// A work item per probe visits rings of cells around the cell of the probe, keeping the K nearest particles in
+	// order. Particles beyond a ring are at least its number of cells away, so the search stops as soon as the K-th
+	// nearest is closer than that. Unused slots hold QUERY_NONE.
+	__kernel void QueryNearest(__global const float2 * probes, const uint ProbeCount, const uint K,
+							   __global const float4 * sorted, __global const uint * sortedIndex,
+							   __global const uint * cellStart, const GridParams Grid, __global uint * counts,
+							   __global uint * indices, __global float * distances2)
+	{
+		const uint IDX = get_global_id(0);
+		if (IDX >= ProbeCount)
+			return;
+
+		float best[QUERY_MAX_K];
+		uint bestIndex[QUERY_MAX_K];
+		uint found = 0;
+
+		const float2 probe = probes[IDX];
+		const int2 c = gridCellCoords(&Grid, probe);
+		const int2 last = convert_int2(Grid.side) - 1;
+		const int rings = max(max(c.x, last.x - c.x), max(c.y, last.y - c.y));
+		for (int ring = 0; ring <= rings; ++ring) {
+			for (int y = c.y - ring; y <= c.y + ring; ++y) {
+				if (y < 0 || y > last.y)
+					continue;
+				// Rows inside the ring only have its two side cells
+				const int stride = ((y == c.y - ring) || (y == c.y + ring)) ? 1 : (2 * ring);
+				for (int x = c.x - ring; x <= c.x + ring; x += stride) {
+					if (x < 0 || x > last.x)
+						continue;
+					const uint cell = ((uint)y * Grid.side.x) + (uint)x;
+					const uint end = cellStart[cell + 1];
+					for (uint k = cellStart[cell]; k < end; ++k) {
+						const float2 d = sorted[k].xy - probe;
+						const float d2 = dot(d, d);
+						if (found == K && d2 >= best[K - 1])
+							continue;
+
+						uint i = (found < K) ? found++ : (K - 1);
+						for (; i > 0 && best[i - 1] > d2; --i) {
+							best[i] = best[i - 1];
+							bestIndex[i] = bestIndex[i - 1];
+						}
+						best[i] = d2;
+						bestIndex[i] = sortedIndex[k];
+					}
+				}
+			}
+
+			const float reach = (float)ring * Grid.cellSize;
+			if (found == K && best[K - 1] <= reach * reach)
+				break;
+		}
+
+		const uint base = IDX * K;
+		for (uint i = 0; i < K; ++i) {
+			indices[base + i] = (i < found) ? bestIndex[i] : QUERY_NONE;
+			distances2[base + i] = (i < found) ? best[i] : INFINITY;
+		}
+		counts[IDX] = found;
 	}
 )";
\ No newline at end of file
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <CL\cl.hpp>
+#include <mutex>
 #include <string>
-#include <tinythread.h>
+#include "jobs.hpp"
+
+
+// Creates and builds an OpenCL program for the current device, throws with the build log on failure. The caller
+// owns the returned program.
+cl_program buildProgram(const char *source, const char *options = nullptr);
 
 
 class Kernel
@@ -20,22 +26,37 @@ private:
 	cl_kernel m_kernel;
 	std::string m_fname;
 	State m_state;
-	mutable tthread::mutex m_mutex;
-	tthread::thread *m_thread;
+	mutable std::mutex m_mutex;
+	JobHandle m_waitJob;
 
 public:
 	Kernel(const char *source, const char *fname);
+	Kernel(cl_program program, const char *fname);		// Shares (and retains) an already built program
 	~Kernel();
 
 	inline const std::string& getFunctionName() const { return m_fname; }
-	inline State getState() const { tthread::lock_guard<tthread::mutex> lock(m_mutex); return m_state; }
-	inline bool isRunning() const { tthread::lock_guard<tthread::mutex> lock(m_mutex); return (m_state == WORKING); }
+	inline State getState() const { std::lock_guard<std::mutex> lock(m_mutex); return m_state; }
+	inline bool isRunning() const { std::lock_guard<std::mutex> lock(m_mutex); return (m_state == WORKING); }
 
 	void setKernelArgument(unsigned int pos, size_t size, const void* arg);
 
-	void executeNDRange(unsigned int numdim, const size_t* worksize, bool wait);
+	void executeNDRange(unsigned int numdim, const size_t* worksize, bool wait, cl_event* evt = nullptr);
+	// Only queues the kernel, for passes of several kernels that are waited for as a whole by the caller
+	void enqueueNDRange(unsigned int numdim, const size_t* worksize);
 };
 
 
 // For simplicity, just embed the kernel source into the executable
-extern const char * const ParticleKernelSource;
\ No newline at end of file
+extern const char * const ParticleKernelSource;
+// Initial condition generators, appended to ParticleKernelSource so both kernels come from one build
+extern const char * const ParticleInitKernelSource;
+// Tracer gather (see tracer.hpp), appended the same way
+extern const char * const ParticleGatherKernelSource;
+// Diagnostics reductions (see diagnostics.hpp), appended the same way
+extern const char * const ParticleReduceKernelSource;
+// Spatial grid construction and prefix sums (see spatialgrid.hpp), which starts the programs that search the grid
+extern const char * const ParticleGridKernelSource;
+// Friends-of-friends clustering over the grid (see clusters.hpp), appended to ParticleGridKernelSource
+extern const char * const ParticleClusterKernelSource;
+// Range and nearest neighbour queries over the grid (see spatialquery.hpp), appended to ParticleGridKernelSource
+extern const char * const ParticleQueryKernelSource;
\ No newline at end of file
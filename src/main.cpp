@@ -1,18 +1,77 @@
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
 
+#include "fastmath.hpp"
 #include "gpu.hpp"
+#include "jobs.hpp"
+#include "options.hpp"
+#include "playback.hpp"
+#include "profiler.hpp"
 #include "sim.hpp"
+#include "snapshot.hpp"
+#include "vksim.hpp"
 
 
 void mainloop();
+void mainloop_vulkan();
+void mainloop_playback();
+
+// Runs a batch of range and a batch of nearest neighbour queries at probes spread uniformly over the domain, and
+// reports their throughput
+void run_spatial_queries(Simulation& simulation, std::mt19937& rng)
+{
+	const vec2f dims = simulation.getDims();
+	std::uniform_real_distribution<float> ux(-0.5f * dims.x, 0.5f * dims.x);
+	std::uniform_real_distribution<float> uy(-0.5f * dims.y, 0.5f * dims.y);
+	std::vector<vec2f> probes(g_options.queryProbes);
+	for (vec2f& probe : probes)
+		probe = vec2f(ux(rng), uy(rng));
+
+	// Range queries list twice the particles a uniform state would have in the circle, and count the rest
+	const float spacing = std::sqrt((dims.x * dims.y) / (float)simulation.getParticleCount());
+	const float radius = g_options.queryRadius * spacing;
+	const uint32_t maxResults =
+		(uint32_t)std::ceil(2.0f * 3.14159265f * g_options.queryRadius * g_options.queryRadius);
+	const SpatialQueryResults& range = simulation.queryRange(probes.data(), probes.size(), radius, maxResults);
+	uint64_t found = 0;
+	for (size_t i = 0; i < range.probeCount; ++i)
+		found += range.counts[i];
+	const double buildSeconds = range.buildSeconds;
+	const double rangeRate = range.seconds > 0.0 ? (range.probeCount / range.seconds) : 0.0;
+	const double meanFound = range.probeCount ? ((double)found / range.probeCount) : 0.0;
+
+	const SpatialQueryResults& nearest = simulation.queryNearest(probes.data(), probes.size(),
+		g_options.queryNeighbours);
+	const double nearestRate = nearest.seconds > 0.0 ? (nearest.probeCount / nearest.seconds) : 0.0;
+
+	std::cout << "Spatial queries at step " << simulation.getStepCount() << ": " << probes.size() << " in range ("
+		<< meanFound << " found each) at " << rangeRate << " queries/s, " << probes.size() << " nearest "
+		<< g_options.queryNeighbours << " at " << nearestRate << " queries/s, grid built in "
+		<< (buildSeconds * 1000.0) << " ms (" << simulation.getQueriesPerSecond() << " queries/s overall)"
+		<< std::endl;
+}
 
 Simulation *TheSimulation = nullptr;
 
 int main(int argc, char **argv)
 {
 	try {
-		initialize_gl();
-		initialize_cl();
+		if (!parse_options(argc, argv))
+			return 0;
+
+		initialize_jobs(g_options.threads, g_options.pinThreads);
+		if (g_options.backend == BACKEND_VULKAN) {
+			initialize_window();
+			initialize_vulkan();
+		}
+		else
+			initialize_gl(g_options.backend == BACKEND_GLCOMPUTE);
+		if (g_options.backend == BACKEND_OPENCL)
+			initialize_cl();
+		g_profiler.initialize(g_options.backend != BACKEND_VULKAN);
 	}
 	catch (std::exception& ex) {
 		std::cerr << "Startup Error: \"" << ex.what() << "\"." << std::endl;
@@ -20,7 +79,10 @@ int main(int argc, char **argv)
 	}
 
 	try {
-		mainloop();
+		if (g_options.benchMath)
+			run_fastmath_benchmark();
+		else
+			mainloop();
 	}
 	catch (std::exception& ex) {
 		std::cerr << "Runtime Error: \"" << ex.what() << "\"." << std::endl;
@@ -28,8 +90,13 @@ int main(int argc, char **argv)
 	}
 
 	try {
+		if (g_trace.isEnabled())
+			g_trace.setEnabled(false);
+		g_profiler.shutdown();
 		shutdown_cl();
+		shutdown_vulkan();
 		shutdown_gl();
+		shutdown_jobs();
 	}
 	catch (std::exception& ex) {
 		std::cerr << "Shutdown Error: \"" << ex.what() << "\"." << std::endl;
@@ -44,23 +111,140 @@ int main(int argc, char **argv)
 
 void mainloop()
 {
-	TheSimulation = new Simulation(50000, 4, 4);
+	g_trace.setThreadName("Main Loop");
+
+	if (g_options.backend == BACKEND_VULKAN) {
+		mainloop_vulkan();
+		return;
+	}
+	if (!g_options.playbackPath.empty()) {
+		mainloop_playback();
+		return;
+	}
+
+	// The snapshot mapping is only needed until the state has been streamed to the solver
+	{
+		std::unique_ptr<Snapshot> snapshot;
+		if (!g_options.snapshotPath.empty())
+			snapshot.reset(new Snapshot(g_options.snapshotPath.c_str()));
+		TheSimulation = new Simulation(g_options.backend, g_options.renderStream, g_options.renderMode,
+			g_options.cull, g_options.initialCondition, g_options.seed, snapshot.get(),
+			snapshot ? snapshot->getParticleCount() : g_options.particleCount, 4, 4);
+	}
+	if (!g_options.checkpointPath.empty()) {
+		TheSimulation->enableCheckpoints(g_options.checkpointPath.c_str(), g_options.checkpointInterval,
+			g_options.checkpointThreshold);
+	}
+	if (!g_options.trajectoryPath.empty()) {
+		TheSimulation->enableTrajectory(g_options.trajectoryPath.c_str(), g_options.trajectoryStride,
+			g_options.trajectoryAttributes, g_options.trajectoryCodecs, g_options.trajectoryTolerance);
+	}
+	if (!g_options.tracerPath.empty())
+		TheSimulation->enableTracer(g_options.tracerPath.c_str(), g_options.tracerIds);
+	if (!g_options.diagnosticsPath.empty())
+		TheSimulation->enableDiagnostics(g_options.diagnosticsPath.c_str(), g_options.diagnosticsInterval);
+	if (!g_options.clusterPath.empty()) {
+		TheSimulation->enableClusters(g_options.clusterPath.c_str(), g_options.clusterInterval, g_options.clusterLinking,
+			g_options.clusterMinMembers);
+	}
 
 	glPointSize(2);
 
+	std::mt19937 queryRng((std::mt19937::result_type)g_options.seed);
+	uint64_t nextQueryStep = g_options.queryInterval;
 	float lastTime = (float)glfwGetTime();
 	while (!glfwWindowShouldClose(g_windowPtr)) {
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		g_profiler.beginFrame();
+
+		{
+			ScopedStageTimer timer(STAGE_CLEAR, true);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
 
 		float thisTime = (float)glfwGetTime();
 
 		TheSimulation->render(thisTime - lastTime);
 		lastTime = thisTime;
 
-		glfwSwapBuffers(g_windowPtr);
+		// Queried between frames like a downstream tool would, which rebuilds the grid once for both batches
+		if (g_options.queryProbes && TheSimulation->getStepCount() >= nextQueryStep) {
+			run_spatial_queries(*TheSimulation, queryRng);
+			nextQueryStep = TheSimulation->getStepCount() + g_options.queryInterval;
+		}
+
+		{
+			ScopedStageTimer timer(STAGE_SWAP);
+			glfwSwapBuffers(g_windowPtr);
+		}
 
 		glfwPollEvents();
+
+		g_profiler.endFrame();
 	}
 
 	delete TheSimulation;
+}
+
+void mainloop_vulkan()
+{
+	// Clearing and presenting are part of the frame recorded by the simulation
+	VulkanSimulation *simulation = nullptr;
+	{
+		std::unique_ptr<Snapshot> snapshot;
+		if (!g_options.snapshotPath.empty())
+			snapshot.reset(new Snapshot(g_options.snapshotPath.c_str()));
+		simulation = new VulkanSimulation(g_options.initialCondition, g_options.seed, snapshot.get(),
+			snapshot ? snapshot->getParticleCount() : g_options.particleCount, 4, 4);
+	}
+
+	float lastTime = (float)glfwGetTime();
+	while (!glfwWindowShouldClose(g_windowPtr)) {
+		g_profiler.beginFrame();
+
+		float thisTime = (float)glfwGetTime();
+
+		simulation->render(thisTime - lastTime);
+		lastTime = thisTime;
+
+		glfwPollEvents();
+
+		g_profiler.endFrame();
+	}
+
+	delete simulation;
+}
+
+void mainloop_playback()
+{
+	// Replays the trajectory through the same renderer, nothing is simulated
+	g_playback = new TrajectoryPlayback(g_options.playbackPath.c_str(), g_options.renderMode);
+
+	glPointSize(2);
+
+	float lastTime = (float)glfwGetTime();
+	while (!glfwWindowShouldClose(g_windowPtr)) {
+		g_profiler.beginFrame();
+
+		{
+			ScopedStageTimer timer(STAGE_CLEAR, true);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+
+		float thisTime = (float)glfwGetTime();
+
+		g_playback->render(thisTime - lastTime);
+		lastTime = thisTime;
+
+		{
+			ScopedStageTimer timer(STAGE_SWAP);
+			glfwSwapBuffers(g_windowPtr);
+		}
+
+		glfwPollEvents();
+
+		g_profiler.endFrame();
+	}
+
+	delete g_playback;
+	g_playback = nullptr;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#	define NOMINMAX
+#	include <Windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+
+// ================================================================================================
+MappedFile::MappedFile(const char *path, const char *kind, MappedAccess access) :
+	m_path{path},
+	m_data{nullptr},
+	m_size{0}
+{
+	// Map the whole file read only, the mapping stays valid after the handles are closed
+#if defined(_WIN32)
+	const DWORD hint = (access == MAPPED_ACCESS_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | hint, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error(std::string("Could not open ") + kind + " '" + path + "'");
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping) {
+		m_data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (!m_data)
+		throw std::runtime_error(std::string("Could not map ") + kind + " '" + path + "'");
+	m_size = (size_t)size.QuadPart;
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(std::string("Could not open ") + kind + " '" + path + "'");
+	struct stat info;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error(std::string("Could not map ") + kind + " '" + path + "'");
+	m_data = static_cast<const unsigned char*>(mapped);
+	m_size = (size_t)info.st_size;
+	madvise(mapped, m_size, (access == MAPPED_ACCESS_SEQUENTIAL) ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+}
+
+// ================================================================================================
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(m_data);
+#else
+	munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+}
+
+// ================================================================================================
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	if (offset >= m_size || !size)
+		return;
+	size = std::min(size, m_size - offset);
+
+#if defined(_WIN32)
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<unsigned char*>(m_data + offset);
+	range.NumberOfBytes = size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// The range has to start on a page, the mapping itself always does
+	static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t begin = offset - (offset % page);
+	madvise(const_cast<unsigned char*>(m_data + begin), size + (offset - begin), MADV_WILLNEED);
+#endif
+}
\ No newline at end of file
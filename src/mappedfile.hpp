@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+// How the pages of a mapping are going to be read, a hint for the readahead of the operating system
+enum MappedAccess :
+	unsigned char
+{
+	MAPPED_ACCESS_SEQUENTIAL = 0,	// Front to back, once
+	MAPPED_ACCESS_RANDOM = 1		// Seeks, where only the prefetched ranges should be read ahead
+};
+
+
+// A whole file mapped read only into memory. The pages are only read as they are touched, or ahead of time with
+// prefetch, so nothing has to be copied to host memory up front.
+class MappedFile
+{
+private:
+	std::string m_path;
+	const unsigned char *m_data;
+	size_t m_size;
+
+public:
+	// Maps the file, throws if it can not be opened or is empty. The kind names the file in the error messages.
+	MappedFile(const char *path, const char *kind, MappedAccess access);
+	~MappedFile();
+
+	inline const std::string& getPath() const { return m_path; }
+	inline const unsigned char* getData() const { return m_data; }
+	inline size_t getSize() const { return m_size; }
+	// If [offset, offset + size) is inside of the file
+	inline bool contains(size_t offset, size_t size) const { return (offset <= m_size) && (size <= m_size - offset); }
+
+	// Asks the operating system to start reading a range in the background, without waiting for it
+	void prefetch(size_t offset, size_t size) const;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+};
\ No newline at end of file
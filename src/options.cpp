@@ -0,0 +1,491 @@
+#include "options.hpp"
+#include "codec.hpp"
+#include "snapshot.hpp"
+#include "spatialquery.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+static_assert(sizeof(Options::trajectoryCodecs) / sizeof(unsigned int) == SNAPSHOT_ATTRIBUTE_COUNT,
+	"Options::trajectoryCodecs holds the stages of each SnapshotAttribute");
+
+Options g_options = {
+	BACKEND_OPENCL,		// backend
+	RENDER_STREAM_FULL,	// renderStream
+	RENDER_MODE_POINTS,	// renderMode
+	false,				// cull
+	INIT_UNIFORM,		// initialCondition
+	0,					// seed
+	50000,				// particleCount
+	"",					// snapshotPath
+	"",					// checkpointPath
+	60.0f,				// checkpointInterval
+	0.0f,				// checkpointThreshold
+	"",					// trajectoryPath
+	10,					// trajectoryStride
+	(1u << SNAPSHOT_POS_X) | (1u << SNAPSHOT_POS_Y) | (1u << SNAPSHOT_VEL_X) | (1u << SNAPSHOT_VEL_Y),	// trajectoryAttributes
+	{
+		TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY,
+		TRAJECTORY_CODEC_QUANTIZE | TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY,
+		TRAJECTORY_CODEC_QUANTIZE | TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY,
+		TRAJECTORY_CODEC_QUANTIZE | TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY,
+		TRAJECTORY_CODEC_QUANTIZE | TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY,
+		TRAJECTORY_CODEC_DELTA | TRAJECTORY_CODEC_ENTROPY
+	},					// trajectoryCodecs
+	1e-4f,				// trajectoryTolerance
+	"",					// playbackPath
+	"",					// tracerPath
+	{},					// tracerIds
+	"",					// diagnosticsPath
+	60,					// diagnosticsInterval
+	"",					// clusterPath
+	300,				// clusterInterval
+	0.2f,				// clusterLinking
+	8,					// clusterMinMembers
+	0,					// queryProbes
+	60,					// queryInterval
+	2.0f,				// queryRadius
+	8,					// queryNeighbours
+	0,					// threads
+	false,				// pinThreads
+	true,				// shaderCache
+	false				// benchMath
+};
+
+
+// ================================================================================================
+const char* getBackendName(SimulationBackend backend)
+{
+	switch (backend)
+	{
+	case BACKEND_OPENCL: return "opencl";
+	case BACKEND_CPU: return "cpu";
+	case BACKEND_GLCOMPUTE: return "glcompute";
+	case BACKEND_VULKAN: return "vulkan";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+const char* getRenderStreamName(RenderStreamMode mode)
+{
+	switch (mode)
+	{
+	case RENDER_STREAM_FULL: return "full";
+	case RENDER_STREAM_COMPACT: return "compact";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+const char* getRenderModeName(RenderMode mode)
+{
+	switch (mode)
+	{
+	case RENDER_MODE_POINTS: return "points";
+	case RENDER_MODE_DENSITY: return "density";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+const char* getInitialConditionName(InitialCondition init)
+{
+	switch (init)
+	{
+	case INIT_UNIFORM: return "uniform";
+	case INIT_DISK: return "disk";
+	case INIT_PLUMMER: return "plummer";
+	case INIT_GALAXY: return "galaxy";
+	case INIT_LATTICE: return "lattice";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+bool parse_options(int argc, char **argv)
+{
+	// Gets the value for an option, or throws if there is not one
+	const auto getvalue = [argc, argv](int& index) -> const char* {
+		if ((index + 1) >= argc)
+			throw std::runtime_error(std::string("Missing value for option '") + argv[index] + "'");
+		return argv[++index];
+	};
+	const auto getsize = [&getvalue](int& index) -> size_t {
+		const char *opt = getvalue(index);
+		char *end = nullptr;
+		const unsigned long long val = strtoull(opt, &end, 10);
+		if (!end || *end)
+			throw std::runtime_error(std::string("Invalid integer value '") + opt + "'");
+		return (size_t)val;
+	};
+	const auto getfloat = [&getvalue](int& index) -> float {
+		const char *opt = getvalue(index);
+		char *end = nullptr;
+		const double val = strtod(opt, &end);
+		if (!end || *end || !(val >= 0.0))
+			throw std::runtime_error(std::string("Invalid non-negative value '") + opt + "'");
+		return (float)val;
+	};
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "--help") || !strcmp(arg, "-h")) {
+			print_usage(argv[0]);
+			return false;
+		}
+		else if (!strcmp(arg, "--backend")) {
+			const char *name = getvalue(i);
+			if (!strcmp(name, "opencl"))
+				g_options.backend = BACKEND_OPENCL;
+			else if (!strcmp(name, "cpu"))
+				g_options.backend = BACKEND_CPU;
+			else if (!strcmp(name, "glcompute"))
+				g_options.backend = BACKEND_GLCOMPUTE;
+			else if (!strcmp(name, "vulkan"))
+				g_options.backend = BACKEND_VULKAN;
+			else
+				throw std::runtime_error(std::string("Unknown backend '") + name + "'");
+		}
+		else if (!strcmp(arg, "--render-stream")) {
+			const char *name = getvalue(i);
+			if (!strcmp(name, "full"))
+				g_options.renderStream = RENDER_STREAM_FULL;
+			else if (!strcmp(name, "compact"))
+				g_options.renderStream = RENDER_STREAM_COMPACT;
+			else
+				throw std::runtime_error(std::string("Unknown render stream mode '") + name + "'");
+		}
+		else if (!strcmp(arg, "--render-mode")) {
+			const char *name = getvalue(i);
+			if (!strcmp(name, "points"))
+				g_options.renderMode = RENDER_MODE_POINTS;
+			else if (!strcmp(name, "density"))
+				g_options.renderMode = RENDER_MODE_DENSITY;
+			else
+				throw std::runtime_error(std::string("Unknown render mode '") + name + "'");
+		}
+		else if (!strcmp(arg, "--cull")) {
+			g_options.cull = true;
+		}
+		else if (!strcmp(arg, "--init")) {
+			const char *name = getvalue(i);
+			if (!strcmp(name, "uniform"))
+				g_options.initialCondition = INIT_UNIFORM;
+			else if (!strcmp(name, "disk"))
+				g_options.initialCondition = INIT_DISK;
+			else if (!strcmp(name, "plummer"))
+				g_options.initialCondition = INIT_PLUMMER;
+			else if (!strcmp(name, "galaxy"))
+				g_options.initialCondition = INIT_GALAXY;
+			else if (!strcmp(name, "lattice"))
+				g_options.initialCondition = INIT_LATTICE;
+			else
+				throw std::runtime_error(std::string("Unknown initial condition '") + name + "'");
+		}
+		else if (!strcmp(arg, "--seed")) {
+			g_options.seed = getsize(i);
+		}
+		else if (!strcmp(arg, "--particles")) {
+			g_options.particleCount = getsize(i);
+			if (!g_options.particleCount)
+				throw std::runtime_error("The particle count must be greater than zero");
+		}
+		else if (!strcmp(arg, "--snapshot")) {
+			g_options.snapshotPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--checkpoint")) {
+			g_options.checkpointPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--checkpoint-interval")) {
+			g_options.checkpointInterval = getfloat(i);
+			if (g_options.checkpointInterval <= 0.0f)
+				throw std::runtime_error("The checkpoint interval must be greater than zero");
+		}
+		else if (!strcmp(arg, "--checkpoint-threshold")) {
+			g_options.checkpointThreshold = getfloat(i);
+		}
+		else if (!strcmp(arg, "--trajectory")) {
+			g_options.trajectoryPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--trajectory-stride")) {
+			g_options.trajectoryStride = (unsigned int)getsize(i);
+			if (!g_options.trajectoryStride)
+				throw std::runtime_error("The trajectory stride must be greater than zero");
+		}
+		else if (!strcmp(arg, "--trajectory-attributes")) {
+			// Comma separated, where pos and vel stand for both of their components
+			std::string list = getvalue(i);
+			g_options.trajectoryAttributes = 0;
+			size_t start = 0;
+			while (start <= list.size()) {
+				const size_t end = std::min(list.find(',', start), list.size());
+				const std::string name = list.substr(start, end - start);
+				if (name == "mass")
+					g_options.trajectoryAttributes |= (1u << SNAPSHOT_MASS);
+				else if (name == "pos")
+					g_options.trajectoryAttributes |= (1u << SNAPSHOT_POS_X) | (1u << SNAPSHOT_POS_Y);
+				else if (name == "vel")
+					g_options.trajectoryAttributes |= (1u << SNAPSHOT_VEL_X) | (1u << SNAPSHOT_VEL_Y);
+				else if (name == "id")
+					g_options.trajectoryAttributes |= (1u << SNAPSHOT_ID);
+				else
+					throw std::runtime_error(std::string("Unknown trajectory attribute '") + name + "'");
+				start = end + 1;
+			}
+		}
+		else if (!strcmp(arg, "--trajectory-codec")) {
+			// Comma separated <attribute>=<stages>, where the stages are joined by '+'
+			std::string list = getvalue(i);
+			size_t start = 0;
+			while (start <= list.size()) {
+				const size_t end = std::min(list.find(',', start), list.size());
+				const std::string entry = list.substr(start, end - start);
+				const size_t equals = entry.find('=');
+				if (equals == std::string::npos)
+					throw std::runtime_error(std::string("Expected <attribute>=<stages> instead of '") + entry + "'");
+
+				uint32_t codec = 0;
+				const std::string stages = entry.substr(equals + 1);
+				size_t stageStart = 0;
+				while (stageStart <= stages.size()) {
+					const size_t stageEnd = std::min(stages.find('+', stageStart), stages.size());
+					const std::string stage = stages.substr(stageStart, stageEnd - stageStart);
+					if (stage == "quantize")
+						codec |= TRAJECTORY_CODEC_QUANTIZE;
+					else if (stage == "delta")
+						codec |= TRAJECTORY_CODEC_DELTA;
+					else if (stage == "entropy")
+						codec |= TRAJECTORY_CODEC_ENTROPY;
+					else if (stage != "raw")
+						throw std::runtime_error(std::string("Unknown trajectory codec stage '") + stage + "'");
+					stageStart = stageEnd + 1;
+				}
+
+				const std::string name = entry.substr(0, equals);
+				if (name == "mass") {
+					g_options.trajectoryCodecs[SNAPSHOT_MASS] = codec;
+				}
+				else if (name == "pos") {
+					g_options.trajectoryCodecs[SNAPSHOT_POS_X] = codec;
+					g_options.trajectoryCodecs[SNAPSHOT_POS_Y] = codec;
+				}
+				else if (name == "vel") {
+					g_options.trajectoryCodecs[SNAPSHOT_VEL_X] = codec;
+					g_options.trajectoryCodecs[SNAPSHOT_VEL_Y] = codec;
+				}
+				else if (name == "id") {
+					g_options.trajectoryCodecs[SNAPSHOT_ID] = codec;
+				}
+				else {
+					throw std::runtime_error(std::string("Unknown trajectory attribute '") + name + "'");
+				}
+				start = end + 1;
+			}
+		}
+		else if (!strcmp(arg, "--trajectory-tolerance")) {
+			g_options.trajectoryTolerance = getfloat(i);
+			if (!(g_options.trajectoryTolerance > 0.0f))
+				throw std::runtime_error("The trajectory tolerance must be greater than zero");
+		}
+		else if (!strcmp(arg, "--playback")) {
+			g_options.playbackPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--tracer")) {
+			g_options.tracerPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--tracer-ids")) {
+			// Comma separated ids, or inclusive ranges of them as <first>-<last>
+			std::string list = getvalue(i);
+			g_options.tracerIds.clear();
+			size_t start = 0;
+			while (start <= list.size()) {
+				const size_t end = std::min(list.find(',', start), list.size());
+				const std::string entry = list.substr(start, end - start);
+				const char *text = entry.c_str();
+				char *next = nullptr;
+				const unsigned long long first = strtoull(text, &next, 10);
+				unsigned long long last = first;
+				if (next != text && *next == '-') {
+					const char *lastText = next + 1;
+					last = strtoull(lastText, &next, 10);
+					if (next == lastText)
+						next = nullptr;
+				}
+				if (!next || next == text || *next || first > last || last > UINT32_MAX)
+					throw std::runtime_error(std::string("Invalid tracer id or range '") + entry + "'");
+				for (unsigned long long id = first; id <= last; ++id)
+					g_options.tracerIds.push_back((uint32_t)id);
+				start = end + 1;
+			}
+			std::sort(g_options.tracerIds.begin(), g_options.tracerIds.end());
+			g_options.tracerIds.erase(std::unique(g_options.tracerIds.begin(), g_options.tracerIds.end()),
+				g_options.tracerIds.end());
+		}
+		else if (!strcmp(arg, "--diagnostics")) {
+			g_options.diagnosticsPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--diagnostics-interval")) {
+			g_options.diagnosticsInterval = (unsigned int)getsize(i);
+			if (!g_options.diagnosticsInterval)
+				throw std::runtime_error("The diagnostics interval must be greater than zero");
+		}
+		else if (!strcmp(arg, "--clusters")) {
+			g_options.clusterPath = getvalue(i);
+		}
+		else if (!strcmp(arg, "--cluster-interval")) {
+			g_options.clusterInterval = (unsigned int)getsize(i);
+			if (!g_options.clusterInterval)
+				throw std::runtime_error("The cluster interval must be greater than zero");
+		}
+		else if (!strcmp(arg, "--cluster-linking")) {
+			g_options.clusterLinking = getfloat(i);
+			if (!(g_options.clusterLinking > 0.0f))
+				throw std::runtime_error("The cluster linking length must be greater than zero");
+		}
+		else if (!strcmp(arg, "--cluster-min-members")) {
+			g_options.clusterMinMembers = (unsigned int)getsize(i);
+			if (!g_options.clusterMinMembers)
+				throw std::runtime_error("Clusters need at least one member");
+		}
+		else if (!strcmp(arg, "--query-probes")) {
+			g_options.queryProbes = (unsigned int)getsize(i);
+		}
+		else if (!strcmp(arg, "--query-interval")) {
+			g_options.queryInterval = (unsigned int)getsize(i);
+			if (!g_options.queryInterval)
+				throw std::runtime_error("The query interval must be greater than zero");
+		}
+		else if (!strcmp(arg, "--query-radius")) {
+			g_options.queryRadius = getfloat(i);
+			if (!(g_options.queryRadius >= 0.0f))
+				throw std::runtime_error("The query radius must not be negative");
+		}
+		else if (!strcmp(arg, "--query-k")) {
+			g_options.queryNeighbours = (unsigned int)getsize(i);
+			if (!g_options.queryNeighbours || g_options.queryNeighbours > QUERY_MAX_K)
+				throw std::runtime_error("The query neighbour count must be between 1 and "
+					+ std::to_string(QUERY_MAX_K));
+		}
+		else if (!strcmp(arg, "--threads")) {
+			g_options.threads = (unsigned int)getsize(i);
+		}
+		else if (!strcmp(arg, "--pin")) {
+			g_options.pinThreads = true;
+		}
+		else if (!strcmp(arg, "--no-shader-cache")) {
+			g_options.shaderCache = false;
+		}
+		else if (!strcmp(arg, "--bench-math")) {
+			g_options.benchMath = true;
+		}
+		else {
+			throw std::runtime_error(std::string("Unknown option '") + arg + "'");
+		}
+	}
+
+	// Culling compacts the visible particles into the render stream on the device
+	if (g_options.cull) {
+		if (g_options.backend != BACKEND_OPENCL)
+			throw std::runtime_error("Culling (--cull) requires the opencl backend");
+		g_options.renderStream = RENDER_STREAM_COMPACT;
+	}
+
+	// The Vulkan renderer only draws the full state as point sprites
+	if (g_options.backend == BACKEND_VULKAN) {
+		if (g_options.renderStream != RENDER_STREAM_FULL || g_options.renderMode != RENDER_MODE_POINTS)
+			throw std::runtime_error("The vulkan backend only supports --render-stream full and --render-mode points");
+		if (!g_options.checkpointPath.empty() || !g_options.trajectoryPath.empty() || !g_options.tracerPath.empty()
+			|| !g_options.diagnosticsPath.empty())
+			throw std::runtime_error("Checkpoints, trajectories, tracers and diagnostics are not supported by the vulkan "
+				"backend");
+	}
+
+	// Clusters are linked on the OpenCL device, or on the host for the CPU solver
+	if (!g_options.clusterPath.empty() && g_options.backend != BACKEND_OPENCL && g_options.backend != BACKEND_CPU)
+		throw std::runtime_error("Clusters (--clusters) require the opencl or cpu backend");
+	// Like the clusters, queries search a grid built by OpenCL kernels or on the host
+	if (g_options.queryProbes && g_options.backend != BACKEND_OPENCL && g_options.backend != BACKEND_CPU)
+		throw std::runtime_error("Spatial queries (--query-probes) require the opencl or cpu backend");
+
+	// The tracer follows an explicit subset, writing every particle each step is what trajectories are for
+	if (!g_options.tracerPath.empty() && g_options.tracerIds.empty())
+		throw std::runtime_error("A tracer (--tracer) needs the ids to follow (--tracer-ids)");
+	// The count of a snapshot is only known once it is opened, the tracer checks its ids again then
+	if (!g_options.tracerIds.empty() && g_options.snapshotPath.empty()
+		&& g_options.tracerIds.back() >= g_options.particleCount)
+		throw std::runtime_error("Tracer ids (--tracer-ids) have to be below the particle count");
+
+	// Playback only draws, through the OpenGL renderer, so there is no state to write out
+	if (!g_options.playbackPath.empty()) {
+		if (g_options.backend == BACKEND_VULKAN)
+			throw std::runtime_error("Playback (--playback) is not supported by the vulkan backend");
+		if (!g_options.checkpointPath.empty() || !g_options.trajectoryPath.empty() || !g_options.tracerPath.empty()
+			|| !g_options.diagnosticsPath.empty() || !g_options.clusterPath.empty() || g_options.queryProbes)
+			throw std::runtime_error("Checkpoints, trajectories, tracers, diagnostics, clusters and queries are not "
+				"available during playback");
+	}
+
+	return true;
+}
+
+// ================================================================================================
+void print_usage(const char *exename)
+{
+	std::cout << "Usage: " << exename << " [options]" << std::endl
+		<< "  --backend <opencl|cpu|glcompute|vulkan>  Simulation implementation to use, glcompute needs" << std::endl
+		<< "                          OpenGL 4.3 and vulkan needs Vulkan 1.2 (default: opencl)" << std::endl
+		<< "  --render-stream <full|compact>  Share the full particle state with OpenGL, or only quantized" << std::endl
+		<< "                          positions written by the step (default: full)" << std::endl
+		<< "  --render-mode <points|density>  Draw sprites, or accumulate a tone mapped density image for" << std::endl
+		<< "                          large particle counts (default: points)" << std::endl
+		<< "  --cull                  Only draw visible particles, subsampled when zoomed out (opencl only," << std::endl
+		<< "                          implies --render-stream compact)" << std::endl
+		<< "  --init <uniform|disk|plummer|galaxy|lattice>  Initial distribution of the particles, generated" << std::endl
+		<< "                          on the OpenCL device or host workers (default: uniform)" << std::endl
+		<< "  --seed <value>          Seed of the initial distribution, which it reproduces exactly (default: 0)" << std::endl
+		<< "  --particles <count>     Number of simulated particles (default: 50000)" << std::endl
+		<< "  --snapshot <path>       Start from the state in a snapshot file, overrides --particles and --init" << std::endl
+		<< "  --checkpoint <path>     Write checkpoints to <path>.0 and <path>.1 in turn, which --snapshot can" << std::endl
+		<< "                          restart from (not with vulkan)" << std::endl
+		<< "  --checkpoint-interval <seconds>  Simulated time between checkpoints (default: 60)" << std::endl
+		<< "  --checkpoint-threshold <value>  Only rewrite chunks of a checkpoint that changed by more than this," << std::endl
+		<< "                          zero keeps them bit exact (default: 0)" << std::endl
+		<< "  --trajectory <path>     Write the particle state to a columnar trajectory file (not with vulkan)" << std::endl
+		<< "  --trajectory-stride <steps>  Simulation steps between trajectory frames (default: 10)" << std::endl
+		<< "  --trajectory-attributes <list>  Comma separated attributes of each frame, from mass, pos, vel and id" << std::endl
+		<< "                          (default: pos,vel)" << std::endl
+		<< "  --trajectory-codec <list>  Comma separated <attribute>=<stages>, with stages from raw, quantize, delta" << std::endl
+		<< "                          and entropy joined by '+' (default: pos and vel quantize+delta+entropy," << std::endl
+		<< "                          mass and id delta+entropy, where id is never quantized)" << std::endl
+		<< "  --trajectory-tolerance <fraction>  Largest quantization error, relative to the domain size" << std::endl
+		<< "                          (default: 1e-4)" << std::endl
+		<< "  --playback <path>       Replay a trajectory file instead of simulating. Space pauses, left and right" << std::endl
+		<< "                          step a frame, page up and down jump a tenth of the file, and up and down" << std::endl
+		<< "                          double or halve the frames advanced per displayed frame" << std::endl
+		<< "  --tracer <path>         Write the state of the particles in --tracer-ids to a small file every step" << std::endl
+		<< "                          (not with vulkan)" << std::endl
+		<< "  --tracer-ids <list>     Comma separated particle ids the tracer follows, or ranges as <first>-<last>" << std::endl
+		<< "  --diagnostics <path>    Write energies, momenta, centre of mass, velocity dispersion and a radial" << std::endl
+		<< "                          density histogram as CSV, reduced on the device (not with vulkan)" << std::endl
+		<< "  --diagnostics-interval <steps>  Simulation steps between diagnostics rows (default: 60)" << std::endl
+		<< "  --clusters <path>       Find friends-of-friends clusters and write their members and summaries" << std::endl
+		<< "                          (opencl and cpu only)" << std::endl
+		<< "  --cluster-interval <steps>  Simulation steps between cluster passes (default: 300)" << std::endl
+		<< "  --cluster-linking <fraction>  Linking length, relative to the mean particle spacing (default: 0.2)" << std::endl
+		<< "  --cluster-min-members <count>  Smallest group of friends kept as a cluster (default: 8)" << std::endl
+		<< "  --query-probes <count>  Run batches of range and nearest neighbour queries at random probes against" << std::endl
+		<< "                          the live state, and report their throughput (opencl and cpu only)" << std::endl
+		<< "  --query-interval <steps>  Simulation steps between query batches (default: 60)" << std::endl
+		<< "  --query-radius <spacings>  Range query radius, in mean particle spacings (default: 2)" << std::endl
+		<< "  --query-k <count>       Neighbours of each nearest neighbour query, up to 32 (default: 8)" << std::endl
+		<< "  --threads <count>       Number of job system workers (default: one per hardware thread)" << std::endl
+		<< "  --pin                   Pin job system workers to individual cores" << std::endl
+		<< "  --no-shader-cache       Always compile the OpenGL programs from source, instead of loading the" << std::endl
+		<< "                          binaries cached from an earlier run" << std::endl
+		<< "  --bench-math            Benchmark the fast math tiers on the host and OpenCL device, then exit" << std::endl;
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// The available implementations of the particle simulation step
+enum SimulationBackend :
+	unsigned char
+{
+	BACKEND_OPENCL = 0,		// OpenCL kernels with OpenGL buffer sharing
+	BACKEND_CPU = 1,		// Native multithreaded SIMD implementation on the host
+	BACKEND_GLCOMPUTE = 2,	// OpenGL 4.3 compute shaders on the vertex buffers, no OpenCL
+	BACKEND_VULKAN = 3		// Vulkan 1.2 compute and graphics pipelines, no OpenGL or OpenCL
+};
+
+const char* getBackendName(SimulationBackend backend);
+
+
+// What is shared with OpenGL for drawing the particles
+enum RenderStreamMode :
+	unsigned char
+{
+	RENDER_STREAM_FULL = 0,		// The full simulation state is the vertex buffer
+	RENDER_STREAM_COMPACT = 1	// The state stays in backend memory, the step writes quantized positions for drawing
+};
+
+const char* getRenderStreamName(RenderStreamMode mode);
+
+
+// How the particles are drawn
+enum RenderMode :
+	unsigned char
+{
+	RENDER_MODE_POINTS = 0,		// Alpha blended, depth tested point sprites
+	RENDER_MODE_DENSITY = 1		// Additive single pixel splats into a density target, then tone mapped
+};
+
+const char* getRenderModeName(RenderMode mode);
+
+
+// Distribution of the particles at startup
+enum InitialCondition :
+	unsigned char
+{
+	INIT_UNIFORM = 0,	// Uniform over the simulation rectangle, at rest
+	INIT_DISK = 1,		// Exponential disk around the attractor, at rest
+	INIT_PLUMMER = 2,	// Projected Plummer profile around the attractor, at rest
+	INIT_GALAXY = 3,	// Exponential disk with two spiral arms, on circular orbits around the attractor
+	INIT_LATTICE = 4	// Regular grid over the simulation rectangle, at rest
+};
+
+const char* getInitialConditionName(InitialCondition init);
+
+
+// Runtime options, parsed from the command line
+struct Options
+{
+	SimulationBackend backend;
+	RenderStreamMode renderStream;
+	RenderMode renderMode;
+	bool cull;				// Cull and subsample the particles on the device before drawing
+	InitialCondition initialCondition;
+	unsigned long long seed;	// Key of the initial condition random numbers
+	size_t particleCount;
+	std::string snapshotPath;	// Initial state file, replaces the generated condition when set
+	std::string checkpointPath;	// Base name of the checkpoint files, none are written when empty
+	float checkpointInterval;	// Simulated seconds between checkpoints
+	float checkpointThreshold;	// Smallest change that rewrites a chunk, zero for bit exact checkpoints
+	std::string trajectoryPath;	// Trajectory output file, none is written when empty
+	unsigned int trajectoryStride;		// Simulation steps between trajectory frames
+	unsigned int trajectoryAttributes;	// Bit per SnapshotAttribute written to the trajectory
+	unsigned int trajectoryCodecs[6];	// TrajectoryCodec stages of each SnapshotAttribute
+	float trajectoryTolerance;	// Quantization error bound, as a fraction of the domain size
+	std::string playbackPath;	// Trajectory to replay instead of simulating, when set
+	std::string tracerPath;		// Tracer output file, written every step, none is written when empty
+	std::vector<uint32_t> tracerIds;	// Sorted particle ids the tracer follows, without duplicates
+	std::string diagnosticsPath;	// Diagnostics time series (CSV), none is written when empty
+	unsigned int diagnosticsInterval;	// Simulation steps between diagnostics reductions
+	std::string clusterPath;	// Cluster output file, none is written when empty
+	unsigned int clusterInterval;	// Simulation steps between cluster passes
+	float clusterLinking;		// Linking length, as a fraction of the mean particle spacing
+	unsigned int clusterMinMembers;	// Smallest group of friends that is kept as a cluster
+	unsigned int queryProbes;	// Probes of the spatial query batches run while simulating, none are run when zero
+	unsigned int queryInterval;	// Simulation steps between spatial query batches
+	float queryRadius;			// Range query radius, as a multiple of the mean particle spacing
+	unsigned int queryNeighbours;	// Particles found by each nearest neighbour query
+	unsigned int threads;	// Job system workers, zero to size to the hardware
+	bool pinThreads;
+	bool shaderCache;		// Load and store linked OpenGL programs in the working directory
+	bool benchMath;			// Run the fast math benchmark instead of the simulation
+};
+
+extern Options g_options;
+
+// Parses the command line into g_options, throws on invalid options. Returns false if the program should exit.
+bool parse_options(int argc, char **argv);
+void print_usage(const char *exename);
\ No newline at end of file
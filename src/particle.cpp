@@ -1,9 +1,185 @@
 #include "particle.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 const size_t ParticleFormatSpecifierCount = 4;
 const vertex_format_specifier_t ParticleFormatSpecifier[4] = {
-	{ 0, 1, GL_FLOAT, 7 * sizeof(GLfloat), 0 },					// Mass
-	{ 1, 2, GL_FLOAT, 7 * sizeof(GLfloat), 1 * sizeof(GLfloat) },	// Position
-	{ 2, 2, GL_FLOAT, 7 * sizeof(GLfloat), 3 * sizeof(GLfloat) },	// Velocity
-	{ 3, 2, GL_FLOAT, 7 * sizeof(GLfloat), 5 * sizeof(GLfloat) }	// Acceleration
-};
\ No newline at end of file
+	{ 0, 1, GL_FLOAT, sizeof(Particle), 0 },					// Mass
+	{ 1, 2, GL_FLOAT, sizeof(Particle), 1 * sizeof(GLfloat) },	// Position
+	{ 2, 2, GL_FLOAT, sizeof(Particle), 3 * sizeof(GLfloat) },	// Velocity
+	{ 3, 2, GL_FLOAT, sizeof(Particle), 5 * sizeof(GLfloat) }	// Acceleration
+};
+
+
+// ================================================================================================
+void getRenderStreamFormat(size_t count, vertex_format_specifier_t (&fmt)[2])
+{
+	fmt[0] = { 0, 2, GL_UNSIGNED_SHORT, 2 * sizeof(GLushort), 0, true };				// Position
+	fmt[1] = { 1, 1, GL_UNSIGNED_BYTE, sizeof(GLubyte), count * 2 * sizeof(GLushort), true };	// Speed key
+}
+
+// ================================================================================================
+void encodeRenderStream(const float *x, const float *y, const float *vx, const float *vy, size_t begin, size_t end,
+	size_t count, void *stream)
+{
+	uint16_t *positions = static_cast<uint16_t*>(stream);
+	uint8_t *keys = static_cast<uint8_t*>(stream) + (count * 2 * sizeof(uint16_t));
+
+	const float posscale = 0.5f / RENDER_STREAM_EXTENT;
+	const float keyscale = 255.0f / RENDER_STREAM_SPEED_SCALE;
+	for (size_t i = begin; i < end; ++i) {
+		const float ux = std::fmin(std::fmax((x[i] * posscale) + 0.5f, 0.0f), 1.0f);
+		const float uy = std::fmin(std::fmax((y[i] * posscale) + 0.5f, 0.0f), 1.0f);
+		const float speed = std::sqrt((vx[i] * vx[i]) + (vy[i] * vy[i]));
+		positions[(i * 2) + 0] = (uint16_t)((ux * 65535.0f) + 0.5f);
+		positions[(i * 2) + 1] = (uint16_t)((uy * 65535.0f) + 0.5f);
+		keys[i] = (uint8_t)(std::fmin(speed * keyscale, 255.0f) + 0.5f);
+	}
+}
+
+// Shared by the frame parameters and the orbits of the initial conditions
+static const float ATTRACTOR_STRENGTH = 5.0f;
+static const float TWO_PI = 6.28318530718f;
+
+
+// ================================================================================================
+void setFrameSimulationParams(FrameParams& params, float totalTime, float dtime)
+{
+	// Pulse field oscillating along the radial direction, a non-zero phase rotates it
+	const float pulseAmount = std::sin(totalTime * 2.0f) * 1.0f;
+	const float pulsePhase = 0.0f;
+
+	params.attractor = { 0.0f, 0.0f };
+	params.pulse = { pulseAmount * std::cos(pulsePhase), pulseAmount * std::sin(pulsePhase) };
+	params.deltaTime = dtime;
+	params.totalTime = totalTime;
+	params.fieldStrength = 0.1f;
+	params.attractorStrength = ATTRACTOR_STRENGTH;
+}
+
+// ================================================================================================
+InitParams makeInitParams(InitialCondition model, unsigned long long seed, size_t count, float xdim, float ydim)
+{
+	InitParams params;
+	params.key[0] = (uint32_t)seed;
+	params.key[1] = (uint32_t)(seed >> 32);
+	params.model = model;
+	params.count = (uint32_t)count;
+	params.dims = { xdim, ydim };
+	params.attractorStrength = ATTRACTOR_STRENGTH;
+
+	// Smallest square that holds all of the particles
+	uint32_t side = (uint32_t)std::sqrt((double)count);
+	while ((size_t)side * side < count)
+		++side;
+	params.latticeSide = std::max(side, 1u);
+	return params;
+}
+
+// ================================================================================================
+static inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t& hi)
+{
+	const uint64_t product = (uint64_t)a * b;
+	hi = (uint32_t)(product >> 32);
+	return (uint32_t)product;
+}
+
+// ================================================================================================
+static void philox4x32(uint32_t (&ctr)[4], uint32_t key0, uint32_t key1)
+{
+	// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3")
+	for (int i = 0; i < 10; ++i) {
+		uint32_t hi0, hi1;
+		const uint32_t lo0 = mulhilo(0xD2511F53u, ctr[0], hi0);
+		const uint32_t lo1 = mulhilo(0xCD9E8D57u, ctr[2], hi1);
+		const uint32_t next[4] = { hi1 ^ ctr[1] ^ key0, lo1, hi0 ^ ctr[3] ^ key1, lo0 };
+		ctr[0] = next[0]; ctr[1] = next[1]; ctr[2] = next[2]; ctr[3] = next[3];
+		key0 += 0x9E3779B9u;
+		key1 += 0xBB67AE85u;
+	}
+}
+
+// ================================================================================================
+static inline float toUniform(uint32_t bits)
+{
+	// [0, 1) from the top 24 bits, which are exact in a float
+	return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// ================================================================================================
+static void generateParticleRange(Particle *particles, size_t begin, size_t end, const InitParams& params)
+{
+	const float halfx = params.dims.x / 2.0f;
+	const float halfy = params.dims.y / 2.0f;
+	const float radius = std::min(halfx, halfy);
+
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t ctr[4] = { (uint32_t)i, 0, 0, 0 };
+		philox4x32(ctr, params.key[0], params.key[1]);
+		const float u[4] = { toUniform(ctr[0]), toUniform(ctr[1]), toUniform(ctr[2]), toUniform(ctr[3]) };
+
+		vec2f pos = { 0.0f, 0.0f };
+		vec2f vel = { 0.0f, 0.0f };
+		switch (params.model)
+		{
+		case INIT_DISK:
+		case INIT_GALAXY: {
+			// Surface density exp(-r / h) has radii distributed as Gamma(2, h), the sum of two exponentials
+			const float scale = radius / 4.0f;
+			const float r = std::min(-scale * std::log((1.0f - u[0]) * (1.0f - u[1])), radius * 2.0f);
+			float angle = TWO_PI * u[2];
+			if (params.model == INIT_GALAXY) {
+				// Two logarithmic arms, with the angle spread around them, on circular orbits of the attractor
+				// (acceleration strength * r / (r + 1)^3)
+				angle = ((u[3] < 0.5f) ? 0.0f : (TWO_PI / 2.0f)) + (2.5f * std::log(1.0f + (r / scale)))
+					+ ((u[2] - 0.5f) * 0.8f);
+				const float speed = r * std::sqrt(params.attractorStrength / ((r + 1.0f) * (r + 1.0f) * (r + 1.0f)));
+				vel = { -std::sin(angle) * speed, std::cos(angle) * speed };
+			}
+			pos = { std::cos(angle) * r, std::sin(angle) * r };
+			break;
+		}
+		case INIT_PLUMMER: {
+			// Projected Plummer profile, the enclosed fraction r^2 / (r^2 + a^2) inverted, cut off at 99%
+			const float scale = radius / 4.0f;
+			const float m = u[0] * 0.99f;
+			const float r = scale * std::sqrt(m / (1.0f - m));
+			const float angle = TWO_PI * u[1];
+			pos = { std::cos(angle) * r, std::sin(angle) * r };
+			break;
+		}
+		case INIT_LATTICE: {
+			const uint32_t side = params.latticeSide;
+			const float col = (float)((uint32_t)i % side) + 0.5f;
+			const float row = (float)((uint32_t)i / side) + 0.5f;
+			pos = { ((col / side) * params.dims.x) - halfx, ((row / side) * params.dims.y) - halfy };
+			break;
+		}
+		default:
+			pos = { (u[0] * params.dims.x) - halfx, (u[1] * params.dims.y) - halfy };
+			break;
+		}
+
+		Particle& part = particles[i];
+		part.mass = 1.0f;
+		part.pos = pos;
+		part.vel = vel;
+		part.acc = { 0.0f, 0.0f };
+		part.id = (uint32_t)i;
+	}
+}
+
+// ================================================================================================
+void generateInitialParticles(Particle *particles, const InitParams& params)
+{
+	g_jobs->wait(generateInitialParticlesAsync(particles, params));
+}
+
+// ================================================================================================
+JobHandle generateInitialParticlesAsync(Particle *particles, const InitParams& params)
+{
+	return g_jobs->parallel_for_async(0, params.count, 16384, [=](size_t begin, size_t end) {
+		generateParticleRange(particles, begin, end, params);
+	});
+}
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <glm\glm.hpp>
+#include <cstdint>
+#include "jobs.hpp"
+#include "options.hpp"
 #include "vbo.hpp"
 
 
@@ -43,15 +46,75 @@ public:
 		};
 		vec2f acc;
 	};
+	// Stays with the particle through every pass that reorders the state, generated particles are numbered by index
+	uint32_t id;
 
 public:
 	Particle() :
 		mass{0},
 		pos{0, 0},
 		vel{0, 0},
-		acc{0, 0}
+		acc{0, 0},
+		id{0}
 	{ 
 		
 	}
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+static_assert(sizeof(Particle) == 32, "Particle must match the layout of the kernel and shader types");
+
+
+// Per-frame simulation parameters (mirror of the kernel FrameParams type). Everything in here only depends on the
+// frame, so it is computed once on the host and read from constant memory by every work-item.
+struct FrameParams
+{
+	vec2f attractor;			// Position of the central attractor
+	vec2f pulse;				// Pulse field amplitude, rotated by the pulse phase
+	float deltaTime;
+	float totalTime;
+	float fieldStrength;		// Strength of the rotational velocity field
+	float attractorStrength;	// Acceleration scale of the attractor force
+	glm::vec4 viewBounds;		// Visible simulation rectangle as (min x, min y, max x, max y), for culling
+	float lodKeep;				// Fraction of the visible particles that are drawn when culling
+	float padding[3];
+};
+static_assert(sizeof(FrameParams) == 64, "FrameParams must match the layout of the kernel type");
+
+// Sets the simulation terms of the frame parameters for the frame starting at totalTime, which are the same for
+// every backend. The view dependent culling terms are left alone.
+void setFrameSimulationParams(FrameParams& params, float totalTime, float dtime);
+
+// Parameters of the initial condition generators (mirror of the kernel InitParams type). Every particle draws its
+// random numbers from Philox4x32-10 with its index as the counter and the seed as the key, so a seed gives the same
+// state however the work is split, on the host workers or in the Initialize kernel.
+struct InitParams
+{
+	uint32_t key[2];			// Seed, low word first
+	uint32_t model;				// InitialCondition
+	uint32_t count;
+	vec2f dims;					// Size of the rectangle around the origin that the distributions are scaled to
+	float attractorStrength;	// For the orbital velocities of INIT_GALAXY
+	uint32_t latticeSide;		// Columns of INIT_LATTICE
+};
+static_assert(sizeof(InitParams) == 32, "InitParams must match the layout of the kernel type");
+
+InitParams makeInitParams(InitialCondition model, unsigned long long seed, size_t count, float xdim, float ydim);
+
+// Fills the particles with the initial condition, on the job system workers
+void generateInitialParticles(Particle *particles, const InitParams& params);
+// As above, but returns without waiting. The array must stay alive until the returned job completes.
+JobHandle generateInitialParticlesAsync(Particle *particles, const InitParams& params);
+
+
+// Layout of the compact render stream (RENDER_STREAM_COMPACT): the positions of all particles as normalized ushort2
+// over [-RENDER_STREAM_EXTENT, RENDER_STREAM_EXTENT], followed by one normalized uchar speed key per particle over
+// [0, RENDER_STREAM_SPEED_SCALE]. Particles outside of the extent are clamped to its edge.
+#define RENDER_STREAM_EXTENT 8.0f
+#define RENDER_STREAM_SPEED_SCALE 2.0f
+#define RENDER_STREAM_BYTES_PER_PARTICLE 5
+
+// Vertex formats of the compact render stream, for the given particle count
+void getRenderStreamFormat(size_t count, vertex_format_specifier_t (&fmt)[2]);
+// Writes particles [begin, end) of a render stream for count particles from attribute columns
+void encodeRenderStream(const float *x, const float *y, const float *vx, const float *vy, size_t begin, size_t end,
+	size_t count, void *stream);
\ No newline at end of file
@@ -0,0 +1,338 @@
+#include "playback.hpp"
+#include "jobs.hpp"
+#include "particle.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+TrajectoryPlayback *g_playback = nullptr;
+
+// Polls of an idle decoder that only yield, before it sleeps between polls instead
+static const unsigned int PLAYBACK_SPIN_POLLS = 64;
+static const size_t PLAYBACK_GRAIN = 16 * 1024;
+// Attributes that the render stream is built from, velocities are optional and only color the particles
+static const uint32_t PLAYBACK_POSITIONS = (1u << SNAPSHOT_POS_X) | (1u << SNAPSHOT_POS_Y);
+static const uint32_t PLAYBACK_ATTRIBUTES = PLAYBACK_POSITIONS | (1u << SNAPSHOT_VEL_X) | (1u << SNAPSHOT_VEL_Y);
+
+
+// ================================================================================================
+TrajectoryPlayback::TrajectoryPlayback(const char *path, RenderMode renderMode) :
+	m_reader{path},
+	m_pCount{m_reader.getParticleCount()},
+	m_frames{},
+	m_decoded{},
+	m_free{},
+	m_cursorMutex{},
+	m_cursor{0, 1, 1},
+	m_stop{false},
+	m_thread{},
+	m_history{},
+	m_historyChunk{},
+	m_columns{},
+	m_ring{},
+	m_fences{},
+	m_ringIndex{0},
+	m_particleShader{nullptr},
+	m_densityRenderer{nullptr},
+	m_viewUniforms{nullptr},
+	m_generation{1},
+	m_step{1},
+	m_shownChunk{0},
+	m_hasFrame{false},
+	m_paused{false},
+	m_showNext{true},
+	m_stalls{0}
+{
+	const std::string error = std::string("Trajectory '") + path + "' ";
+	if ((m_reader.getAttributeMask() & PLAYBACK_POSITIONS) != PLAYBACK_POSITIONS)
+		throw std::runtime_error(error + "has no positions to play back");
+	if (!m_reader.getChunkCount())
+		throw std::runtime_error(error + "has no frames");
+
+	// Velocities that are not stored stay zero
+	for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute) {
+		m_historyChunk[attribute] = SIZE_MAX;
+		if (PLAYBACK_ATTRIBUTES & (1u << attribute))
+			m_columns[attribute].assign(m_pCount, 0.0f);
+	}
+
+	// Rounded up to whole words like the stream buffer of the simulation
+	const size_t streamSize = ((RENDER_STREAM_BYTES_PER_PARTICLE * m_pCount) + 3) & ~(size_t)3;
+	for (size_t i = 0; i < PLAYBACK_DECODED_FRAMES; ++i) {
+		m_frames[i].stream.resize(streamSize);
+		m_free.push(i);
+	}
+
+	const bool density = (renderMode == RENDER_MODE_DENSITY);
+	m_particleShader = new Shader(ParticleCompactVertexShaderSource, nullptr,
+		density ? ParticleSplatFragmentShaderSource : ParticleCompactFragmentShaderSource);
+	m_particleShader->bind();
+	m_particleShader->setUniform("StreamExtent", RENDER_STREAM_EXTENT);
+	m_particleShader->setUniform("SpeedScale", RENDER_STREAM_SPEED_SCALE);
+	m_particleShader->release();
+	m_viewUniforms = new UniformBuffer(UNIFORM_BLOCK_VIEW, sizeof(ViewUniforms));
+	if (density)
+		m_densityRenderer = new DensityRenderer();
+
+	vertex_format_specifier_t streamFormat[2];
+	getRenderStreamFormat(m_pCount, streamFormat);
+	for (VertexBuffer *&buffer : m_ring) {
+		buffer = new VertexBuffer(streamSize, GL_STREAM_DRAW);
+		buffer->setFormat(streamFormat, 2);
+	}
+
+	m_thread = std::thread(&TrajectoryPlayback::run, this);
+
+	std::cout << "Playback: '" << path << "' (" << m_reader.getChunkCount() << " frames of " << m_pCount
+		<< " particles, every " << m_reader.getStride() << " steps)" << std::endl;
+}
+
+// ================================================================================================
+TrajectoryPlayback::~TrajectoryPlayback()
+{
+	m_stop.store(true, std::memory_order_release);
+	if (m_thread.joinable())
+		m_thread.join();
+
+	if (m_stalls)
+		std::cerr << "Playback repeated " << m_stalls << " frames, the decoder could not keep up" << std::endl;
+
+	for (size_t i = 0; i < PLAYBACK_RING_BUFFERS; ++i) {
+		if (m_fences[i])
+			glDeleteSync(m_fences[i]);
+		if (m_ring[i])
+			delete m_ring[i];
+	}
+	if (m_particleShader)
+		delete m_particleShader;
+	if (m_densityRenderer)
+		delete m_densityRenderer;
+	if (m_viewUniforms)
+		delete m_viewUniforms;
+}
+
+// ================================================================================================
+void TrajectoryPlayback::render(float dtime)
+{
+	// One decoded frame per displayed frame, frames of an earlier seek are handed back without being shown
+	if (!m_paused || m_showNext) {
+		ScopedStageTimer timer(STAGE_UPLOAD);
+		bool shown = false;
+		size_t slot;
+		while (!shown && m_decoded.pop(slot)) {
+			const frame_t& frame = m_frames[slot];
+			if (frame.generation == m_generation) {
+				uploadFrame(frame);
+				m_shownChunk = frame.chunk;
+				m_hasFrame = true;
+				m_showNext = false;
+				shown = true;
+			}
+			m_free.push(slot);
+		}
+		if (!shown && m_hasFrame && !m_paused)
+			++m_stalls;
+	}
+	if (!m_hasFrame)
+		return;
+
+	{
+		ScopedStageTimer timer(STAGE_SHADER_BIND);
+		m_particleShader->bind();
+	}
+	{
+		ScopedStageTimer timer(STAGE_UNIFORMS);
+		ViewUniforms view;
+		view.view = g_camera->view();
+		view.projection = g_camera->projection();
+		view.time = (float)m_reader.getChunk(m_shownChunk).time;
+		m_viewUniforms->update(&view);
+	}
+	{
+		ScopedStageTimer timer(STAGE_DRAW, true);
+		if (m_densityRenderer)
+			m_densityRenderer->begin();
+		m_ring[m_ringIndex]->drawBuffer(GL_POINTS, 0, m_pCount);
+
+		// The buffer is only written again once the draws from it are done
+		if (m_fences[m_ringIndex])
+			glDeleteSync(m_fences[m_ringIndex]);
+		m_fences[m_ringIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	m_particleShader->release();
+
+	if (m_densityRenderer) {
+		ScopedStageTimer timer(STAGE_RESOLVE, true);
+		m_densityRenderer->resolve();
+	}
+}
+
+// ================================================================================================
+void TrajectoryPlayback::seek(size_t frame)
+{
+	restart(frame);
+	m_showNext = true;
+}
+
+// ================================================================================================
+void TrajectoryPlayback::setStep(size_t step)
+{
+	m_step = std::min(std::max(step, (size_t)1), m_reader.getChunkCount());
+	restart(m_shownChunk + m_step);
+	std::cout << "Playback step: " << m_step << " frames" << std::endl;
+}
+
+// ================================================================================================
+void TrajectoryPlayback::setPaused(bool paused)
+{
+	m_paused = paused;
+}
+
+// ================================================================================================
+void TrajectoryPlayback::onKey(int key)
+{
+	const size_t count = m_reader.getChunkCount();
+	const size_t jump = std::max(count / 10, (size_t)1);
+	switch (key)
+	{
+	case GLFW_KEY_SPACE: setPaused(!m_paused); break;
+	case GLFW_KEY_RIGHT: seek(m_shownChunk + 1); break;
+	case GLFW_KEY_LEFT: seek(m_shownChunk + count - 1); break;
+	case GLFW_KEY_PAGE_UP: seek(m_shownChunk + jump); break;
+	case GLFW_KEY_PAGE_DOWN: seek(m_shownChunk + count - (jump % count)); break;
+	case GLFW_KEY_UP: setStep(m_step * 2); break;
+	case GLFW_KEY_DOWN: setStep(m_step / 2); break;
+	}
+}
+
+// ================================================================================================
+void TrajectoryPlayback::restart(size_t chunk)
+{
+	// The decoder picks the new cursor up before its next frame, the renderer drops what it decoded before
+	++m_generation;
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+	m_cursor = { chunk % m_reader.getChunkCount(), m_step, m_generation };
+}
+
+// ================================================================================================
+void TrajectoryPlayback::uploadFrame(const frame_t& frame)
+{
+	m_ringIndex = (m_ringIndex + 1) % PLAYBACK_RING_BUFFERS;
+	VertexBuffer *buffer = m_ring[m_ringIndex];
+	if (m_fences[m_ringIndex]) {
+		// Only waits when the GPU is more than a ring behind
+		glClientWaitSync(m_fences[m_ringIndex], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(m_fences[m_ringIndex]);
+		m_fences[m_ringIndex] = nullptr;
+	}
+
+	void *mapped = buffer->mapBufferRange(GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT, 0, buffer->getSize());
+	memcpy(mapped, frame.stream.data(), buffer->getSize());
+	buffer->unmapBuffer();
+}
+
+// ================================================================================================
+void TrajectoryPlayback::run()
+{
+	g_trace.setThreadName("Trajectory Playback");
+
+	const size_t count = m_reader.getChunkCount();
+	const uint32_t attributes = m_reader.getAttributeMask() & PLAYBACK_ATTRIBUTES;
+	// Asks for the chunks of a frame that are not decoded by the frame before it, which stops at the keyframe
+	const auto prefetch = [this, count, attributes](size_t chunk, size_t step) {
+		const size_t keyframe = m_reader.findKeyframe(chunk, SNAPSHOT_POS_X);
+		const size_t first = std::max(keyframe, (chunk >= step) ? chunk - step + 1 : 0);
+		for (size_t index = first; index <= chunk; ++index)
+			m_reader.prefetchChunk(index, attributes);
+	};
+
+	cursor_t cursor = { 0, 1, 0 };
+	size_t next = 0;
+	unsigned int idle = 0;
+	while (!m_stop.load(std::memory_order_acquire)) {
+		bool moved = false;
+		{
+			std::lock_guard<std::mutex> lock(m_cursorMutex);
+			if (m_cursor.generation != cursor.generation) {
+				cursor = m_cursor;
+				next = cursor.chunk;
+				moved = true;
+			}
+		}
+
+		// The window past the cursor is read ahead after a seek, and then one more frame after every decoded one
+		try {
+			if (moved) {
+				for (size_t k = 0; k <= PLAYBACK_PREFETCH_FRAMES; ++k)
+					prefetch((next + (k * cursor.step)) % count, cursor.step);
+			}
+
+			size_t slot;
+			if (!m_free.pop(slot)) {
+				if (++idle < PLAYBACK_SPIN_POLLS)
+					std::this_thread::yield();
+				else
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			idle = 0;
+
+			frame_t& frame = m_frames[slot];
+			decodeFrame(next, frame);
+			frame.chunk = next;
+			frame.generation = cursor.generation;
+			m_decoded.push(slot);
+
+			// Playback wraps around at the end of the file
+			next = (next + cursor.step) % count;
+			prefetch((next + (PLAYBACK_PREFETCH_FRAMES * cursor.step)) % count, cursor.step);
+		}
+		catch (const std::exception& ex) {
+			// The renderer keeps showing the last frame that was decoded
+			std::cerr << "Playback Error: \"" << ex.what() << "\"." << std::endl;
+			return;
+		}
+	}
+}
+
+// ================================================================================================
+void TrajectoryPlayback::decodeFrame(size_t chunk, frame_t& frame)
+{
+	ScopedTrace trace("Playback Decode", "io");
+
+	// Each attribute continues from its history while the chunk is in the same delta chain, and restarts from the
+	// keyframe otherwise, so playing forward decodes every column once and a seek at most a keyframe interval
+	const uint32_t attributes = m_reader.getAttributeMask() & PLAYBACK_ATTRIBUTES;
+	g_jobs->parallel_for(0, SNAPSHOT_ATTRIBUTE_COUNT, 1, [this, chunk, attributes](size_t begin, size_t end) {
+		for (size_t index = begin; index < end; ++index) {
+			const SnapshotAttribute attribute = (SnapshotAttribute)index;
+			if (!(attributes & (1u << attribute)) || m_historyChunk[attribute] == chunk)
+				continue;
+
+			size_t first = m_reader.findKeyframe(chunk, attribute);
+			const size_t decoded = m_historyChunk[attribute];
+			if (decoded != SIZE_MAX && decoded >= first && decoded < chunk)
+				first = decoded + 1;
+
+			m_historyChunk[attribute] = SIZE_MAX;
+			for (size_t current = first; current <= chunk; ++current)
+				m_reader.decodeColumn(current, attribute, m_history[attribute], m_columns[attribute].data());
+			m_historyChunk[attribute] = chunk;
+		}
+	});
+
+	const float *x = m_columns[SNAPSHOT_POS_X].data();
+	const float *y = m_columns[SNAPSHOT_POS_Y].data();
+	const float *vx = m_columns[SNAPSHOT_VEL_X].data();
+	const float *vy = m_columns[SNAPSHOT_VEL_Y].data();
+	const size_t count = m_pCount;
+	unsigned char *stream = frame.stream.data();
+	g_jobs->parallel_for(0, m_pCount, PLAYBACK_GRAIN, [x, y, vx, vy, count, stream](size_t begin, size_t end) {
+		encodeRenderStream(x, y, vx, vy, begin, end, count, stream);
+	});
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "options.hpp"
+#include "shader.hpp"
+#include "splat.hpp"
+#include "spscqueue.hpp"
+#include "trajectory.hpp"
+#include "vbo.hpp"
+
+
+// Frames decoded ahead of the renderer, and vertex buffers the renderer cycles through so an upload never waits for
+// the draw of the previous frame
+#define PLAYBACK_DECODED_FRAMES 4
+#define PLAYBACK_RING_BUFFERS 3
+// Frames past the one being decoded that the file is asked to read ahead
+#define PLAYBACK_PREFETCH_FRAMES 8
+
+
+// Replays a trajectory file through the particle renderer instead of simulating. A decoder thread turns the chunks
+// into the compact render stream ahead of time, prefetching the mapped file past them, and the renderer streams one
+// decoded frame per displayed frame into a ring of vertex buffers. Seeking uses the chunk index of the file, and only
+// decodes from the keyframe before the target.
+class TrajectoryPlayback
+{
+	struct frame_t
+	{
+		std::vector<unsigned char> stream;	// Compact render stream of the chunk
+		size_t chunk;
+		uint64_t generation;				// Of the seek the frame was decoded for
+	};
+
+	// Where the decoder continues from, replaced by every seek
+	struct cursor_t
+	{
+		size_t chunk;
+		size_t step;						// Chunks from one displayed frame to the next
+		uint64_t generation;
+	};
+
+private:
+	TrajectoryReader m_reader;
+	const size_t m_pCount;
+	frame_t m_frames[PLAYBACK_DECODED_FRAMES];
+	SpscQueue<size_t, PLAYBACK_DECODED_FRAMES> m_decoded;	// Frames for the renderer
+	SpscQueue<size_t, PLAYBACK_DECODED_FRAMES> m_free;		// Frames handed back to the decoder
+	std::mutex m_cursorMutex;
+	cursor_t m_cursor;
+	std::atomic<bool> m_stop;
+	std::thread m_thread;
+
+	// Only used by the decoder thread
+	codec_history_t m_history[SNAPSHOT_ATTRIBUTE_COUNT];
+	size_t m_historyChunk[SNAPSHOT_ATTRIBUTE_COUNT];	// Chunk the history holds, SIZE_MAX when it is empty
+	std::vector<float> m_columns[SNAPSHOT_ATTRIBUTE_COUNT];
+
+	// Only used by the render thread
+	VertexBuffer *m_ring[PLAYBACK_RING_BUFFERS];
+	GLsync m_fences[PLAYBACK_RING_BUFFERS];			// Signaled once the last draw from the buffer is done
+	size_t m_ringIndex;
+	Shader *m_particleShader;
+	DensityRenderer *m_densityRenderer;
+	UniformBuffer *m_viewUniforms;
+	uint64_t m_generation;
+	size_t m_step;
+	size_t m_shownChunk;
+	bool m_hasFrame;
+	bool m_paused;
+	bool m_showNext;					// Shows the next frame even while paused, after a seek
+	size_t m_stalls;					// Displayed frames without a new decoded frame
+
+public:
+	// Maps the trajectory and starts decoding from its first frame, throws if it can not be played back
+	TrajectoryPlayback(const char *path, RenderMode renderMode);
+	~TrajectoryPlayback();
+
+	inline size_t getFrameCount() const { return m_reader.getChunkCount(); }
+	inline size_t getFrame() const { return m_shownChunk; }
+	inline bool isPaused() const { return m_paused; }
+
+	// Draws the next decoded frame, or the last one again while paused or when the decoder falls behind
+	void render(float dtime);
+
+	// Continues playback from a frame, which is shown even while paused
+	void seek(size_t frame);
+	// Frames advanced per displayed frame, larger steps scrub through long trajectories quickly
+	void setStep(size_t step);
+	void setPaused(bool paused);
+	// Space pauses, left and right step a frame, page up and down jump a tenth of the file, and up and down change
+	// the playback step
+	void onKey(int key);
+
+	TrajectoryPlayback(const TrajectoryPlayback&) = delete;
+	TrajectoryPlayback& operator = (const TrajectoryPlayback&) = delete;
+
+private:
+	void run();
+	void decodeFrame(size_t chunk, frame_t& frame);
+	void uploadFrame(const frame_t& frame);
+	void restart(size_t chunk);
+};
+
+
+// The playback that receives the window key presses, if one is running
+extern TrajectoryPlayback *g_playback;
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include "profiler.hpp"
+#include "gpu.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+
+Profiler g_profiler;
+
+
+// ================================================================================================
+const char* getFrameStageName(FrameStage stage)
+{
+	static const char* names[STAGE_COUNT] = {
+		"frame", "clear", "acquire", "arguments", "kernel", "release", "upload", "shader bind", "uniforms", "draw",
+		"resolve", "output", "swap"
+	};
+
+	return (stage < STAGE_COUNT) ? names[stage] : "unknown";
+}
+
+
+// ================================================================================================
+StatRing::StatRing() :
+	m_written{0}
+{
+	for (unsigned int i = 0; i < CAPACITY; ++i)
+		m_samples[i].store(0.0f, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+StatRing::Summary StatRing::summarize() const
+{
+	Summary sum = { 0, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+	const unsigned int count = std::min(m_written.load(std::memory_order_relaxed), CAPACITY);
+	if (!count)
+		return sum;
+
+	// Snapshot the samples, any racing writes will only replace single samples with newer ones
+	float sorted[CAPACITY];
+	double total = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		sorted[i] = m_samples[i].load(std::memory_order_relaxed);
+		total += sorted[i];
+	}
+	std::sort(sorted, sorted + count);
+
+	const auto percentile = [&sorted, count](float pct) -> float {
+		const unsigned int index = (unsigned int)(pct * (count - 1) + 0.5f);
+		return sorted[std::min(index, count - 1)];
+	};
+
+	sum.count = count;
+	sum.mean = (float)(total / count);
+	sum.p50 = percentile(0.50f);
+	sum.p95 = percentile(0.95f);
+	sum.p99 = percentile(0.99f);
+	sum.max = sorted[count - 1];
+	return sum;
+}
+
+// ================================================================================================
+void StatRing::clear()
+{
+	m_written.store(0, std::memory_order_relaxed);
+}
+
+
+// ================================================================================================
+Profiler::Profiler() :
+	m_enabled{false},
+	m_initialized{false},
+	m_glTimers{false},
+	m_dumpRequested{false},
+	m_hostTimes{},
+	m_deviceTimes{},
+	m_glQueries{},
+	m_glIssued{},
+	m_glHarvested{},
+	m_glActiveStage{-1},
+	m_clEvents{},
+	m_frameStart{},
+	m_lastReport{},
+	m_reportInterval{5.0f}
+{
+
+}
+
+// ================================================================================================
+Profiler::~Profiler()
+{
+
+}
+
+// ================================================================================================
+void Profiler::initialize(bool glTimers)
+{
+	if (m_initialized)
+		return;
+
+	m_glTimers = glTimers;
+	if (m_glTimers)
+		glGenQueries(STAGE_COUNT * GL_QUERY_DEPTH, &m_glQueries[0][0]);
+	m_lastReport = clock::now();
+	m_initialized = true;
+	m_enabled = true;
+}
+
+// ================================================================================================
+void Profiler::shutdown()
+{
+	if (!m_initialized)
+		return;
+
+	harvestCLEvents(true);
+	if (m_glTimers)
+		glDeleteQueries(STAGE_COUNT * GL_QUERY_DEPTH, &m_glQueries[0][0]);
+	m_initialized = false;
+	m_enabled = false;
+}
+
+// ================================================================================================
+void Profiler::setEnabled(bool enabled)
+{
+	if (enabled == m_enabled || !m_initialized)
+		return;
+
+	m_enabled = enabled;
+	if (enabled) {
+		for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+			m_hostTimes[i].clear();
+			m_deviceTimes[i].clear();
+		}
+		m_lastReport = clock::now();
+	}
+	std::cout << "Profiler " << (enabled ? "enabled" : "disabled") << "." << std::endl;
+}
+
+// ================================================================================================
+void Profiler::beginFrame()
+{
+	m_frameStart = clock::now();
+}
+
+// ================================================================================================
+void Profiler::endFrame()
+{
+	const auto now = clock::now();
+	if (g_trace.isEnabled())
+		g_trace.recordHost(getFrameStageName(STAGE_FRAME), "stage", m_frameStart, now);
+
+	if (!m_enabled) {
+		// Still clean up events that were submitted for tracing, or before the profiler was disabled
+		if (!m_clEvents.empty())
+			harvestCLEvents(false);
+		return;
+	}
+
+	recordHost(STAGE_FRAME, std::chrono::duration<float, std::milli>(now - m_frameStart).count());
+
+	harvestGLTimers();
+	harvestCLEvents(false);
+
+	if (m_dumpRequested) {
+		dump(std::cout);
+		m_dumpRequested = false;
+	}
+	if (m_reportInterval > 0 && std::chrono::duration<float>(now - m_lastReport).count() >= m_reportInterval) {
+		report(std::cout);
+		m_lastReport = now;
+	}
+}
+
+// ================================================================================================
+void Profiler::beginGLTimer(FrameStage stage)
+{
+	// Timer queries cannot nest, and a full ring means the device is far behind, so skip the sample
+	if (!m_glTimers || m_glActiveStage >= 0 || (m_glIssued[stage] - m_glHarvested[stage]) >= GL_QUERY_DEPTH)
+		return;
+
+	glBeginQuery(GL_TIME_ELAPSED, m_glQueries[stage][m_glIssued[stage] % GL_QUERY_DEPTH]);
+	m_glActiveStage = stage;
+}
+
+// ================================================================================================
+void Profiler::endGLTimer(FrameStage stage)
+{
+	if (m_glActiveStage != stage)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	++m_glIssued[stage];
+	m_glActiveStage = -1;
+}
+
+// ================================================================================================
+void Profiler::recordCLEvent(FrameStage stage, cl_event first, cl_event last)
+{
+	if (!first && !last)
+		return;
+
+	m_clEvents.push_back({ stage, first ? first : last, last ? last : first });
+}
+
+// ================================================================================================
+void Profiler::harvestGLTimers()
+{
+	for (unsigned int stage = 0; stage < STAGE_COUNT; ++stage) {
+		while (m_glHarvested[stage] != m_glIssued[stage]) {
+			const GLuint query = m_glQueries[stage][m_glHarvested[stage] % GL_QUERY_DEPTH];
+
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			recordDevice((FrameStage)stage, (float)(elapsed / 1.0e6));
+			++m_glHarvested[stage];
+		}
+	}
+}
+
+// ================================================================================================
+void Profiler::harvestCLEvents(bool block)
+{
+	auto it = m_clEvents.begin();
+	while (it != m_clEvents.end()) {
+		const pending_cl_event_t& pending = *it;
+
+		if (block) {
+			clWaitForEvents(1, &pending.last);
+		}
+		else {
+			cl_int status = CL_COMPLETE;
+			clGetEventInfo(pending.last, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+			if (status > CL_COMPLETE) {
+				++it;
+				continue;
+			}
+		}
+
+		// Will fail silently if the queue was not created with profiling enabled
+		cl_ulong start = 0, end = 0;
+		if (!clGetEventProfilingInfo(pending.first, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr) &&
+				!clGetEventProfilingInfo(pending.last, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr) &&
+				end >= start) {
+			if (m_enabled)
+				recordDevice(pending.stage, (float)((end - start) / 1.0e6));
+			if (g_trace.isEnabled())
+				g_trace.recordDevice(getFrameStageName(pending.stage), start, end);
+		}
+
+		clReleaseEvent(pending.first);
+		if (pending.last != pending.first)
+			clReleaseEvent(pending.last);
+		it = m_clEvents.erase(it);
+	}
+}
+
+// ================================================================================================
+void Profiler::report(std::ostream& stream) const
+{
+	// Report the whole frame, and the three most expensive individual stages
+	struct entry_t { const char* name; const char* where; StatRing::Summary sum; };
+	std::vector<entry_t> entries;
+	for (unsigned int stage = STAGE_FRAME + 1; stage < STAGE_COUNT; ++stage) {
+		const StatRing::Summary host = m_hostTimes[stage].summarize();
+		const StatRing::Summary device = m_deviceTimes[stage].summarize();
+		if (host.count)
+			entries.push_back({ getFrameStageName((FrameStage)stage), "host", host });
+		if (device.count)
+			entries.push_back({ getFrameStageName((FrameStage)stage), "dev", device });
+	}
+	std::sort(entries.begin(), entries.end(), [](const entry_t& l, const entry_t& r) { return l.sum.p50 > r.sum.p50; });
+	if (entries.size() > 3)
+		entries.resize(3);
+
+	const StatRing::Summary frame = m_hostTimes[STAGE_FRAME].summarize();
+	stream << std::fixed << std::setprecision(2) << "[Profiler] frame " << frame.p50 << "/" << frame.p95 << "/"
+		<< frame.p99 << " ms";
+	for (const auto& ent : entries)
+		stream << " | " << ent.name << " (" << ent.where << ") " << ent.sum.p50 << "/" << ent.sum.p95 << "/" << ent.sum.p99;
+	stream << std::defaultfloat << std::endl;
+}
+
+// ================================================================================================
+void Profiler::dump(std::ostream& stream) const
+{
+	const auto printrow = [&stream](const char* name, const char* where, const StatRing::Summary& sum) {
+		stream << "  " << std::left << std::setw(12) << name << std::setw(6) << where << std::right
+			<< std::setw(7) << sum.count << std::setw(10) << sum.mean << std::setw(10) << sum.p50
+			<< std::setw(10) << sum.p95 << std::setw(10) << sum.p99 << std::setw(10) << sum.max << std::endl;
+	};
+
+	stream << "Profiler stage timings (ms):" << std::endl;
+	stream << "  " << std::left << std::setw(12) << "stage" << std::setw(6) << "side" << std::right
+		<< std::setw(7) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p95"
+		<< std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+	stream << std::fixed << std::setprecision(3);
+	for (unsigned int stage = 0; stage < STAGE_COUNT; ++stage) {
+		const StatRing::Summary host = m_hostTimes[stage].summarize();
+		const StatRing::Summary device = m_deviceTimes[stage].summarize();
+		if (host.count)
+			printrow(getFrameStageName((FrameStage)stage), "host", host);
+		if (device.count)
+			printrow(getFrameStageName((FrameStage)stage), "dev", device);
+	}
+	stream << std::defaultfloat;
+}
\ No newline at end of file
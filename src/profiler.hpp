@@ -0,0 +1,183 @@
+#pragma once
+
+#include <CL\cl.hpp>
+#include <GL\glew.h>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <vector>
+#include "trace.hpp"
+
+
+// The individual stages of a frame that are timed by the profiler
+enum FrameStage :
+	unsigned char
+{
+	STAGE_FRAME = 0,	// The entire frame, from the start of the clear to after the swap
+	STAGE_CLEAR,
+	STAGE_ACQUIRE,
+	STAGE_ARGUMENTS,
+	STAGE_KERNEL,
+	STAGE_RELEASE,
+	STAGE_UPLOAD,
+	STAGE_SHADER_BIND,
+	STAGE_UNIFORMS,
+	STAGE_DRAW,
+	STAGE_RESOLVE,		// Tone mapping of the density target (RENDER_MODE_DENSITY)
+	STAGE_OUTPUT,		// State copies, gathers and reductions for the outputs, which are written in the background
+	STAGE_SWAP,
+	STAGE_COUNT
+};
+
+const char* getFrameStageName(FrameStage stage);
+
+
+// Fixed size ring of timing samples (in milliseconds), that can be written to from any thread without locking.
+// Old samples are overwritten once the ring is full, so the statistics always reflect the most recent samples.
+class StatRing
+{
+public:
+	static const unsigned int CAPACITY = 512;
+
+	struct Summary
+	{
+		unsigned int count;
+		float mean;
+		float p50;
+		float p95;
+		float p99;
+		float max;
+	};
+
+private:
+	std::atomic<float> m_samples[CAPACITY];
+	std::atomic<unsigned int> m_written;
+
+public:
+	StatRing();
+
+	inline void push(float value)
+	{
+		const unsigned int index = m_written.fetch_add(1, std::memory_order_relaxed);
+		m_samples[index % CAPACITY].store(value, std::memory_order_relaxed);
+	}
+	inline unsigned int getTotalCount() const { return m_written.load(std::memory_order_relaxed); }
+
+	Summary summarize() const;
+	void clear();
+};
+
+
+// Collects per-stage host timings, GL timer queries, and OpenCL profiling events into rolling statistics.
+// All functions except push-style recording must be called from the main (GL) thread.
+class Profiler
+{
+public:
+	using clock = std::chrono::high_resolution_clock;
+
+	// The number of GL timer queries in flight per stage before samples start getting dropped
+	static const unsigned int GL_QUERY_DEPTH = 4;
+
+private:
+	struct pending_cl_event_t
+	{
+		FrameStage stage;
+		cl_event first;
+		cl_event last;
+	};
+
+	bool m_enabled;
+	bool m_initialized;
+	bool m_glTimers;		// False without an OpenGL context, the GL timer functions do nothing then
+	bool m_dumpRequested;
+	StatRing m_hostTimes[STAGE_COUNT];
+	StatRing m_deviceTimes[STAGE_COUNT];
+	GLuint m_glQueries[STAGE_COUNT][GL_QUERY_DEPTH];
+	unsigned int m_glIssued[STAGE_COUNT];
+	unsigned int m_glHarvested[STAGE_COUNT];
+	int m_glActiveStage;
+	std::vector<pending_cl_event_t> m_clEvents;
+	clock::time_point m_frameStart;
+	clock::time_point m_lastReport;
+	float m_reportInterval;
+
+public:
+	Profiler();
+	~Profiler();
+
+	void initialize(bool glTimers = true);
+	void shutdown();
+
+	inline bool isEnabled() const { return m_enabled; }
+	// Device events are also needed for the device track of a running trace
+	inline bool wantsDeviceEvents() const { return m_enabled || g_trace.isEnabled(); }
+	void setEnabled(bool enabled);
+	inline float getReportInterval() const { return m_reportInterval; }
+	inline void setReportInterval(float seconds) { m_reportInterval = seconds; }
+	inline void requestDump() { m_dumpRequested = true; }
+
+	void beginFrame();
+	void endFrame();
+
+	inline void recordHost(FrameStage stage, float ms) { m_hostTimes[stage].push(ms); }
+	inline void recordDevice(FrameStage stage, float ms) { m_deviceTimes[stage].push(ms); }
+
+	void beginGLTimer(FrameStage stage);
+	void endGLTimer(FrameStage stage);
+
+	// Takes ownership of the event(s), which are released once complete. The device time recorded is the span
+	// from the start of the first event to the end of the last event. Null events are ignored.
+	void recordCLEvent(FrameStage stage, cl_event first, cl_event last = nullptr);
+
+	void report(std::ostream& stream) const;
+	void dump(std::ostream& stream) const;
+
+private:
+	void harvestGLTimers();
+	void harvestCLEvents(bool block);
+};
+
+extern Profiler g_profiler;
+
+
+// Times the host duration of the current scope, and optionally the GL device duration as well. The scope is also
+// recorded on the calling thread's track when a trace is running.
+class ScopedStageTimer
+{
+private:
+	const FrameStage m_stage;
+	const bool m_active;
+	const bool m_tracing;
+	const bool m_glTimer;
+	Profiler::clock::time_point m_start;
+
+public:
+	ScopedStageTimer(FrameStage stage, bool gltimer = false) :
+		m_stage{stage},
+		m_active{g_profiler.isEnabled()},
+		m_tracing{g_trace.isEnabled()},
+		m_glTimer{gltimer}
+	{
+		if (m_active || m_tracing) {
+			if (m_active && m_glTimer)
+				g_profiler.beginGLTimer(m_stage);
+			m_start = Profiler::clock::now();
+		}
+	}
+	~ScopedStageTimer()
+	{
+		if (m_active || m_tracing) {
+			const auto end = Profiler::clock::now();
+			if (m_active) {
+				g_profiler.recordHost(m_stage, std::chrono::duration<float, std::milli>(end - m_start).count());
+				if (m_glTimer)
+					g_profiler.endGLTimer(m_stage);
+			}
+			if (m_tracing)
+				g_trace.recordHost(getFrameStageName(m_stage), "stage", m_start, end);
+		}
+	}
+
+	ScopedStageTimer(const ScopedStageTimer&) = delete;
+	ScopedStageTimer& operator = (const ScopedStageTimer&) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "readback.hpp"
+#include "cpusolver.hpp"
+
+
+// ================================================================================================
+const char* getReadbackSourceName(ReadbackSource source)
+{
+	switch (source)
+	{
+	case READBACK_HOST: return "host copy";
+	case READBACK_OPENCL: return "pinned OpenCL readback";
+	case READBACK_OPENGL: return "OpenGL readback";
+	default: return "unknown";
+	}
+}
+
+// ================================================================================================
+StateReadback::StateReadback(ReadbackSource source, size_t pcount) :
+	m_source{source},
+	m_size{sizeof(Particle) * pcount},
+	m_data{nullptr},
+	m_pinnedMem{nullptr},
+	m_event{nullptr},
+	m_buffer{nullptr},
+	m_fence{nullptr},
+	m_pending{false}
+{
+	if (m_source == READBACK_HOST) {
+		m_data = new Particle[pcount];
+	}
+	else if (m_source == READBACK_OPENCL) {
+		// Mapped once for the lifetime of the readback, reads into pinned memory can run at full transfer speed
+		cl_int clerr;
+		CL_CHECK_RETURN_FATAL(
+			m_pinnedMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, m_size, nullptr,
+				&clerr),
+			clerr, m_pinnedMem, "Could not create a readback buffer");
+		CL_CHECK_RETURN_FATAL(
+			m_data = static_cast<Particle*>(clEnqueueMapBuffer(g_clCommandQueue, m_pinnedMem, CL_TRUE,
+				CL_MAP_READ | CL_MAP_WRITE, 0, m_size, 0, nullptr, nullptr, &clerr)),
+			clerr, m_data, "Could not map a readback buffer");
+	}
+	else {
+		m_buffer = new VertexBuffer(m_size, GL_STREAM_READ);
+	}
+}
+
+// ================================================================================================
+StateReadback::~StateReadback()
+{
+	if (m_event)
+		clWaitForEvents(1, &m_event);
+	if (m_event)
+		clReleaseEvent(m_event);
+	if (m_fence)
+		glDeleteSync(m_fence);
+
+	if (m_buffer)
+		delete m_buffer;
+	else if (m_pinnedMem) {
+		clEnqueueUnmapMemObject(g_clCommandQueue, m_pinnedMem, m_data, 0, nullptr, nullptr);
+		clFinish(g_clCommandQueue);
+		clReleaseMemObject(m_pinnedMem);
+	}
+	else if (m_data)
+		delete[] m_data;
+}
+
+// ================================================================================================
+void StateReadback::start(const CpuSolver& solver)
+{
+	if (m_source != READBACK_HOST)
+		throw std::runtime_error("Cannot read back the host state into a device readback.");
+
+	solver.getState(m_data);
+	m_pending = true;
+}
+
+// ================================================================================================
+void StateReadback::start(cl_mem state)
+{
+	if (m_source != READBACK_OPENCL)
+		throw std::runtime_error("Cannot read back OpenCL memory into this readback.");
+	if (m_event)
+		throw std::runtime_error("Cannot start a readback while the previous one is in flight.");
+
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, state, CL_FALSE, 0, m_size, m_data, 0, nullptr, &m_event),
+		"Could not read back the particle state");
+	clFlush(g_clCommandQueue);
+	m_pending = true;
+}
+
+// ================================================================================================
+void StateReadback::start(const VertexBuffer *state)
+{
+	if (m_source != READBACK_OPENGL)
+		throw std::runtime_error("Cannot read back an OpenGL buffer into this readback.");
+	if (m_fence)
+		throw std::runtime_error("Cannot start a readback while the previous one is in flight.");
+
+	if (m_buffer->isMapped()) {
+		m_buffer->unmapBuffer();
+		m_data = nullptr;
+	}
+
+	// Compute shader writes have to be visible to the copy
+	if (GLEW_VERSION_4_2 || GLEW_ARB_shader_image_load_store)
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, state->getVboName());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer->getVboName());
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)m_size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_pending = true;
+}
+
+// ================================================================================================
+bool StateReadback::poll()
+{
+	if (!m_pending)
+		return false;
+
+	if (m_event) {
+		cl_int status = CL_QUEUED;
+		CL_CHECK_FATAL(clGetEventInfo(m_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr),
+			"Could not query a readback");
+		if (status < 0)
+			throw std::runtime_error("Could not read back the particle state.");
+		if (status != CL_COMPLETE)
+			return false;
+		clReleaseEvent(m_event);
+		m_event = nullptr;
+	}
+	else if (m_fence) {
+		const GLenum status = glClientWaitSync(m_fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(m_fence);
+		m_fence = nullptr;
+		if (status == GL_WAIT_FAILED)
+			throw std::runtime_error("Could not wait for a readback.");
+		m_data = static_cast<Particle*>(m_buffer->mapBufferRange(GL_MAP_READ_BIT, 0, m_size));
+	}
+
+	m_pending = false;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "vbo.hpp"
+#include "particle.hpp"
+
+
+class CpuSolver;
+
+
+// Where the particle state is read back from, which depends on where the backend keeps it
+enum ReadbackSource :
+	unsigned char
+{
+	READBACK_HOST = 0,		// Copied from the CPU solver
+	READBACK_OPENCL = 1,	// Device only state, read into pinned host memory with a non-blocking read
+	READBACK_OPENGL = 2		// OpenGL state buffer, copied on the GPU and mapped once its fence has signaled
+};
+
+const char* getReadbackSourceName(ReadbackSource source);
+
+
+// A copy of the particle state on its way to the host. A readback is started by the frame, and then polled by later
+// frames, so the copy never stalls the render loop.
+class StateReadback
+{
+private:
+	const ReadbackSource m_source;
+	const size_t m_size;
+	Particle *m_data;			// Host buffer, pinned OpenCL mapping or OpenGL mapping, depending on the source
+	cl_mem m_pinnedMem;			// READBACK_OPENCL
+	cl_event m_event;
+	VertexBuffer *m_buffer;		// READBACK_OPENGL
+	GLsync m_fence;
+	bool m_pending;
+
+public:
+	StateReadback(ReadbackSource source, size_t pcount);
+	~StateReadback();
+
+	inline ReadbackSource getSource() const { return m_source; }
+	inline bool isPending() const { return m_pending; }
+
+	// Starts a copy of the state, replacing the data of the previous readback
+	void start(const CpuSolver& solver);
+	void start(cl_mem state);
+	void start(const VertexBuffer *state);
+
+	// Returns true once the data has arrived, without waiting for it
+	bool poll();
+	// Valid once polled, until the next start
+	inline const Particle* getData() const { return m_data; }
+
+	StateReadback(const StateReadback&) = delete;
+	StateReadback& operator = (const StateReadback&) = delete;
+};
\ No newline at end of file
@@ -1,12 +1,240 @@
 #include "shader.hpp"
+#include "options.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <glm\gtc\type_ptr.hpp>
 
 
+static const char * const UniformBlockNames[UNIFORM_BLOCK_COUNT] = { "FrameBlock", "ViewBlock" };
+
+// Header of a cached program binary file
+struct ProgramCacheHeader
+{
+	uint32_t magic;
+	uint32_t format;	// Driver specific binary format, from glGetProgramBinary
+	uint64_t key;		// Repeated from the file name, so a truncated name can not load the wrong program
+	uint32_t length;
+	uint32_t padding;
+};
+static const uint32_t PROGRAM_CACHE_MAGIC = 0x4B353050;	// "P50K"
+
+
+// ================================================================================================
+static bool isProgramCacheEnabled()
+{
+	// Checked once, the context does not change after startup
+	static const bool enabled = [] {
+		if (!g_options.shaderCache || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+			return false;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}();
+	return enabled;
+}
+
+// ================================================================================================
+static uint64_t getProgramCacheKey(const char * const *sources, size_t count)
+{
+	// FNV-1a over the driver identity and every stage, so a driver update or an edited source misses the cache
+	uint64_t hash = 0xCBF29CE484222325ull;
+	auto mix = [&hash](const char *str) {
+		if (str) {
+			for (; *str; ++str)
+				hash = (hash ^ (unsigned char)*str) * 0x100000001B3ull;
+		}
+		// Separator, so moving text between stages or skipping a stage changes the key
+		hash = (hash ^ 0xFF) * 0x100000001B3ull;
+	};
+	mix(reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+	mix(reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+	mix(reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+	for (size_t i = 0; i < count; ++i)
+		mix(sources[i]);
+	return hash;
+}
+
+// ================================================================================================
+static void getProgramCachePath(uint64_t key, char *path, size_t size)
+{
+	snprintf(path, size, "p50k_program_%016llx.bin", (unsigned long long)key);
+}
+
+// ================================================================================================
+static GLuint loadCachedProgram(uint64_t key)
+{
+	if (!isProgramCacheEnabled())
+		return 0;
+
+	char path[64];
+	getProgramCachePath(key, path, sizeof(path));
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	ProgramCacheHeader header;
+	std::unique_ptr<char[]> binary;
+	bool valid = (fread(&header, sizeof(header), 1, file) == 1) && (header.magic == PROGRAM_CACHE_MAGIC)
+		&& (header.key == key) && (header.length > 0);
+	if (valid) {
+		binary.reset(new char[header.length]);
+		valid = (fread(binary.get(), header.length, 1, file) == 1);
+	}
+	fclose(file);
+	if (!valid)
+		return 0;
+
+	// The driver rejects binaries it can no longer use, which then fall back to compiling the source
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, binary.get(), (GLsizei)header.length);
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// ================================================================================================
+static void storeCachedProgram(GLuint program, uint64_t key)
+{
+	if (!isProgramCacheEnabled())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, 0, key, 0, 0 };
+	std::unique_ptr<char[]> binary(new char[length]);
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &header.format, binary.get());
+	if (written <= 0)
+		return;
+	header.length = (uint32_t)written;
+
+	// A missing cache file only costs the next startup a compile, so failures are reported and ignored
+	char path[64];
+	getProgramCachePath(key, path, sizeof(path));
+	FILE *file = fopen(path, "wb");
+	bool stored = (file != nullptr);
+	if (file) {
+		stored = (fwrite(&header, sizeof(header), 1, file) == 1) && (fwrite(binary.get(), header.length, 1, file) == 1);
+		stored = (fclose(file) == 0) && stored;
+	}
+	if (!stored) {
+		std::cerr << "Could not write the program cache file '" << path << "'." << std::endl;
+		remove(path);
+	}
+}
+
+
+// ================================================================================================
+UniformBuffer::UniformBuffer(UniformBlockBinding binding, size_t size) :
+	m_buffer{0},
+	m_binding{binding},
+	m_size{size}
+{
+	glGenBuffers(1, &m_buffer);
+	if (!m_buffer)
+		throw std::runtime_error(std::string("Could not allocate the uniform buffer for ")
+			+ UniformBlockNames[binding] + ".");
+	glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// ================================================================================================
+UniformBuffer::~UniformBuffer()
+{
+	if (m_buffer)
+		glDeleteBuffers(1, &m_buffer);
+}
+
+// ================================================================================================
+void UniformBuffer::update(const void *data)
+{
+	// Rebinding the range is cheap, and keeps the buffer attached if anything else used the binding point
+	glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, m_size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+
+// ================================================================================================
+void ProgramReflection::reflect(GLuint program)
+{
+	m_locations.clear();
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> name((size_t)maxLength + 1);
+	for (GLint i = 0; i < count; ++i) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), nullptr, &size, &type, name.data());
+
+		// Members of uniform blocks are active, but have no location
+		const GLint loc = glGetUniformLocation(program, name.data());
+		if (loc < 0)
+			continue;
+
+		// Arrays are reported as their first element, and set by their plain name
+		std::string uniform(name.data());
+		if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+			uniform.resize(uniform.size() - 3);
+		m_locations.emplace_back(uniform, loc);
+	}
+
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+	name.resize((size_t)maxLength + 1);
+	for (GLint i = 0; i < count; ++i) {
+		glGetActiveUniformBlockName(program, (GLuint)i, (GLsizei)name.size(), nullptr, name.data());
+
+		GLuint binding = 0;
+		while (binding < UNIFORM_BLOCK_COUNT && strcmp(name.data(), UniformBlockNames[binding]) != 0)
+			++binding;
+		if (binding == UNIFORM_BLOCK_COUNT)
+			throw std::runtime_error(std::string("Uniform block '") + name.data() + "' has no binding point.");
+		glUniformBlockBinding(program, (GLuint)i, binding);
+	}
+}
+
+// ================================================================================================
+GLint ProgramReflection::getLocation(const char *name) const
+{
+	// Programs only have a handful of uniforms, so a scan beats hashing the name
+	for (const auto& location : m_locations) {
+		if (strcmp(location.first.c_str(), name) == 0)
+			return location.second;
+	}
+	return -1;
+}
+
+
+
 // ================================================================================================
 Shader::Shader(const char *vert, const char *geom, const char *frag) :
 	m_program{0}
 {
+	// Use the program linked by an earlier run if the driver still accepts it
+	const char * const sources[3] = { vert, geom, frag };
+	const uint64_t cacheKey = getProgramCacheKey(sources, 3);
+	m_program = loadCachedProgram(cacheKey);
+	if (m_program) {
+		m_reflection.reflect(m_program);
+		return;
+	}
+
 	// Load the individual shaders
 	GLuint vshader = loadVertexSource(vert);
 	GLuint gshader = loadGeometrySource(geom);
@@ -17,6 +245,8 @@ Shader::Shader(const char *vert, const char *geom, const char *frag) :
 	if (vshader) glAttachShader(m_program, vshader);
 	if (gshader) glAttachShader(m_program, gshader);
 	if (fshader) glAttachShader(m_program, fshader);
+	if (isProgramCacheEnabled())
+		glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(m_program);
 
 	// Check for linking errors
@@ -33,6 +263,9 @@ Shader::Shader(const char *vert, const char *geom, const char *frag) :
 	if (vshader) glDeleteShader(vshader);
 	if (gshader) glDeleteShader(gshader);
 	if (fshader) glDeleteShader(fshader);
+
+	storeCachedProgram(m_program, cacheKey);
+	m_reflection.reflect(m_program);
 }
 
 // ================================================================================================
@@ -55,37 +288,37 @@ void Shader::release()
 }
 
 // ================================================================================================
-void Shader::setUniform(const std::string& name, bool val)
+void Shader::setUniform(const char *name, bool val)
 {
-	const GLuint loc = glGetUniformLocation(m_program, name.c_str());
+	const GLint loc = m_reflection.getLocation(name);
 	glUniform1i(loc, (int)val);
 }
 
 // ================================================================================================
-void Shader::setUniform(const std::string& name, int val)
+void Shader::setUniform(const char *name, int val)
 {
-	const GLuint loc = glGetUniformLocation(m_program, name.c_str());
+	const GLint loc = m_reflection.getLocation(name);
 	glUniform1i(loc, val);
 }
 
 // ================================================================================================
-void Shader::setUniform(const std::string& name, float val)
+void Shader::setUniform(const char *name, float val)
 {
-	const GLuint loc = glGetUniformLocation(m_program, name.c_str());
+	const GLint loc = m_reflection.getLocation(name);
 	glUniform1f(loc, val);
 }
 
 // ================================================================================================
-void Shader::setUniform(const std::string& name, const vec2f& val)
+void Shader::setUniform(const char *name, const vec2f& val)
 {
-	const GLuint loc = glGetUniformLocation(m_program, name.c_str());
+	const GLint loc = m_reflection.getLocation(name);
 	glUniform2fv(loc, 1, glm::value_ptr(val));
 }
 
 // ================================================================================================
-void Shader::setUniform(const std::string& name, const mat4f& val)
+void Shader::setUniform(const char *name, const mat4f& val)
 {
-	const GLuint loc = glGetUniformLocation(m_program, name.c_str());
+	const GLint loc = m_reflection.getLocation(name);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(val));
 }
 
@@ -166,6 +399,97 @@ GLuint Shader::loadFragmentSource(const char *frag)
 
 
 
+// ================================================================================================
+ComputeShader::ComputeShader(const char *source) :
+	m_program{0},
+	m_localSize{1, 1, 1}
+{
+	const uint64_t cacheKey = getProgramCacheKey(&source, 1);
+	m_program = loadCachedProgram(cacheKey);
+	if (m_program) {
+		glGetProgramiv(m_program, GL_COMPUTE_WORK_GROUP_SIZE, m_localSize);
+		m_reflection.reflect(m_program);
+		return;
+	}
+
+	// Compile the single stage
+	const GLchar *glsource = reinterpret_cast<const GLchar *>(source);
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &glsource, nullptr);
+	glCompileShader(shader);
+
+	int success;
+	GLchar infoLog[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+		glDeleteShader(shader);
+		throw std::runtime_error(std::string("Compute shader compilation error: '")
+			+ infoLog + "'");
+	}
+
+	// Link it into its own program
+	m_program = glCreateProgram();
+	glAttachShader(m_program, shader);
+	if (isProgramCacheEnabled())
+		glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(m_program);
+	glDeleteShader(shader);
+
+	glGetProgramiv(m_program, GL_LINK_STATUS, &success);
+	if (!success) {
+		glGetProgramInfoLog(m_program, 512, nullptr, infoLog);
+		throw std::runtime_error(std::string("Compute program linking error: '")
+			+ infoLog + "'");
+	}
+
+	storeCachedProgram(m_program, cacheKey);
+	glGetProgramiv(m_program, GL_COMPUTE_WORK_GROUP_SIZE, m_localSize);
+	m_reflection.reflect(m_program);
+}
+
+// ================================================================================================
+ComputeShader::~ComputeShader()
+{
+	release();
+	glDeleteProgram(m_program);
+}
+
+// ================================================================================================
+void ComputeShader::bind()
+{
+	glUseProgram(m_program);
+}
+
+// ================================================================================================
+void ComputeShader::release()
+{
+	glUseProgram(0);
+}
+
+// ================================================================================================
+void ComputeShader::setUniform(const char *name, unsigned int val)
+{
+	const GLint loc = m_reflection.getLocation(name);
+	glUniform1ui(loc, val);
+}
+
+// ================================================================================================
+void ComputeShader::setUniform(const char *name, float val)
+{
+	const GLint loc = m_reflection.getLocation(name);
+	glUniform1f(loc, val);
+}
+
+// ================================================================================================
+void ComputeShader::dispatch(size_t count)
+{
+	const size_t groupSize = (size_t)m_localSize[0];
+	glDispatchCompute((GLuint)((count + groupSize - 1) / groupSize), 1, 1);
+}
+
+
+
 const char * const ParticleVertexShaderSource = R"(
 	#version 330 core
 
@@ -175,20 +499,54 @@ const char * const ParticleVertexShaderSource = R"(
 	layout(location = 3) in vec2  inAcc;
 
 	out vec2 vfPos;
+	out float vfKey;
 
-	uniform mat4 View;
-	uniform mat4 Projection;
-	uniform float Time;
+	layout(std140) uniform ViewBlock
+	{
+		mat4 View;
+		mat4 Projection;
+		float Time;
+	};
+	uniform float SpeedScale;
 
 	void main()
 	{
 		vec4 pos = vec4(inPos * 2, 0, 1);
 		vfPos = inPos;
+		vfKey = clamp(length(inVel) / SpeedScale, 0, 1);	// Only read by the splat shader
 		gl_Position = Projection * View * pos;
 		float dist = length(inPos);
 		gl_PointSize = (5 + (sin(dist * 8) * 3)) * sqrt(dist);
 	}
 )";
+const char * const ParticleCompactVertexShaderSource = R"(
+	#version 330 core
+
+	layout(location = 0) in vec2  inPos;	// Normalized ushort2
+	layout(location = 1) in float inKey;	// Normalized uchar
+
+	out vec2 vfPos;
+	out float vfKey;
+
+	layout(std140) uniform ViewBlock
+	{
+		mat4 View;
+		mat4 Projection;
+		float Time;
+	};
+	uniform float StreamExtent;
+
+	void main()
+	{
+		vec2 realPos = ((inPos * 2) - 1) * StreamExtent;
+		vec4 pos = vec4(realPos * 2, 0, 1);
+		vfPos = realPos;
+		vfKey = inKey;
+		gl_Position = Projection * View * pos;
+		float dist = length(realPos);
+		gl_PointSize = (5 + (sin(dist * 8) * 3)) * sqrt(dist);
+	}
+)";
 const char * const ParticleGeometryShaderSource = R"(
 	#version 330 core
 )";
@@ -199,7 +557,12 @@ const char * const ParticleFragmentShaderSource = R"(
 
 	layout(location = 0) out vec4 FragColor;
 
-	uniform float Time;
+	layout(std140) uniform ViewBlock
+	{
+		mat4 View;
+		mat4 Projection;
+		float Time;
+	};
 
 	void main()
 	{
@@ -207,4 +570,236 @@ const char * const ParticleFragmentShaderSource = R"(
 		float alpha = 0.6 + (sin((vfPos.x * 5) + (vfPos.y * 2) + (Time * 2)) * 0.4);
 		FragColor = vec4(dist / 4.0, (1 - dist) * 4, 1 - (dist / 5), 1);
 	}
+)";
+const char * const ParticleCompactFragmentShaderSource = R"(
+	#version 330 core
+
+	in vec2 vfPos;
+	in float vfKey;
+
+	layout(location = 0) out vec4 FragColor;
+
+	void main()
+	{
+		// Same colouring as the full state, brightened by the speed key of the stream
+		float dist = length(vfPos);
+		float brightness = 0.75 + (vfKey * 0.5);
+		FragColor = vec4(vec3(dist / 4.0, (1 - dist) * 4, 1 - (dist / 5)) * brightness, 1);
+	}
+)";
+const char * const ParticleComputeShaderSource = R"(
+	// The group size must be a multiple of 4, so the render stream keys are packed into whole words
+	layout(local_size_x = 256) in;
+
+	// Particle state (mirror of the host Particle type), which is packed to 32 bytes so it is addressed as words. The
+	// floats are converted from their bits, and the id is copied as it is.
+	#define PARTICLE_WORDS 8u
+	layout(std430, binding = 0) readonly buffer SourceState { uint src[]; };
+	layout(std430, binding = 1) writeonly buffer DestinationState { uint dst[]; };
+
+	// Per-frame parameters (mirror of the host FrameParams type, which matches the std140 and std430 layouts)
+	struct FrameParams
+	{
+		vec2 attractor;
+		vec2 pulse;
+		float deltaTime;
+		float totalTime;
+		float fieldStrength;
+		float attractorStrength;
+		vec4 viewBounds;
+		float lodKeep;
+	};
+
+	#ifdef VULKAN
+	layout(push_constant) uniform PushConstants
+	{
+		FrameParams Frame;
+		layout(offset = 64) uint Count;
+	};
+	#else
+	layout(std140) uniform FrameBlock { FrameParams Frame; };
+	uniform uint Count;
+	#endif
+
+	#ifdef RENDER_STREAM
+	// Compact render stream as words, Count ushort2 positions followed by Count uchar keys (see particle.hpp)
+	layout(std430, binding = 2) writeonly buffer RenderStream { uint stream[]; };
+	shared uint groupKeys[gl_WorkGroupSize.x];
+	#endif
+
+	// Same solution as the OpenCL Solve kernel, fm_atan2, fm_sin, fm_cos and fm_cube are prepended by
+	// buildFastMathSource()
+	void main()
+	{
+		// The last group runs past the end, those invocations solve the last particle again but write nothing, so
+		// that every invocation still reaches the barrier below
+		const uint IDX = gl_GlobalInvocationID.x;
+		const bool valid = (IDX < Count);
+		const uint base = min(IDX, Count - 1u) * PARTICLE_WORDS;
+
+		const float mass = uintBitsToFloat(src[base]);
+		const vec2 pos = uintBitsToFloat(uvec2(src[base + 1u], src[base + 2u]));
+		const vec2 vel = uintBitsToFloat(uvec2(src[base + 3u], src[base + 4u]));
+		vec2 force = vec2(0.0f, 0.0f);
+
+		// Force from central attractor
+		vec2 diff = pos - Frame.attractor;
+		float difflen = length(diff) + 1.0f;
+		float scale = 1.0f / fm_cube(difflen);
+		force += (scale * diff);
+
+		// Additional values that are nice to know and are used below (maybe)
+		const float angle = fm_atan2(diff.y, diff.x);
+
+		// Add the effects of an additional velocity field
+		vec2 vfield = vec2(diff.y, -diff.x) * Frame.fieldStrength;
+
+		// And another velocity field, with the pulse amplitude and phase from the frame parameters
+		const vec2 radial = vec2(fm_cos(angle), fm_sin(angle));
+		vfield.x += (Frame.pulse.x * radial.x) - (Frame.pulse.y * radial.y);
+		vfield.y += (Frame.pulse.x * radial.y) + (Frame.pulse.y * radial.x);
+
+		// Solve final changes
+		vec2 dAcc = (-force / mass) * Frame.attractorStrength;
+		vec2 dVel = vel + (dAcc * Frame.deltaTime);
+		vec2 dPos = pos + (dVel * Frame.deltaTime) + (vfield * Frame.deltaTime / difflen);
+
+		// Write solution to output array
+		if (valid) {
+			dst[base] = src[base];
+			dst[base + 1u] = floatBitsToUint(dPos.x);
+			dst[base + 2u] = floatBitsToUint(dPos.y);
+			dst[base + 3u] = floatBitsToUint(dVel.x);
+			dst[base + 4u] = floatBitsToUint(dVel.y);
+			dst[base + 5u] = floatBitsToUint(dAcc.x);
+			dst[base + 6u] = floatBitsToUint(dAcc.y);
+			dst[base + 7u] = src[base + 7u];
+		}
+
+	#ifdef RENDER_STREAM
+		// Bytes cannot be stored individually, so every fourth invocation writes the keys of itself and the next three
+		const vec2 unorm = clamp((dPos * (0.5f / RENDER_STREAM_EXTENT)) + 0.5f, 0.0f, 1.0f);
+		if (valid)
+			stream[IDX] = packUnorm2x16(unorm);
+
+		const float key = clamp(length(dVel) * (255.0f / RENDER_STREAM_SPEED_SCALE), 0.0f, 255.0f);
+		groupKeys[gl_LocalInvocationIndex] = valid ? uint(roundEven(key)) : 0u;
+		memoryBarrierShared();
+		barrier();
+		if (valid && ((IDX & 3u) == 0u)) {
+			const uint first = gl_LocalInvocationIndex;
+			stream[Count + (IDX >> 2u)] = groupKeys[first] | (groupKeys[first + 1u] << 8u)
+				| (groupKeys[first + 2u] << 16u) | (groupKeys[first + 3u] << 24u);
+		}
+	#endif
+	}
+)";
+const char * const ParticleGatherComputeShaderSource = R"(
+	layout(local_size_x = 256) in;
+
+	// Same scan as the OpenCL Gather kernel, over the state as words (see ParticleComputeShaderSource)
+	#define PARTICLE_WORDS 8u
+	layout(std430, binding = 0) readonly buffer State { uint state[]; };
+	layout(std430, binding = 1) readonly buffer Lookup { uint lookup[]; };
+	layout(std430, binding = 2) writeonly buffer Samples { vec4 samples[]; };
+	uniform uint Count;
+	uniform uint LookupCount;
+
+	void main()
+	{
+		const uint IDX = gl_GlobalInvocationID.x;
+		if (IDX >= Count)
+			return;
+
+		const uint base = IDX * PARTICLE_WORDS;
+		const uint id = state[base + 7u];
+		const uint slot = (id < LookupCount) ? lookup[id] : 0xFFFFFFFFu;
+		if (slot != 0xFFFFFFFFu)
+			samples[slot] = uintBitsToFloat(uvec4(state[base + 1u], state[base + 2u], state[base + 3u], state[base + 4u]));
+	}
+)";
+const char * const ParticleReduceComputeShaderSource = R"(
+	// Same passes as the OpenCL Reduce and ReduceFinal kernels, with the result as words
+	#define DIAGNOSTICS_MOMENTS 8u
+	#define DIAGNOSTICS_BINS 64u
+	layout(std430, binding = 1) buffer Partials { float partials[]; };
+	layout(std430, binding = 2) buffer Result { uint result[]; };
+
+	#ifndef DIAGNOSTICS_FINAL
+	layout(local_size_x = 256) in;
+
+	#define PARTICLE_WORDS 8u
+	layout(std430, binding = 0) readonly buffer State { uint state[]; };
+
+	// Per-frame parameters (mirror of the host FrameParams type)
+	struct FrameParams
+	{
+		vec2 attractor;
+		vec2 pulse;
+		float deltaTime;
+		float totalTime;
+		float fieldStrength;
+		float attractorStrength;
+		vec4 viewBounds;
+		float lodKeep;
+	};
+	layout(std140) uniform FrameBlock { FrameParams Frame; };
+	uniform uint Count;
+	uniform float BinScale;
+
+	shared uint groupBins[DIAGNOSTICS_BINS];
+
+	void main()
+	{
+		const uint lane = gl_GlobalInvocationID.x;
+		const uint lanes = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+		for (uint i = gl_LocalInvocationIndex; i < DIAGNOSTICS_BINS; i += gl_WorkGroupSize.x)
+			groupBins[i] = 0u;
+		memoryBarrierShared();
+		barrier();
+
+		float sums[DIAGNOSTICS_MOMENTS] = float[](0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+		for (uint i = lane; i < Count; i += lanes) {
+			const uint base = i * PARTICLE_WORDS;
+			const float mass = uintBitsToFloat(state[base]);
+			const vec2 pos = uintBitsToFloat(uvec2(state[base + 1u], state[base + 2u]));
+			const vec2 vel = uintBitsToFloat(uvec2(state[base + 3u], state[base + 4u]));
+			const vec2 diff = pos - Frame.attractor;
+			const float dist = length(diff);
+			const float difflen = dist + 1.0f;
+
+			sums[0] += mass;
+			sums[1] += mass * pos.x;
+			sums[2] += mass * pos.y;
+			sums[3] += mass * vel.x;
+			sums[4] += mass * vel.y;
+			sums[5] += mass * dot(vel, vel);
+			sums[6] += Frame.attractorStrength * ((0.5f / (difflen * difflen)) - (1.0f / difflen));
+			sums[7] += mass * ((diff.x * vel.y) - (diff.y * vel.x));
+			atomicAdd(groupBins[uint(min(dist * BinScale, float(DIAGNOSTICS_BINS - 1u)))], 1u);
+		}
+		for (uint k = 0u; k < DIAGNOSTICS_MOMENTS; ++k)
+			partials[(k * lanes) + lane] = sums[k];
+
+		memoryBarrierShared();
+		barrier();
+		for (uint i = gl_LocalInvocationIndex; i < DIAGNOSTICS_BINS; i += gl_WorkGroupSize.x) {
+			if (groupBins[i] != 0u)
+				atomicAdd(result[DIAGNOSTICS_MOMENTS + i], groupBins[i]);
+		}
+	}
+	#else
+	layout(local_size_x = 8) in;
+
+	uniform uint Lanes;
+
+	void main()
+	{
+		const uint k = gl_GlobalInvocationID.x;
+		float sum = 0.0f;
+		for (uint lane = 0u; lane < Lanes; ++lane)
+			sum += partials[(k * Lanes) + lane];
+		result[k] = floatBitsToUint(sum);
+	}
+	#endif
 )";
\ No newline at end of file
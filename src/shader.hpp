@@ -3,16 +3,73 @@
 #include <gl\glew.h>
 #include <glm\glm.hpp>
 #include <string>
+#include <vector>
+#include <utility>
 
 
 using vec2f = glm::vec2;
 using mat4f = glm::mat4;
 
 
+// Binding points of the uniform blocks that are shared between programs. Blocks are assigned to them by name when a
+// program is linked, so the sources do not need explicit bindings.
+enum UniformBlockBinding : unsigned char
+{
+	UNIFORM_BLOCK_FRAME = 0,	// "FrameBlock", FrameParams for the compute step
+	UNIFORM_BLOCK_VIEW = 1,		// "ViewBlock", ViewUniforms for the render programs
+	UNIFORM_BLOCK_COUNT
+};
+
+// Host layout of the ViewBlock uniform block (std140)
+struct ViewUniforms
+{
+	mat4f view;
+	mat4f projection;
+	float time;
+	float padding[3];
+};
+
+
+// A uniform buffer for one of the shared binding points, which every program with that block reads
+class UniformBuffer
+{
+private:
+	GLuint m_buffer;
+	const GLuint m_binding;
+	const size_t m_size;
+
+public:
+	UniformBuffer(UniformBlockBinding binding, size_t size);
+	~UniformBuffer();
+
+	// Replaces the whole contents, and binds the buffer to its binding point
+	void update(const void *data);
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator = (const UniformBuffer&) = delete;
+};
+
+
+// Active uniforms of a linked program, read once so setting a uniform does not query the driver
+class ProgramReflection
+{
+private:
+	std::vector<std::pair<std::string, GLint>> m_locations;
+
+public:
+	// Caches the uniform locations, and assigns the shared uniform blocks to their binding points
+	void reflect(GLuint program);
+
+	// Location of the uniform, or -1 (which glUniform* ignores) if it is not active in the program
+	GLint getLocation(const char *name) const;
+};
+
+
 class Shader
 {
 private:
 	GLuint m_program;
+	ProgramReflection m_reflection;
 
 public:
 	Shader(const char *vert, const char *geom, const char *frag);
@@ -21,11 +78,11 @@ public:
 	void bind();
 	void release();
 
-	void setUniform(const std::string& name, bool val);
-	void setUniform(const std::string& name, int val);
-	void setUniform(const std::string& name, float val);
-	void setUniform(const std::string& name, const vec2f& val);
-	void setUniform(const std::string& name, const mat4f& val);
+	void setUniform(const char *name, bool val);
+	void setUniform(const char *name, int val);
+	void setUniform(const char *name, float val);
+	void setUniform(const char *name, const vec2f& val);
+	void setUniform(const char *name, const mat4f& val);
 
 private:
 	GLuint loadVertexSource(const char *vert);
@@ -34,7 +91,43 @@ private:
 };
 
 
+// A program with a single compute shader stage (OpenGL 4.3)
+class ComputeShader
+{
+private:
+	GLuint m_program;
+	ProgramReflection m_reflection;
+	GLint m_localSize[3];
+
+public:
+	ComputeShader(const char *source);
+	~ComputeShader();
+
+	void bind();
+	void release();
+
+	void setUniform(const char *name, unsigned int val);
+	void setUniform(const char *name, float val);
+
+	// Dispatches enough work groups to cover count invocations along x, the program must be bound
+	void dispatch(size_t count);
+
+	ComputeShader(const ComputeShader&) = delete;
+	ComputeShader& operator = (const ComputeShader&) = delete;
+};
+
+
 // For simplicity, we are just going to embed the shader source directly into the executable.
 extern const char * const ParticleVertexShaderSource;
+extern const char * const ParticleCompactVertexShaderSource;	// For RENDER_STREAM_COMPACT
 extern const char * const ParticleGeometryShaderSource;
-extern const char * const ParticleFragmentShaderSource;
\ No newline at end of file
+extern const char * const ParticleFragmentShaderSource;
+extern const char * const ParticleCompactFragmentShaderSource;	// For RENDER_STREAM_COMPACT
+// The physics step for BACKEND_GLCOMPUTE and BACKEND_VULKAN (with VULKAN defined). The #version line, defines and
+// fast math library are prepended at runtime.
+extern const char * const ParticleComputeShaderSource;
+// Tracer gather for BACKEND_GLCOMPUTE (see tracer.hpp), with the #version line prepended at runtime
+extern const char * const ParticleGatherComputeShaderSource;
+// Diagnostics reductions for BACKEND_GLCOMPUTE (see diagnostics.hpp). The #version line is prepended at runtime, and
+// DIAGNOSTICS_FINAL selects the final pass over the partial sums.
+extern const char * const ParticleReduceComputeShaderSource;
\ No newline at end of file
@@ -1,96 +1,911 @@
 #include "sim.hpp"
+#include "fastmath.hpp"
+#include "jobs.hpp"
 #include "particle.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+const float Simulation::LOD_POINTS_PER_PIXEL = 2.0f;
+const float Simulation::CULL_MARGIN = 0.1f;
 
 
 // ================================================================================================
-Simulation::Simulation(size_t pcount, float xdim, float ydim) :
+Simulation::Simulation(SimulationBackend backend, RenderStreamMode streamMode, RenderMode renderMode, bool cull,
+		InitialCondition init, unsigned long long seed, const Snapshot *snapshot, size_t pcount, float xdim, float ydim) :
+	m_backend{backend},
+	m_streamMode{streamMode},
+	m_renderMode{renderMode},
+	m_cull{cull && (backend == BACKEND_OPENCL) && (streamMode == RENDER_STREAM_COMPACT)},
 	m_buffers{nullptr, nullptr},
+	m_stateMem{nullptr, nullptr},
+	m_streamBuffer{nullptr},
+	m_indirectBuffer{nullptr},
+	m_cullCounters{nullptr},
+	m_cullStats{0, 0},
+	m_cullReadback{},
+	m_cullEvents{nullptr, nullptr},
+	m_cullSlot{0},
+	m_drawIndirect{false},
 	m_particleShader{nullptr},
+	m_densityRenderer{nullptr},
 	m_particleKernel{nullptr},
+	m_gatherKernel{nullptr},
+	m_reduceKernels{nullptr, nullptr},
+	m_particleCompute{nullptr},
+	m_frameUniforms{nullptr},
+	m_viewUniforms{nullptr},
+	m_cpuSolver{nullptr},
+	m_frameParams{},
+	m_frameBuffer{nullptr},
 	m_swapped{false},
+	m_totalTime{0.0f},
 	m_pCount{pcount},
-	m_xdim{xdim},
-	m_ydim{ydim}
+	m_initParams{makeInitParams(init, seed, pcount, xdim, ydim)},
+	m_checkpointer{nullptr},
+	m_checkpointReadback{nullptr},
+	m_checkpointInterval{0.0f},
+	m_nextCheckpoint{0.0f},
+	m_checkpointTime{0.0f},
+	m_trajectory{nullptr},
+	m_trajectorySlots{},
+	m_trajectoryDropped{0},
+	m_tracer{nullptr},
+	m_diagnostics{nullptr},
+	m_clusters{nullptr},
+	m_spatialQuery{nullptr},
+	m_stepCount{0}
 {
-	m_particleShader = new Shader(ParticleVertexShaderSource, nullptr, ParticleFragmentShaderSource);
+	const bool compact = (m_streamMode == RENDER_STREAM_COMPACT);
+	const bool density = (m_renderMode == RENDER_MODE_DENSITY);
 
-	m_particleKernel = new Kernel(ParticleKernelSource, "Solve");
+	// Startup runs as a small dependency graph. The OpenCL program is built, or the initial state generated for the
+	// other backends, on the job system workers while this thread creates the OpenGL objects, which have to stay on
+	// the context thread. The jobs only hold shared data, so they can finish safely even if the constructor throws.
+	// A snapshot is streamed into the state once it exists instead, so nothing is generated.
+	auto initialState = std::make_shared<std::vector<Particle>>();
+	JobHandle generateJob;
+	if (!snapshot && (m_backend != BACKEND_OPENCL)) {
+		initialState->resize(m_pCount);
+		generateJob = generateInitialParticlesAsync(initialState->data(), m_initParams);
+		generateJob = g_jobs->submit([initialState]() {}, { generateJob });
+	}
+
+	auto program = std::make_shared<cl_program>(nullptr);
+	JobHandle buildJob;
+	if (m_backend == BACKEND_OPENCL) {
+		std::string source = buildFastMathSource(P50K_FASTMATH_TIER);
+		if (compact) {
+			char defines[256];
+			snprintf(defines, sizeof(defines),
+				"#define RENDER_STREAM\n#define RENDER_STREAM_EXTENT %.9gf\n#define RENDER_STREAM_SPEED_SCALE %.9gf\n",
+				RENDER_STREAM_EXTENT, RENDER_STREAM_SPEED_SCALE);
+			source += defines;
+		}
+		if (m_cull)
+			source += "#define RENDER_CULL\n";
+		source += ParticleKernelSource;
+		source += ParticleInitKernelSource;
+		source += ParticleGatherKernelSource;
+		source += ParticleReduceKernelSource;
+		buildJob = g_jobs->submit([program, source]() { *program = buildProgram(source.c_str()); });
+	}
+
+	m_particleShader = new Shader(compact ? ParticleCompactVertexShaderSource : ParticleVertexShaderSource, nullptr,
+		density ? ParticleSplatFragmentShaderSource
+			: (compact ? ParticleCompactFragmentShaderSource : ParticleFragmentShaderSource));
+	m_viewUniforms = new UniformBuffer(UNIFORM_BLOCK_VIEW, sizeof(ViewUniforms));
+
+	// The constant uniforms are set once, the rest come from the view block
+	m_particleShader->bind();
+	m_particleShader->setUniform("StreamExtent", RENDER_STREAM_EXTENT);
+	m_particleShader->setUniform("SpeedScale", RENDER_STREAM_SPEED_SCALE);
+	m_particleShader->release();
+	if (density)
+		m_densityRenderer = new DensityRenderer();
 
 	const size_t PSIZE = sizeof(Particle) * m_pCount;
-	m_buffers[0] = new VertexBuffer(PSIZE, GL_STATIC_DRAW);
-	m_buffers[1] = new VertexBuffer(PSIZE, GL_STATIC_DRAW);
-	m_buffers[0]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
-	m_buffers[1]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+	if (compact) {
+		vertex_format_specifier_t streamFormat[2];
+		getRenderStreamFormat(m_pCount, streamFormat);
+		// Rounded up to whole words, which the compute shader writes the keys in
+		const size_t streamSize = ((RENDER_STREAM_BYTES_PER_PARTICLE * m_pCount) + 3) & ~(size_t)3;
+		m_streamBuffer = new VertexBuffer(streamSize, (m_backend == BACKEND_CPU) ? GL_STREAM_DRAW : GL_DYNAMIC_DRAW);
+		m_streamBuffer->setFormat(streamFormat, 2);
+	}
+
+	if (m_backend == BACKEND_CPU) {
+		// The host solver keeps the state, and streams it into a single buffer each frame
+		m_cpuSolver = new CpuSolver(m_pCount);
+		if (!compact) {
+			m_buffers[0] = new VertexBuffer(PSIZE, GL_STREAM_DRAW);
+			m_buffers[0]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+		}
+		std::cout << "Initialized CPU Solver (" << CpuSolver::GetIsaName(m_cpuSolver->getIsa()) << ", "
+			<< (g_jobs->getWorkerCount() + 1) << " threads)" << std::endl;
+	}
+	else if (m_backend == BACKEND_GLCOMPUTE) {
+		// The state buffers are written by the compute shader and drawn from directly, so nothing is synchronized
+		// between APIs. With a compact stream they are only bound as storage, and never drawn.
+		std::string source = "#version 430 core\n";
+		if (compact) {
+			char defines[256];
+			snprintf(defines, sizeof(defines),
+				"#define RENDER_STREAM\n#define RENDER_STREAM_EXTENT %.9gf\n#define RENDER_STREAM_SPEED_SCALE %.9gf\n",
+				RENDER_STREAM_EXTENT, RENDER_STREAM_SPEED_SCALE);
+			source += defines;
+		}
+		source += buildFastMathSource(P50K_FASTMATH_TIER, FASTMATH_LANGUAGE_GLSL);
+		source += ParticleComputeShaderSource;
+		m_particleCompute = new ComputeShader(source.c_str());
+		m_particleCompute->bind();
+		m_particleCompute->setUniform("Count", (unsigned int)m_pCount);
+		m_particleCompute->release();
+
+		m_frameUniforms = new UniformBuffer(UNIFORM_BLOCK_FRAME, sizeof(FrameParams));
+
+		m_buffers[0] = new VertexBuffer(PSIZE, GL_DYNAMIC_COPY);
+		m_buffers[1] = new VertexBuffer(PSIZE, GL_DYNAMIC_COPY);
+		if (!compact) {
+			m_buffers[0]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+			m_buffers[1]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+		}
+		std::cout << "Initialized Compute Shader Solver" << std::endl;
+	}
+	else {
+		// The frame parameters are rewritten every frame, but the buffer only needs to be bound once
+		cl_int clerr;
+		CL_CHECK_RETURN_FATAL(
+			m_frameBuffer = clCreateBuffer(g_clContext, CL_MEM_READ_ONLY, sizeof(FrameParams), nullptr, &clerr),
+			clerr, m_frameBuffer, "Could not create the frame parameter buffer");
+
+		if (compact) {
+			// The state never leaves the device, only the stream buffer is shared with OpenGL
+			for (size_t i = 0; i < 2; ++i) {
+				CL_CHECK_RETURN_FATAL(
+					m_stateMem[i] = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, PSIZE, nullptr, &clerr),
+					clerr, m_stateMem[i], "Could not create the particle state buffer %d", (int)i);
+			}
+		}
+		else {
+			m_buffers[0] = new VertexBuffer(PSIZE, GL_STATIC_DRAW);
+			m_buffers[1] = new VertexBuffer(PSIZE, GL_STATIC_DRAW);
+			m_buffers[0]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+			m_buffers[1]->setFormat(ParticleFormatSpecifier, ParticleFormatSpecifierCount);
+		}
+
+		if (m_cull) {
+			CL_CHECK_RETURN_FATAL(
+				m_cullCounters = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(m_cullStats), nullptr, &clerr),
+				clerr, m_cullCounters, "Could not create the culling counter buffer");
+
+			// The kernel count is copied into a DrawArraysIndirectCommand { count, instances, first, base instance }
+			m_drawIndirect = (GLEW_VERSION_4_0 || GLEW_ARB_draw_indirect);
+			if (m_drawIndirect) {
+				const GLuint command[4] = { 0, 1, 0, 0 };
+				m_indirectBuffer = new VertexBuffer(sizeof(command), GL_DYNAMIC_DRAW);
+				m_indirectBuffer->setData(command);
+			}
+			std::cout << "Culling enabled (" << (m_drawIndirect ? "indirect draws" : "count readback") << ")"
+				<< std::endl;
+		}
+
+		// Everything else is created by now, so this only blocks for the remainder of the build
+		g_jobs->wait(buildJob);
+		m_particleKernel = new Kernel(*program, "Solve");
+		Kernel initKernel(*program, "Initialize");
+		m_gatherKernel = new Kernel(*program, "Gather");
+		m_reduceKernels[0] = new Kernel(*program, "Reduce");
+		m_reduceKernels[1] = new Kernel(*program, "ReduceFinal");
+		clReleaseProgram(*program);
+
+		m_particleKernel->setKernelArgument(2, sizeof(m_frameBuffer), &m_frameBuffer);
+		if (compact) {
+			const cl_mem streamMem = m_streamBuffer->getCLMemory();
+			const cl_uint count = (cl_uint)m_pCount;
+			m_particleKernel->setKernelArgument(3, sizeof(streamMem), &streamMem);
+			m_particleKernel->setKernelArgument(4, sizeof(count), &count);
+		}
+		if (m_cull)
+			m_particleKernel->setKernelArgument(5, sizeof(m_cullCounters), &m_cullCounters);
+
+		if (!snapshot)
+			initializeParticlesOpenCL(initKernel);
+	}
+
+	std::cout << "Render stream: " << getRenderStreamName(m_streamMode) << " ("
+		<< (compact ? RENDER_STREAM_BYTES_PER_PARTICLE : sizeof(Particle)) << " bytes per particle)" << std::endl;
+
+	if (snapshot) {
+		loadSnapshot(*snapshot);
+		std::cout << "Initial condition: snapshot '" << snapshot->getPath() << "' (time " << snapshot->getTime()
+			<< ")" << std::endl;
+	}
+	else {
+		std::cout << "Initial condition: " << getInitialConditionName(init) << " (seed " << seed
+			<< ", generated on the " << ((m_backend == BACKEND_OPENCL) ? "device" : "host") << ")" << std::endl;
+	}
 
-	initilizeParticles();
+	if (generateJob) {
+		g_jobs->wait(generateJob);
+		uploadInitialParticles(initialState->data());
+	}
 }
 
 // ================================================================================================
 Simulation::~Simulation()
 {
+	if (m_trajectory)
+		finishTrajectory();
+	// Collect the gathers and reductions in flight, so they go before the kernels and buffers they read
+	if (m_tracer)
+		delete m_tracer;
+	if (m_diagnostics)
+		delete m_diagnostics;
+	if (m_clusters)
+		delete m_clusters;
+	if (m_spatialQuery)
+		delete m_spatialQuery;
+
+	// Waits for the checkpoint being written, which still reads from the readback
+	if (m_checkpointer)
+		delete m_checkpointer;
+	if (m_checkpointReadback)
+		delete m_checkpointReadback;
+
 	if (m_particleShader)
 		delete m_particleShader;
+	if (m_densityRenderer)
+		delete m_densityRenderer;
 	
 	if (m_particleKernel)
 		delete m_particleKernel;
+	if (m_gatherKernel)
+		delete m_gatherKernel;
+	for (Kernel *kernel : m_reduceKernels) {
+		if (kernel)
+			delete kernel;
+	}
+	if (m_particleCompute)
+		delete m_particleCompute;
+	if (m_frameUniforms)
+		delete m_frameUniforms;
+	if (m_viewUniforms)
+		delete m_viewUniforms;
+
+	if (m_cpuSolver)
+		delete m_cpuSolver;
 
-	if (m_buffers[0]) {
+	if (m_frameBuffer)
+		clReleaseMemObject(m_frameBuffer);
+	if (m_stateMem[0])
+		clReleaseMemObject(m_stateMem[0]);
+	if (m_stateMem[1])
+		clReleaseMemObject(m_stateMem[1]);
+	for (cl_event& evt : m_cullEvents) {
+		if (evt) {
+			clWaitForEvents(1, &evt);
+			clReleaseEvent(evt);
+		}
+	}
+	if (m_cullCounters)
+		clReleaseMemObject(m_cullCounters);
+	if (m_indirectBuffer)
+		delete m_indirectBuffer;
+
+	if (m_streamBuffer)
+		delete m_streamBuffer;
+
+	if (m_buffers[0])
 		delete m_buffers[0];
+	if (m_buffers[1])
 		delete m_buffers[1];
-	}
 }
 
 // ================================================================================================
 void Simulation::render(float dtime)
 {
-	static float totalTime = 0.0f;
+	updateFrameParams(dtime);
+
+	if (m_backend == BACKEND_CPU) {
+		stepCPU();
+		m_totalTime += dtime;
+		drawParticles(m_streamBuffer ? m_streamBuffer : m_buffers[0]);
+	}
+	else if (m_backend == BACKEND_GLCOMPUTE) {
+		// The solution is drawn in the same frame, the memory barrier orders it after the dispatch
+		stepGLCompute();
+		m_totalTime += dtime;
+		drawParticles(m_streamBuffer ? m_streamBuffer : getDestinationBuffer());
+		m_swapped = !m_swapped;
+	}
+	else {
+		stepOpenCL();
+		m_totalTime += dtime;
+		drawParticles(m_streamBuffer ? m_streamBuffer : getSourceBuffer());
+		m_swapped = !m_swapped;
+	}
+
+	++m_stepCount;
+	if (m_checkpointer)
+		updateCheckpoint();
+	if (m_trajectory)
+		updateTrajectory();
+}
+
+// ================================================================================================
+void Simulation::enableCheckpoints(const char *path, float interval, float threshold)
+{
+	if (m_checkpointer)
+		throw std::runtime_error("Checkpoints are already enabled.");
+
+	m_checkpointer = new Checkpointer(path, m_pCount, threshold);
+	m_checkpointInterval = interval;
+	m_nextCheckpoint = m_totalTime + interval;
+
+	// The state is copied where it lives, and only handed to the writer once it has arrived
+	m_checkpointReadback = new StateReadback(getReadbackSource(), m_pCount);
+
+	std::cout << "Checkpoints enabled ('" << path << "', every " << interval << "s, "
+		<< getReadbackSourceName(m_checkpointReadback->getSource()) << ")" << std::endl;
+}
+
+// ================================================================================================
+void Simulation::enableTracer(const char *path, const std::vector<uint32_t>& ids)
+{
+	if (m_tracer)
+		throw std::runtime_error("A tracer is already being written.");
+
+	const ReadbackSource source = getGatherSource();
+	m_tracer = new Tracer(path, source, ids, m_pCount);
+
+	std::cout << "Tracer enabled ('" << path << "', " << ids.size() << " particles every step, "
+		<< getReadbackSourceName(source) << ")" << std::endl;
+}
+
+// ================================================================================================
+void Simulation::enableDiagnostics(const char *path, uint32_t interval)
+{
+	if (m_diagnostics)
+		throw std::runtime_error("Diagnostics are already enabled.");
+
+	// The histogram reaches the edge of the domain along its longer axis
+	const float range = 0.5f * std::max(m_initParams.dims.x, m_initParams.dims.y);
+	const ReadbackSource source = getGatherSource();
+	m_diagnostics = new Diagnostics(path, source, interval, range);
+
+	std::cout << "Diagnostics enabled ('" << path << "', every " << interval << " steps, "
+		<< getReadbackSourceName(source) << ")" << std::endl;
+}
+
+// ================================================================================================
+void Simulation::enableClusters(const char *path, uint32_t interval, float linkingFraction, uint32_t minMembers)
+{
+	if (m_clusters)
+		throw std::runtime_error("Clusters are already being found.");
+	if (m_backend == BACKEND_GLCOMPUTE)
+		throw std::runtime_error("Clusters can only be found with the OpenCL or CPU backends.");
+
+	const vec2f dims = m_initParams.dims;
+	const float spacing = std::sqrt((dims.x * dims.y) / (float)m_pCount);
+	const float linkingLength = linkingFraction * spacing;
+	const vec2f origin = -0.5f * dims;
+	m_clusters = new ClusterFinder(path, m_cpuSolver == nullptr, origin, dims, m_pCount, interval, linkingLength,
+		minMembers);
+
+	std::cout << "Clusters enabled ('" << path << "', every " << interval << " steps, linking length "
+		<< linkingLength << ", " << (m_clusters->isDevice() ? "device" : "host") << ")" << std::endl;
+}
+
+// ================================================================================================
+SpatialQuery& Simulation::prepareSpatialQuery()
+{
+	if (!m_spatialQuery) {
+		if (m_backend == BACKEND_GLCOMPUTE)
+			throw std::runtime_error("Spatial queries are only supported by the OpenCL and CPU backends.");
+		const vec2f dims = m_initParams.dims;
+		m_spatialQuery = new SpatialQuery(m_cpuSolver == nullptr, -0.5f * dims, dims, m_pCount);
+	}
+	if (m_spatialQuery->isCurrent(m_stepCount))
+		return *m_spatialQuery;
+
+	// The step has already swapped the latest state to the source, which OpenCL only holds during the step when it
+	// is shared with OpenGL
+	if (m_cpuSolver) {
+		m_spatialQuery->build(m_cpuSolver->getArrays(), m_stepCount);
+	}
+	else if (m_streamBuffer) {
+		m_spatialQuery->build(getSourceMem(), m_stepCount);
+	}
+	else {
+		VertexBuffer *source = getSourceBuffer();
+		source->acquireCLMemory();
+		m_spatialQuery->build(getSourceMem(), m_stepCount);
+		source->releaseCLMemory();
+	}
+	return *m_spatialQuery;
+}
+
+// ================================================================================================
+const SpatialQueryResults& Simulation::queryRange(const vec2f *probes, size_t count, float radius, uint32_t maxResults)
+{
+	return prepareSpatialQuery().range(probes, count, radius, maxResults);
+}
+
+// ================================================================================================
+const SpatialQueryResults& Simulation::queryNearest(const vec2f *probes, size_t count, uint32_t k)
+{
+	return prepareSpatialQuery().nearest(probes, count, k);
+}
+
+// ================================================================================================
+void Simulation::gatherOutputs(cl_mem state, const VertexBuffer *buffer)
+{
+	// Runs before the frame counters advance, so the outputs carry the step and time the state is at
+	ScopedStageTimer timer(STAGE_OUTPUT);
+	const uint64_t step = m_stepCount + 1;
+	const double time = (double)m_totalTime + m_frameParams.deltaTime;
+	if (m_tracer) {
+		if (m_cpuSolver)
+			m_tracer->gather(*m_cpuSolver, step, time);
+		else if (buffer)
+			m_tracer->gather(buffer, m_pCount, step, time);
+		else
+			m_tracer->gather(*m_gatherKernel, state, m_pCount, step, time);
+	}
+	if (m_diagnostics && m_diagnostics->isDue(step)) {
+		if (m_cpuSolver)
+			m_diagnostics->reduce(*m_cpuSolver, m_frameParams, step, time);
+		else if (buffer)
+			m_diagnostics->reduce(buffer, m_pCount, step, time);
+		else
+			m_diagnostics->reduce(*m_reduceKernels[0], *m_reduceKernels[1], state, m_frameBuffer, m_pCount, step,
+				time);
+	}
+	if (m_clusters && m_clusters->isDue(step)) {
+		if (m_cpuSolver)
+			m_clusters->find(*m_cpuSolver, step, time);
+		else
+			m_clusters->find(state, step, time);
+	}
+}
+
+// ================================================================================================
+void Simulation::updateCheckpoint()
+{
+	// Nothing is started while the previous checkpoint is still being written, it still reads the readback
+	if (!m_checkpointReadback->isPending()) {
+		if (m_checkpointer->isBusy() || m_totalTime < m_nextCheckpoint)
+			return;
+		m_nextCheckpoint = m_totalTime + m_checkpointInterval;
+		m_checkpointTime = m_totalTime;
+
+		ScopedStageTimer timer(STAGE_OUTPUT, true);
+		startReadback(*m_checkpointReadback);
+	}
+
+	if (m_checkpointReadback->poll())
+		m_checkpointer->write(m_checkpointReadback->getData(), m_checkpointTime);
+}
+
+// ================================================================================================
+void Simulation::enableTrajectory(const char *path, uint32_t stride, uint32_t attributeMask, const uint32_t *codecs,
+	float tolerance)
+{
+	if (m_trajectory)
+		throw std::runtime_error("A trajectory is already being written.");
+	if (!stride)
+		throw std::runtime_error("The trajectory stride must be greater than zero.");
 
+	// The error bounds follow the extent of each axis, velocities use the same scale per second. Ids are never
+	// quantized, so their scale is unused.
+	const float scales[SNAPSHOT_ATTRIBUTE_COUNT] = {
+		1.0f, m_initParams.dims.x, m_initParams.dims.y, m_initParams.dims.x, m_initParams.dims.y, 1.0f };
+	TrajectoryEncoding encodings[SNAPSHOT_ATTRIBUTE_COUNT];
+	for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute)
+		encodings[attribute] = { codecs[attribute], tolerance * scales[attribute] };
+
+	m_trajectory = new TrajectoryWriter(path, m_pCount, stride, attributeMask, encodings);
+	for (trajectory_slot_t& slot : m_trajectorySlots)
+		slot = { new StateReadback(getReadbackSource(), m_pCount), 0, 0.0f, false };
+
+	std::cout << "Trajectory enabled ('" << path << "', every " << stride << " steps, "
+		<< getReadbackSourceName(m_trajectorySlots[0].readback->getSource()) << ", positions "
+		<< getCodecName(codecs[SNAPSHOT_POS_X]) << ")" << std::endl;
+}
+
+// ================================================================================================
+void Simulation::updateTrajectory()
+{
+	ScopedStageTimer timer(STAGE_OUTPUT);
+
+	// Slots come back once the writer no longer reads their state
+	size_t tag;
+	while (m_trajectory->popWritten(tag))
+		m_trajectorySlots[tag].queued = false;
+
+	// A frame is only dropped when both slots are still busy, the render loop never waits for the writer
+	if ((m_stepCount % m_trajectory->getStride()) == 0) {
+		trajectory_slot_t *free = nullptr;
+		for (trajectory_slot_t& slot : m_trajectorySlots) {
+			if (!slot.queued && !slot.readback->isPending())
+				free = &slot;
+		}
+		if (free) {
+			free->step = m_stepCount;
+			free->time = m_totalTime;
+			startReadback(*free->readback);
+		}
+		else {
+			++m_trajectoryDropped;
+		}
+	}
+
+	queueTrajectoryFrames();
+}
+
+// ================================================================================================
+void Simulation::queueTrajectoryFrames()
+{
+	// Arrived readbacks are queued in step order, so a newer one waits for an older one that is still in flight
+	for (;;) {
+		trajectory_slot_t *oldest = nullptr;
+		for (trajectory_slot_t& slot : m_trajectorySlots) {
+			if (slot.readback->isPending() && (!oldest || slot.step < oldest->step))
+				oldest = &slot;
+		}
+		if (!oldest || !oldest->readback->poll())
+			break;
+
+		// The queue holds more frames than there are slots, so this always succeeds
+		oldest->queued = true;
+		const size_t index = (size_t)(oldest - m_trajectorySlots);
+		m_trajectory->push({ oldest->readback->getData(), oldest->step, oldest->time, index });
+	}
+}
+
+// ================================================================================================
+void Simulation::finishTrajectory()
+{
+	// The readbacks still in flight are waited for, so the last frames are written too
+	if (m_backend == BACKEND_OPENCL)
+		clFinish(g_clCommandQueue);
+	glFinish();
+	queueTrajectoryFrames();
+
+	// Joins the writer once the queue is empty, before the readbacks it reads from are released
+	delete m_trajectory;
+	m_trajectory = nullptr;
+	for (trajectory_slot_t& slot : m_trajectorySlots)
+		delete slot.readback;
+
+	if (m_trajectoryDropped)
+		std::cerr << "Trajectory dropped " << m_trajectoryDropped << " frames, the writer could not keep up" << std::endl;
+}
+
+// ================================================================================================
+ReadbackSource Simulation::getReadbackSource() const
+{
+	// OpenCL with a compact stream keeps the state on the device only, the other backends in OpenGL buffers
+	if (m_cpuSolver)
+		return READBACK_HOST;
+	return m_stateMem[0] ? READBACK_OPENCL : READBACK_OPENGL;
+}
+
+// ================================================================================================
+ReadbackSource Simulation::getGatherSource() const
+{
+	// Gathers and reductions run on the backend itself, even where the state copies read the shared OpenGL buffers
+	if (m_cpuSolver)
+		return READBACK_HOST;
+	return (m_backend == BACKEND_GLCOMPUTE) ? READBACK_OPENGL : READBACK_OPENCL;
+}
+
+// ================================================================================================
+void Simulation::startReadback(StateReadback& readback) const
+{
+	// The step has already swapped the latest state to the source
+	if (m_cpuSolver)
+		readback.start(*m_cpuSolver);
+	else if (m_stateMem[0])
+		readback.start(getSourceMem());
+	else
+		readback.start(getSourceBuffer());
+}
+
+// ================================================================================================
+void Simulation::stepOpenCL()
+{
 	cl_mem src = getSourceMem();
 	cl_mem dst = getDestinationMem();
-	VertexBuffer *srcbuf = getSourceBuffer();
-	VertexBuffer *dstbuf = getDestinationBuffer();
-
-	srcbuf->acquireCLMemory();
-	dstbuf->acquireCLMemory();
-	m_particleKernel->setKernelArgument(0, sizeof(src), &src);
-	m_particleKernel->setKernelArgument(1, sizeof(dst), &dst);
-	m_particleKernel->setKernelArgument(2, sizeof(dtime), &dtime);
-	m_particleKernel->setKernelArgument(3, sizeof(totalTime), &totalTime);
-	size_t global[1] = { m_pCount };
-	m_particleKernel->executeNDRange(1, global, true);
-	srcbuf->releaseCLMemory();
-	dstbuf->releaseCLMemory();
 
-	m_particleShader->bind();
-	m_particleShader->setUniform("Projection", g_camera->projection());
-	m_particleShader->setUniform("View", g_camera->view());
-	m_particleShader->setUniform("Time", (totalTime += dtime));
-	srcbuf->drawBuffer(GL_POINTS, 0, m_pCount);
+	// Only the buffers that are drawn from need to be handed between the APIs
+	VertexBuffer *shared[2] = { m_streamBuffer, m_indirectBuffer };
+	if (!m_streamBuffer) {
+		shared[0] = getSourceBuffer();
+		shared[1] = getDestinationBuffer();
+	}
+
+	// Device events are only generated when the profiler or a trace is running
+	const bool profiling = g_profiler.wantsDeviceEvents();
+	cl_event acqevt[2] = { nullptr, nullptr };
+	cl_event kernevt = nullptr;
+	cl_event relevt[2] = { nullptr, nullptr };
+
+	{
+		ScopedStageTimer timer(STAGE_ACQUIRE);
+		for (size_t i = 0; i < 2; ++i) {
+			if (shared[i])
+				shared[i]->acquireCLMemory(profiling ? &acqevt[i] : nullptr);
+		}
+	}
+	{
+		ScopedStageTimer timer(STAGE_ARGUMENTS);
+		m_particleKernel->setKernelArgument(0, sizeof(src), &src);
+		m_particleKernel->setKernelArgument(1, sizeof(dst), &dst);
+
+		// Non-blocking, the kernel is waited on before the host copy is touched again
+		CL_CHECK_FATAL(clEnqueueWriteBuffer(g_clCommandQueue, m_frameBuffer, CL_FALSE, 0, sizeof(FrameParams),
+			&m_frameParams, 0, nullptr, nullptr), "Could not upload the frame parameters");
+
+		if (m_cull) {
+			const cl_uint zero = 0;
+			CL_CHECK_FATAL(clEnqueueFillBuffer(g_clCommandQueue, m_cullCounters, &zero, sizeof(zero), 0,
+				sizeof(m_cullStats), 0, nullptr, nullptr), "Could not reset the culling counters");
+		}
+	}
+	{
+		ScopedStageTimer timer(STAGE_KERNEL);
+		size_t global[1] = { m_pCount };
+		m_particleKernel->executeNDRange(1, global, true, profiling ? &kernevt : nullptr);
+	}
+	if (m_cull) {
+		// The drawn count becomes the vertex count of the indirect draw, the host copy feeds the next level of detail
+		if (m_indirectBuffer) {
+			CL_CHECK_FATAL(clEnqueueCopyBuffer(g_clCommandQueue, m_cullCounters, m_indirectBuffer->getCLMemory(), 0, 0,
+				sizeof(cl_uint), 0, nullptr, nullptr), "Could not write the indirect draw count");
+
+			// The draw never needs the count on the host, so the statistics and level of detail use the counters of
+			// the previous step, which have arrived by now, instead of waiting for these
+			const size_t slot = m_cullSlot;
+			CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_cullCounters, CL_FALSE, 0, sizeof(m_cullStats),
+				m_cullReadback[slot], 0, nullptr, &m_cullEvents[slot]), "Could not read the culling counters");
+			m_cullSlot = slot ^ 1;
+			cl_event& previous = m_cullEvents[m_cullSlot];
+			if (previous) {
+				CL_CHECK_FATAL(clWaitForEvents(1, &previous), "Could not wait for the culling counters");
+				clReleaseEvent(previous);
+				previous = nullptr;
+				m_cullStats[0] = m_cullReadback[m_cullSlot][0];
+				m_cullStats[1] = m_cullReadback[m_cullSlot][1];
+			}
+		}
+		else {
+			CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_cullCounters, CL_TRUE, 0, sizeof(m_cullStats),
+				m_cullStats, 0, nullptr, nullptr), "Could not read the culling counters");
+		}
+	}
+	// The shared buffers are still acquired by OpenCL here
+	if (m_tracer || m_diagnostics || m_clusters)
+		gatherOutputs(dst, nullptr);
+	{
+		ScopedStageTimer timer(STAGE_RELEASE);
+		for (size_t i = 0; i < 2; ++i) {
+			if (shared[i])
+				shared[i]->releaseCLMemory(profiling ? &relevt[i] : nullptr);
+		}
+	}
+	g_profiler.recordCLEvent(STAGE_ACQUIRE, acqevt[0], acqevt[1]);
+	g_profiler.recordCLEvent(STAGE_KERNEL, kernevt);
+	g_profiler.recordCLEvent(STAGE_RELEASE, relevt[0], relevt[1]);
+}
+
+// ================================================================================================
+void Simulation::stepCPU()
+{
+	{
+		ScopedStageTimer timer(STAGE_KERNEL);
+		m_cpuSolver->step(m_frameParams);
+	}
+	if (m_tracer || m_diagnostics || m_clusters)
+		gatherOutputs(nullptr, nullptr);
+	{
+		// Interleave straight into the buffer, orphaning the storage used by the previous frame
+		ScopedStageTimer timer(STAGE_UPLOAD);
+		VertexBuffer *buffer = m_streamBuffer ? m_streamBuffer : m_buffers[0];
+		void *mapped = buffer->mapBufferRange(GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT, 0, buffer->getSize());
+		if (m_streamBuffer)
+			m_cpuSolver->getRenderStream(mapped);
+		else
+			m_cpuSolver->getState(static_cast<Particle*>(mapped));
+		buffer->unmapBuffer();
+	}
+}
+
+// ================================================================================================
+void Simulation::stepGLCompute()
+{
+	{
+		ScopedStageTimer timer(STAGE_ARGUMENTS);
+		m_frameUniforms->update(&m_frameParams);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, getSourceBuffer()->getVboName());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, getDestinationBuffer()->getVboName());
+		if (m_streamBuffer)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_streamBuffer->getVboName());
+	}
+	{
+		ScopedStageTimer timer(STAGE_KERNEL, true);
+		m_particleCompute->bind();
+		m_particleCompute->dispatch(m_pCount);
+		m_particleCompute->release();
+
+		// The draw reads the results as vertices, and the next step reads them as storage
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	if (m_tracer || m_diagnostics || m_clusters)
+		gatherOutputs(nullptr, getDestinationBuffer());
+}
+
+// ================================================================================================
+void Simulation::updateFrameParams(float dtime)
+{
+	setFrameSimulationParams(m_frameParams, m_totalTime, dtime);
+
+	// The shaders draw particles at twice their simulated position, so the camera bounds are halved
+	const glm::vec4 bounds = g_camera->getVisibleBounds() * 0.5f;
+	const glm::vec2 margin = glm::vec2(bounds.z - bounds.x, bounds.w - bounds.y) * CULL_MARGIN;
+	m_frameParams.viewBounds = bounds + glm::vec4(-margin, margin);
+
+	// Thin out the visible particles to a fixed density on screen, using the visible count from the last step
+	m_frameParams.lodKeep = 1.0f;
+	if (m_cull && m_cullStats[1] > 0) {
+		int width, height;
+		glfwGetFramebufferSize(g_windowPtr, &width, &height);
+		const float budget = (float)width * (float)height * LOD_POINTS_PER_PIXEL;
+		m_frameParams.lodKeep = std::min(1.0f, budget / (float)m_cullStats[1]);
+	}
+	if (m_densityRenderer)
+		m_densityRenderer->setDensityScale(1.0f / m_frameParams.lodKeep);
+}
+
+// ================================================================================================
+void Simulation::drawParticles(VertexBuffer *buffer)
+{
+	{
+		ScopedStageTimer timer(STAGE_SHADER_BIND);
+		m_particleShader->bind();
+	}
+	{
+		ScopedStageTimer timer(STAGE_UNIFORMS);
+		ViewUniforms view;
+		view.view = g_camera->view();
+		view.projection = g_camera->projection();
+		view.time = m_totalTime;
+		m_viewUniforms->update(&view);
+	}
+	{
+		ScopedStageTimer timer(STAGE_DRAW, true);
+		if (m_densityRenderer)
+			m_densityRenderer->begin();
+		if (m_indirectBuffer)
+			buffer->drawBufferIndirect(GL_POINTS, m_indirectBuffer);
+		else
+			buffer->drawBuffer(GL_POINTS, 0, m_cull ? m_cullStats[0] : m_pCount);
+	}
 	m_particleShader->release();
 
-	m_swapped = !m_swapped;
+	if (m_densityRenderer) {
+		ScopedStageTimer timer(STAGE_RESOLVE, true);
+		m_densityRenderer->resolve();
+	}
+}
+
+// ================================================================================================
+void Simulation::uploadInitialParticles(const Particle *pdata)
+{
+	if (m_cpuSolver)
+		m_cpuSolver->setState(pdata);
+	else
+		m_buffers[0]->setData(pdata);
 }
 
 // ================================================================================================
-void Simulation::initilizeParticles()
+void Simulation::loadSnapshot(const Snapshot& snapshot)
 {
-	static const auto randflt = [](float low = 0.0f, float high = 1.0f) -> float {
-		float flt = rand() / (float)RAND_MAX;
-		return (flt * (high - low)) + low;
-	};
-	const float halfx = m_xdim / 2.0f;
-	const float halfy = m_ydim / 2.0f;
+	if (snapshot.getParticleCount() != m_pCount)
+		throw std::runtime_error("The snapshot particle count does not match the simulation");
+
+	if (m_cpuSolver) {
+		// The columns already have the layout of the solver arrays
+		m_cpuSolver->setState(snapshot);
+	}
+	else if (m_stateMem[0]) {
+		// OpenCL with a compact stream keeps the state on the device only
+		loadSnapshotOpenCL(snapshot);
+	}
+	else {
+		// Converted a chunk at a time into mapped ranges of the OpenGL buffer the first step reads from. With OpenCL
+		// this runs before the buffer is ever acquired, so it is still owned by OpenGL.
+		for (size_t first = 0; first < m_pCount; first += SNAPSHOT_CHUNK_PARTICLES) {
+			const size_t count = std::min(SNAPSHOT_CHUNK_PARTICLES, m_pCount - first);
+			void *mapped = m_buffers[0]->mapBufferRange(GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT,
+				first * sizeof(Particle), count * sizeof(Particle));
+			snapshot.readParticles(static_cast<Particle*>(mapped), first, count);
+			m_buffers[0]->unmapBuffer();
+		}
+	}
 
-	Particle *pdata = new Particle[m_pCount];
+	m_totalTime = (float)snapshot.getTime();
+}
+
+// ================================================================================================
+void Simulation::loadSnapshotOpenCL(const Snapshot& snapshot)
+{
+	// The device only state is filled through two pinned staging buffers, so a chunk is converted on the host while
+	// the previous one is still being copied
+	const size_t chunkBytes = sizeof(Particle) * std::min(SNAPSHOT_CHUNK_PARTICLES, m_pCount);
+	cl_mem staging[2] = { nullptr, nullptr };
+	Particle *mapped[2] = { nullptr, nullptr };
+	cl_event copied[2] = { nullptr, nullptr };
+	cl_int clerr;
+	for (size_t i = 0; i < 2; ++i) {
+		CL_CHECK_RETURN_FATAL(
+			staging[i] = clCreateBuffer(g_clContext, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, chunkBytes, nullptr,
+				&clerr),
+			clerr, staging[i], "Could not create snapshot staging buffer %d", (int)i);
+		CL_CHECK_RETURN_FATAL(
+			mapped[i] = static_cast<Particle*>(clEnqueueMapBuffer(g_clCommandQueue, staging[i], CL_TRUE, CL_MAP_WRITE,
+				0, chunkBytes, 0, nullptr, nullptr, &clerr)),
+			clerr, mapped[i], "Could not map snapshot staging buffer %d", (int)i);
+	}
 
-	for (size_t i = 0; i < m_pCount; ++i) {
-		Particle& part = pdata[i];
+	const cl_mem dst = m_stateMem[0];
+	size_t slot = 0;
+	for (size_t first = 0; first < m_pCount; first += SNAPSHOT_CHUNK_PARTICLES, slot ^= 1) {
+		const size_t count = std::min(SNAPSHOT_CHUNK_PARTICLES, m_pCount - first);
+		if (copied[slot]) {
+			CL_CHECK_FATAL(clWaitForEvents(1, &copied[slot]), "Could not wait for a snapshot chunk");
+			clReleaseEvent(copied[slot]);
+			copied[slot] = nullptr;
+		}
+		snapshot.readParticles(mapped[slot], first, count);
+		CL_CHECK_FATAL(clEnqueueWriteBuffer(g_clCommandQueue, dst, CL_FALSE, first * sizeof(Particle),
+			count * sizeof(Particle), mapped[slot], 0, nullptr, &copied[slot]), "Could not copy a snapshot chunk");
+	}
+	CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not wait for the snapshot upload");
 
-		part.mass = 1.0f;
-		part.pos = { randflt(-halfx, halfx), randflt(-halfy, halfy) };
+	for (size_t i = 0; i < 2; ++i) {
+		if (copied[i])
+			clReleaseEvent(copied[i]);
+		clEnqueueUnmapMemObject(g_clCommandQueue, staging[i], mapped[i], 0, nullptr, nullptr);
 	}
+	CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not unmap the snapshot staging buffers");
+	clReleaseMemObject(staging[0]);
+	clReleaseMemObject(staging[1]);
+}
+
+// ================================================================================================
+void Simulation::initializeParticlesOpenCL(Kernel& kernel)
+{
+	// Written straight into the state the first step reads from, nothing passes through the host
+	const cl_mem dst = getSourceMem();
+	VertexBuffer *shared = m_streamBuffer ? nullptr : getSourceBuffer();
+	kernel.setKernelArgument(0, sizeof(dst), &dst);
+	kernel.setKernelArgument(1, sizeof(InitParams), &m_initParams);
 
-	m_buffers[0]->setData(pdata);
-	delete pdata;
+	if (shared)
+		shared->acquireCLMemory();
+	size_t global[1] = { m_pCount };
+	kernel.executeNDRange(1, global, true);
+	if (shared) {
+		shared->releaseCLMemory();
+		CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not wait for the initial state to be released to OpenGL");
+	}
 }
\ No newline at end of file
@@ -4,32 +4,157 @@
 #include "shader.hpp"
 #include "camera.hpp"
 #include "kernel.hpp"
+#include "cpusolver.hpp"
+#include "options.hpp"
+#include "particle.hpp"
+#include "splat.hpp"
+#include "checkpoint.hpp"
+#include "readback.hpp"
+#include "trajectory.hpp"
+#include "tracer.hpp"
+#include "diagnostics.hpp"
+#include "clusters.hpp"
+#include "spatialquery.hpp"
+#include <vector>
+
+
+class Snapshot;
 
 
 class Simulation
 {
+	// A double buffered readback for the trajectory writer
+	struct trajectory_slot_t
+	{
+		StateReadback *readback;
+		uint64_t step;
+		float time;
+		bool queued;					// Passed to the writer, which still reads the state
+	};
+
+public:
+	// When culling, the level of detail keeps at most this many particles per window pixel
+	static const float LOD_POINTS_PER_PIXEL;
+	// Margin around the visible area that is still drawn, as a fraction of its size, so sprites do not pop
+	static const float CULL_MARGIN;
+
 private:
-	VertexBuffer* m_buffers[2];
+	const SimulationBackend m_backend;
+	const RenderStreamMode m_streamMode;
+	const RenderMode m_renderMode;
+	const bool m_cull;
+	VertexBuffer* m_buffers[2];			// Full particle state, shared with OpenGL (RENDER_STREAM_FULL, or always with
+										// BACKEND_GLCOMPUTE, where they are also the shader storage buffers)
+	cl_mem m_stateMem[2];				// Device only particle state (OpenCL with RENDER_STREAM_COMPACT)
+	VertexBuffer* m_streamBuffer;		// Quantized positions for drawing (RENDER_STREAM_COMPACT)
+	VertexBuffer* m_indirectBuffer;		// Draw command, with the count written by the culling pass
+	cl_mem m_cullCounters;				// Particles drawn and visible, written by the culling pass
+	cl_uint m_cullStats[2];				// Host copy of m_cullCounters from the last step, or the one before it with
+										// indirect draws
+	cl_uint m_cullReadback[2][2];		// Non-blocking reads of m_cullCounters, alternating between steps (indirect
+										// draws only)
+	cl_event m_cullEvents[2];
+	size_t m_cullSlot;					// Of the next read into m_cullReadback
+	bool m_drawIndirect;				// If the draw count can be read by the GPU directly, without a readback
 	Shader *m_particleShader;
+	DensityRenderer *m_densityRenderer;	// RENDER_MODE_DENSITY only
 	Kernel *m_particleKernel;
+	Kernel *m_gatherKernel;				// Tracer gather, from the same program (BACKEND_OPENCL)
+	Kernel *m_reduceKernels[2];			// Diagnostics passes, from the same program (BACKEND_OPENCL)
+	ComputeShader *m_particleCompute;	// BACKEND_GLCOMPUTE only
+	UniformBuffer *m_frameUniforms;		// Uniform buffer copy of m_frameParams (BACKEND_GLCOMPUTE)
+	UniformBuffer *m_viewUniforms;		// Camera and time for the render programs, written once per frame
+	CpuSolver *m_cpuSolver;
+	FrameParams m_frameParams;
+	cl_mem m_frameBuffer;		// Device copy of m_frameParams, bound to the kernel once
 	bool m_swapped;
+	float m_totalTime;
 	const size_t m_pCount;
-	const float m_xdim;
-	const float m_ydim;
+	const InitParams m_initParams;
+	Checkpointer *m_checkpointer;
+	StateReadback *m_checkpointReadback;
+	float m_checkpointInterval;			// Simulated seconds between checkpoints
+	float m_nextCheckpoint;
+	float m_checkpointTime;				// Of the state in m_checkpointReadback
+	TrajectoryWriter *m_trajectory;
+	trajectory_slot_t m_trajectorySlots[2];
+	size_t m_trajectoryDropped;			// Frames that were due while both slots were busy
+	Tracer *m_tracer;
+	Diagnostics *m_diagnostics;
+	ClusterFinder *m_clusters;
+	SpatialQuery *m_spatialQuery;		// Created by the first query
+	uint64_t m_stepCount;
 
 public:
-	Simulation(size_t pcount, float xdim, float ydim);
+	Simulation(SimulationBackend backend, RenderStreamMode streamMode, RenderMode renderMode, bool cull,
+		InitialCondition init, unsigned long long seed, const Snapshot *snapshot, size_t pcount, float xdim, float ydim);
 	~Simulation();
 
+	inline SimulationBackend getBackend() const { return m_backend; }
+	inline RenderStreamMode getRenderStreamMode() const { return m_streamMode; }
+	inline RenderMode getRenderMode() const { return m_renderMode; }
+	inline bool isCulling() const { return m_cull; }
+	inline size_t getParticleCount() const { return m_pCount; }
+	inline uint64_t getStepCount() const { return m_stepCount; }
+	// Size of the rectangle around the origin that the initial state was placed in
+	inline vec2f getDims() const { return m_initParams.dims; }
+	// Number of particles drawn in the last frame
+	inline size_t getDrawnCount() const { return m_cull ? m_cullStats[0] : m_pCount; }
+
 	void render(float dtime);
 
+	// Writes a checkpoint every interval of simulated time, see Checkpointer
+	void enableCheckpoints(const char *path, float interval, float threshold);
+	// Writes the attributes in attributeMask (a bit per SnapshotAttribute) every stride steps, see TrajectoryWriter.
+	// Codecs holds the TrajectoryCodec stages of each attribute, and quantization keeps the error within tolerance times
+	// the domain size.
+	void enableTrajectory(const char *path, uint32_t stride, uint32_t attributeMask, const uint32_t *codecs,
+		float tolerance);
+	// Writes the particles with the given ids (sorted and unique) every step, gathered where the state lives, see
+	// Tracer
+	void enableTracer(const char *path, const std::vector<uint32_t>& ids);
+	// Writes a time series of reductions over the state every interval steps, see Diagnostics
+	void enableDiagnostics(const char *path, uint32_t interval);
+	// The newest diagnostics, or nullptr before the first one has arrived
+	inline const DiagnosticsSample* getDiagnostics() const
+		{ return (m_diagnostics && m_diagnostics->hasLatest()) ? &m_diagnostics->getLatest() : nullptr; }
+	// Finds friends-of-friends clusters every interval steps, see ClusterFinder. The linking length is a fraction of
+	// the mean particle spacing.
+	void enableClusters(const char *path, uint32_t interval, float linkingFraction, uint32_t minMembers);
+	// Searches the state after the latest step, see SpatialQuery. The grid is only built when the first batch after a
+	// step arrives, and the results stay valid until the next batch.
+	const SpatialQueryResults& queryRange(const vec2f *probes, size_t count, float radius, uint32_t maxResults);
+	const SpatialQueryResults& queryNearest(const vec2f *probes, size_t count, uint32_t k);
+	// Probes answered per second over all batches, zero before the first one
+	inline double getQueriesPerSecond() const { return m_spatialQuery ? m_spatialQuery->getQueriesPerSecond() : 0.0; }
+
 private:
-	void initilizeParticles();
+	void uploadInitialParticles(const Particle *pdata);
+	void initializeParticlesOpenCL(Kernel& kernel);
+	void loadSnapshot(const Snapshot& snapshot);
+	void loadSnapshotOpenCL(const Snapshot& snapshot);
+	void updateFrameParams(float dtime);
+	void updateCheckpoint();
+	void updateTrajectory();
+	void queueTrajectoryFrames();
+	void finishTrajectory();
+	void gatherOutputs(cl_mem state, const VertexBuffer *buffer);
+	SpatialQuery& prepareSpatialQuery();
+	ReadbackSource getReadbackSource() const;
+	ReadbackSource getGatherSource() const;
+	void startReadback(StateReadback& readback) const;
+
+	void stepOpenCL();
+	void stepCPU();
+	void stepGLCompute();
+	void drawParticles(VertexBuffer *buffer);
 
 	inline size_t getSourceIndex() const { return m_swapped ? 1 : 0; }
 	inline size_t getDestinationIndex() const { return m_swapped ? 0 : 1; }
-	inline cl_mem getSourceMem() const { return m_buffers[m_swapped ? 1 : 0]->getCLMemory(); }
-	inline cl_mem getDestinationMem() const { return m_buffers[m_swapped ? 0 : 1]->getCLMemory(); }
+	inline cl_mem getSourceMem() const
+		{ return m_streamBuffer ? m_stateMem[getSourceIndex()] : m_buffers[getSourceIndex()]->getCLMemory(); }
+	inline cl_mem getDestinationMem() const
+		{ return m_streamBuffer ? m_stateMem[getDestinationIndex()] : m_buffers[getDestinationIndex()]->getCLMemory(); }
 	inline VertexBuffer* getSourceBuffer() const { return m_buffers[m_swapped ? 1 : 0]; }
 	inline VertexBuffer* getDestinationBuffer() const { return m_buffers[m_swapped ? 0 : 1]; }
 };
\ No newline at end of file
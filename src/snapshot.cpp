@@ -0,0 +1,154 @@
+#include "snapshot.hpp"
+#include "jobs.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+static const char SnapshotMagic[8] = { 'P', '5', '0', 'K', 'S', 'N', 'A', 'P' };
+static const size_t SNAPSHOT_GRAIN = 16 * 1024;
+static const size_t SNAPSHOT_COLUMN_ALIGNMENT = 64;
+
+
+// ================================================================================================
+Snapshot::Snapshot(const char *path) :
+	m_file{path, "snapshot", MAPPED_ACCESS_SEQUENTIAL},
+	m_header{nullptr},
+	m_columns{}
+{
+	// Validate everything that is read through the mapping later, a bad file throws here instead of faulting
+	const std::string error = std::string("Snapshot '") + path + "' ";
+	const unsigned char *data = m_file.getData();
+	const size_t size = m_file.getSize();
+	m_header = reinterpret_cast<const SnapshotHeader*>(data);
+	if (size < sizeof(SnapshotHeader) || memcmp(m_header->magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0)
+		throw std::runtime_error(error + "is not a snapshot file");
+	if (m_header->version != SNAPSHOT_VERSION)
+		throw std::runtime_error(error + "has unsupported version " + std::to_string(m_header->version));
+	if (m_header->particleCount == 0 || m_header->particleCount > 0xFFFFFFFFull)
+		throw std::runtime_error(error + "has an invalid particle count");
+
+	const size_t count = (size_t)m_header->particleCount;
+	const size_t columnsEnd = sizeof(SnapshotHeader) + ((size_t)m_header->columnCount * sizeof(SnapshotColumn));
+	if (columnsEnd > size)
+		throw std::runtime_error(error + "is truncated");
+	const SnapshotColumn *columns = reinterpret_cast<const SnapshotColumn*>(data + sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < m_header->columnCount; ++i) {
+		const SnapshotColumn& column = columns[i];
+		const bool valid = (column.attribute < SNAPSHOT_ATTRIBUTE_COUNT)
+			&& (column.type == getSnapshotType((SnapshotAttribute)column.attribute))
+			&& (column.offset % sizeof(float) == 0) && (column.offset >= columnsEnd)
+			&& (column.offset <= size) && ((size - column.offset) / sizeof(float) >= count);
+		if (!valid)
+			throw std::runtime_error(error + "has an invalid column " + std::to_string(i));
+		m_columns[column.attribute] = reinterpret_cast<const float*>(data + column.offset);
+	}
+	if (!m_columns[SNAPSHOT_POS_X] || !m_columns[SNAPSHOT_POS_Y])
+		throw std::runtime_error(error + "has no positions");
+}
+
+// ================================================================================================
+void Snapshot::readParticles(Particle *dst, size_t first, size_t count) const
+{
+	const float * const *columns = m_columns;
+	g_jobs->parallel_for(0, count, SNAPSHOT_GRAIN, [columns, dst, first](size_t begin, size_t end) {
+		const auto read = [columns](SnapshotAttribute attribute, size_t index, float fallback) {
+			return columns[attribute] ? columns[attribute][index] : fallback;
+		};
+		for (size_t i = begin; i < end; ++i) {
+			const size_t index = first + i;
+			Particle& part = dst[i];
+			part.mass = read(SNAPSHOT_MASS, index, 1.0f);
+			part.pos = { columns[SNAPSHOT_POS_X][index], columns[SNAPSHOT_POS_Y][index] };
+			part.vel = { read(SNAPSHOT_VEL_X, index, 0.0f), read(SNAPSHOT_VEL_Y, index, 0.0f) };
+			part.acc = { 0.0f, 0.0f };
+			part.id = columns[SNAPSHOT_ID] ? reinterpret_cast<const uint32_t*>(columns[SNAPSHOT_ID])[index]
+				: (uint32_t)index;
+		}
+	});
+}
+
+
+
+// ================================================================================================
+void writeSnapshot(const char *path, const Particle *particles, size_t count, double time)
+{
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error(std::string("Could not open snapshot '") + path + "' for writing");
+
+	const SnapshotHeader header = makeSnapshotHeader(count, time);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	SnapshotColumn columns[SNAPSHOT_ATTRIBUTE_COUNT];
+	for (uint32_t i = 0; i < SNAPSHOT_ATTRIBUTE_COUNT; ++i)
+		columns[i] = { i, getSnapshotType((SnapshotAttribute)i), getSnapshotColumnOffset(count, (SnapshotAttribute)i) };
+	file.write(reinterpret_cast<const char*>(columns), sizeof(columns));
+
+	const std::vector<char> padding(SNAPSHOT_COLUMN_ALIGNMENT, 0);
+	file.write(padding.data(), (size_t)columns[0].offset - sizeof(header) - sizeof(columns));
+
+	// Transposed a chunk at a time, so the writer never holds a second copy of the state
+	const size_t columnBytes = (size_t)(columns[1].offset - columns[0].offset);
+	std::unique_ptr<float[]> chunk(new float[SNAPSHOT_CHUNK_PARTICLES]);
+	for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute) {
+		for (size_t first = 0; first < count; first += SNAPSHOT_CHUNK_PARTICLES) {
+			const size_t pieceCount = std::min(SNAPSHOT_CHUNK_PARTICLES, count - first);
+			for (size_t i = 0; i < pieceCount; ++i)
+				chunk[i] = getSnapshotValue(particles[first + i], (SnapshotAttribute)attribute);
+			file.write(reinterpret_cast<const char*>(chunk.get()), pieceCount * sizeof(float));
+		}
+		file.write(padding.data(), columnBytes - (count * sizeof(float)));
+	}
+
+	if (!file.good())
+		throw std::runtime_error(std::string("Could not write snapshot '") + path + "'");
+}
+
+// ================================================================================================
+SnapshotHeader makeSnapshotHeader(size_t count, double time)
+{
+	SnapshotHeader header = {};
+	memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+	header.version = SNAPSHOT_VERSION;
+	header.columnCount = SNAPSHOT_ATTRIBUTE_COUNT;
+	header.particleCount = count;
+	header.time = time;
+	return header;
+}
+
+// ================================================================================================
+uint64_t getSnapshotColumnOffset(size_t count, SnapshotAttribute attribute)
+{
+	// The columns follow the descriptors, each aligned so the mapped floats can be read in place
+	const size_t columnBytes = ((count * sizeof(float)) + SNAPSHOT_COLUMN_ALIGNMENT - 1)
+		& ~(SNAPSHOT_COLUMN_ALIGNMENT - 1);
+	const size_t dataStart = (sizeof(SnapshotHeader) + (SNAPSHOT_ATTRIBUTE_COUNT * sizeof(SnapshotColumn))
+		+ SNAPSHOT_COLUMN_ALIGNMENT - 1) & ~(SNAPSHOT_COLUMN_ALIGNMENT - 1);
+	return dataStart + ((size_t)attribute * columnBytes);
+}
+
+// ================================================================================================
+SnapshotType getSnapshotType(SnapshotAttribute attribute)
+{
+	return (attribute == SNAPSHOT_ID) ? SNAPSHOT_UINT32 : SNAPSHOT_FLOAT32;
+}
+
+// ================================================================================================
+float getSnapshotValue(const Particle& part, SnapshotAttribute attribute)
+{
+	float bits;
+	switch (attribute)
+	{
+	case SNAPSHOT_MASS: return part.mass;
+	case SNAPSHOT_POS_X: return part.x;
+	case SNAPSHOT_POS_Y: return part.y;
+	case SNAPSHOT_VEL_X: return part.vx;
+	case SNAPSHOT_VEL_Y: return part.vy;
+	case SNAPSHOT_ID: memcpy(&bits, &part.id, sizeof(bits)); return bits;
+	default: return 0.0f;
+	}
+}
\ No newline at end of file
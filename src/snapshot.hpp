@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "mappedfile.hpp"
+#include "particle.hpp"
+
+
+// Snapshot files hold the particle state as attribute columns, so upstream tools can write them without knowing the
+// Particle layout. The file starts with a SnapshotHeader, followed by columnCount SnapshotColumn descriptors and then
+// the column data, one little endian value of the column type per particle. Columns that are missing take the
+// defaults of a particle at rest with unit mass, numbered by its index, and the acceleration is never stored since
+// every step recomputes it.
+enum SnapshotAttribute :
+	uint32_t
+{
+	SNAPSHOT_MASS = 0,
+	SNAPSHOT_POS_X = 1,
+	SNAPSHOT_POS_Y = 2,
+	SNAPSHOT_VEL_X = 3,
+	SNAPSHOT_VEL_Y = 4,
+	SNAPSHOT_ID = 5,			// The only SNAPSHOT_UINT32 column
+	SNAPSHOT_ATTRIBUTE_COUNT
+};
+
+enum SnapshotType :
+	uint32_t
+{
+	SNAPSHOT_FLOAT32 = 0,
+	SNAPSHOT_UINT32 = 1
+};
+
+struct SnapshotHeader
+{
+	char magic[8];				// "P50KSNAP"
+	uint32_t version;			// SNAPSHOT_VERSION
+	uint32_t columnCount;
+	uint64_t particleCount;
+	double time;				// Simulation time of the state, the clock restarts from here
+};
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader is part of the file format");
+
+struct SnapshotColumn
+{
+	uint32_t attribute;			// SnapshotAttribute
+	uint32_t type;				// SnapshotType
+	uint64_t offset;			// From the start of the file, aligned to the type
+};
+static_assert(sizeof(SnapshotColumn) == 16, "SnapshotColumn is part of the file format");
+
+#define SNAPSHOT_VERSION 1
+// Particles converted per piece while streaming a snapshot to a device, which bounds the staging memory
+#define SNAPSHOT_CHUNK_PARTICLES ((size_t)1 << 18)
+
+
+// A snapshot file mapped into memory. Nothing is read up front, the pages are faulted in as the columns are
+// converted, so loading needs no host copy of the whole state.
+class Snapshot
+{
+private:
+	MappedFile m_file;
+	const SnapshotHeader *m_header;
+	const float *m_columns[SNAPSHOT_ATTRIBUTE_COUNT];	// Into the mapping, nullptr for missing columns. The id column
+														// holds words, see getIds.
+
+public:
+	// Maps and validates the file, throws if it can not be read or is not a snapshot
+	explicit Snapshot(const char *path);
+
+	inline const std::string& getPath() const { return m_file.getPath(); }
+	inline size_t getParticleCount() const { return (size_t)m_header->particleCount; }
+	inline double getTime() const { return m_header->time; }
+	inline const float* getColumn(SnapshotAttribute attribute) const { return m_columns[attribute]; }
+	inline const uint32_t* getIds() const { return reinterpret_cast<const uint32_t*>(m_columns[SNAPSHOT_ID]); }
+
+	// Assembles particles [first, first + count) into dst, on the job system workers
+	void readParticles(Particle *dst, size_t first, size_t count) const;
+
+	Snapshot(const Snapshot&) = delete;
+	Snapshot& operator = (const Snapshot&) = delete;
+};
+
+
+// Writes the particles as a snapshot with all of the stored columns, throws on failure
+void writeSnapshot(const char *path, const Particle *particles, size_t count, double time);
+
+// Layout of the files written by writeSnapshot, for tools that update them in place
+SnapshotHeader makeSnapshotHeader(size_t count, double time);
+uint64_t getSnapshotColumnOffset(size_t count, SnapshotAttribute attribute);
+SnapshotType getSnapshotType(SnapshotAttribute attribute);
+// The value of a column, where the id is returned as its bits so every column can be handled as 32 bit floats
+float getSnapshotValue(const Particle& part, SnapshotAttribute attribute);
\ No newline at end of file
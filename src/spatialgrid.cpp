@@ -0,0 +1,245 @@
+#include "spatialgrid.hpp"
+#include "cpusolver.hpp"
+#include "jobs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+// ================================================================================================
+SpatialGrid::SpatialGrid(cl_program program, vec2f origin, vec2f extent, size_t capacity) :
+	m_device{program != nullptr},
+	m_origin{origin},
+	m_extent{extent},
+	m_capacity{capacity},
+	m_params{},
+	m_countKernel{nullptr},
+	m_scatterKernel{nullptr},
+	m_scanBlocksKernel{nullptr},
+	m_scanTotalsKernel{nullptr},
+	m_scanApplyKernel{nullptr},
+	m_cellStartMem{nullptr},
+	m_cellsMem{nullptr},
+	m_ranksMem{nullptr},
+	m_sortedIndexMem{nullptr},
+	m_sortedMem{nullptr},
+	m_blockSumsMem{nullptr},
+	m_cellCapacity{0},
+	m_cellStart{},
+	m_cells{},
+	m_sortedIndex{},
+	m_sorted{}
+{
+	if (!(m_extent.x > 0.0f) || !(m_extent.y > 0.0f))
+		throw std::runtime_error("A spatial grid needs a positive extent");
+
+	if (!m_device) {
+		m_cells.resize(m_capacity);
+		m_sortedIndex.resize(m_capacity);
+		m_sorted.resize(m_capacity * 4);
+		return;
+	}
+
+	// The destructor does not run if this throws, so whatever was created by then is released here
+	try {
+		m_countKernel = new Kernel(program, "GridCount");
+		m_scatterKernel = new Kernel(program, "GridScatter");
+		m_scanBlocksKernel = new Kernel(program, "ScanBlocks");
+		m_scanTotalsKernel = new Kernel(program, "ScanTotals");
+		m_scanApplyKernel = new Kernel(program, "ScanApply");
+
+		cl_int clerr;
+		const size_t words = std::max(m_capacity, (size_t)1);
+		CL_CHECK_RETURN_FATAL(
+			m_cellsMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * words, nullptr, &clerr),
+			clerr, m_cellsMem, "Could not create the grid cell buffer");
+		CL_CHECK_RETURN_FATAL(
+			m_ranksMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * words, nullptr, &clerr),
+			clerr, m_ranksMem, "Could not create the grid rank buffer");
+		CL_CHECK_RETURN_FATAL(
+			m_sortedIndexMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * words, nullptr,
+				&clerr),
+			clerr, m_sortedIndexMem, "Could not create the grid index buffer");
+		CL_CHECK_RETURN_FATAL(
+			m_sortedMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_float4) * words, nullptr, &clerr),
+			clerr, m_sortedMem, "Could not create the sorted particle buffer");
+	}
+	catch (...) {
+		release();
+		throw;
+	}
+}
+
+// ================================================================================================
+SpatialGrid::~SpatialGrid()
+{
+	release();
+}
+
+// ================================================================================================
+void SpatialGrid::release()
+{
+	if (m_countKernel)
+		delete m_countKernel;
+	if (m_scatterKernel)
+		delete m_scatterKernel;
+	if (m_scanBlocksKernel)
+		delete m_scanBlocksKernel;
+	if (m_scanTotalsKernel)
+		delete m_scanTotalsKernel;
+	if (m_scanApplyKernel)
+		delete m_scanApplyKernel;
+	m_countKernel = m_scatterKernel = m_scanBlocksKernel = m_scanTotalsKernel = m_scanApplyKernel = nullptr;
+
+	for (cl_mem *mem : { &m_cellStartMem, &m_cellsMem, &m_ranksMem, &m_sortedIndexMem, &m_sortedMem,
+		&m_blockSumsMem }) {
+		if (*mem)
+			clReleaseMemObject(*mem);
+		*mem = nullptr;
+	}
+}
+
+// ================================================================================================
+void SpatialGrid::setCellSize(float cellSize, size_t count)
+{
+	if (count > m_capacity)
+		throw std::runtime_error("The spatial grid is too small for the particle count");
+
+	// Cells are square, and grow until both sides fit
+	const float extent = std::max(m_extent.x, m_extent.y);
+	const float size = std::max(cellSize, extent / (float)GRID_MAX_SIDE);
+	m_params.origin = m_origin;
+	m_params.cellSize = size;
+	m_params.invCellSize = 1.0f / size;
+	m_params.side[0] = std::min(std::max((uint32_t)std::ceil(m_extent.x / size), 1u), GRID_MAX_SIDE);
+	m_params.side[1] = std::min(std::max((uint32_t)std::ceil(m_extent.y / size), 1u), GRID_MAX_SIDE);
+	m_params.cellCount = m_params.side[0] * m_params.side[1];
+	m_params.count = (uint32_t)count;
+}
+
+// ================================================================================================
+void SpatialGrid::reserveCells()
+{
+	// The block sums cover the largest scan, of the cells or of a word per particle
+	if (m_params.cellCount <= m_cellCapacity)
+		return;
+
+	if (m_cellStartMem)
+		clReleaseMemObject(m_cellStartMem);
+	if (m_blockSumsMem)
+		clReleaseMemObject(m_blockSumsMem);
+	m_cellStartMem = nullptr;
+	m_blockSumsMem = nullptr;
+
+	m_cellCapacity = m_params.cellCount;
+	const size_t blocks = (std::max(m_cellCapacity, m_capacity) + GRID_SCAN_BLOCK - 1) / GRID_SCAN_BLOCK;
+	cl_int clerr;
+	CL_CHECK_RETURN_FATAL(
+		m_cellStartMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * (m_cellCapacity + 1), nullptr,
+			&clerr),
+		clerr, m_cellStartMem, "Could not create the grid cell start buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_blockSumsMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * blocks, nullptr, &clerr),
+		clerr, m_blockSumsMem, "Could not create the grid scan buffer");
+}
+
+// ================================================================================================
+void SpatialGrid::build(cl_mem state, size_t count, float cellSize)
+{
+	if (!m_device)
+		throw std::runtime_error("Cannot build a host grid from OpenCL memory.");
+
+	setCellSize(cellSize, count);
+	reserveCells();
+
+	// The counts are gathered in the cell start buffer, and scanned into the starts in place
+	const cl_uint zero = 0;
+	CL_CHECK_FATAL(clEnqueueFillBuffer(g_clCommandQueue, m_cellStartMem, &zero, sizeof(zero), 0,
+		sizeof(cl_uint) * m_params.cellCount, 0, nullptr, nullptr), "Could not clear the grid cell counts");
+
+	const size_t global[1] = { count };
+	m_countKernel->setKernelArgument(0, sizeof(state), &state);
+	m_countKernel->setKernelArgument(1, sizeof(m_params), &m_params);
+	m_countKernel->setKernelArgument(2, sizeof(m_cellStartMem), &m_cellStartMem);
+	m_countKernel->setKernelArgument(3, sizeof(m_cellsMem), &m_cellsMem);
+	m_countKernel->setKernelArgument(4, sizeof(m_ranksMem), &m_ranksMem);
+	if (count)
+		m_countKernel->enqueueNDRange(1, global);
+
+	scan(m_cellStartMem, m_params.cellCount);
+
+	m_scatterKernel->setKernelArgument(0, sizeof(state), &state);
+	m_scatterKernel->setKernelArgument(1, sizeof(m_params), &m_params);
+	m_scatterKernel->setKernelArgument(2, sizeof(m_cellStartMem), &m_cellStartMem);
+	m_scatterKernel->setKernelArgument(3, sizeof(m_cellsMem), &m_cellsMem);
+	m_scatterKernel->setKernelArgument(4, sizeof(m_ranksMem), &m_ranksMem);
+	m_scatterKernel->setKernelArgument(5, sizeof(m_sortedIndexMem), &m_sortedIndexMem);
+	m_scatterKernel->setKernelArgument(6, sizeof(m_sortedMem), &m_sortedMem);
+	if (count)
+		m_scatterKernel->enqueueNDRange(1, global);
+}
+
+// ================================================================================================
+void SpatialGrid::build(const particle_soa_t& soa, size_t count, float cellSize)
+{
+	if (m_device)
+		throw std::runtime_error("Cannot build a device grid from the host state.");
+
+	setCellSize(cellSize, count);
+	m_cellStart.assign((size_t)m_params.cellCount + 1, 0);
+
+	// The cells are found in parallel, and the stable counting sort runs on this thread since it is bound by memory
+	const GridParams params = m_params;
+	uint32_t *cells = m_cells.data();
+	g_jobs->parallel_for(0, count, 16384, [&soa, &params, cells](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+			cells[i] = getGridCell(params, soa.x[i], soa.y[i]);
+	});
+
+	for (size_t i = 0; i < count; ++i)
+		++m_cellStart[cells[i] + 1];
+	for (size_t cell = 0; cell < m_params.cellCount; ++cell)
+		m_cellStart[cell + 1] += m_cellStart[cell];
+
+	// Filled from the starts, which are restored by shifting them back afterwards
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t slot = m_cellStart[cells[i]]++;
+		m_sortedIndex[slot] = (uint32_t)i;
+		float *sorted = &m_sorted[(size_t)slot * 4];
+		sorted[0] = soa.x[i];
+		sorted[1] = soa.y[i];
+		sorted[2] = soa.vx[i];
+		sorted[3] = soa.vy[i];
+	}
+	for (size_t cell = m_params.cellCount; cell > 0; --cell)
+		m_cellStart[cell] = m_cellStart[cell - 1];
+	m_cellStart[0] = 0;
+}
+
+// ================================================================================================
+void SpatialGrid::scan(cl_mem data, size_t count)
+{
+	if (!m_device)
+		throw std::runtime_error("Cannot scan device memory with a host grid.");
+	if (count > std::max(m_cellCapacity, m_capacity) || !m_blockSumsMem)
+		throw std::runtime_error("The scan is larger than the spatial grid buffers.");
+
+	const cl_uint words = (cl_uint)count;
+	const cl_uint blocks = (cl_uint)((count + GRID_SCAN_BLOCK - 1) / GRID_SCAN_BLOCK);
+	m_scanBlocksKernel->setKernelArgument(0, sizeof(data), &data);
+	m_scanBlocksKernel->setKernelArgument(1, sizeof(words), &words);
+	m_scanBlocksKernel->setKernelArgument(2, sizeof(m_blockSumsMem), &m_blockSumsMem);
+	m_scanTotalsKernel->setKernelArgument(0, sizeof(m_blockSumsMem), &m_blockSumsMem);
+	m_scanTotalsKernel->setKernelArgument(1, sizeof(blocks), &blocks);
+	m_scanTotalsKernel->setKernelArgument(2, sizeof(data), &data);
+	m_scanTotalsKernel->setKernelArgument(3, sizeof(words), &words);
+	m_scanApplyKernel->setKernelArgument(0, sizeof(data), &data);
+	m_scanApplyKernel->setKernelArgument(1, sizeof(words), &words);
+	m_scanApplyKernel->setKernelArgument(2, sizeof(m_blockSumsMem), &m_blockSumsMem);
+
+	const size_t blockGlobal[1] = { std::max((size_t)blocks, (size_t)1) };
+	const size_t single[1] = { 1 };
+	m_scanBlocksKernel->enqueueNDRange(1, blockGlobal);
+	m_scanTotalsKernel->enqueueNDRange(1, single);
+	m_scanApplyKernel->enqueueNDRange(1, blockGlobal);
+}
\ No newline at end of file
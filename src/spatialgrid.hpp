@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "gpu.hpp"
+#include "kernel.hpp"
+#include "particle.hpp"
+
+
+struct particle_soa_t;
+
+
+// Largest number of cells along an axis, the cells grow beyond the requested size to stay below it
+#define GRID_MAX_SIDE 1024u
+// Words scanned serially by each work item of the scan kernels
+#define GRID_SCAN_BLOCK 1024u
+
+
+// Placement of the cells (mirror of the kernel type). Positions outside of the grid are clamped into the border
+// cells, which keeps any two particles closer than a cell in the same or neighbouring cells, however far out they are.
+struct GridParams
+{
+	vec2f origin;
+	float cellSize;
+	float invCellSize;
+	uint32_t side[2];
+	uint32_t cellCount;
+	uint32_t count;				// Of particles in the grid
+};
+static_assert(sizeof(GridParams) == 32, "GridParams must match the layout of the kernel type");
+
+
+// Particles sorted by the cell they are in, so the neighbours of a position are the contiguous ranges of the cells
+// around it. The grid is built with a counting sort, either on the OpenCL device from the particle state, or on the
+// host from the arrays of the CPU solver. The sorted copies of the positions and velocities keep the neighbour loops
+// on contiguous memory.
+class SpatialGrid
+{
+private:
+	const bool m_device;
+	const vec2f m_origin;
+	const vec2f m_extent;
+	const size_t m_capacity;
+	GridParams m_params;
+
+	// Device grid, with the kernels of a program built from ParticleGridKernelSource
+	Kernel *m_countKernel;
+	Kernel *m_scatterKernel;
+	Kernel *m_scanBlocksKernel;
+	Kernel *m_scanTotalsKernel;
+	Kernel *m_scanApplyKernel;
+	cl_mem m_cellStartMem;		// cellCount + 1 words, the first sorted slot of each cell
+	cl_mem m_cellsMem;			// Cell of each particle
+	cl_mem m_ranksMem;			// Slot of each particle within its cell
+	cl_mem m_sortedIndexMem;	// State index of each sorted slot
+	cl_mem m_sortedMem;			// float4 position and velocity of each sorted slot
+	cl_mem m_blockSumsMem;
+	size_t m_cellCapacity;		// Cells that m_cellStartMem has room for
+
+	// Host grid
+	std::vector<uint32_t> m_cellStart;
+	std::vector<uint32_t> m_cells;
+	std::vector<uint32_t> m_sortedIndex;
+	std::vector<float> m_sorted;	// x, y, vx, vy of each sorted slot
+
+public:
+	// A grid over the rectangle at origin with the given extent, for up to capacity particles. Device grids need a
+	// program that contains ParticleGridKernelSource, host grids pass nullptr.
+	SpatialGrid(cl_program program, vec2f origin, vec2f extent, size_t capacity);
+	~SpatialGrid();
+
+	inline bool isDevice() const { return m_device; }
+	inline size_t getCapacity() const { return m_capacity; }
+	inline const GridParams& getParams() const { return m_params; }
+
+	// Sorts the state into cells of at least cellSize
+	void build(cl_mem state, size_t count, float cellSize);
+	void build(const particle_soa_t& soa, size_t count, float cellSize);
+
+	// Device grid, valid until the next build
+	inline cl_mem getCellStartMem() const { return m_cellStartMem; }
+	inline cl_mem getSortedIndexMem() const { return m_sortedIndexMem; }
+	inline cl_mem getSortedMem() const { return m_sortedMem; }
+	// Host grid, valid until the next build
+	inline const uint32_t* getCellStart() const { return m_cellStart.data(); }
+	inline const uint32_t* getSortedIndex() const { return m_sortedIndex.data(); }
+	inline const float* getSorted() const { return m_sorted.data(); }
+
+	// Replaces the first count words of data with their exclusive prefix sum on the device, and writes the total
+	// after them, so data needs room for count + 1 words. Count is at most the capacity or cell count the grid was
+	// last built for.
+	void scan(cl_mem data, size_t count);
+
+	SpatialGrid(const SpatialGrid&) = delete;
+	SpatialGrid& operator = (const SpatialGrid&) = delete;
+
+private:
+	// Deletes the kernels and releases the buffers that were created, which a failed construction also needs
+	void release();
+	void setCellSize(float cellSize, size_t count);
+	void reserveCells();
+};
+
+
+// Cell of a position, see GridParams
+inline uint32_t getGridCell(const GridParams& grid, float x, float y)
+{
+	const float fx = (x - grid.origin.x) * grid.invCellSize;
+	const float fy = (y - grid.origin.y) * grid.invCellSize;
+	const uint32_t cx = (fx > 0.0f) ? ((fx < (float)(grid.side[0] - 1)) ? (uint32_t)fx : (grid.side[0] - 1)) : 0;
+	const uint32_t cy = (fy > 0.0f) ? ((fy < (float)(grid.side[1] - 1)) ? (uint32_t)fy : (grid.side[1] - 1)) : 0;
+	return (cy * grid.side[0]) + cx;
+}
\ No newline at end of file
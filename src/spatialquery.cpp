@@ -0,0 +1,387 @@
+#include "spatialquery.hpp"
+#include "cpusolver.hpp"
+#include "jobs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+
+using query_clock = std::chrono::steady_clock;
+
+
+// ================================================================================================
+// Cell coordinates of a position on the host grid, see getGridCell
+static inline void getGridCoords(const GridParams& grid, float x, float y, int& cx, int& cy)
+{
+	const uint32_t cell = getGridCell(grid, x, y);
+	cx = (int)(cell % grid.side[0]);
+	cy = (int)(cell / grid.side[0]);
+}
+
+// ================================================================================================
+static inline double getSecondsSince(query_clock::time_point start)
+{
+	return std::chrono::duration<double>(query_clock::now() - start).count();
+}
+
+// ================================================================================================
+SpatialQuery::SpatialQuery(bool device, vec2f origin, vec2f extent, size_t pcount) :
+	m_device{device},
+	m_cellSize{std::sqrt((extent.x * extent.y * QUERY_CELL_PARTICLES) / (float)std::max(pcount, (size_t)1))},
+	m_grid{nullptr},
+	m_built{false},
+	m_builtStep{0},
+	m_buildSeconds{0.0},
+	m_rangeKernel{nullptr},
+	m_nearestKernel{nullptr},
+	m_probesMem{nullptr},
+	m_countsMem{nullptr},
+	m_indicesMem{nullptr},
+	m_distancesMem{nullptr},
+	m_pinnedMem{nullptr},
+	m_pinned{nullptr},
+	m_probeCapacity{0},
+	m_slotCapacity{0},
+	m_counts{},
+	m_indices{},
+	m_distances{},
+	m_results{},
+	m_totalQueries{0},
+	m_totalSeconds{0.0}
+{
+	if (!m_device) {
+		m_grid = new SpatialGrid(nullptr, origin, extent, pcount);
+		return;
+	}
+
+	// The grid and the queries share one program, which only has to be built once
+	std::string source = ParticleGridKernelSource;
+	source += ParticleQueryKernelSource;
+	cl_program program = buildProgram(source.c_str());
+	try {
+		m_grid = new SpatialGrid(program, origin, extent, pcount);
+		m_rangeKernel = new Kernel(program, "QueryRange");
+		m_nearestKernel = new Kernel(program, "QueryNearest");
+	}
+	catch (...) {
+		clReleaseProgram(program);
+		throw;
+	}
+	clReleaseProgram(program);
+}
+
+// ================================================================================================
+SpatialQuery::~SpatialQuery()
+{
+	if (m_pinnedMem) {
+		clEnqueueUnmapMemObject(g_clCommandQueue, m_pinnedMem, m_pinned, 0, nullptr, nullptr);
+		clFinish(g_clCommandQueue);
+	}
+	for (cl_mem mem : { m_probesMem, m_countsMem, m_indicesMem, m_distancesMem, m_pinnedMem }) {
+		if (mem)
+			clReleaseMemObject(mem);
+	}
+
+	if (m_rangeKernel)
+		delete m_rangeKernel;
+	if (m_nearestKernel)
+		delete m_nearestKernel;
+	if (m_grid)
+		delete m_grid;
+}
+
+// ================================================================================================
+void SpatialQuery::build(cl_mem state, uint64_t step)
+{
+	const query_clock::time_point start = query_clock::now();
+	m_grid->build(state, m_grid->getCapacity(), m_cellSize);
+	CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not wait for the query grid");
+
+	m_buildSeconds = getSecondsSince(start);
+	m_built = true;
+	m_builtStep = step;
+}
+
+// ================================================================================================
+void SpatialQuery::build(const particle_soa_t& soa, uint64_t step)
+{
+	const query_clock::time_point start = query_clock::now();
+	m_grid->build(soa, m_grid->getCapacity(), m_cellSize);
+
+	m_buildSeconds = getSecondsSince(start);
+	m_built = true;
+	m_builtStep = step;
+}
+
+// ================================================================================================
+void SpatialQuery::reserve(size_t probes, size_t slots)
+{
+	// Count only range queries have no slots, but OpenCL cannot create an empty buffer
+	slots = std::max(slots, (size_t)1);
+	if (probes <= m_probeCapacity && slots <= m_slotCapacity)
+		return;
+
+	if (m_pinnedMem) {
+		clEnqueueUnmapMemObject(g_clCommandQueue, m_pinnedMem, m_pinned, 0, nullptr, nullptr);
+		clFinish(g_clCommandQueue);
+	}
+	for (cl_mem *mem : { &m_probesMem, &m_countsMem, &m_indicesMem, &m_distancesMem, &m_pinnedMem }) {
+		if (*mem)
+			clReleaseMemObject(*mem);
+		*mem = nullptr;
+	}
+	m_pinned = nullptr;
+
+	// Grown to the larger of the batches seen so far, so alternating batch shapes do not reallocate
+	m_probeCapacity = std::max(probes, m_probeCapacity);
+	m_slotCapacity = std::max(slots, m_slotCapacity);
+	const size_t pinnedSize = (sizeof(cl_uint) * m_probeCapacity)
+		+ ((sizeof(cl_uint) + sizeof(cl_float)) * m_slotCapacity);
+	cl_int clerr;
+	CL_CHECK_RETURN_FATAL(
+		m_probesMem = clCreateBuffer(g_clContext, CL_MEM_READ_ONLY, sizeof(cl_float2) * m_probeCapacity, nullptr,
+			&clerr),
+		clerr, m_probesMem, "Could not create the query probe buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_countsMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * m_probeCapacity, nullptr,
+			&clerr),
+		clerr, m_countsMem, "Could not create the query count buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_indicesMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * m_slotCapacity, nullptr,
+			&clerr),
+		clerr, m_indicesMem, "Could not create the query index buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_distancesMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY, sizeof(cl_float) * m_slotCapacity, nullptr,
+			&clerr),
+		clerr, m_distancesMem, "Could not create the query distance buffer");
+
+	// Mapped until the next reallocation, reads into pinned memory can run at full transfer speed
+	CL_CHECK_RETURN_FATAL(
+		m_pinnedMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, pinnedSize, nullptr,
+			&clerr),
+		clerr, m_pinnedMem, "Could not create the query result buffer");
+	CL_CHECK_RETURN_FATAL(
+		m_pinned = clEnqueueMapBuffer(g_clCommandQueue, m_pinnedMem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, pinnedSize,
+			0, nullptr, nullptr, &clerr),
+		clerr, m_pinned, "Could not map the query result buffer");
+}
+
+// ================================================================================================
+void SpatialQuery::run(Kernel& kernel, cl_uint gridArgument, const vec2f *probes, size_t count, uint32_t width)
+{
+	// The probes are uploaded and the results read back on the same in order queue, and all of it is waited for once
+	CL_CHECK_FATAL(clEnqueueWriteBuffer(g_clCommandQueue, m_probesMem, CL_FALSE, 0, sizeof(cl_float2) * count, probes,
+		0, nullptr, nullptr), "Could not upload the query probes");
+
+	const cl_uint probeCount = (cl_uint)count;
+	const GridParams& grid = m_grid->getParams();
+	const cl_mem sorted = m_grid->getSortedMem();
+	const cl_mem sortedIndex = m_grid->getSortedIndexMem();
+	const cl_mem cellStart = m_grid->getCellStartMem();
+	kernel.setKernelArgument(0, sizeof(m_probesMem), &m_probesMem);
+	kernel.setKernelArgument(1, sizeof(probeCount), &probeCount);
+	kernel.setKernelArgument(gridArgument, sizeof(sorted), &sorted);
+	kernel.setKernelArgument(gridArgument + 1, sizeof(sortedIndex), &sortedIndex);
+	kernel.setKernelArgument(gridArgument + 2, sizeof(cellStart), &cellStart);
+	kernel.setKernelArgument(gridArgument + 3, sizeof(grid), &grid);
+	kernel.setKernelArgument(gridArgument + 4, sizeof(m_countsMem), &m_countsMem);
+	kernel.setKernelArgument(gridArgument + 5, sizeof(m_indicesMem), &m_indicesMem);
+	kernel.setKernelArgument(gridArgument + 6, sizeof(m_distancesMem), &m_distancesMem);
+	const size_t global[1] = { count };
+	kernel.enqueueNDRange(1, global);
+
+	unsigned char *pinned = static_cast<unsigned char*>(m_pinned);
+	const size_t slots = count * width;
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_countsMem, CL_FALSE, 0, sizeof(cl_uint) * count, pinned, 0,
+		nullptr, nullptr), "Could not read the query counts");
+	pinned += sizeof(cl_uint) * m_probeCapacity;
+	if (slots) {
+		CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_indicesMem, CL_FALSE, 0, sizeof(cl_uint) * slots, pinned,
+			0, nullptr, nullptr), "Could not read the query indices");
+		CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_distancesMem, CL_FALSE, 0, sizeof(cl_float) * slots,
+			pinned + (sizeof(cl_uint) * m_slotCapacity), 0, nullptr, nullptr), "Could not read the query distances");
+	}
+	CL_CHECK_FATAL(clFinish(g_clCommandQueue), "Could not wait for the queries");
+}
+
+// ================================================================================================
+const SpatialQueryResults& SpatialQuery::finish(size_t count, uint32_t width, double seconds)
+{
+	m_results.probeCount = count;
+	m_results.width = width;
+	if (m_device && !m_pinned) {
+		m_results.counts = nullptr;
+		m_results.indices = nullptr;
+		m_results.distances2 = nullptr;
+	}
+	else if (m_device) {
+		const unsigned char *pinned = static_cast<const unsigned char*>(m_pinned);
+		m_results.counts = reinterpret_cast<const uint32_t*>(pinned);
+		pinned += sizeof(cl_uint) * m_probeCapacity;
+		m_results.indices = reinterpret_cast<const uint32_t*>(pinned);
+		m_results.distances2 = reinterpret_cast<const float*>(pinned + (sizeof(cl_uint) * m_slotCapacity));
+	}
+	else {
+		m_results.counts = m_counts.data();
+		m_results.indices = m_indices.data();
+		m_results.distances2 = m_distances.data();
+	}
+	m_results.seconds = seconds;
+	m_results.buildSeconds = m_buildSeconds;
+	m_buildSeconds = 0.0;
+
+	m_totalQueries += count;
+	m_totalSeconds += seconds;
+	return m_results;
+}
+
+// ================================================================================================
+const SpatialQueryResults& SpatialQuery::range(const vec2f *probes, size_t count, float radius, uint32_t maxResults)
+{
+	if (!m_built)
+		throw std::runtime_error("The spatial query grid has not been built.");
+	if (!(radius >= 0.0f))
+		throw std::runtime_error("The query radius must not be negative.");
+
+	const query_clock::time_point start = query_clock::now();
+	if (m_device) {
+		if (count) {
+			reserve(count, count * maxResults);
+			m_rangeKernel->setKernelArgument(2, sizeof(radius), &radius);
+			m_rangeKernel->setKernelArgument(3, sizeof(maxResults), &maxResults);
+			run(*m_rangeKernel, 4, probes, count, maxResults);
+		}
+		return finish(count, maxResults, getSecondsSince(start));
+	}
+
+	m_counts.resize(count);
+	m_indices.resize(count * maxResults);
+	m_distances.resize(count * maxResults);
+	const GridParams grid = m_grid->getParams();
+	const uint32_t *cellStart = m_grid->getCellStart();
+	const uint32_t *sortedIndex = m_grid->getSortedIndex();
+	const float *sorted = m_grid->getSorted();
+	uint32_t *counts = m_counts.data();
+	uint32_t *indices = m_indices.data();
+	float *distances = m_distances.data();
+	const float radius2 = radius * radius;
+	g_jobs->parallel_for(0, count, 256,
+		[&grid, cellStart, sortedIndex, sorted, probes, radius, radius2, maxResults, counts, indices, distances](
+			size_t begin, size_t end) {
+			for (size_t probe = begin; probe < end; ++probe) {
+				const vec2f p = probes[probe];
+				int lowX, lowY, highX, highY;
+				getGridCoords(grid, p.x - radius, p.y - radius, lowX, lowY);
+				getGridCoords(grid, p.x + radius, p.y + radius, highX, highY);
+				const size_t base = probe * maxResults;
+				uint32_t found = 0;
+				for (int y = lowY; y <= highY; ++y) {
+					for (int x = lowX; x <= highX; ++x) {
+						const uint32_t cell = ((uint32_t)y * grid.side[0]) + (uint32_t)x;
+						for (uint32_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+							const float dx = sorted[k * 4] - p.x;
+							const float dy = sorted[(k * 4) + 1] - p.y;
+							const float d2 = (dx * dx) + (dy * dy);
+							if (d2 > radius2)
+								continue;
+							if (found < maxResults) {
+								indices[base + found] = sortedIndex[k];
+								distances[base + found] = d2;
+							}
+							++found;
+						}
+					}
+				}
+				counts[probe] = found;
+			}
+		});
+	return finish(count, maxResults, getSecondsSince(start));
+}
+
+// ================================================================================================
+const SpatialQueryResults& SpatialQuery::nearest(const vec2f *probes, size_t count, uint32_t k)
+{
+	if (!m_built)
+		throw std::runtime_error("The spatial query grid has not been built.");
+	if (!k || k > QUERY_MAX_K)
+		throw std::runtime_error("Nearest neighbour queries ask for 1 to " + std::to_string(QUERY_MAX_K)
+			+ " particles.");
+
+	const query_clock::time_point start = query_clock::now();
+	if (m_device) {
+		if (count) {
+			reserve(count, count * k);
+			m_nearestKernel->setKernelArgument(2, sizeof(k), &k);
+			run(*m_nearestKernel, 3, probes, count, k);
+		}
+		return finish(count, k, getSecondsSince(start));
+	}
+
+	// The same ring search as QueryNearest
+	m_counts.resize(count);
+	m_indices.resize(count * k);
+	m_distances.resize(count * k);
+	const GridParams grid = m_grid->getParams();
+	const uint32_t *cellStart = m_grid->getCellStart();
+	const uint32_t *sortedIndex = m_grid->getSortedIndex();
+	const float *sorted = m_grid->getSorted();
+	uint32_t *counts = m_counts.data();
+	uint32_t *indices = m_indices.data();
+	float *distances = m_distances.data();
+	g_jobs->parallel_for(0, count, 256,
+		[&grid, cellStart, sortedIndex, sorted, probes, k, counts, indices, distances](size_t begin, size_t end) {
+			float best[QUERY_MAX_K];
+			uint32_t bestIndex[QUERY_MAX_K];
+			const int lastX = (int)grid.side[0] - 1;
+			const int lastY = (int)grid.side[1] - 1;
+			for (size_t probe = begin; probe < end; ++probe) {
+				const vec2f p = probes[probe];
+				int cx, cy;
+				getGridCoords(grid, p.x, p.y, cx, cy);
+				const int rings = std::max(std::max(cx, lastX - cx), std::max(cy, lastY - cy));
+				uint32_t found = 0;
+				for (int ring = 0; ring <= rings; ++ring) {
+					for (int y = cy - ring; y <= cy + ring; ++y) {
+						if (y < 0 || y > lastY)
+							continue;
+						const int stride = ((y == cy - ring) || (y == cy + ring)) ? 1 : (2 * ring);
+						for (int x = cx - ring; x <= cx + ring; x += stride) {
+							if (x < 0 || x > lastX)
+								continue;
+							const uint32_t cell = ((uint32_t)y * grid.side[0]) + (uint32_t)x;
+							for (uint32_t slot = cellStart[cell]; slot < cellStart[cell + 1]; ++slot) {
+								const float dx = sorted[slot * 4] - p.x;
+								const float dy = sorted[(slot * 4) + 1] - p.y;
+								const float d2 = (dx * dx) + (dy * dy);
+								if (found == k && d2 >= best[k - 1])
+									continue;
+
+								uint32_t i = (found < k) ? found++ : (k - 1);
+								for (; i > 0 && best[i - 1] > d2; --i) {
+									best[i] = best[i - 1];
+									bestIndex[i] = bestIndex[i - 1];
+								}
+								best[i] = d2;
+								bestIndex[i] = sortedIndex[slot];
+							}
+						}
+					}
+
+					const float reach = (float)ring * grid.cellSize;
+					if (found == k && best[k - 1] <= reach * reach)
+						break;
+				}
+
+				const size_t base = probe * k;
+				for (uint32_t i = 0; i < k; ++i) {
+					indices[base + i] = (i < found) ? bestIndex[i] : QUERY_NONE;
+					distances[base + i] = (i < found) ? best[i] : std::numeric_limits<float>::infinity();
+				}
+				counts[probe] = found;
+			}
+		});
+	return finish(count, k, getSecondsSince(start));
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "gpu.hpp"
+#include "kernel.hpp"
+#include "particle.hpp"
+#include "spatialgrid.hpp"
+
+
+struct particle_soa_t;
+
+
+// Most neighbours a nearest neighbour query can ask for, the kernel keeps them in private memory
+#define QUERY_MAX_K 32u
+// Index of the slots that no particle was found for
+#define QUERY_NONE 0xFFFFFFFFu
+// Mean particles per cell of the query grid, which suits radii and neighbour counts of a few particle spacings
+#define QUERY_CELL_PARTICLES 4.0f
+
+
+// Results of a batch, in host memory that stays valid until the next query
+struct SpatialQueryResults
+{
+	size_t probeCount;
+	uint32_t width;				// Slots per probe
+	const uint32_t *counts;		// Particles found for each probe, range queries count beyond the listed ones
+	const uint32_t *indices;	// State indices, width slots per probe
+	const float *distances2;	// Squared distances to the probe, width slots per probe
+	double seconds;				// Of the batch, from the upload of the probes until the results have arrived
+	double buildSeconds;		// Of the grid rebuild the batch needed, zero if it was current
+};
+
+
+// Batched range and nearest neighbour searches over the live state. The particles are sorted into a SpatialGrid on the
+// OpenCL device, or on the host for the CPU solver, and a work item or loop iteration answers each probe from the
+// cells around it. The grid is only rebuilt when a batch arrives for a newer step than it was built for, so a run
+// that is not queried pays nothing, and the results of a device batch come back into pinned host memory.
+class SpatialQuery
+{
+private:
+	const bool m_device;
+	const float m_cellSize;
+	SpatialGrid *m_grid;
+	bool m_built;
+	uint64_t m_builtStep;
+	double m_buildSeconds;		// Of the rebuild that the next batch reports
+
+	// Device queries, with the kernels of a program built from ParticleGridKernelSource and ParticleQueryKernelSource
+	Kernel *m_rangeKernel;
+	Kernel *m_nearestKernel;
+	cl_mem m_probesMem;
+	cl_mem m_countsMem;
+	cl_mem m_indicesMem;
+	cl_mem m_distancesMem;
+	cl_mem m_pinnedMem;			// Mapped counts, indices and distances
+	void *m_pinned;
+	size_t m_probeCapacity;
+	size_t m_slotCapacity;
+
+	// Host queries
+	std::vector<uint32_t> m_counts;
+	std::vector<uint32_t> m_indices;
+	std::vector<float> m_distances;
+
+	SpatialQueryResults m_results;
+	size_t m_totalQueries;
+	double m_totalSeconds;
+
+public:
+	// A grid over the rectangle at origin with the given extent, with cells sized for pcount particles. Device queries
+	// build their program here. Throws on failure.
+	SpatialQuery(bool device, vec2f origin, vec2f extent, size_t pcount);
+	~SpatialQuery();
+
+	inline bool isDevice() const { return m_device; }
+	// If the grid holds the state after the step
+	inline bool isCurrent(uint64_t step) const { return m_built && (m_builtStep == step); }
+	// Probes answered per second over all batches so far
+	inline double getQueriesPerSecond() const
+		{ return (m_totalSeconds > 0.0) ? ((double)m_totalQueries / m_totalSeconds) : 0.0; }
+
+	// Sorts the state after a step into the grid. The OpenCL state has to be acquired, and is no longer read once
+	// this returns.
+	void build(cl_mem state, uint64_t step);
+	void build(const particle_soa_t& soa, uint64_t step);
+
+	// Every particle within radius of each probe, listing at most maxResults of them in no particular order
+	const SpatialQueryResults& range(const vec2f *probes, size_t count, float radius, uint32_t maxResults);
+	// The k nearest particles to each probe, nearest first
+	const SpatialQueryResults& nearest(const vec2f *probes, size_t count, uint32_t k);
+
+	SpatialQuery(const SpatialQuery&) = delete;
+	SpatialQuery& operator = (const SpatialQuery&) = delete;
+
+private:
+	void reserve(size_t probes, size_t slots);
+	// Answers a batch with a query kernel, whose grid arguments start at gridArgument, into the pinned results
+	void run(Kernel& kernel, cl_uint gridArgument, const vec2f *probes, size_t count, uint32_t width);
+	const SpatialQueryResults& finish(size_t count, uint32_t width, double seconds);
+};
\ No newline at end of file
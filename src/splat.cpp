@@ -0,0 +1,166 @@
+#include "splat.hpp"
+#include "gpu.hpp"
+#include <iostream>
+#include <stdexcept>
+
+
+// ================================================================================================
+DensityRenderer::DensityRenderer() :
+	m_fbo{0},
+	m_texture{0},
+	m_emptyVao{0},
+	m_resolveShader{nullptr},
+	m_width{0},
+	m_height{0},
+	m_exposure{0.5f},
+	m_densityScale{1.0f},
+	m_savedPointSize{1.0f}
+{
+	m_resolveShader = new Shader(DensityResolveVertexShaderSource, nullptr, DensityResolveFragmentShaderSource);
+
+	glGenVertexArrays(1, &m_emptyVao);
+	glGenFramebuffers(1, &m_fbo);
+	glGenTextures(1, &m_texture);
+	if (!m_emptyVao || !m_fbo || !m_texture)
+		throw std::runtime_error("Could not allocate the density render target.");
+
+	int width, height;
+	glfwGetFramebufferSize(g_windowPtr, &width, &height);
+	resize(width, height);
+
+	std::cout << "Initialized Density Renderer (" << width << "x" << height << ")" << std::endl;
+}
+
+// ================================================================================================
+DensityRenderer::~DensityRenderer()
+{
+	if (m_resolveShader)
+		delete m_resolveShader;
+
+	if (m_texture)
+		glDeleteTextures(1, &m_texture);
+	if (m_fbo)
+		glDeleteFramebuffers(1, &m_fbo);
+	if (m_emptyVao)
+		glDeleteVertexArrays(1, &m_emptyVao);
+}
+
+// ================================================================================================
+void DensityRenderer::resize(int width, int height)
+{
+	m_width = (width > 0) ? width : 1;
+	m_height = (height > 0) ? height : 1;
+
+	// 32-bit channels, half floats stop counting at 2048 particles per pixel
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("The density render target is not supported by the graphics device.");
+}
+
+// ================================================================================================
+void DensityRenderer::begin()
+{
+	int width, height;
+	glfwGetFramebufferSize(g_windowPtr, &width, &height);
+	if ((width > 0 && width != m_width) || (height > 0 && height != m_height))
+		resize(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	const GLfloat zero[4] = { 0, 0, 0, 0 };
+	glClearBufferfv(GL_COLOR, 0, zero);
+
+	// Single pixel points, accumulated without depth
+	glGetFloatv(GL_POINT_SIZE, &m_savedPointSize);
+	glPointSize(1);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	glBlendFunc(GL_ONE, GL_ONE);
+}
+
+// ================================================================================================
+void DensityRenderer::resolve()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDisable(GL_BLEND);
+
+	m_resolveShader->bind();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	m_resolveShader->setUniform("Density", 0);
+	m_resolveShader->setUniform("Exposure", m_exposure);
+	m_resolveShader->setUniform("DensityScale", m_densityScale);
+
+	glBindVertexArray(m_emptyVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	m_resolveShader->release();
+
+	// Back to the state set up by initialize_gl() for the point sprite renderer
+	glPointSize(m_savedPointSize);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glEnable(GL_DEPTH_TEST);
+}
+
+
+
+// ================================================================================================
+// ================================================================================================
+const char * const ParticleSplatFragmentShaderSource = R"(
+	#version 330 core
+
+	in vec2 vfPos;
+	in float vfKey;
+
+	layout(location = 0) out vec4 FragColor;
+
+	void main()
+	{
+		// Same colouring as the point sprites, clamped so the sums stay meaningful
+		float dist = length(vfPos);
+		float brightness = 0.75 + (vfKey * 0.5);
+		vec3 color = clamp(vec3(dist / 4.0, (1 - dist) * 4, 1 - (dist / 5)), 0, 1) * brightness;
+		FragColor = vec4(color, 1);
+	}
+)";
+const char * const DensityResolveVertexShaderSource = R"(
+	#version 330 core
+
+	const vec2 Corners[3] = vec2[3](vec2(-1, -1), vec2(3, -1), vec2(-1, 3));
+
+	void main()
+	{
+		gl_Position = vec4(Corners[gl_VertexID], 0, 1);
+	}
+)";
+const char * const DensityResolveFragmentShaderSource = R"(
+	#version 330 core
+
+	layout(location = 0) out vec4 FragColor;
+
+	uniform sampler2D Density;
+	uniform float Exposure;
+	uniform float DensityScale;
+
+	void main()
+	{
+		// Average colour of the particles in the pixel, scaled by an exponential response to the particle count
+		vec4 accum = texelFetch(Density, ivec2(gl_FragCoord.xy), 0);
+		vec3 color = accum.rgb / max(accum.a, 1);
+		float intensity = 1 - exp(-accum.a * DensityScale * Exposure);
+		FragColor = vec4(color * intensity, 1);
+	}
+)";
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <GL\glew.h>
+#include "shader.hpp"
+
+
+// Renders particles by accumulating them into a floating point density target, which is then tone mapped onto the
+// window in a single full screen pass. Every particle covers exactly one pixel and there is no depth test, so the
+// cost scales with the particle count and the window size instead of with the overdraw of large sprites.
+//
+// The particles are drawn between begin() and resolve() with ParticleSplatFragmentShaderSource, which writes the
+// particle colour with an alpha of one. Additive blending leaves the colour sum in rgb, and the particle count in a.
+class DensityRenderer
+{
+private:
+	GLuint m_fbo;
+	GLuint m_texture;
+	GLuint m_emptyVao;		// Core profile draws need a bound VAO, even though the full screen pass has no inputs
+	Shader *m_resolveShader;
+	int m_width;
+	int m_height;
+	float m_exposure;
+	float m_densityScale;
+	float m_savedPointSize;
+
+public:
+	DensityRenderer();
+	~DensityRenderer();
+
+	inline float getExposure() const { return m_exposure; }
+	inline void setExposure(float exposure) { m_exposure = exposure; }
+	// Multiplies the particle counts, to compensate for drawing only a fraction of the particles
+	inline void setDensityScale(float scale) { m_densityScale = scale; }
+
+	// Binds and clears the density target, resizing it to the window framebuffer if needed
+	void begin();
+	// Restores the default framebuffer and render state, and tone maps the density target onto it
+	void resolve();
+
+	DensityRenderer(const DensityRenderer&) = delete;
+	DensityRenderer& operator = (const DensityRenderer&) = delete;
+
+private:
+	void resize(int width, int height);
+};
+
+
+extern const char * const ParticleSplatFragmentShaderSource;
+extern const char * const DensityResolveVertexShaderSource;
+extern const char * const DensityResolveFragmentShaderSource;
\ No newline at end of file
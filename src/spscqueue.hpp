@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+
+// Bounded lock-free queue between exactly one producer and one consumer thread. Each side only writes its own index,
+// and the indices are padded apart so the two threads do not contend for the same cache line. Padding instead of
+// alignas keeps the queue usable in objects allocated with plain new.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "The capacity of an SpscQueue must be a power of two");
+
+private:
+	static const size_t CACHE_LINE = 64;
+
+	std::atomic<size_t> m_head;		// Next item to pop, written by the consumer
+	char m_headPadding[CACHE_LINE];
+	std::atomic<size_t> m_tail;		// Next item to push, written by the producer
+	char m_tailPadding[CACHE_LINE];
+	T m_items[Capacity];
+
+public:
+	SpscQueue() :
+		m_head{0},
+		m_headPadding{},
+		m_tail{0},
+		m_tailPadding{},
+		m_items{}
+	{
+
+	}
+
+	// Producer only, returns false without waiting when the queue is full
+	bool push(const T& item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+			return false;
+		m_items[tail & (Capacity - 1)] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only, returns false without waiting when the queue is empty
+	bool pop(T& item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		item = m_items[head & (Capacity - 1)];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator = (const SpscQueue&) = delete;
+};
\ No newline at end of file
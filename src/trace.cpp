@@ -0,0 +1,181 @@
+#include "trace.hpp"
+#include "gpu.hpp"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+
+TraceRecorder g_trace;
+
+// Process ids used to separate the host threads from the device queue in the trace viewer
+static const uint32_t TRACE_PID_HOST = 1;
+static const uint32_t TRACE_PID_DEVICE = 2;
+static const uint32_t TRACE_TID_QUEUE = 1;
+
+
+// ================================================================================================
+TraceRecorder::TraceRecorder() :
+	m_events{nullptr},
+	m_written{0},
+	m_enabled{false},
+	m_writers{0},
+	m_epoch{clock::now()},
+	m_deviceOffset{0},
+	m_deviceCalibrated{false},
+	m_threadMutex{},
+	m_threadNames{},
+	m_traceIndex{0}
+{
+
+}
+
+// ================================================================================================
+TraceRecorder::~TraceRecorder()
+{
+
+}
+
+// ================================================================================================
+void TraceRecorder::setEnabled(bool enabled)
+{
+	if (enabled == isEnabled())
+		return;
+
+	if (enabled) {
+		if (!m_events)
+			m_events.reset(new trace_event_t[CAPACITY]);
+		m_written.store(0);
+		m_deviceCalibrated.store(false);
+		calibrateDeviceClock();
+		m_enabled.store(true);
+		std::cout << "Trace recording started." << std::endl;
+	}
+	else {
+		char path[64];
+		snprintf(path, 64, "p50k_trace_%u.json", m_traceIndex++);
+		write(path);
+	}
+}
+
+// ================================================================================================
+void TraceRecorder::setThreadName(const char* name)
+{
+	const uint32_t tid = getThreadId();
+
+	std::lock_guard<std::mutex> lock(m_threadMutex);
+	for (auto& thread : m_threadNames) {
+		if (thread.first == tid) {
+			thread.second = name;
+			return;
+		}
+	}
+	m_threadNames.emplace_back(tid, name);
+}
+
+// ================================================================================================
+void TraceRecorder::recordHost(const char* name, const char* category, clock::time_point start, clock::time_point end)
+{
+	const int64_t tstart = toTraceTime(start);
+	push({ name, category, tstart, toTraceTime(end) - tstart, TRACE_PID_HOST, getThreadId() });
+}
+
+// ================================================================================================
+void TraceRecorder::recordDevice(const char* name, cl_ulong start, cl_ulong end)
+{
+	// Without a marker calibration, assume that the event ended just now
+	if (!m_deviceCalibrated.load()) {
+		m_deviceOffset.store(toTraceTime(clock::now()) - (int64_t)end);
+		m_deviceCalibrated.store(true);
+	}
+
+	const int64_t offset = m_deviceOffset.load();
+	push({ name, "device", (int64_t)start + offset, (int64_t)(end - start), TRACE_PID_DEVICE, TRACE_TID_QUEUE });
+}
+
+// ================================================================================================
+void TraceRecorder::calibrateDeviceClock()
+{
+	if (!g_clCommandQueue)
+		return;
+
+	cl_event marker = nullptr;
+	if (clEnqueueMarkerWithWaitList(g_clCommandQueue, 0, nullptr, &marker) || !marker)
+		return;
+
+	cl_ulong end = 0;
+	if (!clWaitForEvents(1, &marker) &&
+			!clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr)) {
+		m_deviceOffset.store(toTraceTime(clock::now()) - (int64_t)end);
+		m_deviceCalibrated.store(true);
+	}
+	clReleaseEvent(marker);
+}
+
+// ================================================================================================
+void TraceRecorder::write(const std::string& path)
+{
+	// Stop recording, and wait for any in-progress writes to complete
+	m_enabled.store(false);
+	while (m_writers.load())
+		std::this_thread::yield();
+
+	if (!m_events)
+		return;
+
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "Could not open trace file '" << path << "' for writing." << std::endl;
+		return;
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_HOST << ",\"args\":{\"name\":\"Host\"}}," << std::endl;
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_DEVICE << ",\"args\":{\"name\":\"OpenCL Device\"}}," << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_DEVICE << ",\"tid\":" << TRACE_TID_QUEUE
+		<< ",\"args\":{\"name\":\"Command Queue\"}}";
+	{
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		for (const auto& thread : m_threadNames) {
+			file << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_HOST << ",\"tid\":"
+				<< thread.first << ",\"args\":{\"name\":\"" << thread.second << "\"}}";
+		}
+	}
+
+	// Only the last CAPACITY events are still available in the ring
+	const uint64_t written = m_written.load();
+	const uint64_t first = (written > CAPACITY) ? (written - CAPACITY) : 0;
+	file << std::fixed << std::setprecision(3);
+	for (uint64_t i = first; i < written; ++i) {
+		const trace_event_t& evt = m_events[i % CAPACITY];
+		file << "," << std::endl << "{\"name\":\"" << evt.name << "\",\"cat\":\"" << evt.category
+			<< "\",\"ph\":\"X\",\"ts\":" << (evt.start / 1000.0) << ",\"dur\":" << (evt.duration / 1000.0)
+			<< ",\"pid\":" << evt.pid << ",\"tid\":" << evt.tid << "}";
+	}
+	file << std::endl << "]}" << std::endl;
+
+	std::cout << "Wrote " << (written - first) << " trace events to '" << path << "'";
+	if (first)
+		std::cout << " (" << first << " older events were dropped)";
+	std::cout << "." << std::endl;
+}
+
+// ================================================================================================
+void TraceRecorder::push(const trace_event_t& evt)
+{
+	// Register as a writer before checking the enabled flag, so write() can wait for us to finish
+	m_writers.fetch_add(1);
+	if (m_enabled.load()) {
+		const uint64_t index = m_written.fetch_add(1, std::memory_order_relaxed);
+		m_events[index % CAPACITY] = evt;
+	}
+	m_writers.fetch_sub(1);
+}
+
+// ================================================================================================
+uint32_t TraceRecorder::getThreadId()
+{
+	static std::atomic<uint32_t> nextid{1};
+	static thread_local uint32_t tid = nextid.fetch_add(1);
+	return tid;
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <CL\cl.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Records host thread and device queue timelines, and writes them out in the Chrome Trace Event format (viewable
+// in chrome://tracing or ui.perfetto.dev). The event storage is a fixed size ring, so long traces only keep the
+// most recent events. Event names and categories must be string literals (or otherwise outlive the recorder).
+class TraceRecorder
+{
+public:
+	using clock = std::chrono::high_resolution_clock;
+
+	static const unsigned int CAPACITY = (1 << 18);
+
+private:
+	struct trace_event_t
+	{
+		const char* name;
+		const char* category;
+		int64_t start;		// Nanoseconds since the trace epoch
+		int64_t duration;	// Nanoseconds
+		uint32_t pid;
+		uint32_t tid;
+	};
+
+	std::unique_ptr<trace_event_t[]> m_events;
+	std::atomic<uint64_t> m_written;
+	std::atomic<bool> m_enabled;
+	std::atomic<unsigned int> m_writers;
+	clock::time_point m_epoch;
+	std::atomic<int64_t> m_deviceOffset;	// Add to device timestamps to get nanoseconds since the epoch
+	std::atomic<bool> m_deviceCalibrated;
+	std::mutex m_threadMutex;
+	std::vector<std::pair<uint32_t, std::string>> m_threadNames;
+	unsigned int m_traceIndex;
+
+public:
+	TraceRecorder();
+	~TraceRecorder();
+
+	inline bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+	void setEnabled(bool enabled);
+
+	// Names the calling thread in the trace output
+	void setThreadName(const char* name);
+
+	inline int64_t toTraceTime(clock::time_point time) const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_epoch).count();
+	}
+
+	void recordHost(const char* name, const char* category, clock::time_point start, clock::time_point end);
+	void recordDevice(const char* name, cl_ulong start, cl_ulong end);
+
+	// Measures the offset between the OpenCL device clock and the host clock with a queue marker
+	void calibrateDeviceClock();
+
+	void write(const std::string& path);
+
+private:
+	void push(const trace_event_t& evt);
+	static uint32_t getThreadId();
+};
+
+extern TraceRecorder g_trace;
+
+
+// Records the current scope as a complete event on the calling thread's track
+class ScopedTrace
+{
+private:
+	const char* const m_name;
+	const char* const m_category;
+	const bool m_active;
+	TraceRecorder::clock::time_point m_start;
+
+public:
+	ScopedTrace(const char* name, const char* category = "host") :
+		m_name{name},
+		m_category{category},
+		m_active{g_trace.isEnabled()}
+	{
+		if (m_active)
+			m_start = TraceRecorder::clock::now();
+	}
+	~ScopedTrace()
+	{
+		if (m_active)
+			g_trace.recordHost(m_name, m_category, m_start, TraceRecorder::clock::now());
+	}
+
+	ScopedTrace(const ScopedTrace&) = delete;
+	ScopedTrace& operator = (const ScopedTrace&) = delete;
+};
\ No newline at end of file
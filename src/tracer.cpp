@@ -0,0 +1,318 @@
+#include "tracer.hpp"
+#include "cpusolver.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+
+static const char TracerMagic[8] = { 'P', '5', '0', 'K', 'T', 'R', 'C', 'R' };
+
+
+// ================================================================================================
+Tracer::Tracer(const char *path, ReadbackSource source, const std::vector<uint32_t>& ids, size_t pcount) :
+	m_source{source},
+	m_ids{ids},
+	m_lookup{},
+	m_lookupMem{nullptr},
+	m_samplesMem{nullptr},
+	m_lookupBuffer{nullptr},
+	m_gatherCompute{nullptr},
+	m_ring{},
+	m_oldest{0},
+	m_inFlight{0},
+	m_file{},
+	m_block{},
+	m_writeJob{},
+	m_failed{false},
+	m_records{0}
+{
+	if (m_ids.empty())
+		throw std::runtime_error("A tracer needs at least one particle id");
+	if (m_ids.back() >= pcount) {
+		throw std::runtime_error("Tracer particle id " + std::to_string(m_ids.back()) + " is not below the particle count "
+			+ std::to_string(pcount));
+	}
+
+	m_file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+		throw std::runtime_error(std::string("Could not create tracer '") + path + "'");
+
+	TracerHeader header = {};
+	memcpy(header.magic, TracerMagic, sizeof(TracerMagic));
+	header.version = TRACER_VERSION;
+	header.count = (uint32_t)m_ids.size();
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_file.write(reinterpret_cast<const char*>(m_ids.data()), sizeof(uint32_t) * m_ids.size());
+	if (!m_file)
+		throw std::runtime_error(std::string("Could not write tracer '") + path + "'");
+
+	// Direct lookup by id, a word per particle
+	m_lookup.assign(pcount, TRACER_NO_SLOT);
+	for (size_t i = 0; i < m_ids.size(); ++i)
+		m_lookup[m_ids[i]] = (uint32_t)i;
+
+	// Ids that are never found keep the samples they start with
+	const size_t samplesSize = sizeof(TracerSample) * m_ids.size();
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const std::vector<TracerSample> missing(m_ids.size(), TracerSample{ nan, nan, nan, nan });
+
+	if (m_source == READBACK_OPENCL) {
+		cl_int clerr;
+		CL_CHECK_RETURN_FATAL(
+			m_lookupMem = clCreateBuffer(g_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(uint32_t) * m_lookup.size(), m_lookup.data(), &clerr),
+			clerr, m_lookupMem, "Could not create the tracer lookup buffer");
+		CL_CHECK_RETURN_FATAL(
+			m_samplesMem = clCreateBuffer(g_clContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, samplesSize,
+				const_cast<TracerSample*>(missing.data()), &clerr),
+			clerr, m_samplesMem, "Could not create the tracer sample buffer");
+	}
+	else if (m_source == READBACK_OPENGL) {
+		std::string shaderSource = "#version 430 core\n";
+		shaderSource += ParticleGatherComputeShaderSource;
+		m_gatherCompute = new ComputeShader(shaderSource.c_str());
+		m_gatherCompute->bind();
+		m_gatherCompute->setUniform("LookupCount", (unsigned int)m_lookup.size());
+		m_gatherCompute->release();
+
+		m_lookupBuffer = new VertexBuffer(sizeof(uint32_t) * m_lookup.size(), GL_STATIC_DRAW);
+		m_lookupBuffer->setData(m_lookup.data());
+	}
+
+	for (slot_t& slot : m_ring) {
+		if (m_source == READBACK_HOST) {
+			slot.samples = new TracerSample[m_ids.size()];
+			std::copy(missing.begin(), missing.end(), slot.samples);
+		}
+		else if (m_source == READBACK_OPENCL) {
+			// Mapped for the lifetime of the tracer, like the pinned state readbacks
+			cl_int clerr;
+			CL_CHECK_RETURN_FATAL(
+				slot.pinnedMem = clCreateBuffer(g_clContext, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, samplesSize,
+					nullptr, &clerr),
+				clerr, slot.pinnedMem, "Could not create a tracer readback buffer");
+			CL_CHECK_RETURN_FATAL(
+				slot.samples = static_cast<TracerSample*>(clEnqueueMapBuffer(g_clCommandQueue, slot.pinnedMem, CL_TRUE,
+					CL_MAP_READ | CL_MAP_WRITE, 0, samplesSize, 0, nullptr, nullptr, &clerr)),
+				clerr, slot.samples, "Could not map a tracer readback buffer");
+		}
+		else {
+			// Each slot is gathered into directly, so the ring needs no copies on the GPU
+			slot.buffer = new VertexBuffer(samplesSize, GL_STREAM_READ);
+			slot.buffer->setData(missing.data());
+		}
+	}
+}
+
+// ================================================================================================
+Tracer::~Tracer()
+{
+	// The last records are still written, but a failure can not be thrown from here
+	try {
+		while (m_inFlight)
+			collect(true);
+		flush();
+	}
+	catch (const std::exception& ex) {
+		std::cerr << "Tracer Error: \"" << ex.what() << "\"." << std::endl;
+	}
+	if (m_writeJob)
+		g_jobs->wait(m_writeJob);
+
+	for (slot_t& slot : m_ring) {
+		if (slot.event) {
+			clWaitForEvents(1, &slot.event);
+			clReleaseEvent(slot.event);
+		}
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+
+		if (slot.buffer)
+			delete slot.buffer;
+		else if (slot.pinnedMem) {
+			clEnqueueUnmapMemObject(g_clCommandQueue, slot.pinnedMem, slot.samples, 0, nullptr, nullptr);
+			clFinish(g_clCommandQueue);
+			clReleaseMemObject(slot.pinnedMem);
+		}
+		else if (slot.samples)
+			delete[] slot.samples;
+	}
+
+	if (m_gatherCompute)
+		delete m_gatherCompute;
+	if (m_lookupBuffer)
+		delete m_lookupBuffer;
+	if (m_lookupMem)
+		clReleaseMemObject(m_lookupMem);
+	if (m_samplesMem)
+		clReleaseMemObject(m_samplesMem);
+
+	if (m_failed)
+		std::cerr << "Tracer could not write all of its " << m_records << " records" << std::endl;
+}
+
+// ================================================================================================
+void Tracer::gather(const CpuSolver& solver, uint64_t step, double time)
+{
+	if (m_source != READBACK_HOST)
+		throw std::runtime_error("Cannot gather the host state into a device tracer.");
+
+	// Every particle is looked at, so a gather costs one parallel pass over the ids
+	slot_t& slot = beginGather(step, time);
+	const particle_soa_t& soa = solver.getArrays();
+	const uint32_t *lookup = m_lookup.data();
+	const size_t lookupCount = m_lookup.size();
+	TracerSample *samples = slot.samples;
+	g_jobs->parallel_for(0, solver.getCount(), 4096, [&soa, lookup, lookupCount, samples](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const uint32_t id = soa.id[i];
+			const uint32_t index = (id < lookupCount) ? lookup[id] : TRACER_NO_SLOT;
+			if (index != TRACER_NO_SLOT)
+				samples[index] = { soa.x[i], soa.y[i], soa.vx[i], soa.vy[i] };
+		}
+	});
+	endGather();
+}
+
+// ================================================================================================
+void Tracer::gather(Kernel& kernel, cl_mem state, size_t pcount, uint64_t step, double time)
+{
+	if (m_source != READBACK_OPENCL)
+		throw std::runtime_error("Cannot gather OpenCL memory into this tracer.");
+
+	slot_t& slot = beginGather(step, time);
+	const cl_uint count = (cl_uint)pcount;
+	const cl_uint lookupCount = (cl_uint)m_lookup.size();
+	kernel.setKernelArgument(0, sizeof(state), &state);
+	kernel.setKernelArgument(1, sizeof(count), &count);
+	kernel.setKernelArgument(2, sizeof(m_lookupMem), &m_lookupMem);
+	kernel.setKernelArgument(3, sizeof(lookupCount), &lookupCount);
+	kernel.setKernelArgument(4, sizeof(m_samplesMem), &m_samplesMem);
+	// Only the read is waited for, when the slot is collected. The queue is in order, so the read follows the scan,
+	// and the next gather only overwrites the samples once the read is done.
+	size_t global[1] = { pcount };
+	kernel.enqueueNDRange(1, global);
+	CL_CHECK_FATAL(clEnqueueReadBuffer(g_clCommandQueue, m_samplesMem, CL_FALSE, 0,
+		sizeof(TracerSample) * m_ids.size(), slot.samples, 0, nullptr, &slot.event), "Could not read back the tracer");
+	clFlush(g_clCommandQueue);
+	endGather();
+}
+
+// ================================================================================================
+void Tracer::gather(const VertexBuffer *state, size_t pcount, uint64_t step, double time)
+{
+	if (m_source != READBACK_OPENGL)
+		throw std::runtime_error("Cannot gather an OpenGL buffer into this tracer.");
+
+	slot_t& slot = beginGather(step, time);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, state->getVboName());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_lookupBuffer->getVboName());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, slot.buffer->getVboName());
+	m_gatherCompute->bind();
+	m_gatherCompute->setUniform("Count", (unsigned int)pcount);
+	m_gatherCompute->dispatch(pcount);
+	m_gatherCompute->release();
+
+	// The samples are mapped once the fence has signaled, which needs the shader writes to be visible
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	endGather();
+}
+
+// ================================================================================================
+Tracer::slot_t& Tracer::beginGather(uint64_t step, double time)
+{
+	// Only a full ring waits, for the oldest gather, which has normally arrived long ago
+	if (m_inFlight == TRACER_LATENCY)
+		collect(true);
+
+	slot_t& slot = m_ring[(m_oldest + m_inFlight) % TRACER_LATENCY];
+	slot.step = step;
+	slot.time = time;
+	return slot;
+}
+
+// ================================================================================================
+void Tracer::endGather()
+{
+	++m_inFlight;
+	while (m_inFlight && collect(false)) {}
+	if (m_block.size() >= TRACER_BLOCK_BYTES)
+		flush();
+}
+
+// ================================================================================================
+bool Tracer::collect(bool wait)
+{
+	slot_t& slot = m_ring[m_oldest];
+	const size_t samplesSize = sizeof(TracerSample) * m_ids.size();
+
+	if (slot.event) {
+		if (wait) {
+			CL_CHECK_FATAL(clWaitForEvents(1, &slot.event), "Could not wait for a tracer readback");
+		}
+		cl_int status = CL_QUEUED;
+		CL_CHECK_FATAL(clGetEventInfo(slot.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status,
+			nullptr), "Could not query a tracer readback");
+		if (status < 0)
+			throw std::runtime_error("Could not read back the tracer samples.");
+		if (status != CL_COMPLETE)
+			return false;
+		clReleaseEvent(slot.event);
+		slot.event = nullptr;
+	}
+	else if (slot.fence) {
+		const GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+			wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		if (status == GL_WAIT_FAILED)
+			throw std::runtime_error("Could not wait for a tracer readback.");
+	}
+
+	const TracerRecord record = { slot.step, slot.time };
+	const size_t offset = m_block.size();
+	m_block.resize(offset + sizeof(record) + samplesSize);
+	memcpy(m_block.data() + offset, &record, sizeof(record));
+	if (slot.buffer) {
+		const void *mapped = slot.buffer->mapBufferRange(GL_MAP_READ_BIT, 0, samplesSize);
+		memcpy(m_block.data() + offset + sizeof(record), mapped, samplesSize);
+		slot.buffer->unmapBuffer();
+	}
+	else {
+		memcpy(m_block.data() + offset + sizeof(record), slot.samples, samplesSize);
+	}
+
+	m_oldest = (m_oldest + 1) % TRACER_LATENCY;
+	--m_inFlight;
+	++m_records;
+	return true;
+}
+
+// ================================================================================================
+void Tracer::flush()
+{
+	if (m_block.empty() || m_failed)
+		return;
+
+	// Blocks are written in order, each job waits for the one before it
+	auto block = std::make_shared<std::vector<unsigned char>>();
+	block->swap(m_block);
+	m_block.reserve(block->size());
+	m_writeJob = g_jobs->submit([this, block]() {
+		if (m_failed)
+			return;
+		m_file.write(reinterpret_cast<const char*>(block->data()), (std::streamsize)block->size());
+		m_file.flush();
+		if (!m_file) {
+			m_failed = true;
+			std::cerr << "Tracer Error: \"Could not write a block of records\"." << std::endl;
+		}
+	}, { m_writeJob });
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include "gpu.hpp"
+#include "jobs.hpp"
+#include "kernel.hpp"
+#include "readback.hpp"
+#include "shader.hpp"
+#include "vbo.hpp"
+
+
+class CpuSolver;
+
+
+// Gathers in flight at once, the oldest is only waited for when all of them are
+#define TRACER_LATENCY 4
+// Records collected on the host before they are handed to a write job
+#define TRACER_BLOCK_BYTES ((size_t)64 * 1024)
+
+#define TRACER_VERSION 1u
+// Lookup entry of an id that is not traced
+#define TRACER_NO_SLOT 0xFFFFFFFFu
+
+
+// Tracer files start with a header and the ids in ascending order, and then hold a record for every step. Each
+// record is followed by a sample per id in the order of the header. All values are little endian.
+struct TracerHeader
+{
+	char magic[8];				// "P50KTRCR"
+	uint32_t version;
+	uint32_t count;				// Of ids, and of the samples in every record
+};
+static_assert(sizeof(TracerHeader) == 16, "TracerHeader is part of the file format");
+
+struct TracerRecord
+{
+	uint64_t step;
+	double time;
+};
+static_assert(sizeof(TracerRecord) == 16, "TracerRecord is part of the file format");
+
+struct TracerSample
+{
+	float x;
+	float y;
+	float vx;
+	float vy;
+};
+static_assert(sizeof(TracerSample) == 16, "TracerSample must match the layout of the gather kernels");
+
+
+// Follows a small subset of particles by their stable id, every step. A gather on the device scans the ids of the
+// state and scatters the matching particles into a compact sample array, so only that array is read back, and the
+// scan keeps working however the state is ordered. The read backs are kept in a ring and collected in step order
+// without waiting, and the records are written to the file in blocks on the job system.
+class Tracer
+{
+	struct slot_t
+	{
+		TracerSample *samples;	// Host array, pinned OpenCL mapping, or OpenGL mapping while it is collected
+		cl_mem pinnedMem;		// READBACK_OPENCL
+		cl_event event;
+		VertexBuffer *buffer;	// READBACK_OPENGL, written by the gather shader
+		GLsync fence;
+		uint64_t step;
+		double time;
+	};
+
+private:
+	const ReadbackSource m_source;
+	const std::vector<uint32_t> m_ids;
+	std::vector<uint32_t> m_lookup;		// Sample slot of each id up to the largest one, or TRACER_NO_SLOT
+	cl_mem m_lookupMem;					// READBACK_OPENCL
+	cl_mem m_samplesMem;
+	VertexBuffer *m_lookupBuffer;		// READBACK_OPENGL
+	ComputeShader *m_gatherCompute;
+	slot_t m_ring[TRACER_LATENCY];
+	size_t m_oldest;					// Ring index of the oldest gather in flight
+	size_t m_inFlight;
+	std::ofstream m_file;
+	std::vector<unsigned char> m_block;	// Records that have not been handed to a write job yet
+	JobHandle m_writeJob;
+	std::atomic<bool> m_failed;
+	uint64_t m_records;
+
+public:
+	// Creates the file and the gather resources for where the backend keeps its state, throws on failure. The ids
+	// have to be sorted, unique and below the particle count.
+	Tracer(const char *path, ReadbackSource source, const std::vector<uint32_t>& ids, size_t pcount);
+	// Waits for the gathers in flight, and writes their records
+	~Tracer();
+
+	inline ReadbackSource getSource() const { return m_source; }
+	inline size_t getIdCount() const { return m_ids.size(); }
+
+	// Starts a gather of the state after a step, the kernel is the Gather kernel of the simulation program. The OpenCL
+	// state has to be acquired, and the OpenGL state written by a dispatch before a storage barrier.
+	void gather(const CpuSolver& solver, uint64_t step, double time);
+	void gather(Kernel& kernel, cl_mem state, size_t pcount, uint64_t step, double time);
+	void gather(const VertexBuffer *state, size_t pcount, uint64_t step, double time);
+
+	Tracer(const Tracer&) = delete;
+	Tracer& operator = (const Tracer&) = delete;
+
+private:
+	slot_t& beginGather(uint64_t step, double time);
+	void endGather();
+	// Collects the oldest gather into the block, returns false if it has not arrived and wait is not set
+	bool collect(bool wait);
+	void flush();
+};
\ No newline at end of file
@@ -0,0 +1,367 @@
+#include "trajectory.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#	define NOMINMAX
+#	include <Windows.h>
+#else
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+
+static const char TrajectoryMagic[8] = { 'P', '5', '0', 'K', 'T', 'R', 'A', 'J' };
+static const char TrajectoryEndMagic[8] = { 'P', '5', '0', 'K', 'T', 'E', 'N', 'D' };
+// Polls of an empty queue before the writer thread starts sleeping between them
+static const unsigned int TRAJECTORY_SPIN_POLLS = 64;
+
+
+// ================================================================================================
+TrajectoryWriter::TrajectoryWriter(const char *path, size_t pcount, uint32_t stride, uint32_t attributeMask,
+		const TrajectoryEncoding *encodings) :
+	m_path{path},
+	m_pCount{pcount},
+	m_stride{stride},
+	m_attributeMask{attributeMask & TRAJECTORY_ATTRIBUTES_ALL},
+	m_encodings{},
+	m_file{-1},
+	m_queued{},
+	m_written{},
+	m_stop{false},
+	m_thread{},
+	m_offset{0},
+	m_failed{false},
+	m_chunks{},
+	m_columns{},
+	m_history{},
+	m_values{},
+	m_chunkData{},
+	m_rawBytes{0}
+{
+	if (!m_attributeMask)
+		throw std::runtime_error("A trajectory needs at least one attribute");
+	std::copy(encodings, encodings + SNAPSHOT_ATTRIBUTE_COUNT, m_encodings);
+	// Ids have to come back exactly, so they are never quantized
+	m_encodings[SNAPSHOT_ID].codec &= ~(uint32_t)TRAJECTORY_CODEC_QUANTIZE;
+
+	// Written with positional writes, so the writer never seeks and the offsets are tracked here
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error(std::string("Could not create trajectory '") + path + "'");
+	m_file = (intptr_t)file;
+#else
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw std::runtime_error(std::string("Could not create trajectory '") + path + "'");
+	m_file = fd;
+#endif
+
+	TrajectoryHeader header = {};
+	memcpy(header.magic, TrajectoryMagic, sizeof(TrajectoryMagic));
+	header.version = TRAJECTORY_VERSION;
+	header.stride = m_stride;
+	header.particleCount = m_pCount;
+	header.attributeMask = m_attributeMask;
+	try {
+		writeAt(&header, sizeof(header), 0);
+	}
+	catch (...) {
+#if defined(_WIN32)
+		CloseHandle((HANDLE)m_file);
+#else
+		close((int)m_file);
+#endif
+		throw;
+	}
+	m_offset = sizeof(header);
+
+	m_thread = std::thread([this]() { run(); });
+}
+
+// ================================================================================================
+TrajectoryWriter::~TrajectoryWriter()
+{
+	m_stop.store(true, std::memory_order_release);
+	if (m_thread.joinable())
+		m_thread.join();
+
+#if defined(_WIN32)
+	CloseHandle((HANDLE)m_file);
+#else
+	close((int)m_file);
+#endif
+}
+
+// ================================================================================================
+bool TrajectoryWriter::push(const frame_t& frame)
+{
+	return m_queued.push(frame);
+}
+
+// ================================================================================================
+bool TrajectoryWriter::popWritten(size_t& tag)
+{
+	return m_written.pop(tag);
+}
+
+// ================================================================================================
+void TrajectoryWriter::run()
+{
+	g_trace.setThreadName("Trajectory Writer");
+
+	unsigned int idle = 0;
+	for (;;) {
+		// Everything pushed before the stop is visible once it has been read
+		const bool stopping = m_stop.load(std::memory_order_acquire);
+		frame_t frame;
+		if (!m_queued.pop(frame)) {
+			if (stopping)
+				break;
+			if (++idle < TRAJECTORY_SPIN_POLLS)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		idle = 0;
+
+		// After a failure the frames are still handed back, so the simulation keeps running without output
+		if (!m_failed) {
+			try {
+				writeChunk(frame);
+			}
+			catch (const std::exception& ex) {
+				m_failed = true;
+				std::cerr << "Trajectory Error: \"" << ex.what() << "\"." << std::endl;
+			}
+		}
+
+		// Never more frames in flight than the queue holds, so this does not spin in practice
+		while (!m_written.push(frame.tag))
+			std::this_thread::yield();
+	}
+
+	if (!m_failed) {
+		try {
+			writeIndex();
+			const double ratio = (double)m_rawBytes / (double)std::max<uint64_t>(m_offset, 1);
+			std::cout << "Trajectory written to '" << m_path << "' (" << m_chunks.size() << " frames, "
+				<< ratio << ":1 compression)" << std::endl;
+		}
+		catch (const std::exception& ex) {
+			std::cerr << "Trajectory Error: \"" << ex.what() << "\"." << std::endl;
+		}
+	}
+}
+
+// ================================================================================================
+void TrajectoryWriter::writeChunk(const frame_t& frame)
+{
+	ScopedTrace trace("Trajectory Chunk", "io");
+
+	TrajectoryChunk chunk = {};
+	chunk.step = frame.step;
+	chunk.time = frame.time;
+	chunk.firstColumn = (uint32_t)m_columns.size();
+	const bool keyframe = (m_chunks.size() % TRAJECTORY_KEYFRAME_INTERVAL) == 0;
+
+	// All columns of the chunk are encoded into one buffer, and written with a single call
+	m_values.resize(m_pCount);
+	m_chunkData.clear();
+	for (uint32_t attribute = 0; attribute < SNAPSHOT_ATTRIBUTE_COUNT; ++attribute) {
+		if (!(m_attributeMask & (1u << attribute)))
+			continue;
+
+		for (size_t i = 0; i < m_pCount; ++i)
+			m_values[i] = getSnapshotValue(frame.state[i], (SnapshotAttribute)attribute);
+
+		const size_t start = m_chunkData.size();
+		const TrajectoryEncoding& encoding = m_encodings[attribute];
+		const uint32_t codec = encodeColumn(m_values.data(), m_pCount, encoding.codec, encoding.errorBound, keyframe,
+			m_history[attribute], m_chunkData);
+
+		const TrajectoryColumn entry = { m_offset + start, m_chunkData.size() - start, attribute, codec };
+		m_columns.push_back(entry);
+		m_rawBytes += m_pCount * sizeof(float);
+		++chunk.columnCount;
+	}
+
+	writeAt(m_chunkData.data(), m_chunkData.size(), m_offset);
+	m_offset += m_chunkData.size();
+	m_chunks.push_back(chunk);
+}
+
+// ================================================================================================
+void TrajectoryWriter::writeIndex()
+{
+	TrajectoryFooter footer = {};
+	footer.indexOffset = m_offset;
+	footer.chunkCount = m_chunks.size();
+	footer.columnCount = m_columns.size();
+	memcpy(footer.magic, TrajectoryEndMagic, sizeof(TrajectoryEndMagic));
+
+	writeAt(m_chunks.data(), m_chunks.size() * sizeof(TrajectoryChunk), m_offset);
+	m_offset += m_chunks.size() * sizeof(TrajectoryChunk);
+	writeAt(m_columns.data(), m_columns.size() * sizeof(TrajectoryColumn), m_offset);
+	m_offset += m_columns.size() * sizeof(TrajectoryColumn);
+	writeAt(&footer, sizeof(footer), m_offset);
+	m_offset += sizeof(footer);
+}
+
+// ================================================================================================
+void TrajectoryWriter::writeAt(const void *data, size_t size, uint64_t offset)
+{
+	const char *bytes = static_cast<const char*>(data);
+	while (size > 0) {
+#if defined(_WIN32)
+		// An offset in the OVERLAPPED structure makes a synchronous handle write at that position
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFull);
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		const DWORD request = (DWORD)std::min<size_t>(size, 1u << 30);
+		if (!WriteFile((HANDLE)m_file, bytes, request, &written, &overlapped) || written == 0)
+			throw std::runtime_error(std::string("Could not write trajectory '") + m_path + "'");
+#else
+		const ssize_t written = pwrite((int)m_file, bytes, size, (off_t)offset);
+		if (written <= 0)
+			throw std::runtime_error(std::string("Could not write trajectory '") + m_path + "'");
+#endif
+		bytes += written;
+		size -= (size_t)written;
+		offset += (uint64_t)written;
+	}
+}
+
+
+
+// ================================================================================================
+TrajectoryReader::TrajectoryReader(const char *path) :
+	m_file{path, "trajectory", MAPPED_ACCESS_RANDOM},
+	m_header{},
+	m_chunks{},
+	m_columns{}
+{
+	const std::string error = std::string("Trajectory '") + path + "' ";
+	const unsigned char *data = m_file.getData();
+	const uint64_t size = m_file.getSize();
+	if (size < sizeof(TrajectoryHeader) + sizeof(TrajectoryFooter))
+		throw std::runtime_error(error + "is not a trajectory file");
+	memcpy(&m_header, data, sizeof(m_header));
+	if (memcmp(m_header.magic, TrajectoryMagic, sizeof(TrajectoryMagic)) != 0)
+		throw std::runtime_error(error + "is not a trajectory file");
+	if (m_header.version != TRAJECTORY_VERSION)
+		throw std::runtime_error(error + "has unsupported version " + std::to_string(m_header.version));
+
+	// A file without a footer was not closed by its writer, and has no index to read
+	TrajectoryFooter footer;
+	memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+	if (memcmp(footer.magic, TrajectoryEndMagic, sizeof(TrajectoryEndMagic)) != 0)
+		throw std::runtime_error(error + "is incomplete");
+
+	// The counts are checked by division against the bytes the index has, so corrupt ones can not overflow the sizes
+	if (footer.indexOffset < sizeof(TrajectoryHeader) || footer.indexOffset > size - sizeof(footer))
+		throw std::runtime_error(error + "has an invalid index");
+	const uint64_t indexSize = size - sizeof(footer) - footer.indexOffset;
+	if (footer.chunkCount > indexSize / sizeof(TrajectoryChunk))
+		throw std::runtime_error(error + "has an invalid index");
+	const uint64_t columnsSize = indexSize - (footer.chunkCount * sizeof(TrajectoryChunk));
+	if (footer.columnCount != columnsSize / sizeof(TrajectoryColumn) || columnsSize % sizeof(TrajectoryColumn) != 0)
+		throw std::runtime_error(error + "has an invalid index");
+
+	// The index is copied out, it is small and the column data is not aligned for it
+	m_chunks.resize((size_t)footer.chunkCount);
+	m_columns.resize((size_t)footer.columnCount);
+	const unsigned char *index = data + footer.indexOffset;
+	memcpy(m_chunks.data(), index, m_chunks.size() * sizeof(TrajectoryChunk));
+	memcpy(m_columns.data(), index + (m_chunks.size() * sizeof(TrajectoryChunk)),
+		m_columns.size() * sizeof(TrajectoryColumn));
+
+	for (const TrajectoryChunk& chunk : m_chunks) {
+		if ((uint64_t)chunk.firstColumn + chunk.columnCount > m_columns.size())
+			throw std::runtime_error(error + "has an invalid chunk");
+	}
+	for (const TrajectoryColumn& column : m_columns) {
+		if (column.offset > footer.indexOffset || column.size > footer.indexOffset - column.offset
+			|| column.attribute >= SNAPSHOT_ATTRIBUTE_COUNT)
+			throw std::runtime_error(error + "has an invalid column");
+	}
+}
+
+// ================================================================================================
+bool TrajectoryReader::findChunks(double begin, double end, size_t& first, size_t& last) const
+{
+	// Chunks are written in step order, so their times are sorted
+	const auto firstIt = std::lower_bound(m_chunks.begin(), m_chunks.end(), begin,
+		[](const TrajectoryChunk& chunk, double time) { return chunk.time < time; });
+	const auto lastIt = std::upper_bound(firstIt, m_chunks.end(), end,
+		[](double time, const TrajectoryChunk& chunk) { return time < chunk.time; });
+	first = (size_t)(firstIt - m_chunks.begin());
+	last = (size_t)(lastIt - m_chunks.begin());
+	return first < last;
+}
+
+// ================================================================================================
+const TrajectoryColumn* TrajectoryReader::findColumn(size_t chunk, SnapshotAttribute attribute) const
+{
+	const TrajectoryChunk& entry = m_chunks.at(chunk);
+	for (uint32_t i = 0; i < entry.columnCount; ++i) {
+		const TrajectoryColumn& column = m_columns[entry.firstColumn + i];
+		if (column.attribute == (uint32_t)attribute)
+			return &column;
+	}
+	return nullptr;
+}
+
+// ================================================================================================
+size_t TrajectoryReader::findKeyframe(size_t chunk, SnapshotAttribute attribute) const
+{
+	const TrajectoryColumn *column = findColumn(chunk, attribute);
+	if (!column)
+		throw std::runtime_error("The trajectory chunk does not store the attribute");
+
+	while (column->codec & TRAJECTORY_CODEC_DELTA) {
+		if (chunk == 0 || !(column = findColumn(chunk - 1, attribute)))
+			throw std::runtime_error("The trajectory column is a delta without its previous chunk");
+		--chunk;
+	}
+	return chunk;
+}
+
+// ================================================================================================
+void TrajectoryReader::readColumn(size_t chunk, SnapshotAttribute attribute, float *dst) const
+{
+	// Only the columns of the attribute are read, from the keyframe onwards, and the rest of the chunks are skipped
+	codec_history_t history = {};
+	for (size_t index = findKeyframe(chunk, attribute); index <= chunk; ++index)
+		decodeColumn(index, attribute, history, dst);
+}
+
+// ================================================================================================
+void TrajectoryReader::decodeColumn(size_t chunk, SnapshotAttribute attribute, codec_history_t& history,
+	float *dst) const
+{
+	const TrajectoryColumn *column = findColumn(chunk, attribute);
+	if (!column)
+		throw std::runtime_error("The trajectory chunk does not store the attribute");
+	::decodeColumn(m_file.getData() + column->offset, (size_t)column->size, column->codec, getParticleCount(),
+		history, dst);
+}
+
+// ================================================================================================
+void TrajectoryReader::prefetchChunk(size_t chunk, uint32_t attributeMask) const
+{
+	const TrajectoryChunk& entry = m_chunks.at(chunk);
+	for (uint32_t i = 0; i < entry.columnCount; ++i) {
+		const TrajectoryColumn& column = m_columns[entry.firstColumn + i];
+		if (attributeMask & (1u << column.attribute))
+			m_file.prefetch((size_t)column.offset, (size_t)column.size);
+	}
+}
\ No newline at end of file
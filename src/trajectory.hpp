@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "codec.hpp"
+#include "mappedfile.hpp"
+#include "particle.hpp"
+#include "snapshot.hpp"
+#include "spscqueue.hpp"
+
+
+// Trajectory files hold a frame of the particle state every stride steps. Each frame is written as a chunk of
+// attribute columns, back to back after the TrajectoryHeader. The index after the last chunk describes every chunk
+// and column, and the TrajectoryFooter at the very end points at the index, so a reader can seek straight to the
+// columns it needs, such as only the positions of a time range. Attributes are the snapshot columns, and each is
+// encoded with its own codec stages (see TrajectoryCodec).
+
+struct TrajectoryHeader
+{
+	char magic[8];				// "P50KTRAJ"
+	uint32_t version;			// TRAJECTORY_VERSION
+	uint32_t stride;			// Simulation steps between frames
+	uint64_t particleCount;
+	uint32_t attributeMask;		// Bit per SnapshotAttribute that is stored in every chunk
+	uint32_t reserved;
+};
+static_assert(sizeof(TrajectoryHeader) == 32, "TrajectoryHeader is part of the file format");
+
+struct TrajectoryChunk
+{
+	uint64_t step;
+	double time;
+	uint32_t firstColumn;		// Into the column index
+	uint32_t columnCount;
+};
+static_assert(sizeof(TrajectoryChunk) == 24, "TrajectoryChunk is part of the file format");
+
+struct TrajectoryColumn
+{
+	uint64_t offset;			// From the start of the file
+	uint64_t size;				// Encoded bytes
+	uint32_t attribute;			// SnapshotAttribute
+	uint32_t codec;				// TrajectoryCodec stages that were used
+};
+static_assert(sizeof(TrajectoryColumn) == 24, "TrajectoryColumn is part of the file format");
+
+struct TrajectoryFooter
+{
+	uint64_t indexOffset;		// The chunk index, directly followed by the column index
+	uint64_t chunkCount;
+	uint64_t columnCount;
+	char magic[8];				// "P50KTEND"
+};
+static_assert(sizeof(TrajectoryFooter) == 32, "TrajectoryFooter is part of the file format");
+
+#define TRAJECTORY_VERSION 1
+// Frames that can be queued for the writer thread, which bounds the readbacks the simulation can have in flight
+#define TRAJECTORY_QUEUE_FRAMES 4
+#define TRAJECTORY_ATTRIBUTES_ALL ((1u << SNAPSHOT_ATTRIBUTE_COUNT) - 1)
+// Chunks from one keyframe to the next, keyframes store no deltas so decoding a column can start there
+#define TRAJECTORY_KEYFRAME_INTERVAL 16
+
+
+// How the columns of an attribute are written
+struct TrajectoryEncoding
+{
+	uint32_t codec;				// TrajectoryCodec stages
+	float errorBound;			// Largest absolute error of quantized values
+};
+
+
+// Writes trajectory frames on a dedicated thread. Frames are passed from the simulation thread through a lock-free
+// queue, and handed back through another one once they have been written, so neither side ever waits on the other.
+class TrajectoryWriter
+{
+public:
+	struct frame_t
+	{
+		const Particle *state;	// Has to stay valid until the frame is handed back
+		uint64_t step;
+		double time;
+		size_t tag;				// Returned by popWritten once the state is no longer read
+	};
+
+private:
+	const std::string m_path;
+	const size_t m_pCount;
+	const uint32_t m_stride;
+	const uint32_t m_attributeMask;
+	TrajectoryEncoding m_encodings[SNAPSHOT_ATTRIBUTE_COUNT];
+	intptr_t m_file;			// HANDLE on Windows, file descriptor elsewhere
+	SpscQueue<frame_t, TRAJECTORY_QUEUE_FRAMES> m_queued;
+	SpscQueue<size_t, TRAJECTORY_QUEUE_FRAMES> m_written;
+	std::atomic<bool> m_stop;
+	std::thread m_thread;
+
+	// Only used by the writer thread
+	uint64_t m_offset;
+	bool m_failed;
+	std::vector<TrajectoryChunk> m_chunks;
+	std::vector<TrajectoryColumn> m_columns;
+	codec_history_t m_history[SNAPSHOT_ATTRIBUTE_COUNT];
+	std::vector<float> m_values;
+	std::vector<unsigned char> m_chunkData;
+	uint64_t m_rawBytes;
+
+public:
+	// Creates the file and starts the writer thread, throws if the file can not be created. The encodings are
+	// indexed by SnapshotAttribute.
+	TrajectoryWriter(const char *path, size_t pcount, uint32_t stride, uint32_t attributeMask,
+		const TrajectoryEncoding *encodings);
+	// Writes the frames that are still queued, then the index
+	~TrajectoryWriter();
+
+	inline const std::string& getPath() const { return m_path; }
+	inline uint32_t getStride() const { return m_stride; }
+
+	// Queues a frame, returns false without waiting if the queue is full
+	bool push(const frame_t& frame);
+	// Returns the tag of a frame that has been written, false if there is none
+	bool popWritten(size_t& tag);
+
+	TrajectoryWriter(const TrajectoryWriter&) = delete;
+	TrajectoryWriter& operator = (const TrajectoryWriter&) = delete;
+
+private:
+	void run();
+	void writeChunk(const frame_t& frame);
+	void writeIndex();
+	void writeAt(const void *data, size_t size, uint64_t offset);
+};
+
+
+// Reads the index of a trajectory file, and then individual columns of a chunk on request. The file is mapped, and
+// the index locates the columns of any chunk directly, so seeking to a frame only touches the pages it needs.
+class TrajectoryReader
+{
+private:
+	MappedFile m_file;
+	TrajectoryHeader m_header;
+	std::vector<TrajectoryChunk> m_chunks;
+	std::vector<TrajectoryColumn> m_columns;
+
+public:
+	// Maps the file and validates the index, throws if the file is not a complete trajectory
+	explicit TrajectoryReader(const char *path);
+
+	inline const std::string& getPath() const { return m_file.getPath(); }
+	inline size_t getParticleCount() const { return (size_t)m_header.particleCount; }
+	inline uint32_t getStride() const { return m_header.stride; }
+	inline uint32_t getAttributeMask() const { return m_header.attributeMask; }
+	inline size_t getChunkCount() const { return m_chunks.size(); }
+	inline const TrajectoryChunk& getChunk(size_t index) const { return m_chunks[index]; }
+
+	// Finds the chunks with a time in [begin, end], as [first, last). Returns false when there are none.
+	bool findChunks(double begin, double end, size_t& first, size_t& last) const;
+	// Column of an attribute in a chunk, nullptr if the chunk does not store it
+	const TrajectoryColumn* findColumn(size_t chunk, SnapshotAttribute attribute) const;
+	// The chunk that decoding a column has to start from, the last one at or before chunk without a delta
+	size_t findKeyframe(size_t chunk, SnapshotAttribute attribute) const;
+
+	// Reads the values of one attribute for every particle of a chunk, throws if it is not stored. Columns that are
+	// deltas are decoded from the keyframe before them.
+	void readColumn(size_t chunk, SnapshotAttribute attribute, float *dst) const;
+	// Decodes a single column, the history has to hold the same attribute of the previous chunk when it is a delta.
+	// Sequential readers keep one history per attribute instead of decoding from the keyframe every time.
+	void decodeColumn(size_t chunk, SnapshotAttribute attribute, codec_history_t& history, float *dst) const;
+	// Starts reading the columns of the attributes in attributeMask in the background
+	void prefetchChunk(size_t chunk, uint32_t attributeMask) const;
+
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator = (const TrajectoryReader&) = delete;
+};
\ No newline at end of file
@@ -22,12 +22,15 @@ VertexBuffer::VertexBuffer(size_t size, GLenum usage) :
 	glBufferData(GL_ARRAY_BUFFER, size, nullptr, usage);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	cl_int clerr = 0;
-	m_clMem = clCreateFromGLBuffer(g_clContext, CL_MEM_READ_WRITE, m_vbo, &clerr);
-	if (!m_clMem || clerr) {
-		std::stringstream ss("Unable to bind OpenGL buffer as OpenCL memory (error: ");
-		ss << clerr << ")";
-		throw std::runtime_error(ss.str());
+	// Buffers are only shared with OpenCL when a backend that uses it is running
+	if (g_clContext) {
+		cl_int clerr = 0;
+		m_clMem = clCreateFromGLBuffer(g_clContext, CL_MEM_READ_WRITE, m_vbo, &clerr);
+		if (!m_clMem || clerr) {
+			std::stringstream ss("Unable to bind OpenGL buffer as OpenCL memory (error: ");
+			ss << clerr << ")";
+			throw std::runtime_error(ss.str());
+		}
 	}
 }
 
@@ -55,7 +58,7 @@ void VertexBuffer::setFormat(const vertex_format_specifier_t *fmt, size_t count)
 	for (size_t i = 0; i < count; ++i) {
 		const vertex_format_specifier_t& cfmt = fmt[i];
 		glEnableVertexAttribArray(cfmt.location);
-		glVertexAttribPointer(cfmt.location, cfmt.size, cfmt.type, GL_FALSE, cfmt.stride, 
+		glVertexAttribPointer(cfmt.location, cfmt.size, cfmt.type, cfmt.normalized ? GL_TRUE : GL_FALSE, cfmt.stride, 
 			(GLvoid*)cfmt.offset);
 	}
 
@@ -74,19 +77,19 @@ void VertexBuffer::setData(const void * const data)
 }
 
 // ================================================================================================
-void VertexBuffer::acquireCLMemory()
+void VertexBuffer::acquireCLMemory(cl_event* evt)
 {
 	//glFinish();
-	CL_CHECK_FATAL(clEnqueueAcquireGLObjects(g_clCommandQueue, 1, &m_clMem, 0, nullptr, nullptr),
+	CL_CHECK_FATAL(clEnqueueAcquireGLObjects(g_clCommandQueue, 1, &m_clMem, 0, nullptr, evt),
 		"Unable to acquire CL memory object.");
 	//clFinish(g_clCommandQueue);
 }
 
 // ================================================================================================
-void VertexBuffer::releaseCLMemory()
+void VertexBuffer::releaseCLMemory(cl_event* evt)
 {
 	//clFinish(g_clCommandQueue);
-	CL_CHECK_FATAL(clEnqueueReleaseGLObjects(g_clCommandQueue, 1, &m_clMem, 0, nullptr, nullptr),
+	CL_CHECK_FATAL(clEnqueueReleaseGLObjects(g_clCommandQueue, 1, &m_clMem, 0, nullptr, evt),
 		"Unable to release CL memory object.");
 	//glFinish();
 }
@@ -152,4 +155,17 @@ void VertexBuffer::drawBuffer(GLenum primitiveType, size_t start, size_t count)
 	glDrawArrays(primitiveType, start, count);
 	glBindVertexArray(0);
 }
+
+// ================================================================================================
+void VertexBuffer::drawBufferIndirect(GLenum primitiveType, const VertexBuffer *commands)
+{
+	if (m_isMapped || commands->isMapped())
+		throw std::runtime_error("Cannot draw a VBO that is currently mapped to host memory.");
+
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands->getVboName());
+	glDrawArraysIndirect(primitiveType, nullptr);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
 #pragma warning(default : 4267)
\ No newline at end of file
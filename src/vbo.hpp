@@ -13,6 +13,7 @@ struct vertex_format_specifier_t
 	unsigned int type;
 	GLuint stride;
 	size_t offset;
+	bool normalized;	// Integer types are read as [0, 1] (unsigned) or [-1, 1] (signed) floats when set
 };
 
 
@@ -39,8 +40,8 @@ public:
 	void setFormat(const vertex_format_specifier_t *fmt, size_t count);
 	void setData(const void * const data);
 
-	void acquireCLMemory();
-	void releaseCLMemory();
+	void acquireCLMemory(cl_event* evt = nullptr);
+	void releaseCLMemory(cl_event* evt = nullptr);
 
 	void* mapBuffer(GLenum flag);
 	void* mapBufferRange(GLenum flag, size_t offset, size_t length);
@@ -48,4 +49,6 @@ public:
 	inline bool isMapped() const { return m_isMapped; }
 
 	void drawBuffer(GLenum primitiveType, size_t start, size_t count);
+	// Draws with the count and offset from a DrawArraysIndirectCommand at the start of another buffer (GL 4.0)
+	void drawBufferIndirect(GLenum primitiveType, const VertexBuffer *commands);
 };
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "vkcontext.hpp"
+#include <shaderc\shaderc.h>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+
+
+VkInstance g_vkInstance = VK_NULL_HANDLE;
+VkPhysicalDevice g_vkPhysicalDevice = VK_NULL_HANDLE;
+VkDevice g_vkDevice = VK_NULL_HANDLE;
+VkSurfaceKHR g_vkSurface = VK_NULL_HANDLE;
+uint32_t g_vkGraphicsFamily = 0;
+uint32_t g_vkComputeFamily = 0;
+VkQueue g_vkGraphicsQueue = VK_NULL_HANDLE;
+VkQueue g_vkComputeQueue = VK_NULL_HANDLE;
+
+
+bool _vkThrowError(VkResult result, const char *file, unsigned int line, const char *msg, ...)
+{
+	char outstr[1024];
+	va_list args;
+	va_start(args, msg);
+	vsnprintf(outstr, 1024, msg, args);
+	va_end(args);
+
+	std::stringstream ss;
+	ss << outstr << " (Vulkan error '" << vkGetResultString(result) << "' (" << result << ") at " << file << "("
+		<< line << "))";
+	throw std::runtime_error(ss.str());
+}
+
+void initialize_vulkan()
+{
+	if (!glfwVulkanSupported())
+		throw std::runtime_error("No Vulkan loader or driver was found");
+
+	// Instance, with the surface extensions that GLFW needs for the window
+	uint32_t glfwExtensionCount = 0;
+	const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+	VkApplicationInfo appinfo = {};
+	appinfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	appinfo.pApplicationName = "P50K";
+	appinfo.apiVersion = VK_API_VERSION_1_2;
+
+	VkInstanceCreateInfo instinfo = {};
+	instinfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instinfo.pApplicationInfo = &appinfo;
+	instinfo.enabledExtensionCount = glfwExtensionCount;
+	instinfo.ppEnabledExtensionNames = glfwExtensions;
+	VK_CHECK_FATAL(vkCreateInstance(&instinfo, nullptr, &g_vkInstance), "Could not create the Vulkan instance");
+	VK_CHECK_FATAL(glfwCreateWindowSurface(g_vkInstance, g_windowPtr, nullptr, &g_vkSurface),
+		"Could not create the window surface");
+
+	// Use the first device with timeline semaphores and a family that can draw to the window
+	uint32_t deviceCount = 0;
+	vkEnumeratePhysicalDevices(g_vkInstance, &deviceCount, nullptr);
+	std::vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(g_vkInstance, &deviceCount, devices.data());
+
+	VkPhysicalDeviceProperties props = {};
+	for (VkPhysicalDevice device : devices) {
+		vkGetPhysicalDeviceProperties(device, &props);
+		if (props.apiVersion < VK_API_VERSION_1_2)
+			continue;
+
+		VkPhysicalDeviceVulkan12Features features12 = {};
+		features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &features12;
+		vkGetPhysicalDeviceFeatures2(device, &features);
+		if (!features12.timelineSemaphore)
+			continue;
+
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+
+		// A family without graphics is usually backed by separate hardware queues, which lets the step of the next
+		// frame run while the current one is drawn
+		int graphics = -1;
+		int compute = -1;
+		for (uint32_t i = 0; i < familyCount; ++i) {
+			const VkQueueFlags flags = families[i].queueFlags;
+			VkBool32 present = VK_FALSE;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_vkSurface, &present);
+			if (graphics < 0 && (flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT) && present)
+				graphics = (int)i;
+			if (compute < 0 && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+				compute = (int)i;
+		}
+		if (graphics < 0)
+			continue;
+
+		g_vkPhysicalDevice = device;
+		g_vkGraphicsFamily = (uint32_t)graphics;
+		g_vkComputeFamily = (compute >= 0) ? (uint32_t)compute : (uint32_t)graphics;
+		break;
+	}
+	if (!g_vkPhysicalDevice)
+		throw std::runtime_error("No Vulkan 1.2 device with timeline semaphores can draw to the window");
+
+	// Device, with one queue from each family
+	const bool asyncCompute = (g_vkComputeFamily != g_vkGraphicsFamily);
+	const float priority = 1.0f;
+	VkDeviceQueueCreateInfo queueinfo[2] = {};
+	for (size_t i = 0; i < 2; ++i) {
+		queueinfo[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueinfo[i].queueFamilyIndex = (i == 0) ? g_vkGraphicsFamily : g_vkComputeFamily;
+		queueinfo[i].queueCount = 1;
+		queueinfo[i].pQueuePriorities = &priority;
+	}
+
+	// Sprites need large points, without them the sizes written by the vertex shader are clamped to one pixel
+	VkPhysicalDeviceFeatures supported = {};
+	vkGetPhysicalDeviceFeatures(g_vkPhysicalDevice, &supported);
+	VkPhysicalDeviceVulkan12Features enabled12 = {};
+	enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	enabled12.timelineSemaphore = VK_TRUE;
+	VkPhysicalDeviceFeatures2 enabled = {};
+	enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	enabled.pNext = &enabled12;
+	enabled.features.largePoints = supported.largePoints;
+
+	const char *extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	VkDeviceCreateInfo devinfo = {};
+	devinfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	devinfo.pNext = &enabled;
+	devinfo.queueCreateInfoCount = asyncCompute ? 2 : 1;
+	devinfo.pQueueCreateInfos = queueinfo;
+	devinfo.enabledExtensionCount = 1;
+	devinfo.ppEnabledExtensionNames = extensions;
+	VK_CHECK_FATAL(vkCreateDevice(g_vkPhysicalDevice, &devinfo, nullptr, &g_vkDevice),
+		"Could not create the Vulkan device");
+
+	vkGetDeviceQueue(g_vkDevice, g_vkGraphicsFamily, 0, &g_vkGraphicsQueue);
+	vkGetDeviceQueue(g_vkDevice, g_vkComputeFamily, 0, &g_vkComputeQueue);
+
+	std::cout << "Initialized Vulkan Device (" << props.deviceName << ", "
+		<< (asyncCompute ? "async compute queue" : "single queue") << ")" << std::endl;
+}
+
+void shutdown_vulkan()
+{
+	if (g_vkDevice) {
+		vkDeviceWaitIdle(g_vkDevice);
+		vkDestroyDevice(g_vkDevice, nullptr);
+		g_vkDevice = VK_NULL_HANDLE;
+	}
+	if (g_vkSurface) {
+		vkDestroySurfaceKHR(g_vkInstance, g_vkSurface, nullptr);
+		g_vkSurface = VK_NULL_HANDLE;
+	}
+	if (g_vkInstance) {
+		vkDestroyInstance(g_vkInstance, nullptr);
+		g_vkInstance = VK_NULL_HANDLE;
+	}
+}
+
+uint32_t findVulkanMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memprops;
+	vkGetPhysicalDeviceMemoryProperties(g_vkPhysicalDevice, &memprops);
+	for (uint32_t i = 0; i < memprops.memoryTypeCount; ++i) {
+		if ((typeBits & (1u << i)) && (memprops.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+	throw std::runtime_error("No Vulkan memory type has the required properties");
+}
+
+vulkan_buffer_t createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+	vulkan_buffer_t result = { VK_NULL_HANDLE, VK_NULL_HANDLE, size };
+
+	const uint32_t families[2] = { g_vkGraphicsFamily, g_vkComputeFamily };
+	VkBufferCreateInfo bufinfo = {};
+	bufinfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufinfo.size = size;
+	bufinfo.usage = usage;
+	if (g_vkGraphicsFamily != g_vkComputeFamily) {
+		bufinfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufinfo.queueFamilyIndexCount = 2;
+		bufinfo.pQueueFamilyIndices = families;
+	}
+	else
+		bufinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VK_CHECK_FATAL(vkCreateBuffer(g_vkDevice, &bufinfo, nullptr, &result.buffer), "Could not create a buffer");
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(g_vkDevice, result.buffer, &requirements);
+	VkMemoryAllocateInfo allocinfo = {};
+	allocinfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocinfo.allocationSize = requirements.size;
+	allocinfo.memoryTypeIndex = findVulkanMemoryType(requirements.memoryTypeBits, properties);
+	VK_CHECK_FATAL(vkAllocateMemory(g_vkDevice, &allocinfo, nullptr, &result.memory),
+		"Could not allocate %llu bytes of buffer memory", (unsigned long long)requirements.size);
+	VK_CHECK_FATAL(vkBindBufferMemory(g_vkDevice, result.buffer, result.memory, 0), "Could not bind buffer memory");
+
+	return result;
+}
+
+void destroyVulkanBuffer(vulkan_buffer_t& buffer)
+{
+	if (buffer.buffer)
+		vkDestroyBuffer(g_vkDevice, buffer.buffer, nullptr);
+	if (buffer.memory)
+		vkFreeMemory(g_vkDevice, buffer.memory, nullptr);
+	buffer = { VK_NULL_HANDLE, VK_NULL_HANDLE, 0 };
+}
+
+std::vector<uint32_t> compileVulkanShader(const std::string& source, VkShaderStageFlagBits stage, const char *name)
+{
+	shaderc_shader_kind kind = shaderc_glsl_vertex_shader;
+	switch (stage)
+	{
+	case VK_SHADER_STAGE_FRAGMENT_BIT: kind = shaderc_glsl_fragment_shader; break;
+	case VK_SHADER_STAGE_COMPUTE_BIT: kind = shaderc_glsl_compute_shader; break;
+	default: break;
+	}
+
+	shaderc_compiler_t compiler = shaderc_compiler_initialize();
+	shaderc_compile_options_t options = shaderc_compile_options_initialize();
+	shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+	shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, source.c_str(), source.size(), kind, name,
+		"main", options);
+
+	const bool success = (shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success);
+	const std::string log = shaderc_result_get_error_message(result);
+	std::vector<uint32_t> spirv;
+	if (success) {
+		spirv.resize(shaderc_result_get_length(result) / sizeof(uint32_t));
+		memcpy(spirv.data(), shaderc_result_get_bytes(result), spirv.size() * sizeof(uint32_t));
+	}
+
+	shaderc_result_release(result);
+	shaderc_compile_options_release(options);
+	shaderc_compiler_release(compiler);
+
+	if (!success)
+		throw std::runtime_error(std::string("Vulkan shader '") + name + "' compilation error: '" + log + "'");
+	return spirv;
+}
+
+VkShaderModule createVulkanShaderModule(const std::vector<uint32_t>& spirv)
+{
+	VkShaderModuleCreateInfo modinfo = {};
+	modinfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	modinfo.codeSize = spirv.size() * sizeof(uint32_t);
+	modinfo.pCode = spirv.data();
+
+	VkShaderModule module = VK_NULL_HANDLE;
+	VK_CHECK_FATAL(vkCreateShaderModule(g_vkDevice, &modinfo, nullptr, &module), "Could not create a shader module");
+	return module;
+}
+
+const char *vkGetResultString(VkResult result)
+{
+	switch (result)
+	{
+	case VK_SUCCESS: return "VK_SUCCESS";
+	case VK_NOT_READY: return "VK_NOT_READY";
+	case VK_TIMEOUT: return "VK_TIMEOUT";
+	case VK_EVENT_SET: return "VK_EVENT_SET";
+	case VK_EVENT_RESET: return "VK_EVENT_RESET";
+	case VK_INCOMPLETE: return "VK_INCOMPLETE";
+	case VK_ERROR_OUT_OF_HOST_MEMORY: return "VK_ERROR_OUT_OF_HOST_MEMORY";
+	case VK_ERROR_OUT_OF_DEVICE_MEMORY: return "VK_ERROR_OUT_OF_DEVICE_MEMORY";
+	case VK_ERROR_INITIALIZATION_FAILED: return "VK_ERROR_INITIALIZATION_FAILED";
+	case VK_ERROR_DEVICE_LOST: return "VK_ERROR_DEVICE_LOST";
+	case VK_ERROR_MEMORY_MAP_FAILED: return "VK_ERROR_MEMORY_MAP_FAILED";
+	case VK_ERROR_LAYER_NOT_PRESENT: return "VK_ERROR_LAYER_NOT_PRESENT";
+	case VK_ERROR_EXTENSION_NOT_PRESENT: return "VK_ERROR_EXTENSION_NOT_PRESENT";
+	case VK_ERROR_FEATURE_NOT_PRESENT: return "VK_ERROR_FEATURE_NOT_PRESENT";
+	case VK_ERROR_INCOMPATIBLE_DRIVER: return "VK_ERROR_INCOMPATIBLE_DRIVER";
+	case VK_ERROR_TOO_MANY_OBJECTS: return "VK_ERROR_TOO_MANY_OBJECTS";
+	case VK_ERROR_FORMAT_NOT_SUPPORTED: return "VK_ERROR_FORMAT_NOT_SUPPORTED";
+	case VK_ERROR_SURFACE_LOST_KHR: return "VK_ERROR_SURFACE_LOST_KHR";
+	case VK_ERROR_NATIVE_WINDOW_IN_USE_KHR: return "VK_ERROR_NATIVE_WINDOW_IN_USE_KHR";
+	case VK_SUBOPTIMAL_KHR: return "VK_SUBOPTIMAL_KHR";
+	case VK_ERROR_OUT_OF_DATE_KHR: return "VK_ERROR_OUT_OF_DATE_KHR";
+	default: return "Unknown Vulkan error";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+// GLFW only declares its Vulkan surface functions when Vulkan is included before it, so this has to be included
+// before anything else that includes GLFW (which gpu.hpp does)
+#include <vulkan\vulkan.h>
+#include "gpu.hpp"
+#include <string>
+#include <vector>
+
+
+extern VkInstance g_vkInstance;
+extern VkPhysicalDevice g_vkPhysicalDevice;
+extern VkDevice g_vkDevice;
+extern VkSurfaceKHR g_vkSurface;
+extern uint32_t g_vkGraphicsFamily;		// Queue family that can draw and present
+extern uint32_t g_vkComputeFamily;		// A compute only family if there is one, otherwise g_vkGraphicsFamily
+extern VkQueue g_vkGraphicsQueue;
+extern VkQueue g_vkComputeQueue;
+
+// Throws with the formatted message and the name of the result when a Vulkan call does not return VK_SUCCESS
+#define VK_CHECK_FATAL(stmt, msg, ...) \
+	([&]() -> bool { \
+		const VkResult _vkres = (stmt); \
+		return (_vkres != VK_SUCCESS) ? _vkThrowError(_vkres, __FILE__, __LINE__, msg, ##__VA_ARGS__) : false; \
+	})()
+
+// Failure path of VK_CHECK_FATAL, always throws
+bool _vkThrowError(VkResult result, const char *file, unsigned int line, const char *msg, ...);
+const char *vkGetResultString(VkResult result);
+
+// A buffer with its own memory allocation. With separate graphics and compute families the buffer is shared
+// concurrently by both, so it never needs queue family ownership transfers.
+struct vulkan_buffer_t
+{
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+};
+
+// Creates the instance, the surface of the existing window (see initialize_window()), the device and its queues
+void initialize_vulkan();
+void shutdown_vulkan();
+
+// Index of a memory type allowed by typeBits that has all of the properties, throws if there is none
+uint32_t findVulkanMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties);
+
+vulkan_buffer_t createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+void destroyVulkanBuffer(vulkan_buffer_t& buffer);
+
+// Compiles GLSL (starting with its #version line) to SPIR-V for the stage, throws with the compiler log on errors
+std::vector<uint32_t> compileVulkanShader(const std::string& source, VkShaderStageFlagBits stage, const char *name);
+VkShaderModule createVulkanShaderModule(const std::vector<uint32_t>& spirv);
\ No newline at end of file
@@ -0,0 +1,815 @@
+#include "vksim.hpp"
+#include "fastmath.hpp"
+#include "profiler.hpp"
+#include "jobs.hpp"
+#include "shader.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+
+// Push constants of the step, the frame parameters followed by the particle count
+struct vulkan_step_constants_t
+{
+	FrameParams frame;
+	uint32_t count;
+};
+
+// Push constants of the draw, shared by the vertex and fragment stages
+struct vulkan_draw_constants_t
+{
+	glm::mat4 viewProjection;
+	float time;
+	float speedScale;
+};
+
+
+// ================================================================================================
+VulkanSimulation::VulkanSimulation(InitialCondition init, unsigned long long seed, const Snapshot *snapshot,
+		size_t pcount, float xdim, float ydim) :
+	m_state{},
+	m_descriptorLayout{VK_NULL_HANDLE},
+	m_descriptorPool{VK_NULL_HANDLE},
+	m_descriptorSets{VK_NULL_HANDLE, VK_NULL_HANDLE},
+	m_stepLayout{VK_NULL_HANDLE},
+	m_stepPipeline{VK_NULL_HANDLE},
+	m_drawLayout{VK_NULL_HANDLE},
+	m_drawPipeline{VK_NULL_HANDLE},
+	m_renderPass{VK_NULL_HANDLE},
+	m_stepPool{VK_NULL_HANDLE},
+	m_drawPool{VK_NULL_HANDLE},
+	m_stepTimeline{VK_NULL_HANDLE},
+	m_drawTimeline{VK_NULL_HANDLE},
+	m_timestamps{VK_NULL_HANDLE},
+	m_timestampPeriod{1.0f},
+	m_frames{},
+	m_swapchain{VK_NULL_HANDLE},
+	m_swapchainFormat{VK_FORMAT_UNDEFINED},
+	m_swapchainExtent{0, 0},
+	m_frameIndex{0},
+	m_frameParams{},
+	m_totalTime{0.0f},
+	m_pCount{pcount},
+	m_initParams{makeInitParams(init, seed, pcount, xdim, ydim)}
+{
+	// The state stays in device memory, and is only written by the initial upload and the step
+	const VkDeviceSize PSIZE = sizeof(Particle) * m_pCount;
+	for (size_t i = 0; i < 2; ++i) {
+		m_state[i] = createVulkanBuffer(PSIZE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+
+	// Command buffers are reset and recorded again every time their frame slot comes around
+	VkCommandPoolCreateInfo poolinfo = {};
+	poolinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolinfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolinfo.queueFamilyIndex = g_vkComputeFamily;
+	VK_CHECK_FATAL(vkCreateCommandPool(g_vkDevice, &poolinfo, nullptr, &m_stepPool), "Could not create the step command pool");
+	poolinfo.queueFamilyIndex = g_vkGraphicsFamily;
+	VK_CHECK_FATAL(vkCreateCommandPool(g_vkDevice, &poolinfo, nullptr, &m_drawPool), "Could not create the draw command pool");
+
+	VkSemaphoreTypeCreateInfo timelineinfo = {};
+	timelineinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineinfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineinfo.initialValue = 0;
+	VkSemaphoreCreateInfo seminfo = {};
+	seminfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	seminfo.pNext = &timelineinfo;
+	VK_CHECK_FATAL(vkCreateSemaphore(g_vkDevice, &seminfo, nullptr, &m_stepTimeline), "Could not create the step timeline");
+	VK_CHECK_FATAL(vkCreateSemaphore(g_vkDevice, &seminfo, nullptr, &m_drawTimeline), "Could not create the draw timeline");
+	seminfo.pNext = nullptr;
+
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		frame_t& frame = m_frames[i];
+		VkCommandBufferAllocateInfo allocinfo = {};
+		allocinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocinfo.commandBufferCount = 1;
+		allocinfo.commandPool = m_stepPool;
+		VK_CHECK_FATAL(vkAllocateCommandBuffers(g_vkDevice, &allocinfo, &frame.step), "Could not allocate a command buffer");
+		allocinfo.commandPool = m_drawPool;
+		VK_CHECK_FATAL(vkAllocateCommandBuffers(g_vkDevice, &allocinfo, &frame.draw), "Could not allocate a command buffer");
+		VK_CHECK_FATAL(vkCreateSemaphore(g_vkDevice, &seminfo, nullptr, &frame.imageAcquired),
+			"Could not create a swapchain semaphore");
+	}
+
+	// The step is timed on the device with timestamps when the compute family has them
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(g_vkPhysicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(g_vkPhysicalDevice, &familyCount, families.data());
+	if (families[g_vkComputeFamily].timestampValidBits > 0) {
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(g_vkPhysicalDevice, &props);
+		m_timestampPeriod = props.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo queryinfo = {};
+		queryinfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryinfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryinfo.queryCount = 2 * FRAMES_IN_FLIGHT;
+		VK_CHECK_FATAL(vkCreateQueryPool(g_vkDevice, &queryinfo, nullptr, &m_timestamps),
+			"Could not create the timestamp query pool");
+	}
+
+	createSwapchain();
+	createPipelines();
+	initializeParticles(snapshot);
+
+	std::cout << "Initialized Vulkan Solver (" << FRAMES_IN_FLIGHT << " frames in flight, "
+		<< ((g_vkComputeFamily != g_vkGraphicsFamily) ? "async compute" : "single queue") << ")" << std::endl;
+}
+
+// ================================================================================================
+VulkanSimulation::~VulkanSimulation()
+{
+	destroySwapchain();
+
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		if (m_frames[i].imageAcquired)
+			vkDestroySemaphore(g_vkDevice, m_frames[i].imageAcquired, nullptr);
+	}
+	if (m_timestamps)
+		vkDestroyQueryPool(g_vkDevice, m_timestamps, nullptr);
+	if (m_stepTimeline)
+		vkDestroySemaphore(g_vkDevice, m_stepTimeline, nullptr);
+	if (m_drawTimeline)
+		vkDestroySemaphore(g_vkDevice, m_drawTimeline, nullptr);
+	if (m_stepPool)
+		vkDestroyCommandPool(g_vkDevice, m_stepPool, nullptr);
+	if (m_drawPool)
+		vkDestroyCommandPool(g_vkDevice, m_drawPool, nullptr);
+
+	if (m_stepPipeline)
+		vkDestroyPipeline(g_vkDevice, m_stepPipeline, nullptr);
+	if (m_drawPipeline)
+		vkDestroyPipeline(g_vkDevice, m_drawPipeline, nullptr);
+	if (m_stepLayout)
+		vkDestroyPipelineLayout(g_vkDevice, m_stepLayout, nullptr);
+	if (m_drawLayout)
+		vkDestroyPipelineLayout(g_vkDevice, m_drawLayout, nullptr);
+	if (m_renderPass)
+		vkDestroyRenderPass(g_vkDevice, m_renderPass, nullptr);
+	if (m_descriptorPool)
+		vkDestroyDescriptorPool(g_vkDevice, m_descriptorPool, nullptr);
+	if (m_descriptorLayout)
+		vkDestroyDescriptorSetLayout(g_vkDevice, m_descriptorLayout, nullptr);
+
+	destroyVulkanBuffer(m_state[0]);
+	destroyVulkanBuffer(m_state[1]);
+}
+
+// ================================================================================================
+void VulkanSimulation::render(float dtime)
+{
+	// Nothing can be presented while the window is minimized
+	int width, height;
+	glfwGetFramebufferSize(g_windowPtr, &width, &height);
+	if (width == 0 || height == 0)
+		return;
+
+	const uint32_t slot = (uint32_t)(m_frameIndex % FRAMES_IN_FLIGHT);
+	const frame_t& frame = m_frames[slot];
+	uint32_t imageIndex = 0;
+	{
+		// The command buffers of this slot were last submitted FRAMES_IN_FLIGHT frames ago, and that draw also
+		// completes the step before it
+		ScopedStageTimer timer(STAGE_ACQUIRE);
+		if (m_frameIndex >= FRAMES_IN_FLIGHT) {
+			const uint64_t value = m_frameIndex - FRAMES_IN_FLIGHT + 1;
+			VkSemaphoreWaitInfo waitinfo = {};
+			waitinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitinfo.semaphoreCount = 1;
+			waitinfo.pSemaphores = &m_drawTimeline;
+			waitinfo.pValues = &value;
+			VK_CHECK_FATAL(vkWaitSemaphores(g_vkDevice, &waitinfo, UINT64_MAX), "Could not wait for frame %llu",
+				(unsigned long long)(value - 1));
+
+			uint64_t ticks[2];
+			if (m_timestamps && g_profiler.isEnabled() && vkGetQueryPoolResults(g_vkDevice, m_timestamps, slot * 2, 2,
+					sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+				g_profiler.recordDevice(STAGE_KERNEL, (float)((double)(ticks[1] - ticks[0]) * m_timestampPeriod / 1.0e6));
+		}
+
+		const VkResult result = vkAcquireNextImageKHR(g_vkDevice, m_swapchain, UINT64_MAX, frame.imageAcquired,
+			VK_NULL_HANDLE, &imageIndex);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			destroySwapchain();
+			createSwapchain();
+			return;
+		}
+		if (result != VK_SUBOPTIMAL_KHR)
+			VK_CHECK_FATAL(result, "Could not acquire a swapchain image");
+	}
+	{
+		ScopedStageTimer timer(STAGE_ARGUMENTS);
+		setFrameSimulationParams(m_frameParams, m_totalTime, dtime);
+		recordStep(frame, slot);
+		recordDraw(frame, imageIndex);
+	}
+	{
+		// Waits for the previous step, and for the draw that last read the buffer this step writes
+		ScopedStageTimer timer(STAGE_KERNEL);
+		const VkSemaphore waits[2] = { m_stepTimeline, m_drawTimeline };
+		const uint64_t waitValues[2] = { m_frameIndex, (m_frameIndex > 0) ? (m_frameIndex - 1) : 0 };
+		const VkPipelineStageFlags waitStages[2] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+		const uint64_t signalValue = m_frameIndex + 1;
+
+		VkTimelineSemaphoreSubmitInfo timelineinfo = {};
+		timelineinfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineinfo.waitSemaphoreValueCount = 2;
+		timelineinfo.pWaitSemaphoreValues = waitValues;
+		timelineinfo.signalSemaphoreValueCount = 1;
+		timelineinfo.pSignalSemaphoreValues = &signalValue;
+
+		VkSubmitInfo submit = {};
+		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit.pNext = &timelineinfo;
+		submit.waitSemaphoreCount = 2;
+		submit.pWaitSemaphores = waits;
+		submit.pWaitDstStageMask = waitStages;
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = &frame.step;
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = &m_stepTimeline;
+		VK_CHECK_FATAL(vkQueueSubmit(g_vkComputeQueue, 1, &submit, VK_NULL_HANDLE), "Could not submit the step");
+	}
+	{
+		// Waits for this step before reading the vertices, and for the swapchain image before writing it
+		ScopedStageTimer timer(STAGE_DRAW);
+		const VkSemaphore waits[2] = { m_stepTimeline, frame.imageAcquired };
+		const uint64_t waitValues[2] = { m_frameIndex + 1, 0 };
+		const VkPipelineStageFlags waitStages[2] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+		const VkSemaphore signals[2] = { m_drawTimeline, m_renderFinished[imageIndex] };
+		const uint64_t signalValues[2] = { m_frameIndex + 1, 0 };
+
+		VkTimelineSemaphoreSubmitInfo timelineinfo = {};
+		timelineinfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineinfo.waitSemaphoreValueCount = 2;
+		timelineinfo.pWaitSemaphoreValues = waitValues;
+		timelineinfo.signalSemaphoreValueCount = 2;
+		timelineinfo.pSignalSemaphoreValues = signalValues;
+
+		VkSubmitInfo submit = {};
+		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit.pNext = &timelineinfo;
+		submit.waitSemaphoreCount = 2;
+		submit.pWaitSemaphores = waits;
+		submit.pWaitDstStageMask = waitStages;
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = &frame.draw;
+		submit.signalSemaphoreCount = 2;
+		submit.pSignalSemaphores = signals;
+		VK_CHECK_FATAL(vkQueueSubmit(g_vkGraphicsQueue, 1, &submit, VK_NULL_HANDLE), "Could not submit the draw");
+	}
+	{
+		ScopedStageTimer timer(STAGE_SWAP);
+		VkPresentInfoKHR present = {};
+		present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present.waitSemaphoreCount = 1;
+		present.pWaitSemaphores = &m_renderFinished[imageIndex];
+		present.swapchainCount = 1;
+		present.pSwapchains = &m_swapchain;
+		present.pImageIndices = &imageIndex;
+		const VkResult result = vkQueuePresentKHR(g_vkGraphicsQueue, &present);
+
+		++m_frameIndex;
+		m_totalTime += dtime;
+
+		// Resizes are picked up here, the frame itself was already drawn and is kept
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+			destroySwapchain();
+			createSwapchain();
+		}
+		else
+			VK_CHECK_FATAL(result, "Could not present the swapchain image");
+	}
+}
+
+// ================================================================================================
+void VulkanSimulation::recordStep(const frame_t& frame, uint32_t slot)
+{
+	const size_t source = (size_t)(m_frameIndex % 2);
+
+	VkCommandBufferBeginInfo begininfo = {};
+	begininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_FATAL(vkResetCommandBuffer(frame.step, 0), "Could not reset the step command buffer");
+	VK_CHECK_FATAL(vkBeginCommandBuffer(frame.step, &begininfo), "Could not begin the step command buffer");
+
+	if (m_timestamps) {
+		vkCmdResetQueryPool(frame.step, m_timestamps, slot * 2, 2);
+		vkCmdWriteTimestamp(frame.step, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestamps, slot * 2);
+	}
+
+	vulkan_step_constants_t constants;
+	constants.frame = m_frameParams;
+	constants.count = (uint32_t)m_pCount;
+	vkCmdBindPipeline(frame.step, VK_PIPELINE_BIND_POINT_COMPUTE, m_stepPipeline);
+	vkCmdBindDescriptorSets(frame.step, VK_PIPELINE_BIND_POINT_COMPUTE, m_stepLayout, 0, 1, &m_descriptorSets[source],
+		0, nullptr);
+	vkCmdPushConstants(frame.step, m_stepLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(frame.step, (uint32_t)((m_pCount + 255) / 256), 1, 1);
+
+	if (m_timestamps)
+		vkCmdWriteTimestamp(frame.step, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestamps, (slot * 2) + 1);
+
+	VK_CHECK_FATAL(vkEndCommandBuffer(frame.step), "Could not record the step command buffer");
+}
+
+// ================================================================================================
+void VulkanSimulation::recordDraw(const frame_t& frame, uint32_t imageIndex)
+{
+	const size_t destination = (size_t)((m_frameIndex + 1) % 2);
+
+	VkCommandBufferBeginInfo begininfo = {};
+	begininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_FATAL(vkResetCommandBuffer(frame.draw, 0), "Could not reset the draw command buffer");
+	VK_CHECK_FATAL(vkBeginCommandBuffer(frame.draw, &begininfo), "Could not begin the draw command buffer");
+
+	VkClearValue clear = {};
+	clear.color.float32[3] = 1.0f;
+	VkRenderPassBeginInfo passinfo = {};
+	passinfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	passinfo.renderPass = m_renderPass;
+	passinfo.framebuffer = m_framebuffers[imageIndex];
+	passinfo.renderArea.extent = m_swapchainExtent;
+	passinfo.clearValueCount = 1;
+	passinfo.pClearValues = &clear;
+	vkCmdBeginRenderPass(frame.draw, &passinfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	const VkViewport viewport = { 0.0f, 0.0f, (float)m_swapchainExtent.width, (float)m_swapchainExtent.height, 0.0f, 1.0f };
+	const VkRect2D scissor = { { 0, 0 }, m_swapchainExtent };
+	vkCmdSetViewport(frame.draw, 0, 1, &viewport);
+	vkCmdSetScissor(frame.draw, 0, 1, &scissor);
+
+	// The camera matrices are OpenGL style, so y is flipped and z is moved from [-1, 1] to [0, 1]
+	glm::mat4 clip(1.0f);
+	clip[1][1] = -1.0f;
+	clip[2][2] = 0.5f;
+	clip[3][2] = 0.5f;
+	vulkan_draw_constants_t constants;
+	constants.viewProjection = clip * g_camera->projection() * g_camera->view();
+	constants.time = m_totalTime;
+	constants.speedScale = RENDER_STREAM_SPEED_SCALE;
+
+	const VkDeviceSize offset = 0;
+	vkCmdBindPipeline(frame.draw, VK_PIPELINE_BIND_POINT_GRAPHICS, m_drawPipeline);
+	vkCmdPushConstants(frame.draw, m_drawLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+		sizeof(constants), &constants);
+	vkCmdBindVertexBuffers(frame.draw, 0, 1, &m_state[destination].buffer, &offset);
+	vkCmdDraw(frame.draw, (uint32_t)m_pCount, 1, 0, 0);
+
+	vkCmdEndRenderPass(frame.draw);
+	VK_CHECK_FATAL(vkEndCommandBuffer(frame.draw), "Could not record the draw command buffer");
+}
+
+// ================================================================================================
+void VulkanSimulation::createSwapchain()
+{
+	VkSurfaceCapabilitiesKHR caps;
+	VK_CHECK_FATAL(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(g_vkPhysicalDevice, g_vkSurface, &caps),
+		"Could not query the surface capabilities");
+
+	// The format is picked once, since the render pass and pipeline are created for it
+	if (m_swapchainFormat == VK_FORMAT_UNDEFINED) {
+		uint32_t formatCount = 0;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(g_vkPhysicalDevice, g_vkSurface, &formatCount, nullptr);
+		std::vector<VkSurfaceFormatKHR> formats(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(g_vkPhysicalDevice, g_vkSurface, &formatCount, formats.data());
+		if (formats.empty())
+			throw std::runtime_error("The window surface has no formats");
+
+		// Linear output, like the default OpenGL framebuffer
+		m_swapchainFormat = formats[0].format;
+		for (const VkSurfaceFormatKHR& format : formats) {
+			if (format.format == VK_FORMAT_B8G8R8A8_UNORM || format.format == VK_FORMAT_R8G8B8A8_UNORM) {
+				m_swapchainFormat = format.format;
+				break;
+			}
+		}
+	}
+
+	int width, height;
+	glfwGetFramebufferSize(g_windowPtr, &width, &height);
+	m_swapchainExtent = caps.currentExtent;
+	if (caps.currentExtent.width == UINT32_MAX) {
+		m_swapchainExtent.width = std::min(std::max((uint32_t)width, caps.minImageExtent.width), caps.maxImageExtent.width);
+		m_swapchainExtent.height = std::min(std::max((uint32_t)height, caps.minImageExtent.height),
+			caps.maxImageExtent.height);
+	}
+
+	// One more image than frames in flight, so acquiring does not wait for the presentation engine
+	uint32_t imageCount = std::max(caps.minImageCount, FRAMES_IN_FLIGHT + 1);
+	if (caps.maxImageCount > 0)
+		imageCount = std::min(imageCount, caps.maxImageCount);
+
+	VkSwapchainCreateInfoKHR swapinfo = {};
+	swapinfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	swapinfo.surface = g_vkSurface;
+	swapinfo.minImageCount = imageCount;
+	swapinfo.imageFormat = m_swapchainFormat;
+	swapinfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	swapinfo.imageExtent = m_swapchainExtent;
+	swapinfo.imageArrayLayers = 1;
+	swapinfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	swapinfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	swapinfo.preTransform = caps.currentTransform;
+	swapinfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	swapinfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	swapinfo.clipped = VK_TRUE;
+	VK_CHECK_FATAL(vkCreateSwapchainKHR(g_vkDevice, &swapinfo, nullptr, &m_swapchain), "Could not create the swapchain");
+
+	uint32_t count = 0;
+	vkGetSwapchainImagesKHR(g_vkDevice, m_swapchain, &count, nullptr);
+	std::vector<VkImage> images(count);
+	vkGetSwapchainImagesKHR(g_vkDevice, m_swapchain, &count, images.data());
+
+	// The render pass only depends on the format, so it survives swapchain recreation
+	if (!m_renderPass) {
+		VkAttachmentDescription attachment = {};
+		attachment.format = m_swapchainFormat;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+		VkAttachmentReference colorref = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorref;
+
+		// The layout transition waits for the image acquire semaphore, which is waited on at this stage
+		VkSubpassDependency dependency = {};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+		VkRenderPassCreateInfo passinfo = {};
+		passinfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		passinfo.attachmentCount = 1;
+		passinfo.pAttachments = &attachment;
+		passinfo.subpassCount = 1;
+		passinfo.pSubpasses = &subpass;
+		passinfo.dependencyCount = 1;
+		passinfo.pDependencies = &dependency;
+		VK_CHECK_FATAL(vkCreateRenderPass(g_vkDevice, &passinfo, nullptr, &m_renderPass),
+			"Could not create the render pass");
+	}
+
+	VkSemaphoreCreateInfo seminfo = {};
+	seminfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	m_swapchainViews.resize(count, VK_NULL_HANDLE);
+	m_framebuffers.resize(count, VK_NULL_HANDLE);
+	m_renderFinished.resize(count, VK_NULL_HANDLE);
+	for (uint32_t i = 0; i < count; ++i) {
+		VkImageViewCreateInfo viewinfo = {};
+		viewinfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewinfo.image = images[i];
+		viewinfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewinfo.format = m_swapchainFormat;
+		viewinfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewinfo.subresourceRange.levelCount = 1;
+		viewinfo.subresourceRange.layerCount = 1;
+		VK_CHECK_FATAL(vkCreateImageView(g_vkDevice, &viewinfo, nullptr, &m_swapchainViews[i]),
+			"Could not create swapchain image view %u", i);
+
+		VkFramebufferCreateInfo fbinfo = {};
+		fbinfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbinfo.renderPass = m_renderPass;
+		fbinfo.attachmentCount = 1;
+		fbinfo.pAttachments = &m_swapchainViews[i];
+		fbinfo.width = m_swapchainExtent.width;
+		fbinfo.height = m_swapchainExtent.height;
+		fbinfo.layers = 1;
+		VK_CHECK_FATAL(vkCreateFramebuffer(g_vkDevice, &fbinfo, nullptr, &m_framebuffers[i]),
+			"Could not create swapchain framebuffer %u", i);
+
+		VK_CHECK_FATAL(vkCreateSemaphore(g_vkDevice, &seminfo, nullptr, &m_renderFinished[i]),
+			"Could not create a present semaphore");
+	}
+}
+
+// ================================================================================================
+void VulkanSimulation::destroySwapchain()
+{
+	// The frames in flight can still be drawing to the images, or waiting to present them
+	vkDeviceWaitIdle(g_vkDevice);
+
+	for (VkSemaphore semaphore : m_renderFinished) {
+		if (semaphore)
+			vkDestroySemaphore(g_vkDevice, semaphore, nullptr);
+	}
+	for (VkFramebuffer framebuffer : m_framebuffers) {
+		if (framebuffer)
+			vkDestroyFramebuffer(g_vkDevice, framebuffer, nullptr);
+	}
+	for (VkImageView view : m_swapchainViews) {
+		if (view)
+			vkDestroyImageView(g_vkDevice, view, nullptr);
+	}
+	m_renderFinished.clear();
+	m_framebuffers.clear();
+	m_swapchainViews.clear();
+
+	if (m_swapchain) {
+		vkDestroySwapchainKHR(g_vkDevice, m_swapchain, nullptr);
+		m_swapchain = VK_NULL_HANDLE;
+	}
+}
+
+// ================================================================================================
+void VulkanSimulation::createPipelines()
+{
+	// The three compiles are independent, so they run on the job system workers while the layouts are created
+	const std::string stepSource = std::string("#version 450\n#define VULKAN\n")
+		+ buildFastMathSource(P50K_FASTMATH_TIER, FASTMATH_LANGUAGE_GLSL) + ParticleComputeShaderSource;
+	auto spirv = std::make_shared<std::array<std::vector<uint32_t>, 3>>();
+	const std::vector<JobHandle> compiles = {
+		g_jobs->submit([spirv, stepSource]() {
+			(*spirv)[0] = compileVulkanShader(stepSource, VK_SHADER_STAGE_COMPUTE_BIT, "Solve"); }),
+		g_jobs->submit([spirv]() {
+			(*spirv)[1] = compileVulkanShader(VulkanParticleVertexShaderSource, VK_SHADER_STAGE_VERTEX_BIT,
+				"ParticleVertex"); }),
+		g_jobs->submit([spirv]() {
+			(*spirv)[2] = compileVulkanShader(VulkanParticleFragmentShaderSource, VK_SHADER_STAGE_FRAGMENT_BIT,
+				"ParticleFragment"); })
+	};
+
+	// Step, the same compute shader as BACKEND_GLCOMPUTE with the parameters in push constants
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	for (uint32_t i = 0; i < 2; ++i) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	VkDescriptorSetLayoutCreateInfo setinfo = {};
+	setinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setinfo.bindingCount = 2;
+	setinfo.pBindings = bindings;
+	VK_CHECK_FATAL(vkCreateDescriptorSetLayout(g_vkDevice, &setinfo, nullptr, &m_descriptorLayout),
+		"Could not create the descriptor set layout");
+
+	const VkDescriptorPoolSize poolsize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 };
+	VkDescriptorPoolCreateInfo poolinfo = {};
+	poolinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolinfo.maxSets = 2;
+	poolinfo.poolSizeCount = 1;
+	poolinfo.pPoolSizes = &poolsize;
+	VK_CHECK_FATAL(vkCreateDescriptorPool(g_vkDevice, &poolinfo, nullptr, &m_descriptorPool),
+		"Could not create the descriptor pool");
+
+	const VkDescriptorSetLayout layouts[2] = { m_descriptorLayout, m_descriptorLayout };
+	VkDescriptorSetAllocateInfo allocinfo = {};
+	allocinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocinfo.descriptorPool = m_descriptorPool;
+	allocinfo.descriptorSetCount = 2;
+	allocinfo.pSetLayouts = layouts;
+	VK_CHECK_FATAL(vkAllocateDescriptorSets(g_vkDevice, &allocinfo, m_descriptorSets),
+		"Could not allocate the descriptor sets");
+
+	for (size_t i = 0; i < 2; ++i) {
+		const VkDescriptorBufferInfo buffers[2] = {
+			{ m_state[i].buffer, 0, VK_WHOLE_SIZE },
+			{ m_state[1 - i].buffer, 0, VK_WHOLE_SIZE }
+		};
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_descriptorSets[i];
+		write.dstBinding = 0;
+		write.descriptorCount = 2;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = buffers;
+		vkUpdateDescriptorSets(g_vkDevice, 1, &write, 0, nullptr);
+	}
+
+	const VkPushConstantRange steprange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(vulkan_step_constants_t) };
+	VkPipelineLayoutCreateInfo layoutinfo = {};
+	layoutinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutinfo.setLayoutCount = 1;
+	layoutinfo.pSetLayouts = &m_descriptorLayout;
+	layoutinfo.pushConstantRangeCount = 1;
+	layoutinfo.pPushConstantRanges = &steprange;
+	VK_CHECK_FATAL(vkCreatePipelineLayout(g_vkDevice, &layoutinfo, nullptr, &m_stepLayout),
+		"Could not create the step pipeline layout");
+
+	g_jobs->waitAll(compiles);
+	VkShaderModule stepModule = createVulkanShaderModule((*spirv)[0]);
+
+	VkComputePipelineCreateInfo stepinfo = {};
+	stepinfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	stepinfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stepinfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	stepinfo.stage.module = stepModule;
+	stepinfo.stage.pName = "main";
+	stepinfo.layout = m_stepLayout;
+	const VkResult stepResult = vkCreateComputePipelines(g_vkDevice, VK_NULL_HANDLE, 1, &stepinfo, nullptr,
+		&m_stepPipeline);
+	vkDestroyShaderModule(g_vkDevice, stepModule, nullptr);
+	VK_CHECK_FATAL(stepResult, "Could not create the step pipeline");
+
+	// Draw, point sprites from the state buffer with the same vertex layout as the OpenGL vertex buffers
+	const VkPushConstantRange drawrange = { VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+		sizeof(vulkan_draw_constants_t) };
+	layoutinfo.setLayoutCount = 0;
+	layoutinfo.pSetLayouts = nullptr;
+	layoutinfo.pPushConstantRanges = &drawrange;
+	VK_CHECK_FATAL(vkCreatePipelineLayout(g_vkDevice, &layoutinfo, nullptr, &m_drawLayout),
+		"Could not create the draw pipeline layout");
+
+	VkShaderModule vertModule = createVulkanShaderModule((*spirv)[1]);
+	VkShaderModule fragModule = createVulkanShaderModule((*spirv)[2]);
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	for (size_t i = 0; i < 2; ++i) {
+		stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[i].stage = (i == 0) ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+		stages[i].module = (i == 0) ? vertModule : fragModule;
+		stages[i].pName = "main";
+	}
+
+	const VkVertexInputBindingDescription vertexBinding = { 0, ParticleFormatSpecifier[0].stride,
+		VK_VERTEX_INPUT_RATE_VERTEX };
+	std::vector<VkVertexInputAttributeDescription> attributes(ParticleFormatSpecifierCount);
+	for (size_t i = 0; i < ParticleFormatSpecifierCount; ++i) {
+		const vertex_format_specifier_t& fmt = ParticleFormatSpecifier[i];
+		attributes[i].location = fmt.location;
+		attributes[i].binding = 0;
+		attributes[i].format = (fmt.size == 1) ? VK_FORMAT_R32_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+		attributes[i].offset = (uint32_t)fmt.offset;
+	}
+	VkPipelineVertexInputStateCreateInfo vertexinfo = {};
+	vertexinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexinfo.vertexBindingDescriptionCount = 1;
+	vertexinfo.pVertexBindingDescriptions = &vertexBinding;
+	vertexinfo.vertexAttributeDescriptionCount = (uint32_t)attributes.size();
+	vertexinfo.pVertexAttributeDescriptions = attributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo assemblyinfo = {};
+	assemblyinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	assemblyinfo.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportinfo = {};
+	viewportinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportinfo.viewportCount = 1;
+	viewportinfo.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterinfo = {};
+	rasterinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterinfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterinfo.cullMode = VK_CULL_MODE_NONE;
+	rasterinfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterinfo.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo msinfo = {};
+	msinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	msinfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Same blending as initialize_gl() sets up for the OpenGL renderer
+	VkPipelineColorBlendAttachmentState blend = {};
+	blend.blendEnable = VK_TRUE;
+	blend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blend.colorBlendOp = VK_BLEND_OP_ADD;
+	blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blend.alphaBlendOp = VK_BLEND_OP_ADD;
+	blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT
+		| VK_COLOR_COMPONENT_A_BIT;
+	VkPipelineColorBlendStateCreateInfo blendinfo = {};
+	blendinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blendinfo.attachmentCount = 1;
+	blendinfo.pAttachments = &blend;
+
+	const VkDynamicState dynamicStates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicinfo = {};
+	dynamicinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicinfo.dynamicStateCount = 2;
+	dynamicinfo.pDynamicStates = dynamicStates;
+
+	VkGraphicsPipelineCreateInfo drawinfo = {};
+	drawinfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	drawinfo.stageCount = 2;
+	drawinfo.pStages = stages;
+	drawinfo.pVertexInputState = &vertexinfo;
+	drawinfo.pInputAssemblyState = &assemblyinfo;
+	drawinfo.pViewportState = &viewportinfo;
+	drawinfo.pRasterizationState = &rasterinfo;
+	drawinfo.pMultisampleState = &msinfo;
+	drawinfo.pColorBlendState = &blendinfo;
+	drawinfo.pDynamicState = &dynamicinfo;
+	drawinfo.layout = m_drawLayout;
+	drawinfo.renderPass = m_renderPass;
+	drawinfo.subpass = 0;
+	const VkResult drawResult = vkCreateGraphicsPipelines(g_vkDevice, VK_NULL_HANDLE, 1, &drawinfo, nullptr,
+		&m_drawPipeline);
+	vkDestroyShaderModule(g_vkDevice, vertModule, nullptr);
+	vkDestroyShaderModule(g_vkDevice, fragModule, nullptr);
+	VK_CHECK_FATAL(drawResult, "Could not create the draw pipeline");
+}
+
+// ================================================================================================
+void VulkanSimulation::initializeParticles(const Snapshot *snapshot)
+{
+	const VkDeviceSize PSIZE = sizeof(Particle) * m_pCount;
+
+	// Generated or read from the snapshot straight into host visible memory, and copied into the buffer the first
+	// step reads from
+	vulkan_buffer_t staging = createVulkanBuffer(PSIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	void *mapped = nullptr;
+	VK_CHECK_FATAL(vkMapMemory(g_vkDevice, staging.memory, 0, PSIZE, 0, &mapped), "Could not map the staging buffer");
+	if (snapshot) {
+		snapshot->readParticles(static_cast<Particle*>(mapped), 0, m_pCount);
+		m_totalTime = (float)snapshot->getTime();
+	}
+	else {
+		generateInitialParticles(static_cast<Particle*>(mapped), m_initParams);
+	}
+	vkUnmapMemory(g_vkDevice, staging.memory);
+
+	const frame_t& frame = m_frames[0];
+	VkCommandBufferBeginInfo begininfo = {};
+	begininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_FATAL(vkBeginCommandBuffer(frame.step, &begininfo), "Could not begin the upload command buffer");
+	const VkBufferCopy region = { 0, 0, PSIZE };
+	vkCmdCopyBuffer(frame.step, staging.buffer, m_state[0].buffer, 1, &region);
+	VK_CHECK_FATAL(vkEndCommandBuffer(frame.step), "Could not record the upload command buffer");
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &frame.step;
+	VK_CHECK_FATAL(vkQueueSubmit(g_vkComputeQueue, 1, &submit, VK_NULL_HANDLE), "Could not submit the upload");
+	VK_CHECK_FATAL(vkQueueWaitIdle(g_vkComputeQueue), "Could not upload the initial particle state");
+
+	destroyVulkanBuffer(staging);
+}
+
+
+
+// ================================================================================================
+// ================================================================================================
+const char * const VulkanParticleVertexShaderSource = R"(
+	#version 450
+
+	layout(location = 0) in float inMass;
+	layout(location = 1) in vec2  inPos;
+	layout(location = 2) in vec2  inVel;
+	layout(location = 3) in vec2  inAcc;
+
+	layout(location = 0) out vec2 vfPos;
+	layout(location = 1) out float vfKey;
+
+	layout(push_constant) uniform DrawConstants
+	{
+		mat4 ViewProjection;
+		float Time;
+		float SpeedScale;
+	};
+
+	void main()
+	{
+		vec4 pos = vec4(inPos * 2, 0, 1);
+		vfPos = inPos;
+		vfKey = clamp(length(inVel) / SpeedScale, 0, 1);
+		gl_Position = ViewProjection * pos;
+		float dist = length(inPos);
+		gl_PointSize = (5 + (sin(dist * 8) * 3)) * sqrt(dist);
+	}
+)";
+const char * const VulkanParticleFragmentShaderSource = R"(
+	#version 450
+
+	layout(location = 0) in vec2 vfPos;
+	layout(location = 1) in float vfKey;
+
+	layout(location = 0) out vec4 FragColor;
+
+	layout(push_constant) uniform DrawConstants
+	{
+		mat4 ViewProjection;
+		float Time;
+		float SpeedScale;
+	};
+
+	void main()
+	{
+		float dist = length(vfPos);
+		float brightness = 0.75 + (vfKey * 0.5);
+		FragColor = vec4(vec3(dist / 4.0, (1 - dist) * 4, 1 - (dist / 5)) * brightness, 1);
+	}
+)";
\ No newline at end of file
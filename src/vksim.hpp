@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vkcontext.hpp"
+#include "particle.hpp"
+#include <vector>
+
+
+class Snapshot;
+
+
+// Simulation and point sprite rendering on Vulkan (BACKEND_VULKAN), with the same physics and initial state as the
+// Simulation class. The step of every frame is submitted to the compute queue and the draw to the graphics queue,
+// ordered on the device by two timeline semaphores only, so with an async compute queue the next step overlaps the
+// draw and present of the current frame. The host only waits once FRAMES_IN_FLIGHT frames are queued.
+//
+// The state ping-pongs between two storage buffers that are also the vertex buffers, and frame N draws the state it
+// stepped to. That buffer is written again by frame N + 2, so each step also waits for the draw two frames before.
+class VulkanSimulation
+{
+public:
+	static const uint32_t FRAMES_IN_FLIGHT = 2;
+
+private:
+	struct frame_t
+	{
+		VkCommandBuffer step;
+		VkCommandBuffer draw;
+		VkSemaphore imageAcquired;	// Binary, signalled by the swapchain and waited on by the draw
+	};
+
+	vulkan_buffer_t m_state[2];
+	VkDescriptorSetLayout m_descriptorLayout;
+	VkDescriptorPool m_descriptorPool;
+	VkDescriptorSet m_descriptorSets[2];	// [i] steps from m_state[i] into m_state[1 - i]
+	VkPipelineLayout m_stepLayout;
+	VkPipeline m_stepPipeline;
+	VkPipelineLayout m_drawLayout;
+	VkPipeline m_drawPipeline;
+	VkRenderPass m_renderPass;
+	VkCommandPool m_stepPool;
+	VkCommandPool m_drawPool;
+	VkSemaphore m_stepTimeline;		// Reaches N + 1 when the step of frame N is complete
+	VkSemaphore m_drawTimeline;		// Reaches N + 1 when the draw of frame N is complete
+	VkQueryPool m_timestamps;		// Start and end of the step for each frame in flight, if the queue supports them
+	float m_timestampPeriod;		// Nanoseconds per timestamp tick
+	frame_t m_frames[FRAMES_IN_FLIGHT];
+
+	VkSwapchainKHR m_swapchain;
+	VkFormat m_swapchainFormat;
+	VkExtent2D m_swapchainExtent;
+	std::vector<VkImageView> m_swapchainViews;
+	std::vector<VkFramebuffer> m_framebuffers;
+	std::vector<VkSemaphore> m_renderFinished;	// Binary, per swapchain image, waited on by the present
+
+	uint64_t m_frameIndex;
+	FrameParams m_frameParams;
+	float m_totalTime;
+	const size_t m_pCount;
+	const InitParams m_initParams;
+
+public:
+	VulkanSimulation(InitialCondition init, unsigned long long seed, const Snapshot *snapshot, size_t pcount,
+		float xdim, float ydim);
+	~VulkanSimulation();
+
+	void render(float dtime);
+
+	VulkanSimulation(const VulkanSimulation&) = delete;
+	VulkanSimulation& operator = (const VulkanSimulation&) = delete;
+
+private:
+	void initializeParticles(const Snapshot *snapshot);
+	void createPipelines();
+	void createSwapchain();
+	void destroySwapchain();
+	void recordStep(const frame_t& frame, uint32_t slot);
+	void recordDraw(const frame_t& frame, uint32_t imageIndex);
+};
+
+
+extern const char * const VulkanParticleVertexShaderSource;
+extern const char * const VulkanParticleFragmentShaderSource;
\ No newline at end of file